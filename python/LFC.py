@@ -1,5 +1,10 @@
 import os
+import shutil
+import hashlib
+import inspect
+from collections import OrderedDict
 import numpy as np
+import warnings
 #import ctypes
 #from numpy.ctypeslib import ndpointer
 from copy import deepcopy
@@ -230,7 +235,8 @@ def find_largest_sphere(unitcell, list_of_muon_positions , supercell):
     return np.min(distances)
     
 def locfield(lattice_params, atomic_positions, fourier_components, propagation_vector, phases, muon_positions,
-            ctype, supercellsize, radius, nnn = 2, rcont = 10.0, nangles = None, axis = None):
+            ctype, supercellsize, radius, nnn = 2, rcont = 10.0, nangles = None, axis = None,
+            precision = 'double', reproducible = False, site_rotations = None, site_time_reversals = None):
     """
     Evaluates local fields at the muon site.
     
@@ -251,6 +257,10 @@ def locfield(lattice_params, atomic_positions, fourier_components, propagation_v
     :param float rcont: maximum radius used to search for local moments close to the muon in the contact hyperfine field estimation in Angstrom. Default 10 Angstrom.
     :param int nangles: for 'rotate' and 'incommensurate' simulations, a nangles number of  estimation will perfomed on local moments incrementally rotated by 360/nangles.
     :param list axis: for 'rotate' simulations, axis used to perform the rotation. In 'incommensurate' simulations the axis is defined as the perpendicular vector to the real and the imaginary parts of the fourier componts (warnings will be printed if this vector is not well defined).
+    :param str precision: 'double' (default) or 'mixed'. With 'mixed' the geometry and the dipolar terms are evaluated in single precision and accumulated in double precision.
+    :param bool reproducible: if True the 'sum', 'rotate' and 'incommensurate' results are bitwise identical for any number of OpenMP threads. Default False.
+    :param list site_rotations: for 'sum' simulations, the point group of each muon site (or None) as a list of rotation matrices in fractional coordinates. Only an irreducible wedge of the Lorentz sphere is summed. The operations must be symmetries of the magnetic structure and the supercell must contain the whole sphere, otherwise a ValueError is raised.
+    :param list site_time_reversals: time reversal (+1 or -1) of each of the site_rotations of each muon site. Default: no time reversal.
     :return: a list of :py:class:`~LocalFields` containing the local field components for each muon site defined in the sample.
     :rtype: list
     :raises: TypeError, ValueError
@@ -276,6 +286,8 @@ def locfield(lattice_params, atomic_positions, fourier_components, propagation_v
             nangles  = int(nangles)
         except:
             raise ValueError("Cannot convert number of angles to int.")
+    if site_rotations is not None and not (ctype == 's' or ctype == 'sum'):
+        raise ValueError("Site symmetry can only be used with ctype 'sum'.")
     if ctype == 'r' or ctype == 'rotate':
         if axis is None:
             raise ValueError("Axis for rotation must be specified.")
@@ -339,18 +351,241 @@ def locfield(lattice_params, atomic_positions, fourier_components, propagation_v
     
     res = []
     # if is outside for (minimal) sake of performances
-    for mu in muon_positions:
+    for i, mu in enumerate(muon_positions):
         if ctype == 's' or ctype == 'sum':
-            res.append(LocalFields(*lfclib.Fields(ctype, p,fc,k,phi,mu,sc,latpar,r,nnn,rc)))
+            siteops, sitetr = _site_symmetry(latpar, site_rotations, site_time_reversals, i)
+            res.append(LocalFields(*lfclib.Fields(ctype, p,fc,k,phi,mu,sc,latpar,r,nnn,rc,precision=precision,reproducible=int(reproducible),
+                                                  siteops=siteops,sitetr=sitetr)))
         elif ctype == 'i' or ctype == 'incommensurate':
-            res.append(LocalFields(*lfclib.Fields(ctype, p,fc,k,phi,mu,sc,latpar,r,nnn,rc,nangles)))
+            res.append(LocalFields(*lfclib.Fields(ctype, p,fc,k,phi,mu,sc,latpar,r,nnn,rc,nangles,precision=precision,reproducible=int(reproducible))))
         elif ctype == 'r' or ctype == 'rotate':
-            res.append(LocalFields(*lfclib.Fields(ctype, p,fc,k,phi,mu,sc,latpar,r,nnn,rc,nangles,axis)))
+            res.append(LocalFields(*lfclib.Fields(ctype, p,fc,k,phi,mu,sc,latpar,r,nnn,rc,nangles,axis,precision=precision,reproducible=int(reproducible))))
     
     return res
     
 
-def dipten(lattice_params, magnetic_atom_positions, muon_positions, supercellsize, radius):
+def locfield_adaptive(lattice_params, atomic_positions, fourier_components, propagation_vector, phases, muon_positions,
+                      atol = 1e-4, rtol = 0., rmax = 200., nnn = 2, rcont = 10.0, supercellsize = None):
+    """
+    Evaluates local fields at the muon sites ('sum' calculation) with the
+    Lorentz radius chosen from a tolerance instead of a fixed radius.
+
+    The Lorentz sphere of each site grows by shells about one cell thick.
+    The tail of the sum is estimated from the change of the dipolar plus
+    Lorentz field over the last shells, the Lorentz field being the
+    continuum estimate of the atoms outside the sphere. The growth stops
+    when the estimate is below max(atol, rtol |B_dip + B_lor|), so each
+    site is summed only up to the radius it needs.
+
+    :param float atol: absolute tolerance on :math:`B_{dip}+B_{lor}`, Tesla. Default 1e-4.
+    :param float rtol: tolerance relative to :math:`|B_{dip}+B_{lor}|`. Default 0.
+    :param float rmax: largest Lorentz radius, Angstrom. A warning is issued
+                       for the sites that did not converge within rmax. Default 200.
+    :param list supercellsize: only used to define the phases :math:`2\\pi K\\cdot R`
+                               as in :py:func:`locfield` with the same supercell
+                               (the muon is in cell supercellsize//2). Default:
+                               the muon is in cell 0.
+    :return: a list of :py:class:`~LocalFields` for each muon site and the radii used.
+    :rtype: tuple
+    :raises: TypeError, ValueError
+
+    The other parameters are the same of :py:func:`locfield`.
+    """
+    try:
+        rmax = float(rmax)
+        atol = float(atol)
+        rtol = float(rtol)
+        nnn = int(nnn)
+        rc = float(rcont)
+    except:
+        raise TypeError("Cannot convert rmax, atol, rtol or rcont to float or nnn to int.")
+
+    if rmax <= 0 or atol < 0 or rtol < 0:
+        raise ValueError("rmax must be positive and the tolerances non negative.")
+    if nnn < 0 or rc < 0:
+        raise ValueError("nnn and rcont must be positive.")
+
+    origin = None
+    if supercellsize is not None:
+        origin = np.array(supercellsize, dtype=np.int32)//2
+        if origin.shape != (3,):
+            raise ValueError("Supercellsize has wrong shape.")
+
+    positions = np.array(atomic_positions, dtype=np.float64)
+    latpar = np.array(lattice_params, dtype=np.float64)
+    fourier_components = np.array(fourier_components, dtype=np.complex128)
+    phases = np.array(phases, dtype=np.float64)
+    k = np.array(propagation_vector, dtype=np.float64)
+
+    # Remove non magnetic atoms from list
+    magnetic_atoms = [i for i, e in enumerate(fourier_components)
+                        if not np.allclose(e, 0.)]
+
+    res = []
+    radii = []
+    for mu in np.array(muon_positions, dtype=np.float64).reshape(-1, 3):
+        BCont, BDip, BLor, r, err, converged = lfclib.AdaptiveSum(positions[magnetic_atoms,:],
+                                                                  fourier_components[magnetic_atoms,:],
+                                                                  k, phases[magnetic_atoms], mu, latpar,
+                                                                  rmax, nnn, rc, atol=atol, rtol=rtol,
+                                                                  origin=origin)
+        if not converged:
+            warnings.warn("Muon site {}: estimated error {:e} T at rmax.".format(mu, err))
+        res.append(LocalFields(BCont, BDip, BLor))
+        radii.append(r)
+
+    return res, np.array(radii)
+
+
+def locfield_extrapolated(lattice_params, atomic_positions, fourier_components, propagation_vector, phases, muon_positions,
+                          supercellsize, radius, nradii = 16, nnn = 2, rcont = 10.0):
+    """
+    Evaluates local fields and dipolar tensor at the muon sites
+    extrapolated to an infinite Lorentz radius.
+
+    The dipolar plus Lorentz field of a sphere of radius R does not
+    converge smoothly with R: it oscillates around the limit as atoms
+    enter the sphere. With a single lattice sum, the partial sums at
+    nradii radii equally spaced in (radius/2, radius] are accumulated.
+    Their mean is returned as the estimate of the limit and the largest
+    deviation of the partial sums from the mean as the error.
+    Only atoms with non zero Fourier components are considered.
+
+    :param int nradii: number of partial sums. With nradii = 1 the result
+                       is the one of :py:func:`locfield_and_dipten`. Default 16.
+    :return: a list of :py:class:`~LocalFields`, a list with the dipolar
+             tensor of the magnetic atoms (1/Angstrom^3) and an array with
+             the estimated errors of :math:`B_{dip}+B_{lor}` (Tesla) and of
+             the tensor for each muon site.
+    :rtype: tuple
+    :raises: TypeError, ValueError
+
+    The other parameters are the same of :py:func:`locfield`.
+    """
+    try:
+        sc = np.array(supercellsize, dtype=np.int32)
+    except:
+        raise TypeError("Cannot convert supercellsize to NumPy array.")
+
+    if sc.shape != (3,):
+        raise ValueError("Supercellsize has wrong shape.")
+    if (np.min(sc) <= 0):
+        raise ValueError("Supercellsize must be strictly positive.")
+
+    try:
+        r = float(radius) # Lorentz radius (in A)
+        nradii = int(nradii)
+        nnn = int(nnn)
+        rc = float(rcont)
+    except:
+        raise TypeError("Cannot convert radius or rcont to float or nradii or nnn to int.")
+
+    if nradii <= 0:
+        raise ValueError("nradii must be strictly positive.")
+    if nnn < 0 or rc < 0:
+        raise ValueError("nnn and rcont must be positive.")
+
+    positions = np.array(atomic_positions, dtype=np.float64)
+    latpar = np.array(lattice_params, dtype=np.float64)
+    fourier_components = np.array(fourier_components, dtype=np.complex128)
+
+    # Remove non magnetic atoms from list
+    magnetic_atoms = [i for i, e in enumerate(fourier_components)
+                        if not np.allclose(e, 0.)]
+
+    p = positions[magnetic_atoms,:]
+    fc = fourier_components[magnetic_atoms,:]
+    phi = np.array(phases, dtype=np.float64)[magnetic_atoms]
+    k = np.array(propagation_vector, dtype=np.float64)
+
+    res = []
+    tensors = []
+    errors = []
+    for mu in np.array(muon_positions, dtype=np.float64).reshape(-1, 3):
+        BCont, BDip, BLor, T, err, partial = lfclib.ExtrapolatedSum(p, fc, k, phi, mu, sc,
+                                                                    latpar, r, nnn, rc,
+                                                                    nradii=nradii)
+        res.append(LocalFields(BCont, BDip, BLor))
+        tensors.append(T)
+        errors.append(err)
+
+    return res, tensors, np.array(errors)
+
+
+def locfield_hybrid(lattice_params, atomic_positions, fourier_components, propagation_vector, phases, muon_positions,
+                    radius, near_radius, nnn = 2, rcont = 10.0, supercellsize = None):
+    """
+    Evaluates local fields at the muon sites summing exactly the dipoles
+    within near_radius and treating those up to radius as a continuum.
+
+    Far from the muon the moments only contribute through the smooth
+    magnetization density :math:`M(r) = Re[M_K e^{i q\\cdot r}]`, with
+    :math:`q = 2\\pi K` folded in the first Brillouin zone. The dipolar field
+    of this density in the shell between near_radius and radius is
+    analytic, so the cost scales like near_radius^3. For K = 0 the shell
+    does not contribute and the result is the one of :py:func:`locfield`
+    with radius near_radius.
+    The error is estimated from the change of :math:`B_{dip}+B_{lor}` when
+    near_radius is reduced by a few cells.
+
+    :param float radius: the Lorentz radius, Angstrom.
+    :param float near_radius: radius of the exact sum, Angstrom.
+    :param list supercellsize: only used to define the phases :math:`2\\pi K\\cdot R`
+                               as in :py:func:`locfield` with the same supercell
+                               (the muon is in cell supercellsize//2). Default:
+                               the muon is in cell 0.
+    :return: a list of :py:class:`~LocalFields` for each muon site and the
+             estimated errors (Tesla).
+    :rtype: tuple
+    :raises: TypeError, ValueError
+
+    The other parameters are the same of :py:func:`locfield`. Only the atoms
+    within near_radius are considered for the contact field.
+    """
+    try:
+        r = float(radius)
+        rnear = float(near_radius)
+        nnn = int(nnn)
+        rc = float(rcont)
+    except:
+        raise TypeError("Cannot convert radius, near_radius or rcont to float or nnn to int.")
+
+    if rnear <= 0 or rnear > r:
+        raise ValueError("near_radius must be positive and not larger than radius.")
+    if nnn < 0 or rc < 0:
+        raise ValueError("nnn and rcont must be positive.")
+
+    origin = None
+    if supercellsize is not None:
+        origin = np.array(supercellsize, dtype=np.int32)//2
+        if origin.shape != (3,):
+            raise ValueError("Supercellsize has wrong shape.")
+
+    positions = np.array(atomic_positions, dtype=np.float64)
+    latpar = np.array(lattice_params, dtype=np.float64)
+    fourier_components = np.array(fourier_components, dtype=np.complex128)
+    phases = np.array(phases, dtype=np.float64)
+    k = np.array(propagation_vector, dtype=np.float64)
+
+    # Remove non magnetic atoms from list
+    magnetic_atoms = [i for i, e in enumerate(fourier_components)
+                        if not np.allclose(e, 0.)]
+
+    res = []
+    errors = []
+    for mu in np.array(muon_positions, dtype=np.float64).reshape(-1, 3):
+        BCont, BDip, BLor, err = lfclib.HybridSum(positions[magnetic_atoms,:],
+                                                  fourier_components[magnetic_atoms,:],
+                                                  k, phases[magnetic_atoms], mu, latpar,
+                                                  r, rnear, nnn, rc, origin=origin)
+        res.append(LocalFields(BCont, BDip, BLor))
+        errors.append(err)
+
+    return res, np.array(errors)
+
+
+def dipten(lattice_params, magnetic_atom_positions, muon_positions, supercellsize, radius, precision = 'double',
+           reproducible = False, site_rotations = None):
     """
     Calculates dipolar tensor for given muon sites.
     
@@ -370,6 +605,9 @@ def dipten(lattice_params, magnetic_atom_positions, muon_positions, supercellsiz
     :param sample: the sample object
     :param list supercell: the size of the supercell along the lattice coordinates.
     :param float radius: the radius of the sphere used to evaluate the dipolar tensor.
+    :param str precision: 'double' (default) or 'mixed', see :py:func:`locfield`.
+    :param bool reproducible: if True the results are bitwise identical for any number of OpenMP threads. Default False.
+    :param list site_rotations: the point group of each muon site (or None), see :py:func:`locfield`.
     :return: a list of numpy ndarray containing the dipolar tensor for each muon site defined in the sample. 
     :rtype: list
     :raises: TypeError, ValueError: when radius cannot be converted to float or when radius is negative.
@@ -396,9 +634,1586 @@ def dipten(lattice_params, magnetic_atom_positions, muon_positions, supercellsiz
         
     p = np.array(magnetic_atom_positions)
     
+    res = []
+    for i, mu in enumerate(muon_positions):
+        siteops, sitetr = _site_symmetry(latpar, site_rotations, None, i)
+        res.append(lfclib.DipolarTensor(p,np.array(mu),sc,latpar,r,precision=precision,
+                                        reproducible=int(reproducible),siteops=siteops))
+
+    return res
+
+
+def efg(lattice_params, atomic_positions, charges, muon_positions, supercellsize, radius,
+        reproducible = False):
+    """
+    Calculates the electrostatic potential and the electric field gradient
+    of point charges at the muon sites.
+
+    The charges within the sphere are summed directly, so the result only
+    converges (slowly) for neutral cells. The supercell is traversed as in
+    the other lattice sums, see :py:func:`locfield`.
+
+    :param list atomic_positions: positions of the charges in fractional coordinates.
+    :param list charges: charges, in units of e.
+    :param list supercellsize: the size of the supercell along the lattice coordinates.
+    :param float radius: the radius of the sphere, Angstrom.
+    :param bool reproducible: if True the results are bitwise identical for any number of OpenMP threads. Default False.
+    :return: a list with a tuple (potential in Volt, electric field gradient
+             :math:`V_{ij}` in V/Angstrom^2) for each muon site.
+    :rtype: list
+    :raises: TypeError, ValueError
+    """
+    try:
+        r = float(radius)
+    except:
+        raise TypeError("Cannot convert radius to float.")
+    if r < 0:
+        raise ValueError("Radius must be greater or equal to 0.")
+
+    try:
+        sc = np.array(supercellsize, dtype=np.int32)
+    except:
+        raise TypeError("Cannot convert supercellsize to NumPy array.")
+    if sc.shape != (3,):
+        raise ValueError("Supercellsize has wrong shape.")
+    if (np.min(sc) <= 0):
+        raise ValueError("Supercellsize must be strictly positive.")
+
+    latpar = np.array(lattice_params, dtype=np.float64)
+    p = np.array(atomic_positions, dtype=np.float64)
+    q = np.array(charges, dtype=np.float64)
+
+    res = []
+    for mu in np.array(muon_positions, dtype=np.float64).reshape(-1, 3):
+        res.append(lfclib.ChargeSum(p, q, mu, sc, latpar, r,
+                                     reproducible=int(reproducible)))
+    return res
+
+
+def locfield_and_dipten(lattice_params, atomic_positions, fourier_components, propagation_vector, phases, muon_positions,
+                        supercellsize, radius, nnn = 2, rcont = 10.0, components = 'cdlt'):
+    """
+    Evaluates local fields and dipolar tensor at the muon sites with a single lattice sum.
+
+    This is equivalent to calling :py:func:`locfield` (with ctype 'sum')
+    and :py:func:`dipten` for the magnetic atoms, but the lattice is 
+    traversed only once.
+    Only atoms with non zero Fourier components are considered.
+
+    :param str components: quantities to be evaluated, any combination of
+                           'c' (contact), 'd' (dipolar), 'l' (Lorentz),
+                           't' (dipolar tensor) and 's' (dipolar tensor of 
+                           each magnetic atom, in the order of the magnetic
+                           atoms in atomic_positions). Default 'cdlt'.
+    :return: a list containing, for each muon site, a tuple with a
+             :py:class:`~LocalFields` object (fields not requested are 
+             zero), the dipolar tensor and the sublattice tensors 
+             (None when not requested).
+    :rtype: list
+    :raises: TypeError, ValueError
+
+    The other parameters are the same of :py:func:`locfield`.
+    """
+    try:
+        sc = np.array(supercellsize, dtype=np.int32)
+    except:
+        raise TypeError("Cannot convert supercellsize to NumPy array.")
+
+    if sc.shape != (3,):
+        raise ValueError("Supercellsize has wrong shape.")
+    if (np.min(sc) <= 0):
+        raise ValueError("Supercellsize must be strictly positive.")
+
+    try:
+        r = float(radius) # Lorentz radius (in A)
+    except:
+        raise TypeError("Cannot convert radius to float.")
+
+    try:
+        nnn = int(nnn)
+        rc = float(rcont)
+    except:
+        raise TypeError("Cannot convert nnn to int or rcont to float.")
+
+    if nnn < 0 or rc < 0:
+        raise ValueError("nnn and rcont must be positive.")
+
+    positions = np.array(atomic_positions)
+    latpar = np.array(lattice_params)
+    fourier_components = np.array(fourier_components, dtype=np.complex128)
+
+    # Remove non magnetic atoms from list
+    magnetic_atoms = [i for i, e in enumerate(fourier_components)
+                        if not np.allclose(e, np.zeros(3, dtype=np.complex128))]
+
+    p = positions[magnetic_atoms,:]
+    fc = fourier_components[magnetic_atoms,:]
+    phi = np.array(phases)[magnetic_atoms]
+    k = np.array(propagation_vector)
+
     res = []
     for mu in muon_positions:
-        res.append(lfclib.DipolarTensor(p,np.array(mu),sc,latpar,r))
+        BCont, BDip, BLor, T, Tsub = lfclib.FusedSum(p, fc, k, phi, np.array(mu), sc,
+                                                     latpar, r, nnn, rc,
+                                                     components=components)
+        zero = np.zeros(3)
+        fields = LocalFields(zero if BCont is None else BCont,
+                             zero if BDip is None else BDip,
+                             zero if BLor is None else BLor)
+        res.append((fields, T, Tsub))
 
     return res
 
+
+class LFCSession(object):
+    """
+    Local fields of a structure that is modified one parameter at a time,
+    e.g. in interactive analysis.
+
+    The session stores the inputs of :py:func:`locfield` (with ctype
+    'sum') and keeps track of those that change between two evaluations.
+    Since the fields are linear in the moments, changing the Fourier
+    components or the phases reuses the lattice sums of all the muon sites,
+    moving some muon sites only repeats the sums of those sites and
+    changing ACont reuses everything. A larger radius only adds the shell
+    between the old and the new radius to the previous sums, so that a
+    convergence study costs about as much as its largest radius. Any
+    other change repeats all the lattice sums.
+
+    The parameters are the same of :py:func:`locfield`. ACont is the
+    contact coupling of the returned :py:class:`~LocalFields`.
+
+    :ivar nsums: number of lattice sums performed by the last evaluation.
+    """
+
+    def __init__(self, lattice_params, atomic_positions, fourier_components, propagation_vector, phases,
+                 muon_positions, supercellsize, radius, nnn = 2, rcont = 10.0, ACont = 0.):
+        self._session = lfclib.SessionNew()
+        self._positions = None
+        self._fc = None
+        self._phases = None
+        self.ACont = 0.
+        self.nsums = 0
+        self.update(lattice_params, atomic_positions, fourier_components, propagation_vector, phases,
+                    muon_positions, supercellsize, radius, nnn, rcont, ACont)
+
+    def update(self, lattice_params = None, atomic_positions = None, fourier_components = None,
+               propagation_vector = None, phases = None, muon_positions = None, supercellsize = None,
+               radius = None, nnn = None, rcont = None, ACont = None):
+        """
+        Changes some of the inputs of the session. The other inputs keep
+        their value.
+
+        :return: True if any input of the lattice sums or of the moments changed.
+        :rtype: bool
+        :raises: TypeError, ValueError
+        """
+        kw = {}
+        if lattice_params is not None or supercellsize is not None:
+            if lattice_params is not None:
+                self._latpar = np.array(lattice_params, dtype=np.float64)
+            if supercellsize is not None:
+                try:
+                    sc = np.array(supercellsize, dtype=np.int32)
+                except:
+                    raise TypeError("Cannot convert supercellsize to NumPy array.")
+                if sc.shape != (3,):
+                    raise ValueError("Supercellsize has wrong shape.")
+                if (np.min(sc) <= 0):
+                    raise ValueError("Supercellsize must be strictly positive.")
+                self._sc = sc
+            kw['Cell'] = self._latpar
+            kw['Supercell'] = self._sc
+
+        if atomic_positions is not None:
+            self._positions = np.array(atomic_positions, dtype=np.float64)
+        if fourier_components is not None:
+            self._fc = np.array(fourier_components, dtype=np.complex128)
+        if phases is not None:
+            self._phases = np.array(phases, dtype=np.float64)
+        if atomic_positions is not None or fourier_components is not None or phases is not None:
+            if not (len(self._positions) == len(self._fc) == len(self._phases)):
+                raise ValueError("atomic_positions, fourier_components and phases have different lengths.")
+            # Remove non magnetic atoms from list
+            magnetic_atoms = [i for i, e in enumerate(self._fc) if not np.allclose(e, 0.)]
+            if len(magnetic_atoms) == 0:
+                raise ValueError("There are no magnetic atoms.")
+            kw['positions'] = self._positions[magnetic_atoms,:]
+            kw['FC'] = self._fc[magnetic_atoms,:]
+            kw['Phi'] = self._phases[magnetic_atoms]
+
+        if propagation_vector is not None:
+            kw['K'] = np.array(propagation_vector, dtype=np.float64)
+        if muon_positions is not None:
+            kw['Muons'] = np.array(muon_positions, dtype=np.float64).reshape(-1, 3)
+
+        try:
+            if radius is not None:
+                kw['r'] = float(radius)
+            if nnn is not None:
+                kw['nnn'] = int(nnn)
+            if rcont is not None:
+                kw['rcont'] = float(rcont)
+        except:
+            raise TypeError("Cannot convert radius or rcont to float or nnn to int.")
+
+        if ACont is not None:
+            self.ACont = float(ACont)
+
+        return lfclib.SessionUpdate(self._session, **kw)
+
+    def fields(self):
+        """
+        Local fields at the muon sites.
+
+        :return: a list of :py:class:`~LocalFields`, one for each muon site.
+        :rtype: list
+        """
+        BCont, BDip, BLor, _, self.nsums = lfclib.SessionEvaluate(self._session)
+        return [LocalFields(BCont[i], BDip[i], BLor[i], self.ACont) for i in range(len(BDip))]
+
+    def dipten(self):
+        """
+        Dipolar tensors of the magnetic atoms at the muon sites (see :py:func:`dipten`).
+
+        :return: the tensors, shape (n_mu, 3, 3), 1/Angstrom^3.
+        :rtype: numpy.ndarray
+        """
+        _, _, _, tensors, self.nsums = lfclib.SessionEvaluate(self._session, tensor=1)
+        return tensors
+
+
+class ResultCache(object):
+    """
+    Cache of the results of :py:func:`locfield` and :py:func:`dipten`.
+
+    The inputs of each call are canonicalized (all the arguments, with
+    their defaults, arrays converted to float64 or complex128 and
+    C-ordered) and hashed with SHA-256 together with the version of the
+    library, so equal calls share the same key regardless of how the
+    arguments are passed. The results are kept in an in-process LRU of
+    `maxsize` entries and, if `directory` is given, in a local store
+    with one .npy file per entry, that can be shared by several
+    processes and users and is read back memory-mapped.
+
+    The store lives in the `muLFC-cache` subdirectory of `directory` and
+    keeps the entries of each build of the library (its version and a
+    hash of the compiled extension) in a separate subdirectory, marked
+    by a `muLFC-cache-version` file, so that several builds can share
+    `directory`. :py:meth:`clear` also removes the marked subdirectories
+    of the other builds; nothing else in `directory` is touched. When the
+    files exceed `max_bytes` the least recently used ones are deleted.
+    A store removed while in use is created again by the next write.
+
+    The functions are used through the cache as
+    ``cache.locfield(...)`` and ``cache.dipten(...)``, with the
+    arguments of :py:func:`locfield` and :py:func:`dipten`.
+
+    :ivar hits: number of calls answered by the cache.
+    :ivar misses: number of calls that were evaluated.
+    """
+
+    _ROOT = 'muLFC-cache'
+    _MARKER = 'muLFC-cache-version'
+    _build = None
+
+    @classmethod
+    def build(cls):
+        """
+        Identifier of the build of the library used in the keys and in the
+        name of the store: the version and the first 16 hexadecimal digits
+        of the SHA-256 of the compiled extension, so that a rebuilt library
+        never reads the results of another one.
+
+        :rtype: str
+        """
+        if cls._build is None:
+            build = '.'.join(str(x) for x in get_version())
+            fname = getattr(lfclib, '__file__', None)
+            if fname is not None:
+                h = hashlib.sha256()
+                with open(fname, 'rb') as f:
+                    for chunk in iter(lambda: f.read(1 << 20), b''):
+                        h.update(chunk)
+                build += '-' + h.hexdigest()[:16]
+            cls._build = build
+        return cls._build
+
+    def __init__(self, maxsize = 128, directory = None, max_bytes = None):
+        try:
+            self._maxsize = int(maxsize)
+        except:
+            raise TypeError("Cannot convert maxsize to int.")
+        if self._maxsize < 0:
+            raise ValueError("maxsize must be positive.")
+        self._max_bytes = None if max_bytes is None else int(max_bytes)
+        self._lru = OrderedDict()
+        self._version = self.build()
+        self.hits = 0
+        self.misses = 0
+
+        self._dir = None
+        if directory is not None:
+            self._root = os.path.join(os.path.expanduser(directory), self._ROOT)
+            self._dir = os.path.join(self._root, self._version)
+            self._make_store()
+
+    def _make_store(self):
+        # the directory of this build and its marker
+        os.makedirs(self._dir, exist_ok=True)
+        marker = os.path.join(self._dir, self._MARKER)
+        if not os.path.isfile(marker):
+            tmp = marker + '.%d.tmp' % os.getpid()
+            with open(tmp, 'w') as f:
+                f.write(self._version + '\n')
+            os.replace(tmp, marker)
+
+    @staticmethod
+    def _canonical(h, x):
+        # arguments are hashed with their type, shape and content
+        if x is None or isinstance(x, (bool, str)):
+            h.update(repr(x).encode())
+        elif isinstance(x, (int, float, np.integer, np.floating)):
+            h.update(repr(float(x)).encode())
+        else:
+            try:
+                a = np.asarray(x)
+            except ValueError:
+                a = None
+            if a is None or a.dtype == object:
+                # ragged lists, e.g. site_rotations with None
+                h.update(b'[')
+                for e in x:
+                    ResultCache._canonical(h, e)
+                h.update(b']')
+            else:
+                a = np.ascontiguousarray(a, dtype=(np.complex128 if np.iscomplexobj(a) else np.float64))
+                h.update(repr((a.dtype.str, a.shape)).encode())
+                h.update(a.tobytes())
+
+    def key(self, function, *args, **kwargs):
+        """
+        Key of a call of function with the given arguments.
+
+        :param function: :py:func:`locfield` or :py:func:`dipten`.
+        :return: the hexadecimal SHA-256 digest.
+        :rtype: str
+        """
+        bound = inspect.signature(function).bind(*args, **kwargs)
+        bound.apply_defaults()
+        h = hashlib.sha256()
+        h.update(('muLFC ' + self._version + ' ' + function.__name__).encode())
+        for name, value in bound.arguments.items():
+            h.update(name.encode())
+            if name == 'ctype':
+                value = str(value)[0]  # 's' and 'sum' are the same calculation
+            self._canonical(h, value)
+        return h.hexdigest()
+
+    def _get(self, key):
+        if key in self._lru:
+            self._lru.move_to_end(key)
+            return self._lru[key]
+        if self._dir is not None:
+            fname = os.path.join(self._dir, key + '.npy')
+            try:
+                value = np.load(fname, mmap_mode='r')
+                os.utime(fname, None)
+            except (IOError, OSError, ValueError):
+                return None
+            self._remember(key, value)
+            return value
+        return None
+
+    def _remember(self, key, value):
+        if self._maxsize == 0:
+            return
+        self._lru[key] = value
+        self._lru.move_to_end(key)
+        while len(self._lru) > self._maxsize:
+            self._lru.popitem(last=False)
+
+    def _put(self, key, value):
+        self._remember(key, value)
+        if self._dir is None:
+            return
+        try:
+            self._write(key, value)
+        except FileNotFoundError:
+            # the store was removed by another process, see clear
+            try:
+                self._make_store()
+                self._write(key, value)
+            except OSError:
+                return
+        if self._max_bytes is not None:
+            self._trim()
+
+    def _write(self, key, value):
+        # write and rename, so that readers never see a partial file
+        fname = os.path.join(self._dir, key + '.npy')
+        tmp = fname + '.%d.tmp' % os.getpid()
+        with open(tmp, 'wb') as f:
+            np.save(f, value)
+        os.replace(tmp, fname)
+
+    def _trim(self):
+        # other processes sharing the store may remove entries at any time
+        entries = []
+        try:
+            names = os.listdir(self._dir)
+        except FileNotFoundError:
+            return
+        for name in names:
+            if name.endswith('.npy'):
+                try:
+                    st = os.stat(os.path.join(self._dir, name))
+                except FileNotFoundError:
+                    continue
+                entries.append((st.st_mtime, st.st_size, name))
+        total = sum(e[1] for e in entries)
+        for mtime, size, name in sorted(entries):
+            if total <= self._max_bytes:
+                break
+            try:
+                os.remove(os.path.join(self._dir, name))
+            except FileNotFoundError:
+                pass
+            total -= size
+
+    def clear(self):
+        """
+        Removes all the entries, in memory and on disk, and the stores of
+        the other builds of the library in the same directory.
+        """
+        self._lru.clear()
+        if self._dir is None:
+            return
+        try:
+            names = os.listdir(self._dir)
+        except FileNotFoundError:
+            names = []
+        for name in names:
+            if name.endswith('.npy'):
+                try:
+                    os.remove(os.path.join(self._dir, name))
+                except FileNotFoundError:
+                    pass
+        # only the stores of other builds, recognized by their marker
+        try:
+            stores = os.listdir(self._root)
+        except FileNotFoundError:
+            stores = []
+        for d in stores:
+            if d != self._version and os.path.isfile(os.path.join(self._root, d, self._MARKER)):
+                shutil.rmtree(os.path.join(self._root, d), ignore_errors=True)
+
+    def locfield(self, *args, **kwargs):
+        """
+        Same as :py:func:`locfield`, through the cache.
+        Each call returns new :py:class:`~LocalFields` objects.
+        """
+        key = self.key(locfield, *args, **kwargs)
+        value = self._get(key)
+        if value is None:
+            self.misses += 1
+            res = locfield(*args, **kwargs)
+            # n_mu x (contact, dipolar, Lorentz) x ([nangles x] 3)
+            value = np.array([[r._BCont, r._BDip, r._BLor] for r in res], dtype=np.float64)
+            self._put(key, value)
+        else:
+            self.hits += 1
+        return [LocalFields(np.array(v[0]), np.array(v[1]), np.array(v[2])) for v in value]
+
+    def dipten(self, *args, **kwargs):
+        """
+        Same as :py:func:`dipten`, through the cache.
+        """
+        key = self.key(dipten, *args, **kwargs)
+        value = self._get(key)
+        if value is None:
+            self.misses += 1
+            value = np.array(dipten(*args, **kwargs), dtype=np.float64)
+            self._put(key, value)
+        else:
+            self.hits += 1
+        return [np.array(v) for v in value]
+
+
+_STRUCTURE_MAGIC = b'muLFCstr'
+_STRUCTURE_HEADER = 120
+
+
+def write_structure(filename, lattice_params, atomic_positions, fourier_components, propagation_vector,
+                    phases, muon_positions):
+    """
+    Writes a binary structure file for the lfc-run batch driver.
+
+    The file holds the lattice, the atoms with their Fourier components
+    and phases, the propagation vector and the muon sites in native byte
+    order, in the layout of the C library (see src/lfcfile.h), so that it
+    can be memory mapped and used without parsing. The parameters are the
+    same of :py:func:`locfield`.
+
+    :param str filename: name of the file, usually with extension .lfc.
+    :raises: ValueError
+    """
+    latpar = np.ascontiguousarray(lattice_params, dtype=np.float64)
+    p = np.ascontiguousarray(atomic_positions, dtype=np.float64).reshape(-1, 3)
+    fc = np.ascontiguousarray(fourier_components, dtype=np.complex128).reshape(-1, 3)
+    phi = np.ascontiguousarray(phases, dtype=np.float64).reshape(-1)
+    k = np.ascontiguousarray(propagation_vector, dtype=np.float64)
+    mus = np.ascontiguousarray(muon_positions, dtype=np.float64).reshape(-1, 3)
+
+    if latpar.shape != (3, 3) or k.shape != (3,):
+        raise ValueError("Invalid shape of lattice_params or propagation_vector.")
+    if not (len(p) == len(fc) == len(phi)):
+        raise ValueError("atomic_positions, fourier_components and phases have different lengths.")
+
+    with open(filename, 'wb') as f:
+        f.write(_STRUCTURE_MAGIC)
+        f.write(np.array([1, len(p), len(mus), 0], dtype=np.uint32).tobytes())
+        for a in (latpar, k, p, fc, phi, mus):
+            f.write(a.tobytes())
+
+
+def read_structure(filename):
+    """
+    Reads a binary structure file written by :py:func:`write_structure`.
+
+    The file is memory mapped and the arrays are read-only views of it.
+
+    :param str filename: name of the file.
+    :return: lattice_params (3x3), atomic_positions (n, 3), fourier_components
+             (n, 3, complex), propagation_vector, phases (n) and muon_positions (n_mu, 3).
+    :rtype: tuple
+    :raises: ValueError
+    """
+    m = np.memmap(filename, dtype=np.uint8, mode='r')
+    if len(m) < _STRUCTURE_HEADER or bytes(m[:8]) != _STRUCTURE_MAGIC:
+        raise ValueError("Not a structure file.")
+    version, natoms, nmu, _ = m[8:24].view(np.uint32)
+    if version != 1 or len(m) != _STRUCTURE_HEADER + 8 * (10 * int(natoms) + 3 * int(nmu)):
+        raise ValueError("Unsupported or truncated structure file.")
+    d = m[24:].view(np.float64)
+    o = 12 + 3 * natoms
+    return (d[:9].reshape(3, 3), d[12:o].reshape(-1, 3),
+            d[o:o + 6 * natoms].view(np.complex128).reshape(-1, 3),
+            d[9:12], d[o + 6 * natoms:o + 7 * natoms],
+            d[o + 7 * natoms:].reshape(-1, 3))
+
+
+def locfield_domains(lattice_params, atomic_positions, domains, muon_positions,
+                     supercellsize, radius, nnn = 2, rcont = 10.0, weights = None):
+    """
+    Evaluates local fields at the muon sites for several magnetic domains.
+
+    Each domain is a magnetic structure defined on the same atoms, for
+    example an arm of the star of the propagation vector or a symmetry
+    equivalent arrangement of the moments. The lattice is traversed only
+    once for all the domains and the lattice sums of the domains sharing
+    the same propagation vector are shared too.
+    Only atoms with non zero Fourier components in at least one domain
+    are considered.
+
+    :param list domains: a list of tuples (fourier_components, propagation_vector, phases),
+                         one for each domain, with the same meaning of the
+                         arguments of :py:func:`locfield`.
+    :param list weights: population of each domain. Default: equal populations.
+    :return: a list containing, for each muon site, a tuple with the list of
+             :py:class:`~LocalFields` of each domain and the
+             :py:class:`~LocalFields` averaged over the domains with the given weights.
+    :rtype: list
+    :raises: TypeError, ValueError
+
+    The other parameters are the same of :py:func:`locfield`.
+    """
+    try:
+        sc = np.array(supercellsize, dtype=np.int32)
+    except:
+        raise TypeError("Cannot convert supercellsize to NumPy array.")
+
+    if sc.shape != (3,):
+        raise ValueError("Supercellsize has wrong shape.")
+    if (np.min(sc) <= 0):
+        raise ValueError("Supercellsize must be strictly positive.")
+
+    try:
+        r = float(radius) # Lorentz radius (in A)
+    except:
+        raise TypeError("Cannot convert radius to float.")
+
+    try:
+        nnn = int(nnn)
+        rc = float(rcont)
+    except:
+        raise TypeError("Cannot convert nnn to int or rcont to float.")
+
+    if nnn < 0 or rc < 0:
+        raise ValueError("nnn and rcont must be positive.")
+
+    if len(domains) == 0:
+        raise ValueError("At least one domain must be specified.")
+
+    if weights is None:
+        weights = np.ones(len(domains))
+    weights = np.array(weights, dtype=np.float64)
+    if weights.shape != (len(domains),) or np.sum(weights) <= 0.:
+        raise ValueError("One positive weight must be given for each domain.")
+    weights = weights / np.sum(weights)
+
+    positions = np.array(atomic_positions)
+    latpar = np.array(lattice_params)
+    fcs = np.array([np.array(d[0], dtype=np.complex128) for d in domains])
+    ks = np.array([np.array(d[1], dtype=np.float64) for d in domains])
+    phis = np.array([np.array(d[2], dtype=np.float64) for d in domains])
+
+    # Remove atoms that are not magnetic in any domain
+    magnetic_atoms = [i for i in range(positions.shape[0])
+                        if not np.allclose(fcs[:,i,:], 0.)]
+
+    p = positions[magnetic_atoms,:]
+    fc = fcs[:,magnetic_atoms,:]
+    phi = phis[:,magnetic_atoms]
+
+    res = []
+    for mu in muon_positions:
+        BCont, BDip, BLor = lfclib.DomainSum(p, fc, ks, phi, np.array(mu), sc,
+                                             latpar, r, nnn, rc)
+        fields = [LocalFields(BCont[d], BDip[d], BLor[d]) for d in range(len(domains))]
+        average = LocalFields(np.dot(weights, BCont), np.dot(weights, BDip),
+                              np.dot(weights, BLor))
+        res.append((fields, average))
+
+    return res
+
+
+def locfield_configurations(lattice_params, atomic_positions, fourier_components, muon_positions,
+                            supercellsize, radius, nnn = 2, rcont = 10.0,
+                            propagation_vector = None, phases = None):
+    """
+    Evaluates local fields at the muon sites for many configurations of
+    the magnetic moments, e.g. the candidate structures of a refinement.
+
+    The lattice sums are performed once for each muon site and the fields of
+    all the configurations are then obtained with a single matrix product,
+    which is much faster than one :py:func:`locfield` call per
+    configuration and muon site.
+    Only atoms with non zero Fourier components in at least one
+    configuration are considered.
+
+    :param fourier_components: the Fourier components (or the moments, for
+                               zero propagation vector) of the atoms in each
+                               configuration, shape (n_conf, n_atoms, 3).
+    :param propagation_vector: propagation vector shared by all the configurations. Default: zero.
+    :param phases: phases shared by all the configurations. Default: zero.
+    :return: the fields, with shape (n_conf, n_mu, 3).
+    :rtype: :py:class:`~LocalFields`
+    :raises: TypeError, ValueError
+
+    The other parameters are the same of :py:func:`locfield`.
+    """
+    try:
+        sc = np.array(supercellsize, dtype=np.int32)
+    except:
+        raise TypeError("Cannot convert supercellsize to NumPy array.")
+
+    if sc.shape != (3,):
+        raise ValueError("Supercellsize has wrong shape.")
+    if (np.min(sc) <= 0):
+        raise ValueError("Supercellsize must be strictly positive.")
+
+    try:
+        r = float(radius) # Lorentz radius (in A)
+        nnn = int(nnn)
+        rc = float(rcont)
+    except:
+        raise TypeError("Cannot convert radius or rcont to float or nnn to int.")
+
+    if nnn < 0 or rc < 0:
+        raise ValueError("nnn and rcont must be positive.")
+
+    positions = np.array(atomic_positions, dtype=np.float64)
+    latpar = np.array(lattice_params, dtype=np.float64)
+    fcs = np.array(fourier_components, dtype=np.complex128)
+    if fcs.ndim != 3 or fcs.shape[1:] != (positions.shape[0], 3):
+        raise ValueError("fourier_components must have shape (n_conf, n_atoms, 3).")
+
+    k = np.zeros(3) if propagation_vector is None else np.array(propagation_vector, dtype=np.float64)
+    phi = np.zeros(positions.shape[0]) if phases is None else np.array(phases, dtype=np.float64)
+    mus = np.array(muon_positions, dtype=np.float64).reshape(-1, 3)
+
+    # Remove atoms that are not magnetic in any configuration
+    magnetic_atoms = [i for i in range(positions.shape[0])
+                        if not np.allclose(fcs[:,i,:], 0.)]
+
+    BCont, BDip, BLor = lfclib.ConfigSum(positions[magnetic_atoms,:], fcs[:,magnetic_atoms,:],
+                                         k, phi[magnetic_atoms], mus, sc, latpar, r, nnn, rc)
+    return LocalFields(BCont, BDip, BLor)
+
+
+def _pq_columns(fc, phases):
+    # P and Q of each atom (see simplesum.c) in the column layout of the
+    # response matrices: 6a+j is P_a[j] (j < 3) or Q_a[j-3]
+    phi = 2.*np.pi*phases
+    P = np.cos(phi)[:,None]*fc.real + np.sin(phi)[:,None]*fc.imag
+    Q = np.cos(phi)[:,None]*fc.imag - np.sin(phi)[:,None]*fc.real
+    return np.hstack([P, Q]).reshape(-1)
+
+
+def fit_moments(lattice_params, atomic_positions, basis, muon_positions, frequencies,
+                supercellsize, radius, initial, nnn = 2, rcont = 10.0,
+                propagation_vector = None, phases = None, offset = None,
+                uncertainties = None, ACont = 0., fit_ACont = False, maxiter = 200):
+    """
+    Fits the magnetic moments to the precession frequencies measured at the
+    muon sites with the Levenberg-Marquardt algorithm.
+
+    The Fourier components of the atoms are ``offset + sum_i p_i basis[i]``,
+    where the parameters :math:`p_i` are fitted. The fields are linear in the
+    parameters: the lattice sums are performed once and the fit uses
+    analytic derivatives, so that each iteration is very cheap.
+    The residuals are :math:`(\\gamma_\\mu |\\mathbf{B}|/2\\pi - \\nu)/\\sigma`.
+
+    :param basis: basis vectors, shape (n_params, n_atoms, 3), in the format of the Fourier components.
+    :param frequencies: measured frequency (MHz) at each muon site.
+    :param initial: initial values of the parameters.
+    :param propagation_vector: propagation vector. Default: zero.
+    :param phases: phases of the atoms. Default: zero.
+    :param offset: fixed Fourier components added to the basis expansion. Default: zero.
+    :param uncertainties: uncertainties of the frequencies (MHz). Default: 1 MHz.
+    :param float ACont: contact hyperfine coupling, initial value when fit_ACont is True.
+    :param bool fit_ACont: fit the contact hyperfine coupling too.
+    :param int maxiter: maximum number of iterations.
+    :return: the best fit parameters, ACont and :math:`\\chi^2`.
+    :rtype: tuple
+    :raises: TypeError, ValueError
+
+    The other parameters are the same of :py:func:`locfield`.
+    """
+    try:
+        sc = np.array(supercellsize, dtype=np.int32)
+    except:
+        raise TypeError("Cannot convert supercellsize to NumPy array.")
+
+    if sc.shape != (3,):
+        raise ValueError("Supercellsize has wrong shape.")
+    if (np.min(sc) <= 0):
+        raise ValueError("Supercellsize must be strictly positive.")
+
+    try:
+        r = float(radius) # Lorentz radius (in A)
+        nnn = int(nnn)
+        rc = float(rcont)
+    except:
+        raise TypeError("Cannot convert radius or rcont to float or nnn to int.")
+
+    if nnn < 0 or rc < 0:
+        raise ValueError("nnn and rcont must be positive.")
+
+    positions = np.array(atomic_positions, dtype=np.float64)
+    latpar = np.array(lattice_params, dtype=np.float64)
+    natoms = positions.shape[0]
+    basis = np.array(basis, dtype=np.complex128)
+    if basis.ndim != 3 or basis.shape[1:] != (natoms, 3):
+        raise ValueError("basis must have shape (n_params, n_atoms, 3).")
+    p0 = np.array(initial, dtype=np.float64).reshape(-1)
+    if p0.shape != (basis.shape[0],):
+        raise ValueError("One initial value must be given for each basis vector.")
+    offset = np.zeros([natoms, 3], dtype=np.complex128) if offset is None else np.array(offset, dtype=np.complex128)
+    if offset.shape != (natoms, 3):
+        raise ValueError("offset must have shape (n_atoms, 3).")
+
+    k = np.zeros(3) if propagation_vector is None else np.array(propagation_vector, dtype=np.float64)
+    phi = np.zeros(natoms) if phases is None else np.array(phases, dtype=np.float64)
+    mus = np.array(muon_positions, dtype=np.float64).reshape(-1, 3)
+    freq = np.array(frequencies, dtype=np.float64).reshape(-1)
+    if freq.shape != (mus.shape[0],):
+        raise ValueError("One frequency must be given for each muon site.")
+    sigma = None
+    if uncertainties is not None:
+        sigma = np.array(uncertainties, dtype=np.float64).reshape(-1)
+        if sigma.shape != freq.shape or np.min(sigma) <= 0.:
+            raise ValueError("One positive uncertainty must be given for each frequency.")
+
+    # Remove atoms that are never magnetic
+    magnetic_atoms = [i for i in range(natoms)
+                        if not (np.allclose(basis[:,i,:], 0.) and np.allclose(offset[i], 0.))]
+
+    V = np.array([_pq_columns(b[magnetic_atoms], phi[magnetic_atoms]) for b in basis]).T
+    x0 = _pq_columns(offset[magnetic_atoms], phi[magnetic_atoms])
+
+    R = lfclib.ConfigResponse(positions[magnetic_atoms,:], k, mus, sc, latpar, r, nnn, rc)
+    params, acont, chi2, niter = lfclib.FitMoments(R, np.ascontiguousarray(V), freq, p0,
+                                                   offset=x0, sigma=sigma, ACont=float(ACont),
+                                                   fit_acont=int(fit_ACont), maxiter=int(maxiter))
+    return params, acont, chi2
+
+
+class StrainExpansion(object):
+    """
+    Dipolar and Lorentz fields and dipolar tensor of a lattice and their
+    first derivatives with respect to a homogeneous strain, for fast
+    pressure and thermal expansion sweeps.
+
+    The strain :math:`\\epsilon` (Voigt order xx, yy, zz, yz, xz, xy, tensor
+    components) maps the lattice vectors to :math:`(1+\\epsilon) a`, while the
+    fractional positions, the moments and the radius are unchanged.
+    The derivatives are computed in the same lattice sum of the fields and
+    include the atoms crossing the surface of the sphere in the continuum
+    limit, so that the expansion reproduces :py:func:`locfield` on the strained
+    lattice up to terms of order :math:`\\epsilon^2` and to the
+    fluctuations of the surface of a finite sphere.
+
+    The parameters are the same of :py:func:`locfield`. Only the dipolar
+    and Lorentz fields are considered (no contact term) and, as in
+    :py:func:`dipten`, the tensor refers to the magnetic atoms.
+
+    :ivar dip: dipolar fields, shape (n_mu, 3), Tesla.
+    :ivar lor: Lorentz fields, shape (n_mu, 3), Tesla.
+    :ivar tensor: dipolar tensors, shape (n_mu, 3, 3), 1/Angstrom^3.
+    :ivar d_dip: derivatives of the dipolar fields, shape (n_mu, 6, 3).
+    :ivar d_lor: derivatives of the Lorentz fields, shape (n_mu, 6, 3).
+    :ivar d_tensor: derivatives of the tensors, shape (n_mu, 6, 3, 3).
+    """
+
+    def __init__(self, lattice_params, atomic_positions, fourier_components, propagation_vector, phases,
+                 muon_positions, supercellsize, radius):
+        try:
+            sc = np.array(supercellsize, dtype=np.int32)
+        except:
+            raise TypeError("Cannot convert supercellsize to NumPy array.")
+
+        if sc.shape != (3,):
+            raise ValueError("Supercellsize has wrong shape.")
+        if (np.min(sc) <= 0):
+            raise ValueError("Supercellsize must be strictly positive.")
+
+        try:
+            r = float(radius) # Lorentz radius (in A)
+            if r<0:
+                raise ValueError("Lorentz radius must be greater or equal to 0.")
+        except:
+            raise TypeError("Cannot convert radius to float.")
+
+        positions = np.array(atomic_positions, dtype=np.float64)
+        self._latpar = np.array(lattice_params, dtype=np.float64)
+        fourier_components = np.array(fourier_components, dtype=np.complex128)
+        phases = np.array(phases, dtype=np.float64)
+        k = np.array(propagation_vector, dtype=np.float64)
+        mus = np.array(muon_positions, dtype=np.float64).reshape(-1, 3)
+
+        # Remove non magnetic atoms from list
+        magnetic_atoms = [i for i, e in enumerate(fourier_components)
+                            if not np.allclose(e, 0.)]
+
+        res = [lfclib.StrainSum(positions[magnetic_atoms,:], fourier_components[magnetic_atoms,:],
+                                k, phases[magnetic_atoms], mu, sc, self._latpar, r)
+               for mu in mus]
+        self.dip, self.lor, self.tensor, self.d_dip, self.d_lor, self.d_tensor = \
+            [np.array([x[i] for x in res]) for i in range(6)]
+
+    def strain(self, lattice_params):
+        """
+        Strain that maps the reference lattice onto lattice_params.
+
+        The symmetric part of :math:`A_0^{-1} A - 1` is returned, where the
+        rows of A are the lattice vectors. Rigid rotations are discarded.
+
+        :param lattice_params: lattice vectors of the strained lattice, 3x3.
+        :return: the six strain components (xx, yy, zz, yz, xz, xy).
+        """
+        F = np.linalg.solve(self._latpar, np.array(lattice_params, dtype=np.float64))
+        e = 0.5*(F + F.T) - np.eye(3)
+        return np.array([e[0,0], e[1,1], e[2,2], e[1,2], e[0,2], e[0,1]])
+
+    def predict(self, strain):
+        """
+        First order estimate of the fields and tensors of a strained lattice.
+
+        :param strain: the six strain components (xx, yy, zz, yz, xz, xy) or
+                       the lattice vectors of the strained lattice (3x3).
+        :return: dipolar fields (n_mu, 3), Lorentz fields (n_mu, 3) and
+                 dipolar tensors (n_mu, 3, 3).
+        :rtype: tuple
+        """
+        e = np.array(strain, dtype=np.float64)
+        if e.shape == (3, 3):
+            e = self.strain(e)
+        if e.shape != (6,):
+            raise ValueError("strain must have 6 components or be a 3x3 lattice.")
+        return (self.dip + np.einsum('s,msx->mx', e, self.d_dip),
+                self.lor + np.einsum('s,msx->mx', e, self.d_lor),
+                self.tensor + np.einsum('s,msxy->mxy', e, self.d_tensor))
+
+
+def polarization(local_fields, times, weights = None, direction = None,
+                 powder = False, nbins = 0):
+    """
+    Evaluates the zero field muon polarization function
+
+    .. math::
+
+        P(t) = \\sum_i w_i \\left[ \\cos^2\\theta_i + \\sin^2\\theta_i \\cos(\\gamma_\\mu |\\mathbf{B}_i| t) \\right]
+
+    for the total fields of one or more muon sites, where :math:`\\theta_i`
+    is the angle between the field and the initial muon spin.
+    When the fields have been computed for n angles (e.g. incommensurate
+    structures) each angle of a site has weight :math:`w_{site}/n`.
+
+    :param local_fields: a :py:class:`~LocalFields` or a list of :py:class:`~LocalFields`, one for each muon site.
+    :param times: times in microseconds.
+    :param list weights: population of each muon site. Default: equal populations.
+    :param direction: initial muon spin direction in Cartesian coordinates. Default: z.
+    :param bool powder: compute the powder average. Default: False.
+    :param int nbins: if larger than 0 the fields are collected in nbins bins
+                      of :math:`|\\mathbf{B}|` before computing the time evolution.
+                      This is faster for many fields and long time windows.
+                      Default: 0, i.e. all fields are used.
+    :return: polarization at each time.
+    :rtype: numpy.ndarray
+    :raises: TypeError, ValueError
+    """
+    if isinstance(local_fields, LocalFields):
+        local_fields = [local_fields]
+
+    if len(local_fields) == 0:
+        raise ValueError("At least one set of local fields must be specified.")
+
+    if weights is None:
+        weights = np.ones(len(local_fields))
+    weights = np.array(weights, dtype=np.float64)
+    if weights.shape != (len(local_fields),) or np.min(weights) < 0. or np.sum(weights) <= 0.:
+        raise ValueError("One non negative weight must be given for each muon site.")
+
+    try:
+        t = np.array(times, dtype=np.float64).reshape(-1)
+        nbins = int(nbins)
+    except:
+        raise TypeError("Cannot convert times to NumPy array or nbins to int.")
+
+    if nbins < 0:
+        raise ValueError("nbins must be positive.")
+
+    if direction is not None:
+        direction = np.array(direction, dtype=np.float64)
+        if direction.shape != (3,) or np.allclose(direction, 0.):
+            raise ValueError("direction must be a non zero vector.")
+
+    fields = []
+    fweights = []
+    for lf, w in zip(local_fields, weights):
+        B = np.atleast_2d(lf.T)
+        fields.append(B)
+        fweights.append(np.full(B.shape[0], w / B.shape[0]))
+
+    return lfclib.Polarization(np.concatenate(fields), t, np.concatenate(fweights),
+                               direction, 1 if powder else 0, nbins)
+
+
+def field_histogram(lattice_params, atomic_positions, fourier_components, propagation_vector, phases,
+                    muon_positions, ctype, supercellsize, radius, nangles, nbins, bmax,
+                    axis = None, ACont = 0., nnn = 2, rcont = 10.0, weights = None,
+                    precision = 'double'):
+    """
+    Histograms of the local fields of a rotated ('rotate') or incommensurate
+    ('incommensurate') magnetic order, summed over muon sites.
+
+    The fields are accumulated directly in the bins, without storing the
+    nangles fields of each site. Each field of a site has weight
+    :math:`w_{site}/n_{angles}`, so that the histograms sum to 1 when all
+    the fields are within the range.
+
+    :param int nbins: number of bins.
+    :param float bmax: range of the histograms in Tesla. The bin edges of the
+                       intensity histogram are ``np.linspace(0, bmax, nbins+1)``,
+                       those of the components ``np.linspace(-bmax, bmax, nbins+1)``.
+    :param float ACont: contact hyperfine coupling used for the total field (see :py:class:`~LocalFields`). Default 0.
+    :param list weights: population of each muon site. Default: equal populations.
+    :return: the histogram of :math:`|\\mathbf{B}|` (shape (nbins,)) and those of
+             :math:`B_x, B_y, B_z` (shape (3, nbins)).
+    :rtype: tuple
+    :raises: TypeError, ValueError
+
+    The other parameters are the same of :py:func:`locfield`.
+    """
+    args, axis, ACont, weights = _binned_input(lattice_params, atomic_positions,
+        fourier_components, propagation_vector, phases, muon_positions, ctype,
+        supercellsize, radius, nangles, nbins, bmax, axis, ACont, nnn, rcont, weights)
+
+    return lfclib.Histogram(ctype[0], *args, rot_axis=axis, ACont=ACont,
+                            weights=weights, precision=precision)
+
+
+def field_polarization(lattice_params, atomic_positions, fourier_components, propagation_vector, phases,
+                       muon_positions, ctype, supercellsize, radius, nangles, nbins, bmax, times,
+                       axis = None, ACont = 0., direction = None, powder = False,
+                       nnn = 2, rcont = 10.0, weights = None, precision = 'double'):
+    """
+    Zero field muon polarization function (see :py:func:`polarization`) of a
+    rotated ('rotate') or incommensurate ('incommensurate') magnetic order,
+    summed over muon sites.
+
+    The nangles fields of each site are added to a histogram of
+    :math:`|\\mathbf{B}|` as soon as they are computed, so that the fields of
+    all the sites and angles are never stored. Each bin is represented by
+    the weighted average field of its entries, and each field of a site has
+    weight :math:`w_{site}/n_{angles}`.
+
+    :param int nbins: number of bins of :math:`|\\mathbf{B}|`.
+    :param float bmax: range of the histogram in Tesla. Fields larger than bmax
+                       are added to the last bin, so a bmax close to the
+                       largest field gives the most accurate result.
+    :param times: times in microseconds.
+    :param float ACont: contact hyperfine coupling used for the total field (see :py:class:`~LocalFields`). Default 0.
+    :param direction: initial muon spin direction in Cartesian coordinates. Default: z.
+    :param bool powder: compute the powder average. Default: False.
+    :param list weights: population of each muon site. Default: equal populations.
+    :return: polarization at each time.
+    :rtype: numpy.ndarray
+    :raises: TypeError, ValueError
+
+    The other parameters are the same of :py:func:`locfield`.
+    """
+    args, axis, ACont, weights = _binned_input(lattice_params, atomic_positions,
+        fourier_components, propagation_vector, phases, muon_positions, ctype,
+        supercellsize, radius, nangles, nbins, bmax, axis, ACont, nnn, rcont, weights)
+
+    try:
+        t = np.array(times, dtype=np.float64).reshape(-1)
+    except:
+        raise TypeError("Cannot convert times to NumPy array.")
+
+    if direction is not None:
+        direction = np.array(direction, dtype=np.float64)
+        if direction.shape != (3,) or np.allclose(direction, 0.):
+            raise ValueError("direction must be a non zero vector.")
+
+    return lfclib.FieldPolarization(ctype[0], *(args + (t,)), rot_axis=axis, ACont=ACont,
+                                    weights=weights, direction=direction,
+                                    powder=1 if powder else 0, precision=precision)
+
+
+def _binned_input(lattice_params, atomic_positions, fourier_components, propagation_vector, phases,
+                  muon_positions, ctype, supercellsize, radius, nangles, nbins, bmax,
+                  axis, ACont, nnn, rcont, weights):
+    # validates the input of field_histogram and field_polarization and
+    # returns the positional arguments of lfclib.Histogram after calc_type
+    if ctype not in ('r', 'rotate', 'i', 'incommensurate'):
+        raise ValueError("Invalid calculation type.")
+
+    if ctype == 'r' or ctype == 'rotate':
+        if axis is None:
+            raise ValueError("Axis for rotation must be specified.")
+        axis = np.array(axis, dtype=np.float64)
+        axis = axis/np.linalg.norm(axis)
+
+    try:
+        sc = np.array(supercellsize, dtype=np.int32)
+    except:
+        raise TypeError("Cannot convert supercellsize to NumPy array.")
+
+    if sc.shape != (3,):
+        raise ValueError("Supercellsize has wrong shape.")
+    if (np.min(sc) <= 0):
+        raise ValueError("Supercellsize must be strictly positive.")
+
+    try:
+        r = float(radius) # Lorentz radius (in A)
+        nnn = int(nnn)
+        rc = float(rcont)
+        nangles = int(nangles)
+        nbins = int(nbins)
+        bmax = float(bmax)
+        ACont = float(ACont)
+    except:
+        raise TypeError("Cannot convert parameters to int or float.")
+
+    if nnn < 0 or rc < 0:
+        raise ValueError("nnn and rcont must be positive.")
+    if nangles <= 0 or nbins <= 0 or bmax <= 0:
+        raise ValueError("nangles, nbins and bmax must be strictly positive.")
+
+    mus = np.array(muon_positions, dtype=np.float64).reshape(-1, 3)
+    if weights is not None:
+        weights = np.array(weights, dtype=np.float64)
+        if weights.shape != (mus.shape[0],) or np.min(weights) < 0. or np.sum(weights) <= 0.:
+            raise ValueError("One non negative weight must be given for each muon site.")
+
+    positions = np.array(atomic_positions)
+    latpar = np.array(lattice_params)
+    fourier_components = np.array(fourier_components, dtype=np.complex128)
+
+    # Remove non magnetic atoms from list
+    magnetic_atoms = [i for i, e in enumerate(fourier_components)
+                        if not np.allclose(e, 0.)]
+
+    p = positions[magnetic_atoms,:]
+    fc = fourier_components[magnetic_atoms,:]
+    phi = np.array(phases)[magnetic_atoms]
+    k = np.array(propagation_vector)
+
+    return ((p, fc, k, phi, mus, sc, latpar, r, nnn, rc, nangles, nbins, bmax),
+            axis, ACont, weights)
+
+
+class DisorderSites(object):
+    """
+    Sites of the supercell inside the Lorentz sphere, for fields of diluted
+    or disordered magnetic configurations.
+
+    The dipolar tensor of each (cell, atom) site inside the sphere is
+    computed once. The fields of any number of configurations, i.e. one
+    moment per site, are then obtained with a sparse dot product each,
+    evaluated in parallel.
+
+    The parent configuration is the magnetic order defined by
+    fourier_components, propagation_vector and phases (same meaning as in
+    :py:func:`locfield`); only its magnetic atoms are considered.
+
+    :ivar cells: cell of each site in the supercell, shape (n_sites, 3).
+    :ivar atoms: index of the atom of each site in atomic_positions.
+    :ivar moments: moment of each site in the parent configuration (Cartesian, :math:`\\mu_B`).
+    :ivar dist: distance of each site from the muon (sites are sorted by distance).
+    """
+
+    def __init__(self, lattice_params, atomic_positions, fourier_components, propagation_vector, phases,
+                 muon_position, supercellsize, radius, nnn = 2, rcont = 10.0):
+        try:
+            sc = np.array(supercellsize, dtype=np.int32)
+        except:
+            raise TypeError("Cannot convert supercellsize to NumPy array.")
+
+        if sc.shape != (3,):
+            raise ValueError("Supercellsize has wrong shape.")
+        if (np.min(sc) <= 0):
+            raise ValueError("Supercellsize must be strictly positive.")
+
+        try:
+            self._r = float(radius) # Lorentz radius (in A)
+            self._nnn = int(nnn)
+            self._rc = float(rcont)
+        except:
+            raise TypeError("Cannot convert radius or rcont to float or nnn to int.")
+
+        if self._nnn < 0 or self._rc < 0:
+            raise ValueError("nnn and rcont must be positive.")
+
+        positions = np.array(atomic_positions, dtype=np.float64)
+        self._natoms = positions.shape[0]
+        latpar = np.array(lattice_params, dtype=np.float64)
+        fourier_components = np.array(fourier_components, dtype=np.complex128)
+        phases = np.array(phases, dtype=np.float64)
+        k = np.array(propagation_vector, dtype=np.float64)
+
+        # Remove non magnetic atoms from list
+        magnetic_atoms = np.array([i for i, e in enumerate(fourier_components)
+                                    if not np.allclose(e, 0.)], dtype=np.int64)
+
+        keys, self._tensors, self.dist = lfclib.SphereSites(positions[magnetic_atoms,:],
+                                                            np.array(muon_position, dtype=np.float64),
+                                                            sc, latpar, self._r)
+        keys = keys.astype(np.int64)
+        nmag = len(magnetic_atoms)
+        cell = keys // nmag
+        self.cells = np.array([cell // (sc[1]*sc[2]), (cell // sc[2]) % sc[1], cell % sc[2]]).T
+        self.atoms = magnetic_atoms[keys % nmag]
+
+        # m = cos(2 pi K.n) P + sin(2 pi K.n) Q, see simplesum.c
+        fc = fourier_components[self.atoms]
+        phi = 2.*np.pi*phases[self.atoms]
+        P = np.cos(phi)[:,None]*fc.real + np.sin(phi)[:,None]*fc.imag
+        Q = np.cos(phi)[:,None]*fc.imag - np.sin(phi)[:,None]*fc.real
+        kn = 2.*np.pi*np.dot(self.cells, k)
+        self.moments = np.cos(kn)[:,None]*P + np.sin(kn)[:,None]*Q
+
+    @property
+    def nsites(self):
+        """
+        Number of sites inside the Lorentz sphere.
+        """
+        return len(self.dist)
+
+    def fields(self, moments):
+        """
+        Local fields of a batch of configurations.
+
+        :param moments: moments of the sites, shape (n_sites, 3) for a single
+                        configuration or (n_conf, n_sites, 3). Zero moments are
+                        vacancies and are excluded from the contact field.
+        :return: the fields of the configurations, with shape (3,) or (n_conf, 3).
+        :rtype: :py:class:`~LocalFields`
+        """
+        m = np.array(moments, dtype=np.float64)
+        single = (m.ndim == 2)
+        if single:
+            m = m[None,:,:]
+        if m.ndim != 3 or m.shape[1:] != (self.nsites, 3):
+            raise ValueError("moments must have shape (n_sites, 3) or (n_conf, n_sites, 3).")
+        BCont, BDip, BLor = lfclib.DisorderSum(self._tensors, self.dist, m,
+                                               self._r, self._nnn, self._rc)
+        if single:
+            return LocalFields(BCont[0], BDip[0], BLor[0])
+        return LocalFields(BCont, BDip, BLor)
+
+    def sample(self, nconf, occupancy = 1., random_directions = False, seed = 0):
+        """
+        Local fields of random configurations derived from the parent one.
+
+        :param int nconf: number of configurations.
+        :param occupancy: occupation probability, either a number, one value
+                          per atom of atomic_positions or one value per site.
+        :param bool random_directions: if True each moment points in a random
+                                       direction, with the magnitude of the parent moment.
+        :param int seed: seed of the random number generator. The results
+                         only depend on the seed, not on the number of threads.
+        :return: the fields of the configurations, with shape (nconf, 3).
+        :rtype: :py:class:`~LocalFields`
+        """
+        occ = np.array(occupancy, dtype=np.float64)
+        if occ.ndim == 0:
+            occ = np.full(self.nsites, float(occ))
+        elif occ.shape == (self.nsites,):
+            pass
+        elif occ.shape == (self._natoms,):
+            occ = occ[self.atoms]
+        else:
+            raise ValueError("Invalid shape of occupancy.")
+        BCont, BDip, BLor = lfclib.DilutionSample(self._tensors, self.dist, self.moments,
+                                                  int(nconf), self._r, self._nnn, self._rc,
+                                                  occupancy=occ,
+                                                  random_directions=int(random_directions),
+                                                  seed=int(seed))
+        return LocalFields(BCont, BDip, BLor)
+
+
+def _cartesian_rotation(lattice_params, R):
+    # x_frac' = R x_frac and r_cart = x_frac . L (row vectors), hence
+    # r_cart' = L^T R L^-T r_cart for column vectors.
+    L = np.array(lattice_params, dtype=np.float64)
+    return np.dot(L.T, np.dot(np.array(R, dtype=np.float64), np.linalg.inv(L.T)))
+
+
+def _site_symmetry(lattice_params, site_rotations, site_time_reversals, i):
+    # Cartesian rotations and time reversals of the point group of muon site i
+    if site_rotations is None or site_rotations[i] is None:
+        return None, None
+    siteops = np.array([_cartesian_rotation(lattice_params, R) for R in site_rotations[i]])
+    sitetr = None
+    if site_time_reversals is not None and site_time_reversals[i] is not None:
+        sitetr = np.array(site_time_reversals[i], dtype=np.int32)
+    return siteops, sitetr
+
+
+def symmetry_reduce(muon_positions, rotations, translations, propagation_vector = None,
+                    supercellsize = None, symprec = 1e-5):
+    """
+    Groups the muon sites in sets of symmetry equivalent sites.
+
+    A site x_i is equivalent to x_j if R x_j + t = x_i + n, where (R, t) is one 
+    of the symmetry operations (in fractional coordinates) and n is a lattice 
+    vector.
+    When a propagation vector is given, the lattice sums are centered in 
+    the cell supercellsize//2 and the operation is only used if the 
+    full lattice translation relating the two sites is a symmetry of the 
+    magnetic order (K.n integer).
+
+    :param list muon_positions: muon positions in fractional coordinates.
+    :param rotations: (nops, 3, 3) rotation matrices in fractional coordinates.
+    :param translations: (nops, 3) fractional translations.
+    :param propagation_vector: propagation vector (reciprocal lattice units), optional.
+    :param list supercellsize: supercell size, required with propagation_vector.
+    :param float symprec: tolerance used to compare positions.
+    :return: the indices of the irreducible sites and, for each site, a 
+             tuple (index of the irreducible site, index of the operation).
+             The operation index is None for the irreducible sites.
+    :rtype: tuple
+    :raises: ValueError
+    """
+    rotations = np.array(rotations, dtype=np.float64).reshape(-1,3,3)
+    translations = np.array(translations, dtype=np.float64).reshape(-1,3)
+    if rotations.shape[0] != translations.shape[0]:
+        raise ValueError("Rotations and translations must have the same length.")
+
+    K = None
+    if propagation_vector is not None and np.any(np.abs(propagation_vector) > symprec):
+        if supercellsize is None:
+            raise ValueError("supercellsize is required when a propagation vector is given.")
+        K = np.array(propagation_vector, dtype=np.float64)
+        c0 = np.floor(np.array(supercellsize, dtype=np.float64)/2.)
+
+    sites = [np.array(mu, dtype=np.float64) for mu in muon_positions]
+    irreducible = []
+    mapping = []
+    for i, x in enumerate(sites):
+        found = None
+        for j in irreducible:
+            for g in range(rotations.shape[0]):
+                d = np.dot(rotations[g], sites[j]) + translations[g] - x
+                n = np.round(d)
+                if not np.allclose(d, n, atol=symprec):
+                    continue
+                if K is not None:
+                    # lattice vector between the transformed and the requested site
+                    N = n + np.dot(rotations[g], c0) - c0
+                    kn = np.dot(K, N)
+                    if abs(kn - np.round(kn)) > symprec:
+                        continue
+                found = (j, g)
+                break
+            if found is not None:
+                break
+        if found is None:
+            irreducible.append(i)
+            mapping.append((i, None))
+        else:
+            mapping.append(found)
+    return irreducible, mapping
+
+
+def _grid_symmetry(grid, mask, rotations, translations, propagation_vector, origin, symprec):
+    """
+    Maps the retained points of a grid onto the irreducible ones.
+    Returns the flat indices of the points and, for each of them, the
+    position of its irreducible point in that list and the operation
+    (-1 for the irreducible points).
+    """
+    grid = np.array(grid)
+    points = np.flatnonzero(mask.reshape(-1))
+    x = np.array(np.unravel_index(points, grid)).T / grid
+    position = -np.ones(mask.size, dtype=np.int64)
+    position[points] = np.arange(len(points))
+
+    # mapped[g, i]: position of g x_i in the list of points, -1 if not on it
+    nops = rotations.shape[0]
+    mapped = -np.ones((nops, len(points)), dtype=np.int64)
+    for g in range(nops):
+        f = (np.dot(x, rotations[g].T) + translations[g]) * grid
+        n = np.round(f)
+        ok = np.all(np.abs(f - n) < symprec * grid, axis=1)
+        idx = np.mod(n, grid).astype(np.int64)
+        if propagation_vector is not None:
+            # lattice vector between the transformed and the grid point
+            N = (n - idx) / grid + np.dot(rotations[g], origin) - origin
+            kn = np.dot(N, propagation_vector)
+            ok &= np.abs(kn - np.round(kn)) < symprec
+        flat = np.ravel_multi_index(idx.T, grid)
+        mapped[g, ok] = position[flat[ok]]
+
+    irreducible = -np.ones(len(points), dtype=np.int64)
+    operation = -np.ones(len(points), dtype=np.int64)
+    for i in range(len(points)):
+        if irreducible[i] >= 0:
+            continue
+        irreducible[i] = i
+        for g in range(nops):
+            j = mapped[g, i]
+            if j >= 0 and irreducible[j] < 0:
+                irreducible[j] = i
+                operation[j] = g
+    return points, irreducible, operation
+
+
+def grid_scan(lattice_params, atomic_positions, fourier_components, propagation_vector, phases,
+              grid, radius, min_distance = 1.0, nnn = 2, rcont = 10.0, tensor = False,
+              rotations = None, translations = None, time_reversals = None,
+              supercellsize = None, symprec = 1e-5):
+    """
+    Evaluates local fields (and optionally the dipolar tensor) on the
+    points (i/n_a, j/n_b, k/n_c) of a regular grid in the unit cell, as
+    candidate muon sites.
+
+    Points closer than min_distance to any atom (magnetic or not) are
+    excluded. When the symmetry operations are given, the fields are only
+    evaluated at the symmetry inequivalent points and obtained at the
+    others as in :py:func:`locfield_symmetric`. The remaining points share
+    a single lattice and are evaluated in parallel.
+
+    :param list grid: number of points along a, b and c.
+    :param float radius: the Lorentz radius, Angstrom. No supercell is needed.
+    :param float min_distance: minimum distance of the points from the atoms, Angstrom. Default 1.
+    :param bool tensor: if True the dipolar tensor of the magnetic atoms
+                        (as :py:func:`dipten`) is also evaluated. Default False.
+    :param rotations: (nops, 3, 3) rotation matrices in fractional coordinates, optional.
+    :param translations: (nops, 3) fractional translations, optional.
+    :param time_reversals: (nops,) True (or -1) for the operations combined
+                           with time reversal. Default: no time reversal.
+    :param list supercellsize: only used to define the phases :math:`2\\pi K\\cdot R`
+                               as in :py:func:`locfield` with the same supercell.
+                               Default: the muon is in cell 0.
+    :param float symprec: tolerance used to compare positions.
+    :return: the retained points (n x 3, fractional coordinates), the
+             contact (for ACont = 1, see :py:class:`~LocalFields`),
+             dipolar and Lorentz fields (n x 3 each, Tesla) and the
+             dipolar tensors (n x 3 x 3) or None.
+    :rtype: tuple
+    :raises: TypeError, ValueError
+
+    The other parameters are the same of :py:func:`locfield`.
+    """
+    try:
+        grid = np.array(grid, dtype=np.int32)
+        r = float(radius)
+        dmin = float(min_distance)
+        nnn = int(nnn)
+        rc = float(rcont)
+    except:
+        raise TypeError("Cannot convert grid to int, radius, min_distance or rcont to float or nnn to int.")
+
+    if grid.shape != (3,) or np.min(grid) <= 0:
+        raise ValueError("grid must be three positive integers.")
+    if dmin < 0 or nnn < 0 or rc < 0:
+        raise ValueError("min_distance, nnn and rcont must be positive.")
+
+    origin = np.zeros(3, dtype=np.int32)
+    if supercellsize is not None:
+        origin = np.array(supercellsize, dtype=np.int32)//2
+        if origin.shape != (3,):
+            raise ValueError("Supercellsize has wrong shape.")
+
+    positions = np.array(atomic_positions, dtype=np.float64)
+    latpar = np.array(lattice_params, dtype=np.float64)
+    fourier_components = np.array(fourier_components, dtype=np.complex128)
+    phases = np.array(phases, dtype=np.float64)
+    k = np.array(propagation_vector, dtype=np.float64)
+
+    mask = lfclib.GridMask(positions, latpar, grid, dmin)
+
+    if rotations is None:
+        points = np.flatnonzero(mask.reshape(-1))
+        irreducible = np.arange(len(points))
+        operation = -np.ones(len(points), dtype=np.int64)
+        rotations = np.zeros((0, 3, 3))
+    else:
+        rotations = np.array(rotations, dtype=np.float64).reshape(-1,3,3)
+        translations = np.array(translations, dtype=np.float64).reshape(-1,3)
+        if rotations.shape[0] != translations.shape[0]:
+            raise ValueError("Rotations and translations must have the same length.")
+        K = k if np.any(np.abs(k) > symprec) else None
+        points, irreducible, operation = _grid_symmetry(grid, mask, rotations, translations,
+                                                        K, origin, symprec)
+
+    theta = np.ones(rotations.shape[0])
+    if time_reversals is not None:
+        tr = np.array(time_reversals).reshape(-1)
+        if tr.dtype == np.bool_:
+            theta = np.where(tr, -1., 1.)
+        else:
+            theta = np.where(tr.astype(np.float64) < 0, -1., 1.)
+
+    x = np.array(np.unravel_index(points, grid)).T / grid
+
+    # Remove non magnetic atoms from list
+    magnetic_atoms = [i for i, e in enumerate(fourier_components)
+                        if not np.allclose(e, 0.)]
+
+    computed = np.flatnonzero(operation < 0)
+    BCont, BDip, BLor, T = lfclib.GridScan(positions[magnetic_atoms,:],
+                                           fourier_components[magnetic_atoms,:],
+                                           k, phases[magnetic_atoms], x[computed], latpar,
+                                           r, nnn, rc, origin=origin, tensor=int(tensor))
+
+    # the results of the irreducible points, then the others
+    where = -np.ones(len(points), dtype=np.int64)
+    where[computed] = np.arange(len(computed))
+    src = where[irreducible]
+    cont, dip, lor = BCont[src], BDip[src], BLor[src]
+    tensors = T[src] if tensor else None
+    for g in range(rotations.shape[0]):
+        sel = np.flatnonzero(operation == g)
+        if len(sel) == 0:
+            continue
+        Rc = _cartesian_rotation(latpar, rotations[g])
+        # magnetic fields are axial vectors, odd under time reversal
+        Rf = theta[g] * np.linalg.det(Rc) * Rc
+        cont[sel] = np.dot(cont[sel], Rf.T)
+        dip[sel] = np.dot(dip[sel], Rf.T)
+        lor[sel] = np.dot(lor[sel], Rf.T)
+        if tensor:
+            tensors[sel] = np.einsum('ij,njk,lk->nil', Rc, tensors[sel], Rc)
+
+    return x, cont, dip, lor, tensors
+
+
+def locfield_symmetric(lattice_params, atomic_positions, fourier_components, propagation_vector, phases, muon_positions,
+                       rotations, translations, time_reversals, supercellsize, radius, nnn = 2, rcont = 10.0,
+                       symprec = 1e-5, **kwargs):
+    """
+    Same as :py:func:`locfield` with ctype 'sum', but the fields are only 
+    evaluated for the symmetry inequivalent muon sites.
+
+    The fields at the other sites are obtained as 
+    B(g x) = theta det(R) R B(x), where R is the rotation (in Cartesian 
+    coordinates) and theta is -1 for operations combined with time reversal.
+    The operations must be symmetries of the magnetic structure 
+    (for example the operations of its magnetic space group).
+
+    :param rotations: (nops, 3, 3) rotation matrices in fractional coordinates.
+    :param translations: (nops, 3) fractional translations.
+    :param time_reversals: (nops,) True (or -1) for the operations combined with time reversal.
+    :param float symprec: tolerance used to compare positions.
+    :return: a list of :py:class:`~LocalFields`, one for each muon site.
+    :rtype: list
+
+    The remaining parameters and keywords are those of :py:func:`locfield`.
+    """
+    tr = np.array(time_reversals).reshape(-1)
+    if tr.dtype == np.bool_:
+        theta = np.where(tr, -1., 1.)
+    else:
+        theta = np.where(tr.astype(np.float64) < 0, -1., 1.)
+
+    irreducible, mapping = symmetry_reduce(muon_positions, rotations, translations,
+                                           propagation_vector, supercellsize, symprec)
+
+    computed = locfield(lattice_params, atomic_positions, fourier_components, propagation_vector, 
+                        phases, [muon_positions[i] for i in irreducible], 's', 
+                        supercellsize, radius, nnn, rcont, **kwargs)
+    computed = dict(zip(irreducible, computed))
+
+    res = []
+    for j, g in mapping:
+        f = computed[j]
+        if g is None:
+            res.append(f)
+            continue
+        Rc = _cartesian_rotation(lattice_params, np.array(rotations)[g])
+        # magnetic fields are axial vectors, odd under time reversal
+        Rc = theta[g] * np.linalg.det(Rc) * Rc
+        res.append(LocalFields(np.dot(Rc, f._BCont), np.dot(Rc, f._BDip),
+                               np.dot(Rc, f._BLor), f.ACont))
+    return res
+
+
+def dipten_symmetric(lattice_params, magnetic_atom_positions, muon_positions, rotations, translations,
+                     supercellsize, radius, symprec = 1e-5, **kwargs):
+    """
+    Same as :py:func:`dipten`, but the tensor is only evaluated for the 
+    symmetry inequivalent muon sites and then transformed as 
+    T(g x) = R T(x) R^T.
+    The operations must be symmetries of the lattice of magnetic atoms.
+
+    :param rotations: (nops, 3, 3) rotation matrices in fractional coordinates.
+    :param translations: (nops, 3) fractional translations.
+    :param float symprec: tolerance used to compare positions.
+    :return: a list of numpy ndarray, one for each muon site.
+    :rtype: list
+
+    The remaining parameters and keywords are those of :py:func:`dipten`.
+    """
+    irreducible, mapping = symmetry_reduce(muon_positions, rotations, translations,
+                                           symprec=symprec)
+
+    computed = dipten(lattice_params, magnetic_atom_positions,
+                      [muon_positions[i] for i in irreducible], 
+                      supercellsize, radius, **kwargs)
+    computed = dict(zip(irreducible, computed))
+
+    res = []
+    for j, g in mapping:
+        if g is None:
+            res.append(computed[j])
+            continue
+        Rc = _cartesian_rotation(lattice_params, np.array(rotations)[g])
+        res.append(np.dot(Rc, np.dot(computed[j], Rc.T)))
+    return res
@@ -1,6 +1,27 @@
 from .LFC import (get_version,
                      locfield,
+                     locfield_adaptive,
+                     locfield_extrapolated,
+                     locfield_hybrid,
                      dipten,
+                     efg,
+                     locfield_and_dipten,
+                     LFCSession,
+                     ResultCache,
+                     write_structure,
+                     read_structure,
+                     locfield_domains,
+                     locfield_configurations,
+                     fit_moments,
+                     StrainExpansion,
+                     polarization,
+                     field_histogram,
+                     field_polarization,
+                     DisorderSites,
+                     locfield_symmetric,
+                     dipten_symmetric,
+                     symmetry_reduce,
+                     grid_scan,
                      find_largest_sphere)
 
 __version__ = "{}.{}.{}".format(* get_version() )
@@ -9,11 +9,27 @@
 #define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
 
 #include "Python.h"
+#include "pythread.h"
 #include <numpy/arrayobject.h>
 #include "dipolartensor.h"
 #include "fastincommsum.h"
 #include "rotatesum.h"
 #include "simplesum.h"
+#include "fusedsum.h"
+#include "wedge.h"
+#include "polarization.h"
+#include "histogram.h"
+#include "disorder.h"
+#include "configsum.h"
+#include "fit.h"
+#include "strainsum.h"
+#include "adaptivesum.h"
+#include "extrapolate.h"
+#include "hybridsum.h"
+#include "gridscan.h"
+#include "chargesum.h"
+#include "session.h"
+#include "config.h"
 
 /* support numpy 1.6 - this macro got renamed and deprecated at once in 1.7 */
 #ifndef NPY_ARRAY_IN_ARRAY
@@ -24,7 +40,7 @@
 #define PyArray_SHAPE PyArray_DIMS
 #endif
 
-static char module_docstring[] = "This module provides two functions: Fields and DipolarTensor.";
+static char module_docstring[] = "This module provides twenty-three functions: Fields, AdaptiveSum, ExtrapolatedSum, HybridSum, GridMask, GridScan, DipolarTensor, ChargeSum, SessionNew, SessionUpdate, SessionEvaluate, FusedSum, DomainSum, ConfigSum, ConfigResponse, FitMoments, StrainSum, Polarization, Histogram, FieldPolarization, SphereSites, DisorderSum and DilutionSample.";
 static char py_lfclib_fields_docstring[] = "Calculate the Local Field components: dipolar, Lorentz and Contact\n"
 "\n"
 "    This function calculates the magnetic field (in Tesla) at the muon site.\n"
@@ -64,6 +80,21 @@ static char py_lfclib_fields_docstring[] = "Calculate the Local Field components
 "        Number of divisions of the full turn in the 'r' and 'i' runs\n"
 "    rot_axis: numpy.ndarray, optional\n"
 "        axis for the rotations when using the 'r' option.\n"
+"    precision: str, optional\n"
+"        'double' (default) or 'mixed'. In 'mixed' mode positions, distances and\n"
+"        dipolar terms are evaluated in single precision and accumulated in double\n"
+"        precision. See README.md for the error bound.\n"
+"    reproducible: int, optional\n"
+"        if non zero the result of the 's', 'r' and 'i' runs is bitwise\n"
+"        identical for any number of OpenMP threads.\n"
+"    siteops: numpy.ndarray, optional\n"
+"        point group of the muon site as n x 3 x 3 Cartesian rotation matrices\n"
+"        acting on positions relative to the muon ('s' run only). Only an\n"
+"        irreducible wedge of the Lorentz sphere is summed. The operations\n"
+"        must be symmetries of the magnetic structure and the supercell\n"
+"        must contain the whole sphere.\n"
+"    sitetr: numpy.ndarray, optional\n"
+"        time reversal (+1 or -1) of each of the siteops.\n"
 "\n"    
 "    Returns\n"
 "    -------\n"
@@ -72,6 +103,199 @@ static char py_lfclib_fields_docstring[] = "Calculate the Local Field components
 
 
 
+static char py_lfclib_ad_docstring[] = "Local fields with the Lorentz radius chosen from a tolerance.\n"
+"\n"
+"    The sphere grows by shells about one cell thick until the change of\n"
+"    the dipolar plus Lorentz field over the last shells is below\n"
+"    max(atol, rtol |B_dip + B_lor|). No supercell is needed.\n"
+"\n"
+"    Parameters\n"
+"    ----------\n"
+"    positions, FC, K, Phi, Muon, Cell:\n"
+"        same as Fields.\n"
+"    rmax : float\n"
+"        Largest Lorentz radius.\n"
+"    nnn, rcont:\n"
+"        same as Fields.\n"
+"    atol : float, optional\n"
+"        Absolute tolerance in Tesla (default 1e-4).\n"
+"    rtol : float, optional\n"
+"        Relative tolerance (default 0).\n"
+"    origin : numpy.ndarray, optional\n"
+"        Index of the cell of the muon in the phases 2 pi K.R (3 integers).\n"
+"        Fields uses Supercell/2. Default: zero.\n"
+"\n"    
+"    Returns\n"
+"    -------\n"
+"    Results : tuple\n"
+"        Contact, Dipolar and Lorentz fields (Tesla), the radius used, the\n"
+"        estimated error (Tesla) and 1 if the tolerance was reached (0 if the\n"
+"        radius reached rmax).\n";
+
+static char py_lfclib_hy_docstring[] = "Local fields with an exact near field and a continuum far field.\n"
+"\n"
+"    The dipoles within rnear are summed exactly. Those between rnear and r\n"
+"    are replaced by the smooth magnetization density of the propagation\n"
+"    vector, whose field is analytic. The cost scales like rnear^3 and no\n"
+"    supercell is needed.\n"
+"\n"
+"    Parameters\n"
+"    ----------\n"
+"    positions, FC, K, Phi, Muon, Cell, r:\n"
+"        same as Fields.\n"
+"    rnear : float\n"
+"        Radius of the exact sum, 0 < rnear <= r.\n"
+"    nnn, rcont:\n"
+"        same as Fields. Only atoms within rnear are considered.\n"
+"    origin : numpy.ndarray, optional\n"
+"        Index of the cell of the muon in the phases 2 pi K.R (3 integers).\n"
+"        Fields uses Supercell/2. Default: zero.\n"
+"\n"    
+"    Returns\n"
+"    -------\n"
+"    Results : tuple\n"
+"        Contact, Dipolar and Lorentz fields (Tesla) and the estimated\n"
+"        error of B_dip + B_lor (Tesla).\n";
+
+static char py_lfclib_gm_docstring[] = "Points of a grid in the unit cell far enough from the atoms.\n"
+"\n"
+"    Parameters\n"
+"    ----------\n"
+"    atoms : numpy.ndarray\n"
+"        Positions of all the atoms in fractional coordinates.\n"
+"    Cell : numpy.ndarray\n"
+"        Lattice parameters, same as Fields.\n"
+"    grid : numpy.ndarray\n"
+"        Number of points along a, b and c (3 integers).\n"
+"    dmin : float\n"
+"        Minimum distance from the atoms (Angstrom).\n"
+"\n"    
+"    Returns\n"
+"    -------\n"
+"    mask : numpy.ndarray\n"
+"        Boolean array of shape grid, True for the points (i/n_a, j/n_b, k/n_c)\n"
+"        at least dmin away from all the atoms.\n";
+
+static char py_lfclib_gs_docstring[] = "Local fields at many muon sites of the same cell.\n"
+"\n"
+"    The magnetic atoms that can enter the spheres of the points are built\n"
+"    once and shared by all the points, which are distributed among the\n"
+"    threads. No supercell is needed.\n"
+"\n"
+"    Parameters\n"
+"    ----------\n"
+"    positions, FC, K, Phi:\n"
+"        same as Fields.\n"
+"    Points : numpy.ndarray\n"
+"        Muon positions in fractional coordinates (n_points x 3).\n"
+"    Cell, r, nnn, rcont:\n"
+"        same as Fields.\n"
+"    origin : numpy.ndarray, optional\n"
+"        Index of the cell of the muon in the phases 2 pi K.R (3 integers).\n"
+"        Fields uses Supercell/2. Default: zero.\n"
+"    tensor : int, optional\n"
+"        If non zero, the dipolar tensor of the magnetic atoms is also\n"
+"        computed (as DipolarTensor). Default 0.\n"
+"\n"    
+"    Returns\n"
+"    -------\n"
+"    Results : tuple\n"
+"        Contact, Dipolar and Lorentz fields (n_points x 3, Tesla) and the\n"
+"        dipolar tensors (n_points x 3 x 3, 1/Angstrom^3) or None.\n";
+
+static char py_lfclib_chs_docstring[] = "Electrostatic potential and electric field gradient of point charges.\n"
+"\n"
+"    Direct sum over the charges within the sphere. It converges only for\n"
+"    neutral cells.\n"
+"\n"
+"    Parameters\n"
+"    ----------\n"
+"    positions : numpy.ndarray\n"
+"        Positions of the charges in fractional coordinates.\n"
+"    charges : numpy.ndarray\n"
+"        Charges, in units of e.\n"
+"    Muon, Supercell, Cell, r:\n"
+"        same as Fields.\n"
+"    reproducible: int, optional\n"
+"        if non zero the result is bitwise identical for any number of\n"
+"        OpenMP threads.\n"
+"\n"    
+"    Returns\n"
+"    -------\n"
+"    Results : tuple\n"
+"        The potential (Volt) and the electric field gradient V_ij\n"
+"        (3 x 3, V/Angstrom^2).\n";
+
+static char py_lfclib_sn_docstring[] = "New, empty, local field session.\n"
+"\n"
+"    Returns\n"
+"    -------\n"
+"    session : capsule\n"
+"        Opaque session, to be used with SessionUpdate and SessionEvaluate.\n"
+"        The calls on a session are serialized by a lock, so it can be\n"
+"        shared by several threads.\n";
+
+static char py_lfclib_su_docstring[] = "Updates the inputs of a local field session.\n"
+"\n"
+"    Only the arguments that are given are changed. Each of them is compared\n"
+"    with the stored value and the following evaluation only repeats the\n"
+"    lattice sums that depend on what changed: none for FC and Phi, those\n"
+"    of the moved sites for Muons, the shell between the old and the new\n"
+"    radius for a larger r, all of them otherwise.\n"
+"\n"
+"    Parameters\n"
+"    ----------\n"
+"    session : capsule\n"
+"        Session returned by SessionNew.\n"
+"    Cell, Supercell, positions, FC, K, Phi, r, nnn, rcont:\n"
+"        same as Fields, for the magnetic atoms only. Cell and Supercell,\n"
+"        FC and Phi must be given together. When the number of atoms\n"
+"        changes FC and Phi are reset to zero.\n"
+"    Muons : numpy.ndarray\n"
+"        Positions of the muon sites in fractional coordinates, n_mu x 3.\n"
+"\n"    
+"    Returns\n"
+"    -------\n"
+"    changed : bool\n"
+"        True if any input changed.\n";
+
+static char py_lfclib_se_docstring[] = "Local fields and dipolar tensors of a session.\n"
+"\n"
+"    Parameters\n"
+"    ----------\n"
+"    session : capsule\n"
+"        Session returned by SessionNew.\n"
+"    tensor : int, optional\n"
+"        If non zero the dipolar tensors are also returned.\n"
+"\n"    
+"    Returns\n"
+"    -------\n"
+"    Results : tuple\n"
+"        Contact (for ACont = 1), Dipolar and Lorentz fields (n_mu x 3,\n"
+"        Tesla), the dipolar tensors (n_mu x 3 x 3, 1/Angstrom^3) or None,\n"
+"        and the number of lattice sums performed.\n";
+
+static char py_lfclib_ex_docstring[] = "Local fields and dipolar tensor extrapolated to an infinite Lorentz radius.\n"
+"\n"
+"    The partial sums at nradii radii equally spaced in (r/2, r] are\n"
+"    accumulated in a single lattice sum. Their mean estimates the limit and\n"
+"    their spread gives the error.\n"
+"\n"
+"    Parameters\n"
+"    ----------\n"
+"    positions, FC, K, Phi, Muon, Supercell, Cell, r, nnn, rcont:\n"
+"        same as Fields.\n"
+"    nradii : int, optional\n"
+"        Number of partial sums (default 16).\n"
+"\n"    
+"    Returns\n"
+"    -------\n"
+"    Results : tuple of 6 numpy.ndarray\n"
+"        Contact, Dipolar and Lorentz fields (Tesla), dipolar tensor of the\n"
+"        atoms (3 x 3, 1/Angstrom^3, as DipolarTensor), the estimated errors\n"
+"        of B_dip + B_lor and of the tensor, and the partial sums\n"
+"        (nradii x 15: B_dip, B_lor, tensor).\n";
+
 static char py_lfclib_dt_docstring[] = "Dipolar tensor calculation.\n"
 "\n"
 "    This function calculates the dipolar tensor at the muon site.\n"
@@ -92,6 +316,12 @@ static char py_lfclib_dt_docstring[] = "Dipolar tensor calculation.\n"
 "        v3(1)  v3(2)  v3(3)    ... 3rd lattice vector\n"
 "    r : float\n"
 "        Lorentz sphere radius\n"
+"    precision: str, optional\n"
+"        'double' (default) or 'mixed', see Fields.\n"
+"    reproducible: int, optional\n"
+"        if non zero the result is bitwise identical for any number of threads.\n"
+"    siteops: numpy.ndarray, optional\n"
+"        point group of the muon site, see Fields.\n"
 "\n"    
 "    Returns\n"
 "    -------\n"
@@ -99,10 +329,416 @@ static char py_lfclib_dt_docstring[] = "Dipolar tensor calculation.\n"
 "        The array contains the dipolar tensor.\n";
 
 
+static char py_lfclib_fs_docstring[] = "Local fields and dipolar tensors in a single lattice sum.\n"
+"\n"
+"    This function evaluates, with a single traversal of the supercell, the\n"
+"    quantities returned by Fields (with calc_type 's') and DipolarTensor.\n"
+"    The result does not depend on the number of OpenMP threads.\n"
+"\n"
+"    Parameters\n"
+"    ----------\n"
+"    positions, FC, K, Phi, Muon, Supercell, Cell, r, nnn, rcont:\n"
+"        same as Fields.\n"
+"    components: str, optional\n"
+"        quantities to be computed, any combination of\n"
+"        'c' (contact field), 'd' (dipolar field), 'l' (Lorentz field),\n"
+"        't' (dipolar tensor) and 's' (dipolar tensor of each sublattice).\n"
+"        Default 'cdlt'.\n"
+"\n"    
+"    Returns\n"
+"    -------\n"
+"    Fields : tuple\n"
+"        Contact field, Dipolar field, Lorentz field (Tesla), dipolar tensor\n"
+"        (3x3, 1/Angstrom^3) and the tensors of each sublattice (natoms x 3 x 3,\n"
+"        in the order of positions). Components not requested are None.\n";
+
+
+static char py_lfclib_ds_docstring[] = "Local fields of several magnetic domains in a single lattice sum.\n"
+"\n"
+"    This function evaluates the quantities returned by Fields (with calc_type\n"
+"    's') for n_domains magnetic structures defined on the same atoms, e.g.\n"
+"    the arms of the star of K or symmetry equivalent arrangements of the\n"
+"    moments. The supercell is traversed only once.\n"
+"\n"
+"    Parameters\n"
+"    ----------\n"
+"    positions : numpy.ndarray\n"
+"        Atomic positions in fractional coordinates.\n"
+"    FC : numpy.ndarray\n"
+"        Fourier components, n_domains x n_atoms x 3, in Cartesian coordinates.\n"
+"    K  : numpy.ndarray\n"
+"        Propagation vector of each domain, n_domains x 3.\n"
+"    Phi: numpy.ndarray\n"
+"        Phases, n_domains x n_atoms.\n"
+"    Muon, Supercell, Cell, r, nnn, rcont:\n"
+"        same as Fields.\n"
+"\n"    
+"    Returns\n"
+"    -------\n"
+"    Fields : tuple of 3 numpy.ndarray\n"
+"        Contact, Dipolar and Lorentz fields of each domain (n_domains x 3, Tesla).\n";
+
+
+static char py_lfclib_st_docstring[] = "Dipolar field, dipolar tensor and their strain derivatives in a single lattice sum.\n"
+"\n"
+"    The strain e = (e_xx, e_yy, e_zz, e_yz, e_xz, e_xy) maps the lattice\n"
+"    vectors to (1 + e) a at fixed radius, fractional coordinates and moments.\n"
+"    Atoms crossing the surface of the sphere are accounted for by their\n"
+"    continuum (ellipsoidal shape) limit.\n"
+"\n"
+"    Parameters\n"
+"    ----------\n"
+"    positions, FC, K, Phi, Muon, Supercell, Cell, r:\n"
+"        same as Fields.\n"
+"\n"    
+"    Returns\n"
+"    -------\n"
+"    Results : tuple of 6 numpy.ndarray\n"
+"        Dipolar and Lorentz fields (3, Tesla), dipolar tensor of the atoms\n"
+"        (3 x 3, 1/Angstrom^3, as DipolarTensor), derivatives of the dipolar\n"
+"        and Lorentz fields (6 x 3) and of the tensor (6 x 3 x 3).\n";
+
+static char py_lfclib_pol_docstring[] = "Muon polarization function of a set of local fields.\n"
+"\n"
+"    P(t) = sum_i w_i [cos^2(theta_i) + sin^2(theta_i) cos(gamma_mu |B_i| t)]\n"
+"    where theta_i is the angle between B_i and the initial muon spin.\n"
+"\n"
+"    Parameters\n"
+"    ----------\n"
+"    fields : numpy.ndarray\n"
+"        Local fields, n_fields x 3, in Tesla (e.g. the total fields returned\n"
+"        by Fields for all the muon sites and angles).\n"
+"    times : numpy.ndarray\n"
+"        Times in microseconds.\n"
+"    weights : numpy.ndarray, optional\n"
+"        Probability of each field (normalized internally). Default: equal.\n"
+"    direction : numpy.ndarray, optional\n"
+"        Initial muon spin direction, Cartesian. Default: [0, 0, 1].\n"
+"    powder : int, optional\n"
+"        If non zero the powder average is computed. Default: 0.\n"
+"    nbins : int, optional\n"
+"        0 to sum over all the fields (default), otherwise the fields are\n"
+"        collected in nbins bins of |B| before the time evolution.\n"
+"\n"    
+"    Returns\n"
+"    -------\n"
+"    P : numpy.ndarray\n"
+"        Polarization at each time.\n";
+
+static char py_lfclib_hist_docstring[] = "Histograms of the local fields of rotated or incommensurate orders.\n"
+"\n"
+"    The fields obtained by Fields with calc_type 'r' or 'i' for each muon\n"
+"    site are accumulated in the bins of the histogram of the intensity of\n"
+"    the total field B_dip + B_lor + ACont*B_cont and of the histograms of\n"
+"    its Cartesian components, without returning the fields.\n"
+"\n"
+"    Parameters\n"
+"    ----------\n"
+"    calc_type : string\n"
+"        'r' or 'i', see Fields.\n"
+"    positions, FC, K, Phi:\n"
+"        same as Fields.\n"
+"    Muons : numpy.ndarray\n"
+"        Muon positions in fractional coordinates, n_sites x 3.\n"
+"    Supercell, Cell, r, nnn, rcont, nangles:\n"
+"        same as Fields.\n"
+"    nbins : int\n"
+"        Number of bins.\n"
+"    bmax : float\n"
+"        |B| is binned in [0, bmax), the components in [-bmax, bmax). Tesla.\n"
+"    rot_axis : numpy.ndarray, optional\n"
+"        Rotation axis, required for calc_type 'r'.\n"
+"    ACont : float, optional\n"
+"        Contact hyperfine coupling. Default: 0.\n"
+"    weights : numpy.ndarray, optional\n"
+"        Weight of each muon site (normalized internally). Default: equal.\n"
+"    precision : string, optional\n"
+"        same as Fields.\n"
+"\n"    
+"    Returns\n"
+"    -------\n"
+"    Histograms : tuple of 2 numpy.ndarray\n"
+"        Histogram of |B| (nbins) and of B_x, B_y, B_z (3 x nbins). Each\n"
+"        field of a site has weight w_site/nangles.\n";
+
+static char py_lfclib_fpol_docstring[] = "Muon polarization function of rotated or incommensurate orders.\n"
+"\n"
+"    The fields obtained by Fields with calc_type 'r' or 'i' for each muon\n"
+"    site are added to a histogram of the intensity of the total field\n"
+"    B_dip + B_lor + ACont*B_cont as soon as they are computed, and the\n"
+"    polarization is evaluated from the histogram as in Polarization,\n"
+"    without returning or storing the fields.\n"
+"\n"
+"    Parameters\n"
+"    ----------\n"
+"    calc_type : string\n"
+"        'r' or 'i', see Fields.\n"
+"    positions, FC, K, Phi:\n"
+"        same as Fields.\n"
+"    Muons : numpy.ndarray\n"
+"        Muon positions in fractional coordinates, n_sites x 3.\n"
+"    Supercell, Cell, r, nnn, rcont, nangles:\n"
+"        same as Fields.\n"
+"    nbins : int\n"
+"        Number of bins of |B|.\n"
+"    bmax : float\n"
+"        |B| is binned in [0, bmax), larger fields are added to the last\n"
+"        bin. Tesla.\n"
+"    times : numpy.ndarray\n"
+"        Times in microseconds.\n"
+"    rot_axis : numpy.ndarray, optional\n"
+"        Rotation axis, required for calc_type 'r'.\n"
+"    ACont : float, optional\n"
+"        Contact hyperfine coupling. Default: 0.\n"
+"    weights : numpy.ndarray, optional\n"
+"        Weight of each muon site (normalized internally). Default: equal.\n"
+"    direction : numpy.ndarray, optional\n"
+"        Initial muon spin direction, Cartesian. Default: [0, 0, 1].\n"
+"    powder : int, optional\n"
+"        If non zero the powder average is computed. Default: 0.\n"
+"    precision : string, optional\n"
+"        same as Fields.\n"
+"\n"    
+"    Returns\n"
+"    -------\n"
+"    P : numpy.ndarray\n"
+"        Polarization at each time. Each field of a site has weight\n"
+"        w_site/nangles.\n";
+
+static char py_lfclib_ss_docstring[] = "Sites of the supercell inside the Lorentz sphere and their dipolar tensors.\n"
+"\n"
+"    Parameters\n"
+"    ----------\n"
+"    positions : numpy.ndarray\n"
+"        Atomic positions in fractional coordinates.\n"
+"    Muon, Supercell, Cell, r:\n"
+"        same as Fields.\n"
+"\n"    
+"    Returns\n"
+"    -------\n"
+"    Sites : tuple of 3 numpy.ndarray\n"
+"        For each (cell, atom) site inside the sphere, sorted by distance:\n"
+"        the key ((i*scy+j)*scz+k)*n_atoms + atom, the dipolar tensor\n"
+"        (xx, xy, xz, yy, yz, zz, Tesla/mu_B, n_sites x 6) and the distance\n"
+"        from the muon (Angstrom).\n";
+
+static char py_lfclib_dis_docstring[] = "Local fields of a batch of configurations of the sites returned by SphereSites.\n"
+"\n"
+"    Parameters\n"
+"    ----------\n"
+"    tensors, dist : numpy.ndarray\n"
+"        Dipolar tensors and distances returned by SphereSites.\n"
+"    moments : numpy.ndarray\n"
+"        Moments (mu_B, Cartesian) of the sites, n_conf x n_sites x 3. Zero\n"
+"        moments are vacancies and do not enter the contact field.\n"
+"    r, nnn, rcont:\n"
+"        same as Fields (r must be the radius used in SphereSites).\n"
+"\n"    
+"    Returns\n"
+"    -------\n"
+"    Fields : tuple of 3 numpy.ndarray\n"
+"        Contact, Dipolar and Lorentz fields of each configuration (n_conf x 3, Tesla).\n";
+
+static char py_lfclib_dil_docstring[] = "Local fields of random configurations of the sites returned by SphereSites.\n"
+"\n"
+"    Parameters\n"
+"    ----------\n"
+"    tensors, dist : numpy.ndarray\n"
+"        Dipolar tensors and distances returned by SphereSites.\n"
+"    moments : numpy.ndarray\n"
+"        Parent moments (mu_B, Cartesian) of the sites, n_sites x 3.\n"
+"    nconf : int\n"
+"        Number of random configurations.\n"
+"    r, nnn, rcont:\n"
+"        same as DisorderSum.\n"
+"    occupancy : numpy.ndarray, optional\n"
+"        Occupation probability of each site. Default: all sites occupied.\n"
+"    random_directions : int, optional\n"
+"        If non zero the moments are oriented at random. Default: 0.\n"
+"    seed : int, optional\n"
+"        Seed of the random number generator. Default: 0.\n"
+"\n"    
+"    Returns\n"
+"    -------\n"
+"    Fields : tuple of 3 numpy.ndarray\n"
+"        Contact, Dipolar and Lorentz fields of each configuration (nconf x 3, Tesla).\n";
+
+static char py_lfclib_cs_docstring[] = "Local fields of many moment configurations at many muon sites.\n"
+"\n"
+"    The lattice sums are performed once for each muon site and the fields\n"
+"    of all the configurations are obtained with a matrix product.\n"
+"\n"
+"    Parameters\n"
+"    ----------\n"
+"    positions : numpy.ndarray\n"
+"        Atomic positions in fractional coordinates.\n"
+"    FC : numpy.ndarray\n"
+"        Fourier components, n_conf x n_atoms x 3, in Cartesian coordinates.\n"
+"    K, Phi:\n"
+"        same as Fields, shared by all the configurations.\n"
+"    Muons : numpy.ndarray\n"
+"        Muon positions in fractional coordinates, n_mu x 3.\n"
+"    Supercell, Cell, r, nnn, rcont:\n"
+"        same as Fields.\n"
+"\n"    
+"    Returns\n"
+"    -------\n"
+"    Fields : tuple of 3 numpy.ndarray\n"
+"        Contact, Dipolar and Lorentz fields (n_conf x n_mu x 3, Tesla).\n";
+
+static char py_lfclib_cr_docstring[] = "Response matrices of the local fields at many muon sites.\n"
+"\n"
+"    Parameters\n"
+"    ----------\n"
+"    positions, K:\n"
+"        same as Fields.\n"
+"    Muons : numpy.ndarray\n"
+"        Muon positions in fractional coordinates, n_mu x 3.\n"
+"    Supercell, Cell, r, nnn, rcont:\n"
+"        same as Fields.\n"
+"\n"    
+"    Returns\n"
+"    -------\n"
+"    Response : numpy.ndarray\n"
+"        n_mu x 9 x 6 n_atoms. Rows 0-2: contact field (for ACont = 1), 3-5\n"
+"        dipolar field, 6-8 Lorentz field (Tesla). Column 6a+j multiplies the\n"
+"        component j of P_a (j < 3) or Q_a (j >= 3), where\n"
+"        P = cos(2 pi phi) Re(FC) + sin(2 pi phi) Im(FC) and\n"
+"        Q = cos(2 pi phi) Im(FC) - sin(2 pi phi) Re(FC).\n";
+
+static char py_lfclib_fit_docstring[] = "Levenberg-Marquardt fit of the moments to precession frequencies.\n"
+"\n"
+"    The moments (P and Q of each atom, see ConfigResponse) are\n"
+"    offset + basis . params and the residuals are\n"
+"    (gamma_mu |B| / 2 pi - frequencies) / sigma.\n"
+"\n"
+"    Parameters\n"
+"    ----------\n"
+"    response : numpy.ndarray\n"
+"        Response matrices returned by ConfigResponse.\n"
+"    basis : numpy.ndarray\n"
+"        6 n_atoms x n_params.\n"
+"    frequencies : numpy.ndarray\n"
+"        Measured frequency (MHz) at each muon site.\n"
+"    params : numpy.ndarray\n"
+"        Initial values of the parameters.\n"
+"    offset : numpy.ndarray, optional\n"
+"        Fixed part of the moments, 6 n_atoms. Default: zero.\n"
+"    sigma : numpy.ndarray, optional\n"
+"        Uncertainties of the frequencies (MHz). Default: 1.\n"
+"    ACont : float, optional\n"
+"        Contact hyperfine coupling (initial value if fitted). Default: 0.\n"
+"    fit_acont : int, optional\n"
+"        If non zero ACont is fitted. Default: 0.\n"
+"    maxiter : int, optional\n"
+"        Maximum number of iterations. Default: 200.\n"
+"    tol : float, optional\n"
+"        Relative decrease of chi^2 below which the fit stops. Default: 1e-12.\n"
+"\n"    
+"    Returns\n"
+"    -------\n"
+"    Fit : tuple\n"
+"        Best fit parameters, ACont, chi^2 and number of iterations.\n";
+
+
+/* Converts the precision keyword into the flags used by the C library. */
+static int parse_precision(const char *precision, unsigned int *flags) {
+  if (precision == NULL || strcmp(precision, "double")==0 || strcmp(precision, "d")==0) {
+    return 0;
+  } else if (strcmp(precision, "mixed")==0 || strcmp(precision, "m")==0) {
+    *flags |= LFC_MIXED_PRECISION;
+    return 0;
+  }
+  PyErr_Format(PyExc_ValueError,
+                 "Valid precisions are 'double' and 'mixed'.  Unknown value %s", precision);
+  return -1;
+}
+
+/* Converts the components keyword into the mask used by FusedSum. */
+static int parse_components(const char *components, unsigned int *mask) {
+  const char *c;
+
+  if (components == NULL) {
+    *mask = LFC_CONTACT | LFC_DIPOLAR | LFC_LORENTZ | LFC_TENSOR;
+    return 0;
+  }
+  *mask = 0;
+  for (c = components; *c; c++) {
+    switch (*c) {
+      case 'c': *mask |= LFC_CONTACT; break;
+      case 'd': *mask |= LFC_DIPOLAR; break;
+      case 'l': *mask |= LFC_LORENTZ; break;
+      case 't': *mask |= LFC_TENSOR; break;
+      case 's': *mask |= LFC_SUBLATTICE; break;
+      default:
+        PyErr_Format(PyExc_ValueError,
+                       "Valid components are 'c', 'd', 'l', 't' and 's'.  Unknown value %c", *c);
+        return -1;
+    }
+  }
+  return 0;
+}
+
+/* Converts the site symmetry keywords into arrays of rotations and time
+ * reversals. Both are set to NULL when ositeops is not given. */
+static int parse_siteops(PyObject *ositeops, PyObject *ositetr,
+                         PyArrayObject **siteops, PyArrayObject **sitetr,
+                         unsigned int *nops) {
+  npy_intp * sShape;
+
+  *siteops = NULL;
+  *sitetr = NULL;
+  *nops = 0;
+  if (ositeops == NULL || ositeops == Py_None) {
+    return 0;
+  }
+
+  *siteops = (PyArrayObject *) PyArray_FROMANY(ositeops, NPY_DOUBLE, 3, 3,
+                                               NPY_ARRAY_IN_ARRAY);
+  if (!*siteops) {
+    return -1;
+  }
+  sShape = PyArray_SHAPE(*siteops);
+  if (sShape[1] != 3 || sShape[2] != 3) {
+    Py_DECREF(*siteops);
+    *siteops = NULL;
+    PyErr_SetString(PyExc_ValueError, "siteops must be a n x 3 x 3 array.");
+    return -1;
+  }
+  *nops = (unsigned int) sShape[0];
+
+  if (ositetr != NULL && ositetr != Py_None) {
+    *sitetr = (PyArrayObject *) PyArray_FROMANY(ositetr, NPY_INT, 1, 1,
+                                                NPY_ARRAY_IN_ARRAY);
+    if (!*sitetr || PyArray_SHAPE(*sitetr)[0] != sShape[0]) {
+      Py_DECREF(*siteops);
+      Py_XDECREF(*sitetr);
+      *siteops = NULL;
+      *sitetr = NULL;
+      if (!PyErr_Occurred())
+        PyErr_SetString(PyExc_ValueError, "sitetr must have one entry for each of the siteops.");
+      return -1;
+    }
+  }
+
+  if (!wedge_check((double *) PyArray_DATA(*siteops),
+                   *sitetr ? (int *) PyArray_DATA(*sitetr) : NULL, *nops)) {
+    Py_DECREF(*siteops);
+    Py_XDECREF(*sitetr);
+    *siteops = NULL;
+    *sitetr = NULL;
+    PyErr_SetString(PyExc_ValueError, "siteops do not form a group of orthogonal matrices.");
+    return -1;
+  }
+  return 0;
+}
 
-static PyObject * py_lfclib_fields(PyObject *self, PyObject *args) {
+static PyObject * py_lfclib_fields(PyObject *self, PyObject *args, PyObject *kwargs) {
   /* input variables */
   char* calc_type = NULL;
+  char* precision = NULL;
+  int reproducible = 0;
+  unsigned int flags = 0;
   unsigned int nnn=0;
   unsigned int nangles=0;
   
@@ -112,8 +748,11 @@ static PyObject * py_lfclib_fields(PyObject *self, PyObject *args) {
   PyObject *opositions, *oFC, *oK, *oPhi;
   PyObject *omu, *osupercell, *ocell;
   PyObject *orot_axis = NULL;
+  PyObject *ositeops = NULL, *ositetr = NULL;
   
   PyArrayObject *positions, *FC, *K, *Phi;
+  PyArrayObject *siteops = NULL, *sitetr = NULL;
+  unsigned int nops = 0;
   PyArrayObject *mu, *supercell, *cell;
   PyArrayObject *rot_axis = NULL;
 
@@ -149,12 +788,34 @@ static PyObject * py_lfclib_fields(PyObject *self, PyObject *args) {
   int nd = 1;
   npy_cdouble v;
 
+  static char *kwlist[] = {"calc_type", "positions", "FC", "K", "Phi",
+                           "Muon", "Supercell", "Cell", "r", "nnn", "rcont",
+                           "nangles", "rot_axis", "precision", "reproducible",
+                           "siteops", "sitetr", NULL};
+
   /* put arguments into variables */
-  if (!PyArg_ParseTuple(args, "sOOOOOOOdId|IO", &calc_type, 
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "sOOOOOOOdId|IOsiOO", kwlist,
+                                        &calc_type, 
                                         &opositions, &oFC, &oK, &oPhi,
                                         &omu, &osupercell, &ocell,
                                         &r,&nnn,&rcont,
-                                        &nangles,&orot_axis)) {
+                                        &nangles,&orot_axis,&precision,
+                                        &reproducible,&ositeops,&ositetr)) {
+    return NULL;
+  }
+
+  if (parse_precision(precision, &flags) < 0) {
+    return NULL;
+  }
+  if (reproducible) {
+    flags |= LFC_REPRODUCIBLE;
+  }
+  if (ositeops != NULL && ositeops != Py_None &&
+      !(strcmp(calc_type, "s")==0 || strcmp(calc_type, "sum")==0)) {
+    PyErr_SetString(PyExc_ValueError, "siteops can only be used with calc_type 's'.");
+    return NULL;
+  }
+  if (parse_siteops(ositeops, ositetr, &siteops, &sitetr, &nops) < 0) {
     return NULL;
   }
   
@@ -184,6 +845,8 @@ static PyObject * py_lfclib_fields(PyObject *self, PyObject *args) {
     Py_XDECREF(mu);
     Py_XDECREF(supercell);
     Py_XDECREF(cell);
+    Py_XDECREF(siteops);
+    Py_XDECREF(sitetr);
     PyErr_Format(PyExc_RuntimeError,
                     "Error parsing numpy arrays.");                 
     return NULL;
@@ -209,6 +872,8 @@ static PyObject * py_lfclib_fields(PyObject *self, PyObject *args) {
     Py_DECREF(mu);
     Py_DECREF(supercell);
     Py_DECREF(cell);    
+    Py_XDECREF(siteops);
+    Py_XDECREF(sitetr);
     PyErr_Format(PyExc_ValueError,
                    "Valid calculations are 's', 'r', 'i'.  Unknown value %s", calc_type);
     return NULL;
@@ -224,6 +889,8 @@ static PyObject * py_lfclib_fields(PyObject *self, PyObject *args) {
         Py_DECREF(mu);
         Py_DECREF(supercell);
         Py_DECREF(cell);          
+        Py_XDECREF(siteops);
+        Py_XDECREF(sitetr);
         PyErr_Format(PyExc_ValueError,
                         "Number of angles required!");
         return NULL;  
@@ -241,6 +908,8 @@ static PyObject * py_lfclib_fields(PyObject *self, PyObject *args) {
       Py_DECREF(mu);
       Py_DECREF(supercell);
       Py_DECREF(cell);          
+      Py_XDECREF(siteops);
+      Py_XDECREF(sitetr);
       PyErr_Format(PyExc_ValueError,
                     "Axis for rotation required!");
       return NULL;        
@@ -280,6 +949,8 @@ static PyObject * py_lfclib_fields(PyObject *self, PyObject *args) {
       Py_DECREF(mu);
       Py_DECREF(supercell);
       Py_DECREF(cell);          
+      Py_XDECREF(siteops);
+      Py_XDECREF(sitetr);
       PyErr_Format(PyExc_ValueError,
                     "Axis for rotation required but not parsed!");
       return NULL;        
@@ -305,6 +976,8 @@ static PyObject * py_lfclib_fields(PyObject *self, PyObject *args) {
     Py_DECREF(mu);
     Py_DECREF(supercell);
     Py_DECREF(cell);       
+    Py_XDECREF(siteops);
+    Py_XDECREF(sitetr);
     Py_XDECREF(rot_axis);   /* Null in case it is optional */
 	
     PyErr_SetString(PyExc_RuntimeError, "positions and FC arrays must have "
@@ -320,6 +993,8 @@ static PyObject * py_lfclib_fields(PyObject *self, PyObject *args) {
     Py_DECREF(mu);
     Py_DECREF(supercell);
     Py_DECREF(cell);       
+    Py_XDECREF(siteops);
+    Py_XDECREF(sitetr);
     Py_XDECREF(rot_axis);   /* Null in case it is optional */
 	
 	PyErr_SetString(PyExc_RuntimeError, "positions and Phi arrays must have "
@@ -350,6 +1025,8 @@ static PyObject * py_lfclib_fields(PyObject *self, PyObject *args) {
     Py_DECREF(mu);
     Py_DECREF(supercell);
     Py_DECREF(cell);       
+    Py_XDECREF(siteops);
+    Py_XDECREF(sitetr);
     Py_XDECREF(rot_axis);   /* Null in case it is optional */
     if (in_positions != NULL){
         free(in_positions);
@@ -436,6 +1113,36 @@ static PyObject * py_lfclib_fields(PyObject *self, PyObject *args) {
   
   
 
+  /* the wedge is only valid for symmetric summation domains */
+  if (siteops != NULL &&
+      (!wedge_sphere_check(in_muonpos, in_supercell, in_cell, r) ||
+       !wedge_structure_check((double *) PyArray_DATA(siteops),
+                              sitetr ? (int *) PyArray_DATA(sitetr) : NULL, nops,
+                              in_positions, in_fc, in_K, in_phi, in_muonpos,
+                              in_supercell, in_cell, num_atoms))) {
+    PyErr_SetString(PyExc_ValueError,
+                    wedge_sphere_check(in_muonpos, in_supercell, in_cell, r) ?
+                    "siteops are not symmetries of the magnetic structure." :
+                    "The supercell does not contain the Lorentz sphere, siteops cannot be used.");
+    free(in_positions);
+    free(in_fc);
+    free(in_K);
+    free(in_phi);
+    free(in_muonpos);
+    free(in_supercell);
+    free(in_cell);
+    Py_DECREF(positions);
+    Py_DECREF(FC);
+    Py_DECREF(K);
+    Py_DECREF(Phi);
+    Py_DECREF(mu);
+    Py_DECREF(supercell);
+    Py_DECREF(cell);
+    Py_XDECREF(siteops);
+    Py_XDECREF(sitetr);
+    return NULL;
+  }
+
   /* allocate output arrays */
   nd = 1;
   if (icalc_type >= 2) {
@@ -478,6 +1185,8 @@ static PyObject * py_lfclib_fields(PyObject *self, PyObject *args) {
       free(in_cell);          
     if (in_axis != NULL)
       free(in_axis);          
+    Py_XDECREF(siteops);
+    Py_XDECREF(sitetr);
     PyErr_SetString(PyExc_MemoryError, "Cannot create output arrays.");
     return NULL;
   }
@@ -492,16 +1201,19 @@ static PyObject * py_lfclib_fields(PyObject *self, PyObject *args) {
   switch (icalc_type)
   {
     case 1:
-      SimpleSum(in_positions, in_fc, in_K, in_phi, in_muonpos, in_supercell, 
-        in_cell,r, nnn,rcont,num_atoms,cont,dip,lor);
+      SimpleSumEx(in_positions, in_fc, in_K, in_phi, in_muonpos, in_supercell, 
+        in_cell,r, nnn,rcont,num_atoms,
+        siteops ? (double *) PyArray_DATA(siteops) : NULL,
+        sitetr ? (int *) PyArray_DATA(sitetr) : NULL, nops,
+        flags,cont,dip,lor);
       break;
     case 2:
-      RotataSum(in_positions, in_fc, in_K, in_phi, in_muonpos, in_supercell, 
-        in_cell,r, nnn,rcont,num_atoms,in_axis,nangles,cont,dip,lor);
+      RotataSumEx(in_positions, in_fc, in_K, in_phi, in_muonpos, in_supercell, 
+        in_cell,r, nnn,rcont,num_atoms,in_axis,nangles,flags,cont,dip,lor);
       break;
     case 3:
-      FastIncommSum(in_positions, in_fc, in_K, in_phi, in_muonpos, in_supercell, 
-        in_cell,r, nnn,rcont,num_atoms,nangles,cont,dip,lor);
+      FastIncommSumEx(in_positions, in_fc, in_K, in_phi, in_muonpos, in_supercell, 
+        in_cell,r, nnn,rcont,num_atoms,nangles,flags,cont,dip,lor);
     
   }
   Py_END_ALLOW_THREADS
@@ -532,117 +1244,2734 @@ static PyObject * py_lfclib_fields(PyObject *self, PyObject *args) {
   Py_DECREF(supercell);
   Py_DECREF(cell);
   Py_XDECREF(rot_axis);   /* Null in case it is optional */
+  Py_XDECREF(siteops);
+  Py_XDECREF(sitetr);
 
   return Py_BuildValue("NNN", ocont, odip, olor);
 }
 
 
-static PyObject * py_lfclib_dt(PyObject *self, PyObject *args) {
-  
-  double r=0.0;
-  PyObject *opositions, *omu, *osupercell, *ocell;
-  PyArrayObject *positions,  *mu, *supercell, *cell, *odt;
-  
+static PyObject * py_lfclib_ad(PyObject *self, PyObject *args, PyObject *kwargs) {
+
+  double rmax=0.0, rcont=0.0, atol=1e-4, rtol=0.0, radius=0.0, error=0.0;
+  unsigned int nnn=0;
+  int converged=0;
+  PyObject *opositions, *oFC, *oK, *oPhi, *omu, *ocell, *oorigin = NULL;
+  PyArrayObject *positions, *FC, *K, *Phi, *mu, *cell, *origin = NULL;
+  PyArrayObject *ocont = NULL, *odip = NULL, *olor = NULL;
+
   int num_atoms=0;
-  int * in_supercell;
-  npy_intp * pShape, * out_dim;
-  int nd = 2;
+  npy_intp out_dim[1] = {3};
 
+  static char *kwlist[] = {"positions", "FC", "K", "Phi", "Muon", "Cell",
+                           "rmax", "nnn", "rcont", "atol", "rtol", "origin", NULL};
 
-  /* put arguments into variables */ 
-  if (!PyArg_ParseTuple(args, "OOOOd", 
-                            &opositions, &omu, &osupercell, &ocell,&r))
+  /* put arguments into variables */
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOOOOdId|ddO", kwlist,
+                            &opositions, &oFC, &oK, &oPhi, &omu, &ocell,
+                            &rmax, &nnn, &rcont, &atol, &rtol, &oorigin))
   {
     return NULL;
   }
-  
+
+  if (oorigin != NULL && oorigin != Py_None) {
+    origin = (PyArrayObject *) PyArray_FROMANY(oorigin, NPY_INT32, 1, 1,
+                                               NPY_ARRAY_IN_ARRAY);
+    if (!origin)
+      return NULL;
+    if (PyArray_SIZE(origin) != 3) {
+      Py_DECREF(origin);
+      PyErr_SetString(PyExc_ValueError, "origin must have 3 elements.");
+      return NULL;
+    }
+  }
+
   /* turn inputs into numpy array types */
   positions = (PyArrayObject *) PyArray_FROMANY(opositions, NPY_DOUBLE, 2, 2,
                                               NPY_ARRAY_IN_ARRAY);
+  FC = (PyArrayObject *) PyArray_FROMANY(oFC, NPY_COMPLEX128, 2, 2,
+                                              NPY_ARRAY_IN_ARRAY);
+  K = (PyArrayObject *) PyArray_FROMANY(oK, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+  Phi = (PyArrayObject *) PyArray_FROMANY(oPhi, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
   mu = (PyArrayObject *) PyArray_FROMANY(omu, NPY_DOUBLE, 1, 1,
                                               NPY_ARRAY_IN_ARRAY);
-                                              
-  supercell = (PyArrayObject *) PyArray_FROMANY(osupercell, NPY_INT32,
-                                                   1, 1, NPY_ARRAY_IN_ARRAY);
   cell = (PyArrayObject *) PyArray_FROMANY(ocell, NPY_DOUBLE, 2, 2,
                                              NPY_ARRAY_IN_ARRAY);
-  
+
   /* Validate data */
-  if ( !positions || !mu || !supercell || !cell) {
+  if (!positions || !FC || !K || !Phi || !mu || !cell) {
     Py_XDECREF(positions);
+    Py_XDECREF(FC);
+    Py_XDECREF(K);
+    Py_XDECREF(Phi);
     Py_XDECREF(mu);
-    Py_XDECREF(supercell);
     Py_XDECREF(cell);
+    Py_XDECREF(origin);
     PyErr_Format(PyExc_RuntimeError,
-                    "Error parsing numpy arrays.");                 
+                    "Error parsing numpy arrays.");
     return NULL;
   }
 
-  /* General validity checks */
-  
-  pShape = PyArray_SHAPE(positions);
+  num_atoms = PyArray_SHAPE(positions)[0];
 
-  num_atoms = pShape[0];
+  if (PyArray_SHAPE(positions)[1] != 3 || PyArray_SHAPE(FC)[0] != num_atoms ||
+      PyArray_SHAPE(FC)[1] != 3 || PyArray_SIZE(K) != 3 ||
+      PyArray_SIZE(Phi) != num_atoms || PyArray_SIZE(mu) != 3 ||
+      PyArray_SIZE(cell) != 9) {
+    Py_DECREF(positions);
+    Py_DECREF(FC);
+    Py_DECREF(K);
+    Py_DECREF(Phi);
+    Py_DECREF(mu);
+    Py_DECREF(cell);
+    Py_XDECREF(origin);
+    PyErr_SetString(PyExc_RuntimeError, "Inconsistent shapes of the input arrays.");
+    return NULL;
+  }
+  if (nnn > 200) {
+    Py_DECREF(positions);
+    Py_DECREF(FC);
+    Py_DECREF(K);
+    Py_DECREF(Phi);
+    Py_DECREF(mu);
+    Py_DECREF(cell);
+    Py_XDECREF(origin);
+    PyErr_Format(PyExc_RuntimeError,
+                    "Error, number of nearest neighbours exceedingly large.");
+    return NULL;
+  }
+  if (!(rmax > 0.0) || atol < 0.0 || rtol < 0.0) {
+    Py_DECREF(positions);
+    Py_DECREF(FC);
+    Py_DECREF(K);
+    Py_DECREF(Phi);
+    Py_DECREF(mu);
+    Py_DECREF(cell);
+    Py_XDECREF(origin);
+    PyErr_SetString(PyExc_ValueError, "rmax must be positive and the tolerances non negative.");
+    return NULL;
+  }
+
+  /* allocate output arrays */
+  ocont = (PyArrayObject *) PyArray_ZEROS(1, out_dim, NPY_DOUBLE,0);
+  odip = (PyArrayObject *) PyArray_ZEROS(1, out_dim, NPY_DOUBLE,0);
+  olor = (PyArrayObject *) PyArray_ZEROS(1, out_dim, NPY_DOUBLE,0);
+
+  if (!ocont || !odip || !olor) {
+    Py_XDECREF(ocont);
+    Py_XDECREF(odip);
+    Py_XDECREF(olor);
+    Py_DECREF(positions);
+    Py_DECREF(FC);
+    Py_DECREF(K);
+    Py_DECREF(Phi);
+    Py_DECREF(mu);
+    Py_DECREF(cell);
+    Py_XDECREF(origin);
+    PyErr_SetString(PyExc_MemoryError, "Cannot create output arrays.");
+    return NULL;
+  }
+
+  /* long computation starts here. No python object is touched so free thread execution */
+  Py_BEGIN_ALLOW_THREADS
+  converged = AdaptiveSum( (double *) PyArray_DATA(positions),
+      (double *) PyArray_DATA(FC),
+      (double *) PyArray_DATA(K),
+      (double *) PyArray_DATA(Phi),
+      (double *) PyArray_DATA(mu),
+      (origin != NULL ? (int *) PyArray_DATA(origin) : NULL),
+      (double *) PyArray_DATA(cell),
+      rmax, atol, rtol, nnn, rcont, num_atoms,
+      (double *) PyArray_DATA(ocont),
+      (double *) PyArray_DATA(odip),
+      (double *) PyArray_DATA(olor),
+      &radius, &error);
+  Py_END_ALLOW_THREADS
+
+  Py_DECREF(positions);
+  Py_DECREF(FC);
+  Py_DECREF(K);
+  Py_DECREF(Phi);
+  Py_DECREF(mu);
+  Py_DECREF(cell);
+  Py_XDECREF(origin);
+
+  return Py_BuildValue("NNNddi", ocont, odip, olor, radius, error, converged);
+}
+
+static PyObject * py_lfclib_hy(PyObject *self, PyObject *args, PyObject *kwargs) {
+
+  double r=0.0, rnear=0.0, rcont=0.0, error=0.0;
+  unsigned int nnn=0;
+  PyObject *opositions, *oFC, *oK, *oPhi, *omu, *ocell, *oorigin = NULL;
+  PyArrayObject *positions, *FC, *K, *Phi, *mu, *cell, *origin = NULL;
+  PyArrayObject *ocont = NULL, *odip = NULL, *olor = NULL;
+
+  int num_atoms=0;
+  npy_intp out_dim[1] = {3};
+
+  static char *kwlist[] = {"positions", "FC", "K", "Phi", "Muon", "Cell",
+                           "r", "rnear", "nnn", "rcont", "origin", NULL};
+
+  /* put arguments into variables */
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOOOOddId|O", kwlist,
+                            &opositions, &oFC, &oK, &oPhi, &omu, &ocell,
+                            &r, &rnear, &nnn, &rcont, &oorigin))
+  {
+    return NULL;
+  }
+
+  if (oorigin != NULL && oorigin != Py_None) {
+    origin = (PyArrayObject *) PyArray_FROMANY(oorigin, NPY_INT32, 1, 1,
+                                               NPY_ARRAY_IN_ARRAY);
+    if (!origin)
+      return NULL;
+    if (PyArray_SIZE(origin) != 3) {
+      Py_DECREF(origin);
+      PyErr_SetString(PyExc_ValueError, "origin must have 3 elements.");
+      return NULL;
+    }
+  }
+
+  /* turn inputs into numpy array types */
+  positions = (PyArrayObject *) PyArray_FROMANY(opositions, NPY_DOUBLE, 2, 2,
+                                              NPY_ARRAY_IN_ARRAY);
+  FC = (PyArrayObject *) PyArray_FROMANY(oFC, NPY_COMPLEX128, 2, 2,
+                                              NPY_ARRAY_IN_ARRAY);
+  K = (PyArrayObject *) PyArray_FROMANY(oK, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+  Phi = (PyArrayObject *) PyArray_FROMANY(oPhi, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+  mu = (PyArrayObject *) PyArray_FROMANY(omu, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+  cell = (PyArrayObject *) PyArray_FROMANY(ocell, NPY_DOUBLE, 2, 2,
+                                             NPY_ARRAY_IN_ARRAY);
+
+  /* Validate data */
+  if (!positions || !FC || !K || !Phi || !mu || !cell) {
+    Py_XDECREF(positions);
+    Py_XDECREF(FC);
+    Py_XDECREF(K);
+    Py_XDECREF(Phi);
+    Py_XDECREF(mu);
+    Py_XDECREF(cell);
+    Py_XDECREF(origin);
+    PyErr_Format(PyExc_RuntimeError,
+                    "Error parsing numpy arrays.");
+    return NULL;
+  }
+
+  num_atoms = PyArray_SHAPE(positions)[0];
+
+  if (PyArray_SHAPE(positions)[1] != 3 || PyArray_SHAPE(FC)[0] != num_atoms ||
+      PyArray_SHAPE(FC)[1] != 3 || PyArray_SIZE(K) != 3 ||
+      PyArray_SIZE(Phi) != num_atoms || PyArray_SIZE(mu) != 3 ||
+      PyArray_SIZE(cell) != 9) {
+    Py_DECREF(positions);
+    Py_DECREF(FC);
+    Py_DECREF(K);
+    Py_DECREF(Phi);
+    Py_DECREF(mu);
+    Py_DECREF(cell);
+    Py_XDECREF(origin);
+    PyErr_SetString(PyExc_RuntimeError, "Inconsistent shapes of the input arrays.");
+    return NULL;
+  }
+  if (nnn > 200) {
+    Py_DECREF(positions);
+    Py_DECREF(FC);
+    Py_DECREF(K);
+    Py_DECREF(Phi);
+    Py_DECREF(mu);
+    Py_DECREF(cell);
+    Py_XDECREF(origin);
+    PyErr_Format(PyExc_RuntimeError,
+                    "Error, number of nearest neighbours exceedingly large.");
+    return NULL;
+  }
+  if (!(rnear > 0.0) || rnear > r) {
+    Py_DECREF(positions);
+    Py_DECREF(FC);
+    Py_DECREF(K);
+    Py_DECREF(Phi);
+    Py_DECREF(mu);
+    Py_DECREF(cell);
+    Py_XDECREF(origin);
+    PyErr_SetString(PyExc_ValueError, "rnear must be positive and not larger than r.");
+    return NULL;
+  }
+
+  /* allocate output arrays */
+  ocont = (PyArrayObject *) PyArray_ZEROS(1, out_dim, NPY_DOUBLE,0);
+  odip = (PyArrayObject *) PyArray_ZEROS(1, out_dim, NPY_DOUBLE,0);
+  olor = (PyArrayObject *) PyArray_ZEROS(1, out_dim, NPY_DOUBLE,0);
+
+  if (!ocont || !odip || !olor) {
+    Py_XDECREF(ocont);
+    Py_XDECREF(odip);
+    Py_XDECREF(olor);
+    Py_DECREF(positions);
+    Py_DECREF(FC);
+    Py_DECREF(K);
+    Py_DECREF(Phi);
+    Py_DECREF(mu);
+    Py_DECREF(cell);
+    Py_XDECREF(origin);
+    PyErr_SetString(PyExc_MemoryError, "Cannot create output arrays.");
+    return NULL;
+  }
+
+  /* long computation starts here. No python object is touched so free thread execution */
+  Py_BEGIN_ALLOW_THREADS
+  HybridSum( (double *) PyArray_DATA(positions),
+      (double *) PyArray_DATA(FC),
+      (double *) PyArray_DATA(K),
+      (double *) PyArray_DATA(Phi),
+      (double *) PyArray_DATA(mu),
+      (origin != NULL ? (int *) PyArray_DATA(origin) : NULL),
+      (double *) PyArray_DATA(cell),
+      r, rnear, nnn, rcont, num_atoms,
+      (double *) PyArray_DATA(ocont),
+      (double *) PyArray_DATA(odip),
+      (double *) PyArray_DATA(olor),
+      &error);
+  Py_END_ALLOW_THREADS
+
+  Py_DECREF(positions);
+  Py_DECREF(FC);
+  Py_DECREF(K);
+  Py_DECREF(Phi);
+  Py_DECREF(mu);
+  Py_DECREF(cell);
+  Py_XDECREF(origin);
+
+  return Py_BuildValue("NNNd", ocont, odip, olor, error);
+}
+
+static PyObject * py_lfclib_gm(PyObject *self, PyObject *args, PyObject *kwargs) {
+
+  double dmin=0.0;
+  PyObject *oatoms, *ocell, *ogrid;
+  PyArrayObject *atoms, *cell, *grid;
+  PyArrayObject *omask = NULL;
+  npy_intp mask_dim[3];
+  int num_atoms=0;
+  unsigned int x;
+
+  static char *kwlist[] = {"atoms", "Cell", "grid", "dmin", NULL};
+
+  /* put arguments into variables */
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOd", kwlist,
+                            &oatoms, &ocell, &ogrid, &dmin))
+  {
+    return NULL;
+  }
+
+  /* turn inputs into numpy array types */
+  atoms = (PyArrayObject *) PyArray_FROMANY(oatoms, NPY_DOUBLE, 2, 2,
+                                              NPY_ARRAY_IN_ARRAY);
+  cell = (PyArrayObject *) PyArray_FROMANY(ocell, NPY_DOUBLE, 2, 2,
+                                             NPY_ARRAY_IN_ARRAY);
+  grid = (PyArrayObject *) PyArray_FROMANY(ogrid, NPY_INT32, 1, 1,
+                                             NPY_ARRAY_IN_ARRAY);
+
+  /* Validate data */
+  if (!atoms || !cell || !grid) {
+    Py_XDECREF(atoms);
+    Py_XDECREF(cell);
+    Py_XDECREF(grid);
+    PyErr_Format(PyExc_RuntimeError,
+                    "Error parsing numpy arrays.");
+    return NULL;
+  }
+
+  num_atoms = PyArray_SHAPE(atoms)[0];
+
+  if (PyArray_SHAPE(atoms)[1] != 3 || PyArray_SIZE(cell) != 9 ||
+      PyArray_SIZE(grid) != 3) {
+    Py_DECREF(atoms);
+    Py_DECREF(cell);
+    Py_DECREF(grid);
+    PyErr_SetString(PyExc_RuntimeError, "Inconsistent shapes of the input arrays.");
+    return NULL;
+  }
+  for (x = 0; x < 3; x++)
+    mask_dim[x] = ((int *) PyArray_DATA(grid))[x];
+  if (mask_dim[0] <= 0 || mask_dim[1] <= 0 || mask_dim[2] <= 0 || dmin < 0.0) {
+    Py_DECREF(atoms);
+    Py_DECREF(cell);
+    Py_DECREF(grid);
+    PyErr_SetString(PyExc_ValueError, "The grid must be positive and the minimum distance non negative.");
+    return NULL;
+  }
+
+  /* allocate output arrays */
+  omask = (PyArrayObject *) PyArray_ZEROS(3, mask_dim, NPY_BOOL, 0);
+  if (!omask) {
+    Py_DECREF(atoms);
+    Py_DECREF(cell);
+    Py_DECREF(grid);
+    PyErr_SetString(PyExc_MemoryError, "Cannot create output arrays.");
+    return NULL;
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+  GridMask( (double *) PyArray_DATA(atoms), num_atoms,
+      (double *) PyArray_DATA(cell),
+      (int *) PyArray_DATA(grid), dmin,
+      (char *) PyArray_DATA(omask));
+  Py_END_ALLOW_THREADS
+
+  Py_DECREF(atoms);
+  Py_DECREF(cell);
+  Py_DECREF(grid);
+
+  return (PyObject *) omask;
+}
+
+static PyObject * py_lfclib_gs(PyObject *self, PyObject *args, PyObject *kwargs) {
+
+  double r=0.0, rcont=0.0;
+  unsigned int nnn=0;
+  int tensor=0;
+  PyObject *opositions, *oFC, *oK, *oPhi, *opoints, *ocell, *oorigin = NULL;
+  PyArrayObject *positions, *FC, *K, *Phi, *points, *cell, *origin = NULL;
+  PyArrayObject *ocont = NULL, *odip = NULL, *olor = NULL, *otensor = NULL;
+
+  int num_atoms=0;
+  npy_intp num_points=0;
+  npy_intp vec_dim[2];
+  npy_intp mat_dim[3];
+
+  static char *kwlist[] = {"positions", "FC", "K", "Phi", "Points", "Cell",
+                           "r", "nnn", "rcont", "origin", "tensor", NULL};
+
+  /* put arguments into variables */
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOOOOdId|Oi", kwlist,
+                            &opositions, &oFC, &oK, &oPhi, &opoints, &ocell,
+                            &r, &nnn, &rcont, &oorigin, &tensor))
+  {
+    return NULL;
+  }
+
+  if (oorigin != NULL && oorigin != Py_None) {
+    origin = (PyArrayObject *) PyArray_FROMANY(oorigin, NPY_INT32, 1, 1,
+                                               NPY_ARRAY_IN_ARRAY);
+    if (!origin)
+      return NULL;
+    if (PyArray_SIZE(origin) != 3) {
+      Py_DECREF(origin);
+      PyErr_SetString(PyExc_ValueError, "origin must have 3 elements.");
+      return NULL;
+    }
+  }
+
+  /* turn inputs into numpy array types */
+  positions = (PyArrayObject *) PyArray_FROMANY(opositions, NPY_DOUBLE, 2, 2,
+                                              NPY_ARRAY_IN_ARRAY);
+  FC = (PyArrayObject *) PyArray_FROMANY(oFC, NPY_COMPLEX128, 2, 2,
+                                              NPY_ARRAY_IN_ARRAY);
+  K = (PyArrayObject *) PyArray_FROMANY(oK, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+  Phi = (PyArrayObject *) PyArray_FROMANY(oPhi, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+  points = (PyArrayObject *) PyArray_FROMANY(opoints, NPY_DOUBLE, 2, 2,
+                                              NPY_ARRAY_IN_ARRAY);
+  cell = (PyArrayObject *) PyArray_FROMANY(ocell, NPY_DOUBLE, 2, 2,
+                                             NPY_ARRAY_IN_ARRAY);
+
+  /* Validate data */
+  if (!positions || !FC || !K || !Phi || !points || !cell) {
+    Py_XDECREF(positions);
+    Py_XDECREF(FC);
+    Py_XDECREF(K);
+    Py_XDECREF(Phi);
+    Py_XDECREF(points);
+    Py_XDECREF(cell);
+    Py_XDECREF(origin);
+    PyErr_Format(PyExc_RuntimeError,
+                    "Error parsing numpy arrays.");
+    return NULL;
+  }
+
+  num_atoms = PyArray_SHAPE(positions)[0];
+  num_points = PyArray_SHAPE(points)[0];
+
+  if (PyArray_SHAPE(positions)[1] != 3 || PyArray_SHAPE(FC)[0] != num_atoms ||
+      PyArray_SHAPE(FC)[1] != 3 || PyArray_SIZE(K) != 3 ||
+      PyArray_SIZE(Phi) != num_atoms || PyArray_SHAPE(points)[1] != 3 ||
+      PyArray_SIZE(cell) != 9) {
+    Py_DECREF(positions);
+    Py_DECREF(FC);
+    Py_DECREF(K);
+    Py_DECREF(Phi);
+    Py_DECREF(points);
+    Py_DECREF(cell);
+    Py_XDECREF(origin);
+    PyErr_SetString(PyExc_RuntimeError, "Inconsistent shapes of the input arrays.");
+    return NULL;
+  }
+  if (nnn > 200) {
+    Py_DECREF(positions);
+    Py_DECREF(FC);
+    Py_DECREF(K);
+    Py_DECREF(Phi);
+    Py_DECREF(points);
+    Py_DECREF(cell);
+    Py_XDECREF(origin);
+    PyErr_Format(PyExc_RuntimeError,
+                    "Error, number of nearest neighbours exceedingly large.");
+    return NULL;
+  }
+
+  /* allocate output arrays */
+  vec_dim[0] = num_points; vec_dim[1] = 3;
+  mat_dim[0] = num_points; mat_dim[1] = 3; mat_dim[2] = 3;
+  ocont = (PyArrayObject *) PyArray_ZEROS(2, vec_dim, NPY_DOUBLE,0);
+  odip = (PyArrayObject *) PyArray_ZEROS(2, vec_dim, NPY_DOUBLE,0);
+  olor = (PyArrayObject *) PyArray_ZEROS(2, vec_dim, NPY_DOUBLE,0);
+  if (tensor)
+    otensor = (PyArrayObject *) PyArray_ZEROS(3, mat_dim, NPY_DOUBLE,0);
+
+  if (!ocont || !odip || !olor || (tensor && !otensor)) {
+    Py_XDECREF(ocont);
+    Py_XDECREF(odip);
+    Py_XDECREF(olor);
+    Py_XDECREF(otensor);
+    Py_DECREF(positions);
+    Py_DECREF(FC);
+    Py_DECREF(K);
+    Py_DECREF(Phi);
+    Py_DECREF(points);
+    Py_DECREF(cell);
+    Py_XDECREF(origin);
+    PyErr_SetString(PyExc_MemoryError, "Cannot create output arrays.");
+    return NULL;
+  }
+
+  /* long computation starts here. No python object is touched so free thread execution */
+  Py_BEGIN_ALLOW_THREADS
+  GridScan( (double *) PyArray_DATA(positions),
+      (double *) PyArray_DATA(FC),
+      (double *) PyArray_DATA(K),
+      (double *) PyArray_DATA(Phi),
+      (double *) PyArray_DATA(points), (unsigned int) num_points,
+      (origin != NULL ? (int *) PyArray_DATA(origin) : NULL),
+      (double *) PyArray_DATA(cell),
+      r, nnn, rcont, num_atoms,
+      (double *) PyArray_DATA(ocont),
+      (double *) PyArray_DATA(odip),
+      (double *) PyArray_DATA(olor),
+      (otensor != NULL ? (double *) PyArray_DATA(otensor) : NULL));
+  Py_END_ALLOW_THREADS
+
+  Py_DECREF(positions);
+  Py_DECREF(FC);
+  Py_DECREF(K);
+  Py_DECREF(Phi);
+  Py_DECREF(points);
+  Py_DECREF(cell);
+  Py_XDECREF(origin);
+
+  return Py_BuildValue("NNNN", ocont, odip, olor,
+      otensor ? (PyObject *) otensor : (Py_INCREF(Py_None), Py_None));
+}
+
+static PyObject * py_lfclib_chs(PyObject *self, PyObject *args, PyObject *kwargs) {
+
+  double r=0.0, potential=0.0;
+  int reproducible = 0;
+  PyObject *opositions, *ocharges, *omu, *osupercell, *ocell;
+  PyArrayObject *positions, *charges, *mu, *supercell, *cell;
+  PyArrayObject *oefg = NULL;
+
+  int num_atoms=0;
+  npy_intp mat_dim[2] = {3, 3};
+
+  static char *kwlist[] = {"positions", "charges", "Muon", "Supercell", "Cell",
+                           "r", "reproducible", NULL};
+
+  /* put arguments into variables */
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOOOd|i", kwlist,
+                            &opositions, &ocharges, &omu, &osupercell,
+                            &ocell, &r, &reproducible))
+  {
+    return NULL;
+  }
+
+  /* turn inputs into numpy array types */
+  positions = (PyArrayObject *) PyArray_FROMANY(opositions, NPY_DOUBLE, 2, 2,
+                                              NPY_ARRAY_IN_ARRAY);
+  charges = (PyArrayObject *) PyArray_FROMANY(ocharges, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+  mu = (PyArrayObject *) PyArray_FROMANY(omu, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+  supercell = (PyArrayObject *) PyArray_FROMANY(osupercell, NPY_INT32,
+                                                   1, 1, NPY_ARRAY_IN_ARRAY);
+  cell = (PyArrayObject *) PyArray_FROMANY(ocell, NPY_DOUBLE, 2, 2,
+                                             NPY_ARRAY_IN_ARRAY);
+
+  /* Validate data */
+  if (!positions || !charges || !mu || !supercell || !cell) {
+    Py_XDECREF(positions);
+    Py_XDECREF(charges);
+    Py_XDECREF(mu);
+    Py_XDECREF(supercell);
+    Py_XDECREF(cell);
+    PyErr_Format(PyExc_RuntimeError,
+                    "Error parsing numpy arrays.");
+    return NULL;
+  }
+
+  num_atoms = PyArray_SHAPE(positions)[0];
+
+  if (PyArray_SHAPE(positions)[1] != 3 || PyArray_SIZE(charges) != num_atoms ||
+      PyArray_SIZE(mu) != 3 || PyArray_SIZE(supercell) != 3 ||
+      PyArray_SIZE(cell) != 9) {
+    Py_DECREF(positions);
+    Py_DECREF(charges);
+    Py_DECREF(mu);
+    Py_DECREF(supercell);
+    Py_DECREF(cell);
+    PyErr_SetString(PyExc_RuntimeError, "Inconsistent shapes of the input arrays.");
+    return NULL;
+  }
+
+  /* allocate output arrays */
+  oefg = (PyArrayObject *) PyArray_ZEROS(2, mat_dim, NPY_DOUBLE,0);
+  if (!oefg) {
+    Py_DECREF(positions);
+    Py_DECREF(charges);
+    Py_DECREF(mu);
+    Py_DECREF(supercell);
+    Py_DECREF(cell);
+    PyErr_SetString(PyExc_MemoryError, "Cannot create output arrays.");
+    return NULL;
+  }
+
+  /* long computation starts here. No python object is touched so free thread execution */
+  Py_BEGIN_ALLOW_THREADS
+  ChargeSum( (double *) PyArray_DATA(positions),
+      (double *) PyArray_DATA(charges),
+      (double *) PyArray_DATA(mu),
+      (int *) PyArray_DATA(supercell),
+      (double *) PyArray_DATA(cell),
+      r, num_atoms, reproducible ? LFC_REPRODUCIBLE : 0, &potential,
+      (double *) PyArray_DATA(oefg));
+  Py_END_ALLOW_THREADS
+
+  Py_DECREF(positions);
+  Py_DECREF(charges);
+  Py_DECREF(mu);
+  Py_DECREF(supercell);
+  Py_DECREF(cell);
+
+  return Py_BuildValue("dN", potential, oefg);
+}
+
+/* A session and the lock serializing SessionUpdate and SessionEvaluate:
+ * the evaluation runs without the GIL and must not see a half updated
+ * session. */
+typedef struct {
+  lfc_session s;
+  PyThread_type_lock lock;
+} py_lfclib_session;
+
+static void py_lfclib_session_free(PyObject *capsule) {
+  py_lfclib_session *ps = (py_lfclib_session *) PyCapsule_GetPointer(capsule, "lfclib.Session");
+  if (ps) {
+    lfc_session_free(&ps->s);
+    PyThread_free_lock(ps->lock);
+    free(ps);
+  }
+}
+
+/* Takes the lock of the session, releasing the GIL while waiting for it. */
+static void py_lfclib_session_lock(py_lfclib_session *ps) {
+  if (!PyThread_acquire_lock(ps->lock, NOWAIT_LOCK)) {
+    Py_BEGIN_ALLOW_THREADS
+    PyThread_acquire_lock(ps->lock, WAIT_LOCK);
+    Py_END_ALLOW_THREADS
+  }
+}
+
+static PyObject * py_lfclib_sn(PyObject *self, PyObject *args) {
+
+  py_lfclib_session *ps = malloc(sizeof(py_lfclib_session));
+  if (!ps) {
+    PyErr_SetString(PyExc_MemoryError, "Cannot create session.");
+    return NULL;
+  }
+  ps->lock = PyThread_allocate_lock();
+  if (!ps->lock) {
+    free(ps);
+    PyErr_SetString(PyExc_MemoryError, "Cannot create session.");
+    return NULL;
+  }
+  lfc_session_init(&ps->s);
+  return PyCapsule_New(ps, "lfclib.Session", py_lfclib_session_free);
+}
+
+/* Converts obj to a contiguous array of type, with size elements if size > 0. */
+static PyArrayObject * py_lfclib_session_array(PyObject *obj, int type, npy_intp size,
+                                               const char *name) {
+  PyArrayObject *arr = (PyArrayObject *) PyArray_FROMANY(obj, type, 1, 2,
+                                                         NPY_ARRAY_IN_ARRAY);
+  if (!arr) {
+    PyErr_Format(PyExc_RuntimeError, "Error parsing %s.", name);
+    return NULL;
+  }
+  if (size > 0 && PyArray_SIZE(arr) != size) {
+    Py_DECREF(arr);
+    PyErr_Format(PyExc_RuntimeError, "%s has the wrong size.", name);
+    return NULL;
+  }
+  return arr;
+}
+
+/* The arguments of SessionUpdate, converted and checked before they are
+ * applied to the session. NULL arrays (and zero has_* flags) are not
+ * updated. */
+typedef struct {
+  PyArrayObject *cell, *supercell, *positions, *FC, *K, *Phi, *mu;
+  int has_r, has_nnn, has_rcont;
+  double r, rcont;
+  long nnn;
+} py_lfclib_session_args;
+
+static void py_lfclib_session_args_free(py_lfclib_session_args *a) {
+  Py_XDECREF(a->cell);
+  Py_XDECREF(a->supercell);
+  Py_XDECREF(a->positions);
+  Py_XDECREF(a->FC);
+  Py_XDECREF(a->K);
+  Py_XDECREF(a->Phi);
+  Py_XDECREF(a->mu);
+}
+
+/* Converts the arguments of SessionUpdate into a, returns -1 with an
+ * exception set if any of them is invalid. The sizes of FC and Phi
+ * depend on the session and are checked by py_lfclib_session_update. */
+static int py_lfclib_session_parse(py_lfclib_session_args *a, PyObject *ocell,
+    PyObject *osupercell, PyObject *opositions, PyObject *oFC, PyObject *oK,
+    PyObject *oPhi, PyObject *omu, PyObject *or, PyObject *onnn, PyObject *orcont) {
+
+  /* cell and supercell, and FC and Phi, are always given together */
+  if (ocell || osupercell) {
+    a->cell = py_lfclib_session_array(ocell ? ocell : Py_None, NPY_DOUBLE, 9, "Cell");
+    if (!a->cell)
+      return -1;
+    a->supercell = py_lfclib_session_array(osupercell ? osupercell : Py_None, NPY_INT32, 3, "Supercell");
+    if (!a->supercell)
+      return -1;
+  }
+
+  if (opositions) {
+    a->positions = py_lfclib_session_array(opositions, NPY_DOUBLE, 0, "positions");
+    if (!a->positions)
+      return -1;
+    if (PyArray_SIZE(a->positions) % 3 != 0) {
+      PyErr_SetString(PyExc_RuntimeError, "positions has the wrong size.");
+      return -1;
+    }
+  }
+
+  if (oFC || oPhi) {
+    a->FC = py_lfclib_session_array(oFC ? oFC : Py_None, NPY_COMPLEX128, 0, "FC");
+    if (!a->FC)
+      return -1;
+    a->Phi = py_lfclib_session_array(oPhi ? oPhi : Py_None, NPY_DOUBLE, 0, "Phi");
+    if (!a->Phi)
+      return -1;
+  }
+
+  if (oK) {
+    a->K = py_lfclib_session_array(oK, NPY_DOUBLE, 3, "K");
+    if (!a->K)
+      return -1;
+  }
+
+  if (omu) {
+    a->mu = py_lfclib_session_array(omu, NPY_DOUBLE, 0, "Muons");
+    if (!a->mu)
+      return -1;
+    if (PyArray_SIZE(a->mu) % 3 != 0) {
+      PyErr_SetString(PyExc_RuntimeError, "Muons has the wrong size.");
+      return -1;
+    }
+  }
+
+  a->has_r = (or != NULL);
+  a->has_nnn = (onnn != NULL);
+  a->has_rcont = (orcont != NULL);
+  if (or)
+    a->r = PyFloat_AsDouble(or);
+  if (onnn)
+    a->nnn = PyLong_AsLong(onnn);
+  if (orcont)
+    a->rcont = PyFloat_AsDouble(orcont);
+  if (PyErr_Occurred())
+    return -1;
+  if ((a->has_r && a->r < 0) || (a->has_nnn && a->nnn < 0) ||
+      (a->has_rcont && a->rcont < 0)) {
+    PyErr_SetString(PyExc_ValueError, "r, nnn and rcont must be positive.");
+    return -1;
+  }
+  return 0;
+}
+
+/* Applies the updates of SessionUpdate to s, with the lock held. Nothing
+ * is changed if an exception is raised. */
+static PyObject * py_lfclib_session_update(lfc_session *s, const py_lfclib_session_args *a) {
+
+  unsigned int natoms = a->positions ? (unsigned int) (PyArray_SIZE(a->positions) / 3) : s->natoms;
+  int changed = 0;
+
+  if (a->FC && (PyArray_SIZE(a->FC) != (npy_intp) natoms * 3 ||
+                PyArray_SIZE(a->Phi) != (npy_intp) natoms)) {
+    PyErr_SetString(PyExc_RuntimeError,
+                    PyArray_SIZE(a->FC) != (npy_intp) natoms * 3 ?
+                    "FC has the wrong size." : "Phi has the wrong size.");
+    return NULL;
+  }
+
+  /* cell and atoms first, they fix the size of the moments */
+  if (a->cell)
+    changed |= lfc_session_set_cell(s, (double *) PyArray_DATA(a->cell),
+                                    (int *) PyArray_DATA(a->supercell));
+  if (a->positions)
+    changed |= lfc_session_set_positions(s, (double *) PyArray_DATA(a->positions), natoms);
+  if (a->FC)
+    changed |= lfc_session_set_moments(s, (double *) PyArray_DATA(a->FC),
+                                       (double *) PyArray_DATA(a->Phi));
+  if (a->K)
+    changed |= lfc_session_set_k(s, (double *) PyArray_DATA(a->K));
+  if (a->mu)
+    changed |= lfc_session_set_muons(s, (double *) PyArray_DATA(a->mu),
+                                     PyArray_SIZE(a->mu) / 3);
+  if (a->has_r || a->has_nnn || a->has_rcont)
+    changed |= lfc_session_set_sphere(s, a->has_r ? a->r : s->radius,
+                                      a->has_nnn ? (unsigned int) a->nnn : s->nnn,
+                                      a->has_rcont ? a->rcont : s->cont_radius);
+
+  return PyBool_FromLong(changed);
+}
+
+static PyObject * py_lfclib_su(PyObject *self, PyObject *args, PyObject *kwargs) {
+
+  PyObject *osession, *result;
+  PyObject *ocell = NULL, *osupercell = NULL, *opositions = NULL, *oFC = NULL;
+  PyObject *oK = NULL, *oPhi = NULL, *omu = NULL, *or = NULL, *onnn = NULL, *orcont = NULL;
+  py_lfclib_session *ps;
+  py_lfclib_session_args a = {NULL};
+
+  static char *kwlist[] = {"session", "Cell", "Supercell", "positions", "FC", "K",
+                           "Phi", "Muons", "r", "nnn", "rcont", NULL};
+
+  /* put arguments into variables */
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|OOOOOOOOOO", kwlist,
+                            &osession, &ocell, &osupercell, &opositions, &oFC,
+                            &oK, &oPhi, &omu, &or, &onnn, &orcont))
+  {
+    return NULL;
+  }
+
+  ps = (py_lfclib_session *) PyCapsule_GetPointer(osession, "lfclib.Session");
+  if (!ps)
+    return NULL;
+
+  /* all the arguments are checked before the session is touched */
+  if (py_lfclib_session_parse(&a, ocell, osupercell, opositions, oFC, oK, oPhi,
+                              omu, or, onnn, orcont) < 0) {
+    py_lfclib_session_args_free(&a);
+    return NULL;
+  }
+
+  py_lfclib_session_lock(ps);
+  result = py_lfclib_session_update(&ps->s, &a);
+  PyThread_release_lock(ps->lock);
+  py_lfclib_session_args_free(&a);
+  return result;
+}
+
+static PyObject * py_lfclib_se(PyObject *self, PyObject *args, PyObject *kwargs) {
+
+  PyObject *osession;
+  PyArrayObject *ocont = NULL, *odip = NULL, *olor = NULL, *otensor = NULL;
+  py_lfclib_session *ps;
+  lfc_session *s;
+  int tensor = 0;
+  unsigned int nsums;
+  npy_intp vec_dim[2];
+  npy_intp ten_dim[3];
+
+  static char *kwlist[] = {"session", "tensor", NULL};
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|i", kwlist, &osession, &tensor))
+  {
+    return NULL;
+  }
+
+  ps = (py_lfclib_session *) PyCapsule_GetPointer(osession, "lfclib.Session");
+  if (!ps)
+    return NULL;
+  s = &ps->s;
+
+  /* the sizes of the outputs and the evaluation must see the same session */
+  py_lfclib_session_lock(ps);
+
+  if (s->natoms == 0) {
+    PyThread_release_lock(ps->lock);
+    PyErr_SetString(PyExc_RuntimeError, "The session has no atoms.");
+    return NULL;
+  }
+
+  vec_dim[0] = s->nmu; vec_dim[1] = 3;
+  ten_dim[0] = s->nmu; ten_dim[1] = 3; ten_dim[2] = 3;
+
+  /* allocate output arrays */
+  ocont = (PyArrayObject *) PyArray_ZEROS(2, vec_dim, NPY_DOUBLE, 0);
+  odip = (PyArrayObject *) PyArray_ZEROS(2, vec_dim, NPY_DOUBLE, 0);
+  olor = (PyArrayObject *) PyArray_ZEROS(2, vec_dim, NPY_DOUBLE, 0);
+  if (tensor)
+    otensor = (PyArrayObject *) PyArray_ZEROS(3, ten_dim, NPY_DOUBLE, 0);
+  if (!ocont || !odip || !olor || (tensor && !otensor)) {
+    Py_XDECREF(ocont);
+    Py_XDECREF(odip);
+    Py_XDECREF(olor);
+    Py_XDECREF(otensor);
+    PyThread_release_lock(ps->lock);
+    PyErr_SetString(PyExc_MemoryError, "Cannot create output arrays.");
+    return NULL;
+  }
+
+  /* long computation starts here. No python object is touched so free thread execution */
+  Py_BEGIN_ALLOW_THREADS
+  nsums = lfc_session_evaluate(s, (double *) PyArray_DATA(ocont),
+      (double *) PyArray_DATA(odip), (double *) PyArray_DATA(olor),
+      otensor ? (double *) PyArray_DATA(otensor) : NULL);
+  Py_END_ALLOW_THREADS
+  PyThread_release_lock(ps->lock);
+
+  return Py_BuildValue("NNNNI", ocont, odip, olor,
+      otensor ? (PyObject *) otensor : (Py_INCREF(Py_None), Py_None), nsums);
+}
+
+static PyObject * py_lfclib_ex(PyObject *self, PyObject *args, PyObject *kwargs) {
+
+  double r=0.0, rcont=0.0;
+  unsigned int nnn=0, nradii=16;
+  PyObject *opositions, *oFC, *oK, *oPhi, *omu, *osupercell, *ocell;
+  PyArrayObject *positions, *FC, *K, *Phi, *mu, *supercell, *cell;
+  PyArrayObject *ocont = NULL, *odip = NULL, *olor = NULL, *otensor = NULL;
+  PyArrayObject *oerr = NULL, *opartial = NULL;
+
+  int num_atoms=0;
+  npy_intp vec_dim[1] = {3};
+  npy_intp mat_dim[2] = {3, 3};
+  npy_intp err_dim[1] = {2};
+  npy_intp partial_dim[2];
+
+  static char *kwlist[] = {"positions", "FC", "K", "Phi", "Muon", "Supercell",
+                           "Cell", "r", "nnn", "rcont", "nradii", NULL};
+
+  /* put arguments into variables */
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOOOOOdId|I", kwlist,
+                            &opositions, &oFC, &oK, &oPhi, &omu, &osupercell,
+                            &ocell, &r, &nnn, &rcont, &nradii))
+  {
+    return NULL;
+  }
+
+  if (nradii == 0) {
+    PyErr_SetString(PyExc_ValueError, "nradii must be positive.");
+    return NULL;
+  }
+
+  /* turn inputs into numpy array types */
+  positions = (PyArrayObject *) PyArray_FROMANY(opositions, NPY_DOUBLE, 2, 2,
+                                              NPY_ARRAY_IN_ARRAY);
+  FC = (PyArrayObject *) PyArray_FROMANY(oFC, NPY_COMPLEX128, 2, 2,
+                                              NPY_ARRAY_IN_ARRAY);
+  K = (PyArrayObject *) PyArray_FROMANY(oK, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+  Phi = (PyArrayObject *) PyArray_FROMANY(oPhi, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+  mu = (PyArrayObject *) PyArray_FROMANY(omu, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+  supercell = (PyArrayObject *) PyArray_FROMANY(osupercell, NPY_INT32,
+                                                   1, 1, NPY_ARRAY_IN_ARRAY);
+  cell = (PyArrayObject *) PyArray_FROMANY(ocell, NPY_DOUBLE, 2, 2,
+                                             NPY_ARRAY_IN_ARRAY);
+
+  /* Validate data */
+  if (!positions || !FC || !K || !Phi || !mu || !supercell || !cell) {
+    Py_XDECREF(positions);
+    Py_XDECREF(FC);
+    Py_XDECREF(K);
+    Py_XDECREF(Phi);
+    Py_XDECREF(mu);
+    Py_XDECREF(supercell);
+    Py_XDECREF(cell);
+    PyErr_Format(PyExc_RuntimeError,
+                    "Error parsing numpy arrays.");
+    return NULL;
+  }
+
+  num_atoms = PyArray_SHAPE(positions)[0];
+
+  if (PyArray_SHAPE(positions)[1] != 3 || PyArray_SHAPE(FC)[0] != num_atoms ||
+      PyArray_SHAPE(FC)[1] != 3 || PyArray_SIZE(K) != 3 ||
+      PyArray_SIZE(Phi) != num_atoms || PyArray_SIZE(mu) != 3 ||
+      PyArray_SIZE(supercell) != 3 || PyArray_SIZE(cell) != 9) {
+    Py_DECREF(positions);
+    Py_DECREF(FC);
+    Py_DECREF(K);
+    Py_DECREF(Phi);
+    Py_DECREF(mu);
+    Py_DECREF(supercell);
+    Py_DECREF(cell);
+    PyErr_SetString(PyExc_RuntimeError, "Inconsistent shapes of the input arrays.");
+    return NULL;
+  }
+  if (nnn > 200) {
+    Py_DECREF(positions);
+    Py_DECREF(FC);
+    Py_DECREF(K);
+    Py_DECREF(Phi);
+    Py_DECREF(mu);
+    Py_DECREF(supercell);
+    Py_DECREF(cell);
+    PyErr_Format(PyExc_RuntimeError,
+                    "Error, number of nearest neighbours exceedingly large.");
+    return NULL;
+  }
+
+  /* allocate output arrays */
+  partial_dim[0] = (npy_intp) nradii;
+  partial_dim[1] = (npy_intp) 15;
+  ocont = (PyArrayObject *) PyArray_ZEROS(1, vec_dim, NPY_DOUBLE,0);
+  odip = (PyArrayObject *) PyArray_ZEROS(1, vec_dim, NPY_DOUBLE,0);
+  olor = (PyArrayObject *) PyArray_ZEROS(1, vec_dim, NPY_DOUBLE,0);
+  otensor = (PyArrayObject *) PyArray_ZEROS(2, mat_dim, NPY_DOUBLE,0);
+  oerr = (PyArrayObject *) PyArray_ZEROS(1, err_dim, NPY_DOUBLE,0);
+  opartial = (PyArrayObject *) PyArray_ZEROS(2, partial_dim, NPY_DOUBLE,0);
+
+  if (!ocont || !odip || !olor || !otensor || !oerr || !opartial) {
+    Py_XDECREF(ocont);
+    Py_XDECREF(odip);
+    Py_XDECREF(olor);
+    Py_XDECREF(otensor);
+    Py_XDECREF(oerr);
+    Py_XDECREF(opartial);
+    Py_DECREF(positions);
+    Py_DECREF(FC);
+    Py_DECREF(K);
+    Py_DECREF(Phi);
+    Py_DECREF(mu);
+    Py_DECREF(supercell);
+    Py_DECREF(cell);
+    PyErr_SetString(PyExc_MemoryError, "Cannot create output arrays.");
+    return NULL;
+  }
+
+  /* long computation starts here. No python object is touched so free thread execution */
+  Py_BEGIN_ALLOW_THREADS
+  ExtrapolatedSum( (double *) PyArray_DATA(positions),
+      (double *) PyArray_DATA(FC),
+      (double *) PyArray_DATA(K),
+      (double *) PyArray_DATA(Phi),
+      (double *) PyArray_DATA(mu),
+      (int *) PyArray_DATA(supercell),
+      (double *) PyArray_DATA(cell),
+      r, nradii, nnn, rcont, num_atoms,
+      (double *) PyArray_DATA(ocont),
+      (double *) PyArray_DATA(odip),
+      (double *) PyArray_DATA(olor),
+      (double *) PyArray_DATA(otensor),
+      (double *) PyArray_DATA(oerr),
+      (double *) PyArray_DATA(opartial));
+  Py_END_ALLOW_THREADS
+
+  Py_DECREF(positions);
+  Py_DECREF(FC);
+  Py_DECREF(K);
+  Py_DECREF(Phi);
+  Py_DECREF(mu);
+  Py_DECREF(supercell);
+  Py_DECREF(cell);
+
+  return Py_BuildValue("NNNNNN", ocont, odip, olor, otensor, oerr, opartial);
+}
+
+static PyObject * py_lfclib_dt(PyObject *self, PyObject *args, PyObject *kwargs) {
+  
+  double r=0.0;
+  char* precision = NULL;
+  int reproducible = 0;
+  unsigned int flags = 0;
+  PyObject *opositions, *omu, *osupercell, *ocell;
+  PyObject *ositeops = NULL;
+  PyArrayObject *positions,  *mu, *supercell, *cell, *odt;
+  PyArrayObject *siteops = NULL, *sitetr = NULL;
+  unsigned int nops = 0;
+  
+  int num_atoms=0;
+  int * in_supercell;
+  npy_intp * pShape, * out_dim;
+  int nd = 2;
+
+
+  static char *kwlist[] = {"positions", "Muon", "Supercell", "Cell", "r",
+                           "precision", "reproducible", "siteops", NULL};
+
+  /* put arguments into variables */ 
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOOd|siO", kwlist,
+                            &opositions, &omu, &osupercell, &ocell,&r,&precision,
+                            &reproducible, &ositeops))
+  {
+    return NULL;
+  }
+
+  if (parse_precision(precision, &flags) < 0) {
+    return NULL;
+  }
+  if (reproducible) {
+    flags |= LFC_REPRODUCIBLE;
+  }
+  if (parse_siteops(ositeops, NULL, &siteops, &sitetr, &nops) < 0) {
+    return NULL;
+  }
+  
+  /* turn inputs into numpy array types */
+  positions = (PyArrayObject *) PyArray_FROMANY(opositions, NPY_DOUBLE, 2, 2,
+                                              NPY_ARRAY_IN_ARRAY);
+  mu = (PyArrayObject *) PyArray_FROMANY(omu, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+                                              
+  supercell = (PyArrayObject *) PyArray_FROMANY(osupercell, NPY_INT32,
+                                                   1, 1, NPY_ARRAY_IN_ARRAY);
+  cell = (PyArrayObject *) PyArray_FROMANY(ocell, NPY_DOUBLE, 2, 2,
+                                             NPY_ARRAY_IN_ARRAY);
+  
+  /* Validate data */
+  if ( !positions || !mu || !supercell || !cell) {
+    Py_XDECREF(positions);
+    Py_XDECREF(mu);
+    Py_XDECREF(supercell);
+    Py_XDECREF(cell);
+    Py_XDECREF(siteops);
+    PyErr_Format(PyExc_RuntimeError,
+                    "Error parsing numpy arrays.");                 
+    return NULL;
+  }
+
+  /* General validity checks */
+  
+  pShape = PyArray_SHAPE(positions);
+
+  num_atoms = pShape[0];
   
   if (num_atoms == 0) {
     PyErr_Format(PyExc_RuntimeError,
-                    "No magnetic atoms specified.");                 
-    return NULL;      
+                    "No magnetic atoms specified.");                 
+    return NULL;      
+  }
+
+
+  /* to avoid problems with int types */
+  in_supercell = malloc(3*sizeof(int));
+  in_supercell[0] = *(npy_int64 *)PyArray_GETPTR1(supercell, 0);
+  in_supercell[1] = *(npy_int64 *)PyArray_GETPTR1(supercell, 1);
+  in_supercell[2] = *(npy_int64 *)PyArray_GETPTR1(supercell, 2);
+
+  /* the wedge is only valid for symmetric summation domains */
+  if (siteops != NULL &&
+      (!wedge_sphere_check((double *) PyArray_DATA(mu), in_supercell,
+                           (double *) PyArray_DATA(cell), r) ||
+       !wedge_structure_check((double *) PyArray_DATA(siteops), NULL, nops,
+                              (double *) PyArray_DATA(positions), NULL, NULL, NULL,
+                              (double *) PyArray_DATA(mu), in_supercell,
+                              (double *) PyArray_DATA(cell), num_atoms))) {
+    PyErr_SetString(PyExc_ValueError,
+                    wedge_sphere_check((double *) PyArray_DATA(mu), in_supercell,
+                                       (double *) PyArray_DATA(cell), r) ?
+                    "siteops are not symmetries of the atomic positions." :
+                    "The supercell does not contain the Lorentz sphere, siteops cannot be used.");
+    Py_DECREF(positions);
+    Py_DECREF(mu);
+    Py_DECREF(supercell);
+    Py_DECREF(cell);
+    Py_DECREF(siteops);
+    free(in_supercell);
+    return NULL;
+  }
+ 
+  nd = 2; 
+  out_dim= (npy_intp *)malloc(2 * sizeof(npy_intp));
+  out_dim[0] = (npy_intp) 3;
+  out_dim[1] = (npy_intp) 3;
+  
+  odt = (PyArrayObject *) PyArray_ZEROS(nd, out_dim, NPY_DOUBLE,0);
+  
+  free(out_dim);
+
+  if (!odt) {
+    Py_XDECREF(positions);
+    Py_XDECREF(mu);
+    Py_XDECREF(supercell);
+    Py_XDECREF(cell);
+    Py_XDECREF(siteops);
+    if (in_supercell != NULL)
+      free(in_supercell);
+    PyErr_SetString(PyExc_MemoryError, "Cannot create output array.");
+    return NULL;
+  }
+  
+  /* long computation starts here. No python object is touched so free thread execution */
+  Py_BEGIN_ALLOW_THREADS  
+  DipolarTensorEx( (double *) PyArray_DATA(positions),
+      (double *) PyArray_DATA(mu),
+      in_supercell, 
+      (double *) PyArray_DATA(cell), 
+      r, num_atoms,
+      siteops ? (double *) PyArray_DATA(siteops) : NULL, nops, flags,
+      (double *) PyArray_DATA(odt));
+  Py_END_ALLOW_THREADS
+  
+  
+  Py_DECREF(positions);
+  Py_DECREF(mu);
+  Py_DECREF(supercell);
+  Py_DECREF(cell);
+  Py_XDECREF(siteops);
+  
+  free(in_supercell);
+  return Py_BuildValue("N", odt);
+
+}
+
+static PyObject * py_lfclib_fs(PyObject *self, PyObject *args, PyObject *kwargs) {
+
+  double r=0.0, rcont=0.0;
+  unsigned int nnn=0;
+  char* components = NULL;
+  unsigned int mask = 0;
+  PyObject *opositions, *oFC, *oK, *oPhi, *omu, *osupercell, *ocell;
+  PyArrayObject *positions, *FC, *K, *Phi, *mu, *supercell, *cell;
+  PyArrayObject *ocont = NULL, *odip = NULL, *olor = NULL, *odt = NULL, *osub = NULL;
+
+  int num_atoms=0;
+  npy_intp * pShape;
+  npy_intp out_dim[3];
+
+  static char *kwlist[] = {"positions", "FC", "K", "Phi", "Muon", "Supercell",
+                           "Cell", "r", "nnn", "rcont", "components", NULL};
+
+  /* put arguments into variables */
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOOOOOdId|s", kwlist,
+                            &opositions, &oFC, &oK, &oPhi, &omu, &osupercell,
+                            &ocell, &r, &nnn, &rcont, &components))
+  {
+    return NULL;
+  }
+
+  if (parse_components(components, &mask) < 0) {
+    return NULL;
+  }
+
+  /* turn inputs into numpy array types */
+  positions = (PyArrayObject *) PyArray_FROMANY(opositions, NPY_DOUBLE, 2, 2,
+                                              NPY_ARRAY_IN_ARRAY);
+  FC = (PyArrayObject *) PyArray_FROMANY(oFC, NPY_COMPLEX128, 2, 2,
+                                              NPY_ARRAY_IN_ARRAY);
+  K = (PyArrayObject *) PyArray_FROMANY(oK, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+  Phi = (PyArrayObject *) PyArray_FROMANY(oPhi, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+  mu = (PyArrayObject *) PyArray_FROMANY(omu, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+  supercell = (PyArrayObject *) PyArray_FROMANY(osupercell, NPY_INT32,
+                                                   1, 1, NPY_ARRAY_IN_ARRAY);
+  cell = (PyArrayObject *) PyArray_FROMANY(ocell, NPY_DOUBLE, 2, 2,
+                                             NPY_ARRAY_IN_ARRAY);
+
+  /* Validate data */
+  if (!positions || !FC || !K || !Phi || !mu || !supercell || !cell) {
+    Py_XDECREF(positions);
+    Py_XDECREF(FC);
+    Py_XDECREF(K);
+    Py_XDECREF(Phi);
+    Py_XDECREF(mu);
+    Py_XDECREF(supercell);
+    Py_XDECREF(cell);
+    PyErr_Format(PyExc_RuntimeError,
+                    "Error parsing numpy arrays.");
+    return NULL;
+  }
+
+  pShape = PyArray_SHAPE(positions);
+  num_atoms = pShape[0];
+
+  if (pShape[1] != 3 || PyArray_SHAPE(FC)[0] != num_atoms ||
+      PyArray_SHAPE(FC)[1] != 3 || PyArray_SHAPE(Phi)[0] != num_atoms ||
+      PyArray_SIZE(K) != 3 || PyArray_SIZE(mu) != 3 ||
+      PyArray_SIZE(supercell) != 3 || PyArray_SIZE(cell) != 9) {
+    Py_DECREF(positions);
+    Py_DECREF(FC);
+    Py_DECREF(K);
+    Py_DECREF(Phi);
+    Py_DECREF(mu);
+    Py_DECREF(supercell);
+    Py_DECREF(cell);
+    PyErr_SetString(PyExc_RuntimeError, "Inconsistent shapes of the input arrays.");
+    return NULL;
+  }
+  if (nnn > 200) {
+    Py_DECREF(positions);
+    Py_DECREF(FC);
+    Py_DECREF(K);
+    Py_DECREF(Phi);
+    Py_DECREF(mu);
+    Py_DECREF(supercell);
+    Py_DECREF(cell);
+    PyErr_Format(PyExc_RuntimeError,
+                    "Error, number of nearest neighbours exceedingly large.");
+    return NULL;
+  }
+
+  /* allocate output arrays */
+  out_dim[0] = (npy_intp) 3;
+  if (mask & LFC_CONTACT)
+    ocont = (PyArrayObject *) PyArray_ZEROS(1, out_dim, NPY_DOUBLE,0);
+  if (mask & LFC_DIPOLAR)
+    odip = (PyArrayObject *) PyArray_ZEROS(1, out_dim, NPY_DOUBLE,0);
+  if (mask & LFC_LORENTZ)
+    olor = (PyArrayObject *) PyArray_ZEROS(1, out_dim, NPY_DOUBLE,0);
+  out_dim[1] = (npy_intp) 3;
+  if (mask & LFC_TENSOR)
+    odt = (PyArrayObject *) PyArray_ZEROS(2, out_dim, NPY_DOUBLE,0);
+  out_dim[0] = (npy_intp) num_atoms;
+  out_dim[1] = (npy_intp) 3;
+  out_dim[2] = (npy_intp) 3;
+  if (mask & LFC_SUBLATTICE)
+    osub = (PyArrayObject *) PyArray_ZEROS(3, out_dim, NPY_DOUBLE,0);
+
+  if (((mask & LFC_CONTACT) && !ocont) || ((mask & LFC_DIPOLAR) && !odip) ||
+      ((mask & LFC_LORENTZ) && !olor) || ((mask & LFC_TENSOR) && !odt) ||
+      ((mask & LFC_SUBLATTICE) && !osub)) {
+    Py_XDECREF(ocont);
+    Py_XDECREF(odip);
+    Py_XDECREF(olor);
+    Py_XDECREF(odt);
+    Py_XDECREF(osub);
+    Py_DECREF(positions);
+    Py_DECREF(FC);
+    Py_DECREF(K);
+    Py_DECREF(Phi);
+    Py_DECREF(mu);
+    Py_DECREF(supercell);
+    Py_DECREF(cell);
+    PyErr_SetString(PyExc_MemoryError, "Cannot create output arrays.");
+    return NULL;
+  }
+
+  /* long computation starts here. No python object is touched so free thread execution */
+  Py_BEGIN_ALLOW_THREADS
+  FusedSum( (double *) PyArray_DATA(positions),
+      (double *) PyArray_DATA(FC),
+      (double *) PyArray_DATA(K),
+      (double *) PyArray_DATA(Phi),
+      (double *) PyArray_DATA(mu),
+      (int *) PyArray_DATA(supercell),
+      (double *) PyArray_DATA(cell),
+      r, nnn, rcont, num_atoms, mask,
+      ocont ? (double *) PyArray_DATA(ocont) : NULL,
+      odip ? (double *) PyArray_DATA(odip) : NULL,
+      olor ? (double *) PyArray_DATA(olor) : NULL,
+      odt ? (double *) PyArray_DATA(odt) : NULL,
+      osub ? (double *) PyArray_DATA(osub) : NULL);
+  Py_END_ALLOW_THREADS
+
+  Py_DECREF(positions);
+  Py_DECREF(FC);
+  Py_DECREF(K);
+  Py_DECREF(Phi);
+  Py_DECREF(mu);
+  Py_DECREF(supercell);
+  Py_DECREF(cell);
+
+  /* components not requested are returned as None */
+  return Py_BuildValue("NNNNN",
+      ocont ? (PyObject *) ocont : (Py_INCREF(Py_None), Py_None),
+      odip ? (PyObject *) odip : (Py_INCREF(Py_None), Py_None),
+      olor ? (PyObject *) olor : (Py_INCREF(Py_None), Py_None),
+      odt ? (PyObject *) odt : (Py_INCREF(Py_None), Py_None),
+      osub ? (PyObject *) osub : (Py_INCREF(Py_None), Py_None));
+}
+
+static PyObject * py_lfclib_ds(PyObject *self, PyObject *args, PyObject *kwargs) {
+
+  double r=0.0, rcont=0.0;
+  unsigned int nnn=0;
+  PyObject *opositions, *oFC, *oK, *oPhi, *omu, *osupercell, *ocell;
+  PyArrayObject *positions, *FC, *K, *Phi, *mu, *supercell, *cell;
+  PyArrayObject *ocont = NULL, *odip = NULL, *olor = NULL;
+
+  int num_atoms=0, num_domains=0;
+  npy_intp * pShape;
+  npy_intp out_dim[2];
+
+  static char *kwlist[] = {"positions", "FC", "K", "Phi", "Muon", "Supercell",
+                           "Cell", "r", "nnn", "rcont", NULL};
+
+  /* put arguments into variables */
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOOOOOdId", kwlist,
+                            &opositions, &oFC, &oK, &oPhi, &omu, &osupercell,
+                            &ocell, &r, &nnn, &rcont))
+  {
+    return NULL;
+  }
+
+  /* turn inputs into numpy array types */
+  positions = (PyArrayObject *) PyArray_FROMANY(opositions, NPY_DOUBLE, 2, 2,
+                                              NPY_ARRAY_IN_ARRAY);
+  FC = (PyArrayObject *) PyArray_FROMANY(oFC, NPY_COMPLEX128, 3, 3,
+                                              NPY_ARRAY_IN_ARRAY);
+  K = (PyArrayObject *) PyArray_FROMANY(oK, NPY_DOUBLE, 2, 2,
+                                              NPY_ARRAY_IN_ARRAY);
+  Phi = (PyArrayObject *) PyArray_FROMANY(oPhi, NPY_DOUBLE, 2, 2,
+                                              NPY_ARRAY_IN_ARRAY);
+  mu = (PyArrayObject *) PyArray_FROMANY(omu, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+  supercell = (PyArrayObject *) PyArray_FROMANY(osupercell, NPY_INT32,
+                                                   1, 1, NPY_ARRAY_IN_ARRAY);
+  cell = (PyArrayObject *) PyArray_FROMANY(ocell, NPY_DOUBLE, 2, 2,
+                                             NPY_ARRAY_IN_ARRAY);
+
+  /* Validate data */
+  if (!positions || !FC || !K || !Phi || !mu || !supercell || !cell) {
+    Py_XDECREF(positions);
+    Py_XDECREF(FC);
+    Py_XDECREF(K);
+    Py_XDECREF(Phi);
+    Py_XDECREF(mu);
+    Py_XDECREF(supercell);
+    Py_XDECREF(cell);
+    PyErr_Format(PyExc_RuntimeError,
+                    "Error parsing numpy arrays.");
+    return NULL;
+  }
+
+  pShape = PyArray_SHAPE(positions);
+  num_atoms = pShape[0];
+  num_domains = PyArray_SHAPE(FC)[0];
+
+  if (pShape[1] != 3 || PyArray_SHAPE(FC)[1] != num_atoms ||
+      PyArray_SHAPE(FC)[2] != 3 || PyArray_SHAPE(K)[0] != num_domains ||
+      PyArray_SHAPE(K)[1] != 3 || PyArray_SHAPE(Phi)[0] != num_domains ||
+      PyArray_SHAPE(Phi)[1] != num_atoms || PyArray_SIZE(mu) != 3 ||
+      PyArray_SIZE(supercell) != 3 || PyArray_SIZE(cell) != 9) {
+    Py_DECREF(positions);
+    Py_DECREF(FC);
+    Py_DECREF(K);
+    Py_DECREF(Phi);
+    Py_DECREF(mu);
+    Py_DECREF(supercell);
+    Py_DECREF(cell);
+    PyErr_SetString(PyExc_RuntimeError, "Inconsistent shapes of the input arrays.");
+    return NULL;
+  }
+  if (nnn > 200) {
+    Py_DECREF(positions);
+    Py_DECREF(FC);
+    Py_DECREF(K);
+    Py_DECREF(Phi);
+    Py_DECREF(mu);
+    Py_DECREF(supercell);
+    Py_DECREF(cell);
+    PyErr_Format(PyExc_RuntimeError,
+                    "Error, number of nearest neighbours exceedingly large.");
+    return NULL;
+  }
+
+  /* allocate output arrays */
+  out_dim[0] = (npy_intp) num_domains;
+  out_dim[1] = (npy_intp) 3;
+  ocont = (PyArrayObject *) PyArray_ZEROS(2, out_dim, NPY_DOUBLE,0);
+  odip = (PyArrayObject *) PyArray_ZEROS(2, out_dim, NPY_DOUBLE,0);
+  olor = (PyArrayObject *) PyArray_ZEROS(2, out_dim, NPY_DOUBLE,0);
+
+  if (!ocont || !odip || !olor) {
+    Py_XDECREF(ocont);
+    Py_XDECREF(odip);
+    Py_XDECREF(olor);
+    Py_DECREF(positions);
+    Py_DECREF(FC);
+    Py_DECREF(K);
+    Py_DECREF(Phi);
+    Py_DECREF(mu);
+    Py_DECREF(supercell);
+    Py_DECREF(cell);
+    PyErr_SetString(PyExc_MemoryError, "Cannot create output arrays.");
+    return NULL;
+  }
+
+  /* long computation starts here. No python object is touched so free thread execution */
+  Py_BEGIN_ALLOW_THREADS
+  DomainSum( (double *) PyArray_DATA(positions), num_domains,
+      (double *) PyArray_DATA(FC),
+      (double *) PyArray_DATA(K),
+      (double *) PyArray_DATA(Phi),
+      (double *) PyArray_DATA(mu),
+      (int *) PyArray_DATA(supercell),
+      (double *) PyArray_DATA(cell),
+      r, nnn, rcont, num_atoms,
+      (double *) PyArray_DATA(ocont),
+      (double *) PyArray_DATA(odip),
+      (double *) PyArray_DATA(olor));
+  Py_END_ALLOW_THREADS
+
+  Py_DECREF(positions);
+  Py_DECREF(FC);
+  Py_DECREF(K);
+  Py_DECREF(Phi);
+  Py_DECREF(mu);
+  Py_DECREF(supercell);
+  Py_DECREF(cell);
+
+  return Py_BuildValue("NNN", ocont, odip, olor);
+}
+
+static PyObject * py_lfclib_cs(PyObject *self, PyObject *args, PyObject *kwargs) {
+
+  double r=0.0, rcont=0.0;
+  unsigned int nnn=0;
+  PyObject *opositions, *oFC, *oK, *oPhi, *omu, *osupercell, *ocell;
+  PyArrayObject *positions, *FC, *K, *Phi, *mu, *supercell, *cell;
+  PyArrayObject *ocont = NULL, *odip = NULL, *olor = NULL;
+
+  int num_atoms=0, num_conf=0, num_mu=0;
+  npy_intp * pShape;
+  npy_intp out_dim[3];
+
+  static char *kwlist[] = {"positions", "FC", "K", "Phi", "Muons", "Supercell",
+                           "Cell", "r", "nnn", "rcont", NULL};
+
+  /* put arguments into variables */
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOOOOOdId", kwlist,
+                            &opositions, &oFC, &oK, &oPhi, &omu, &osupercell,
+                            &ocell, &r, &nnn, &rcont))
+  {
+    return NULL;
+  }
+
+  /* turn inputs into numpy array types */
+  positions = (PyArrayObject *) PyArray_FROMANY(opositions, NPY_DOUBLE, 2, 2,
+                                              NPY_ARRAY_IN_ARRAY);
+  FC = (PyArrayObject *) PyArray_FROMANY(oFC, NPY_COMPLEX128, 3, 3,
+                                              NPY_ARRAY_IN_ARRAY);
+  K = (PyArrayObject *) PyArray_FROMANY(oK, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+  Phi = (PyArrayObject *) PyArray_FROMANY(oPhi, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+  mu = (PyArrayObject *) PyArray_FROMANY(omu, NPY_DOUBLE, 2, 2,
+                                              NPY_ARRAY_IN_ARRAY);
+  supercell = (PyArrayObject *) PyArray_FROMANY(osupercell, NPY_INT32,
+                                                   1, 1, NPY_ARRAY_IN_ARRAY);
+  cell = (PyArrayObject *) PyArray_FROMANY(ocell, NPY_DOUBLE, 2, 2,
+                                             NPY_ARRAY_IN_ARRAY);
+
+  /* Validate data */
+  if (!positions || !FC || !K || !Phi || !mu || !supercell || !cell) {
+    Py_XDECREF(positions);
+    Py_XDECREF(FC);
+    Py_XDECREF(K);
+    Py_XDECREF(Phi);
+    Py_XDECREF(mu);
+    Py_XDECREF(supercell);
+    Py_XDECREF(cell);
+    PyErr_Format(PyExc_RuntimeError,
+                    "Error parsing numpy arrays.");
+    return NULL;
+  }
+
+  pShape = PyArray_SHAPE(positions);
+  num_atoms = pShape[0];
+  num_conf = PyArray_SHAPE(FC)[0];
+  num_mu = PyArray_SHAPE(mu)[0];
+
+  if (pShape[1] != 3 || PyArray_SHAPE(FC)[1] != num_atoms ||
+      PyArray_SHAPE(FC)[2] != 3 || PyArray_SIZE(K) != 3 ||
+      PyArray_SIZE(Phi) != num_atoms || PyArray_SHAPE(mu)[1] != 3 ||
+      PyArray_SIZE(supercell) != 3 || PyArray_SIZE(cell) != 9) {
+    Py_DECREF(positions);
+    Py_DECREF(FC);
+    Py_DECREF(K);
+    Py_DECREF(Phi);
+    Py_DECREF(mu);
+    Py_DECREF(supercell);
+    Py_DECREF(cell);
+    PyErr_SetString(PyExc_RuntimeError, "Inconsistent shapes of the input arrays.");
+    return NULL;
+  }
+  if (nnn > 200) {
+    Py_DECREF(positions);
+    Py_DECREF(FC);
+    Py_DECREF(K);
+    Py_DECREF(Phi);
+    Py_DECREF(mu);
+    Py_DECREF(supercell);
+    Py_DECREF(cell);
+    PyErr_Format(PyExc_RuntimeError,
+                    "Error, number of nearest neighbours exceedingly large.");
+    return NULL;
+  }
+
+  /* allocate output arrays */
+  out_dim[0] = (npy_intp) num_conf;
+  out_dim[1] = (npy_intp) num_mu;
+  out_dim[2] = (npy_intp) 3;
+  ocont = (PyArrayObject *) PyArray_ZEROS(3, out_dim, NPY_DOUBLE,0);
+  odip = (PyArrayObject *) PyArray_ZEROS(3, out_dim, NPY_DOUBLE,0);
+  olor = (PyArrayObject *) PyArray_ZEROS(3, out_dim, NPY_DOUBLE,0);
+
+  if (!ocont || !odip || !olor) {
+    Py_XDECREF(ocont);
+    Py_XDECREF(odip);
+    Py_XDECREF(olor);
+    Py_DECREF(positions);
+    Py_DECREF(FC);
+    Py_DECREF(K);
+    Py_DECREF(Phi);
+    Py_DECREF(mu);
+    Py_DECREF(supercell);
+    Py_DECREF(cell);
+    PyErr_SetString(PyExc_MemoryError, "Cannot create output arrays.");
+    return NULL;
+  }
+
+  /* long computation starts here. No python object is touched so free thread execution */
+  Py_BEGIN_ALLOW_THREADS
+  ConfigSum( (double *) PyArray_DATA(positions), num_conf,
+      (double *) PyArray_DATA(FC),
+      (double *) PyArray_DATA(K),
+      (double *) PyArray_DATA(Phi),
+      (double *) PyArray_DATA(mu), num_mu,
+      (int *) PyArray_DATA(supercell),
+      (double *) PyArray_DATA(cell),
+      r, nnn, rcont, num_atoms,
+      (double *) PyArray_DATA(ocont),
+      (double *) PyArray_DATA(odip),
+      (double *) PyArray_DATA(olor));
+  Py_END_ALLOW_THREADS
+
+  Py_DECREF(positions);
+  Py_DECREF(FC);
+  Py_DECREF(K);
+  Py_DECREF(Phi);
+  Py_DECREF(mu);
+  Py_DECREF(supercell);
+  Py_DECREF(cell);
+
+  return Py_BuildValue("NNN", ocont, odip, olor);
+}
+
+static PyObject * py_lfclib_cr(PyObject *self, PyObject *args, PyObject *kwargs) {
+
+  double r=0.0, rcont=0.0;
+  unsigned int nnn=0;
+  PyObject *opositions, *oK, *omu, *osupercell, *ocell;
+  PyArrayObject *positions, *K, *mu, *supercell, *cell;
+  PyArrayObject *oresp = NULL;
+
+  int num_atoms=0, num_mu=0;
+  npy_intp out_dim[3];
+
+  static char *kwlist[] = {"positions", "K", "Muons", "Supercell", "Cell",
+                           "r", "nnn", "rcont", NULL};
+
+  /* put arguments into variables */
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOOOdId", kwlist,
+                            &opositions, &oK, &omu, &osupercell, &ocell,
+                            &r, &nnn, &rcont))
+  {
+    return NULL;
+  }
+
+  /* turn inputs into numpy array types */
+  positions = (PyArrayObject *) PyArray_FROMANY(opositions, NPY_DOUBLE, 2, 2,
+                                              NPY_ARRAY_IN_ARRAY);
+  K = (PyArrayObject *) PyArray_FROMANY(oK, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+  mu = (PyArrayObject *) PyArray_FROMANY(omu, NPY_DOUBLE, 2, 2,
+                                              NPY_ARRAY_IN_ARRAY);
+  supercell = (PyArrayObject *) PyArray_FROMANY(osupercell, NPY_INT32,
+                                                   1, 1, NPY_ARRAY_IN_ARRAY);
+  cell = (PyArrayObject *) PyArray_FROMANY(ocell, NPY_DOUBLE, 2, 2,
+                                             NPY_ARRAY_IN_ARRAY);
+
+  /* Validate data */
+  if (!positions || !K || !mu || !supercell || !cell) {
+    Py_XDECREF(positions);
+    Py_XDECREF(K);
+    Py_XDECREF(mu);
+    Py_XDECREF(supercell);
+    Py_XDECREF(cell);
+    PyErr_Format(PyExc_RuntimeError,
+                    "Error parsing numpy arrays.");
+    return NULL;
+  }
+
+  num_atoms = PyArray_SHAPE(positions)[0];
+  num_mu = PyArray_SHAPE(mu)[0];
+
+  if (PyArray_SHAPE(positions)[1] != 3 || PyArray_SIZE(K) != 3 ||
+      PyArray_SHAPE(mu)[1] != 3 || PyArray_SIZE(supercell) != 3 ||
+      PyArray_SIZE(cell) != 9 || nnn > 200) {
+    Py_DECREF(positions);
+    Py_DECREF(K);
+    Py_DECREF(mu);
+    Py_DECREF(supercell);
+    Py_DECREF(cell);
+    PyErr_SetString(PyExc_RuntimeError, "Inconsistent shapes of the input arrays.");
+    return NULL;
+  }
+
+  /* allocate output array */
+  out_dim[0] = (npy_intp) num_mu;
+  out_dim[1] = (npy_intp) 9;
+  out_dim[2] = (npy_intp) 6 * num_atoms;
+  oresp = (PyArrayObject *) PyArray_ZEROS(3, out_dim, NPY_DOUBLE,0);
+
+  if (!oresp) {
+    Py_DECREF(positions);
+    Py_DECREF(K);
+    Py_DECREF(mu);
+    Py_DECREF(supercell);
+    Py_DECREF(cell);
+    PyErr_SetString(PyExc_MemoryError, "Cannot create output array.");
+    return NULL;
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+  ConfigResponse( (double *) PyArray_DATA(positions),
+      (double *) PyArray_DATA(K),
+      (double *) PyArray_DATA(mu), num_mu,
+      (int *) PyArray_DATA(supercell),
+      (double *) PyArray_DATA(cell),
+      r, nnn, rcont, num_atoms,
+      (double *) PyArray_DATA(oresp));
+  Py_END_ALLOW_THREADS
+
+  Py_DECREF(positions);
+  Py_DECREF(K);
+  Py_DECREF(mu);
+  Py_DECREF(supercell);
+  Py_DECREF(cell);
+
+  return (PyObject *) oresp;
+}
+
+static PyObject * py_lfclib_fit(PyObject *self, PyObject *args, PyObject *kwargs) {
+
+  double acont=0.0, tol=1e-12, chi2=0.0;
+  unsigned int fit_acont=0, maxiter=200;
+  int niter=0;
+  PyObject *oresp, *obasis, *ofreq, *oparams, *ooffset = NULL, *osigma = NULL;
+  PyArrayObject *resp, *basis, *freq, *params = NULL, *offset = NULL, *sigma = NULL;
+
+  int num_mu=0, num_col=0, num_par=0;
+
+  static char *kwlist[] = {"response", "basis", "frequencies", "params",
+                           "offset", "sigma", "ACont", "fit_acont", "maxiter",
+                           "tol", NULL};
+
+  /* put arguments into variables */
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOO|OOdIId", kwlist,
+                            &oresp, &obasis, &ofreq, &oparams, &ooffset,
+                            &osigma, &acont, &fit_acont, &maxiter, &tol))
+  {
+    return NULL;
+  }
+
+  /* turn inputs into numpy array types, params is returned and must be a copy */
+  resp = (PyArrayObject *) PyArray_FROMANY(oresp, NPY_DOUBLE, 3, 3,
+                                              NPY_ARRAY_IN_ARRAY);
+  basis = (PyArrayObject *) PyArray_FROMANY(obasis, NPY_DOUBLE, 2, 2,
+                                              NPY_ARRAY_IN_ARRAY);
+  freq = (PyArrayObject *) PyArray_FROMANY(ofreq, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+  params = (PyArrayObject *) PyArray_FROMANY(oparams, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY | NPY_ARRAY_ENSURECOPY);
+  if (ooffset != NULL && ooffset != Py_None)
+    offset = (PyArrayObject *) PyArray_FROMANY(ooffset, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+  if (osigma != NULL && osigma != Py_None)
+    sigma = (PyArrayObject *) PyArray_FROMANY(osigma, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+
+  /* Validate data */
+  if (!resp || !basis || !freq || !params ||
+      (ooffset != NULL && ooffset != Py_None && !offset) ||
+      (osigma != NULL && osigma != Py_None && !sigma)) {
+    Py_XDECREF(resp);
+    Py_XDECREF(basis);
+    Py_XDECREF(freq);
+    Py_XDECREF(params);
+    Py_XDECREF(offset);
+    Py_XDECREF(sigma);
+    PyErr_Format(PyExc_RuntimeError,
+                    "Error parsing numpy arrays.");
+    return NULL;
+  }
+
+  num_mu = PyArray_SHAPE(resp)[0];
+  num_col = PyArray_SHAPE(resp)[2];
+  num_par = PyArray_SIZE(params);
+
+  if (PyArray_SHAPE(resp)[1] != 9 || PyArray_SHAPE(basis)[0] != num_col ||
+      PyArray_SHAPE(basis)[1] != num_par || PyArray_SIZE(freq) != num_mu ||
+      (offset && PyArray_SIZE(offset) != num_col) ||
+      (sigma && PyArray_SIZE(sigma) != num_mu)) {
+    Py_DECREF(resp);
+    Py_DECREF(basis);
+    Py_DECREF(freq);
+    Py_DECREF(params);
+    Py_XDECREF(offset);
+    Py_XDECREF(sigma);
+    PyErr_SetString(PyExc_RuntimeError, "Inconsistent shapes of the input arrays.");
+    return NULL;
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+  niter = FitMoments( (double *) PyArray_DATA(resp), num_mu, num_col,
+      (double *) PyArray_DATA(basis),
+      offset ? (double *) PyArray_DATA(offset) : NULL, num_par,
+      (double *) PyArray_DATA(freq),
+      sigma ? (double *) PyArray_DATA(sigma) : NULL,
+      fit_acont, maxiter, tol,
+      (double *) PyArray_DATA(params), &acont, &chi2);
+  Py_END_ALLOW_THREADS
+
+  Py_DECREF(resp);
+  Py_DECREF(basis);
+  Py_DECREF(freq);
+  Py_XDECREF(offset);
+  Py_XDECREF(sigma);
+
+  return Py_BuildValue("Nddi", params, acont, chi2, niter);
+}
+
+static PyObject * py_lfclib_st(PyObject *self, PyObject *args, PyObject *kwargs) {
+
+  double r=0.0;
+  PyObject *opositions, *oFC, *oK, *oPhi, *omu, *osupercell, *ocell;
+  PyArrayObject *positions, *FC, *K, *Phi, *mu, *supercell, *cell;
+  PyArrayObject *odip = NULL, *olor = NULL, *otensor = NULL;
+  PyArrayObject *oddip = NULL, *odlor = NULL, *odtensor = NULL;
+
+  int num_atoms=0;
+  npy_intp vec_dim[1] = {3};
+  npy_intp mat_dim[2] = {3, 3};
+  npy_intp dvec_dim[2] = {6, 3};
+  npy_intp dmat_dim[3] = {6, 3, 3};
+
+  static char *kwlist[] = {"positions", "FC", "K", "Phi", "Muon", "Supercell",
+                           "Cell", "r", NULL};
+
+  /* put arguments into variables */
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOOOOOd", kwlist,
+                            &opositions, &oFC, &oK, &oPhi, &omu, &osupercell,
+                            &ocell, &r))
+  {
+    return NULL;
+  }
+
+  /* turn inputs into numpy array types */
+  positions = (PyArrayObject *) PyArray_FROMANY(opositions, NPY_DOUBLE, 2, 2,
+                                              NPY_ARRAY_IN_ARRAY);
+  FC = (PyArrayObject *) PyArray_FROMANY(oFC, NPY_COMPLEX128, 2, 2,
+                                              NPY_ARRAY_IN_ARRAY);
+  K = (PyArrayObject *) PyArray_FROMANY(oK, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+  Phi = (PyArrayObject *) PyArray_FROMANY(oPhi, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+  mu = (PyArrayObject *) PyArray_FROMANY(omu, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+  supercell = (PyArrayObject *) PyArray_FROMANY(osupercell, NPY_INT32,
+                                                   1, 1, NPY_ARRAY_IN_ARRAY);
+  cell = (PyArrayObject *) PyArray_FROMANY(ocell, NPY_DOUBLE, 2, 2,
+                                             NPY_ARRAY_IN_ARRAY);
+
+  /* Validate data */
+  if (!positions || !FC || !K || !Phi || !mu || !supercell || !cell) {
+    Py_XDECREF(positions);
+    Py_XDECREF(FC);
+    Py_XDECREF(K);
+    Py_XDECREF(Phi);
+    Py_XDECREF(mu);
+    Py_XDECREF(supercell);
+    Py_XDECREF(cell);
+    PyErr_Format(PyExc_RuntimeError,
+                    "Error parsing numpy arrays.");
+    return NULL;
+  }
+
+  num_atoms = PyArray_SHAPE(positions)[0];
+
+  if (PyArray_SHAPE(positions)[1] != 3 || PyArray_SHAPE(FC)[0] != num_atoms ||
+      PyArray_SHAPE(FC)[1] != 3 || PyArray_SIZE(K) != 3 ||
+      PyArray_SIZE(Phi) != num_atoms || PyArray_SIZE(mu) != 3 ||
+      PyArray_SIZE(supercell) != 3 || PyArray_SIZE(cell) != 9) {
+    Py_DECREF(positions);
+    Py_DECREF(FC);
+    Py_DECREF(K);
+    Py_DECREF(Phi);
+    Py_DECREF(mu);
+    Py_DECREF(supercell);
+    Py_DECREF(cell);
+    PyErr_SetString(PyExc_RuntimeError, "Inconsistent shapes of the input arrays.");
+    return NULL;
+  }
+
+  /* allocate output arrays */
+  odip = (PyArrayObject *) PyArray_ZEROS(1, vec_dim, NPY_DOUBLE,0);
+  olor = (PyArrayObject *) PyArray_ZEROS(1, vec_dim, NPY_DOUBLE,0);
+  otensor = (PyArrayObject *) PyArray_ZEROS(2, mat_dim, NPY_DOUBLE,0);
+  oddip = (PyArrayObject *) PyArray_ZEROS(2, dvec_dim, NPY_DOUBLE,0);
+  odlor = (PyArrayObject *) PyArray_ZEROS(2, dvec_dim, NPY_DOUBLE,0);
+  odtensor = (PyArrayObject *) PyArray_ZEROS(3, dmat_dim, NPY_DOUBLE,0);
+
+  if (!odip || !olor || !otensor || !oddip || !odlor || !odtensor) {
+    Py_XDECREF(odip);
+    Py_XDECREF(olor);
+    Py_XDECREF(otensor);
+    Py_XDECREF(oddip);
+    Py_XDECREF(odlor);
+    Py_XDECREF(odtensor);
+    Py_DECREF(positions);
+    Py_DECREF(FC);
+    Py_DECREF(K);
+    Py_DECREF(Phi);
+    Py_DECREF(mu);
+    Py_DECREF(supercell);
+    Py_DECREF(cell);
+    PyErr_SetString(PyExc_MemoryError, "Cannot create output arrays.");
+    return NULL;
+  }
+
+  /* long computation starts here. No python object is touched so free thread execution */
+  Py_BEGIN_ALLOW_THREADS
+  StrainSum( (double *) PyArray_DATA(positions),
+      (double *) PyArray_DATA(FC),
+      (double *) PyArray_DATA(K),
+      (double *) PyArray_DATA(Phi),
+      (double *) PyArray_DATA(mu),
+      (int *) PyArray_DATA(supercell),
+      (double *) PyArray_DATA(cell),
+      r, num_atoms,
+      (double *) PyArray_DATA(odip),
+      (double *) PyArray_DATA(olor),
+      (double *) PyArray_DATA(otensor),
+      (double *) PyArray_DATA(oddip),
+      (double *) PyArray_DATA(odlor),
+      (double *) PyArray_DATA(odtensor));
+  Py_END_ALLOW_THREADS
+
+  Py_DECREF(positions);
+  Py_DECREF(FC);
+  Py_DECREF(K);
+  Py_DECREF(Phi);
+  Py_DECREF(mu);
+  Py_DECREF(supercell);
+  Py_DECREF(cell);
+
+  return Py_BuildValue("NNNNNN", odip, olor, otensor, oddip, odlor, odtensor);
+}
+
+static PyObject * py_lfclib_pol(PyObject *self, PyObject *args, PyObject *kwargs) {
+
+  unsigned int powder=0, nbins=0;
+  PyObject *ofields, *otimes, *oweights = NULL, *odirection = NULL;
+  PyArrayObject *fields, *times, *weights = NULL, *direction = NULL;
+  PyArrayObject *opol = NULL;
+
+  int num_fields=0;
+  npy_intp out_dim[1];
+
+  static char *kwlist[] = {"fields", "times", "weights", "direction",
+                           "powder", "nbins", NULL};
+
+  /* put arguments into variables */
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|OOII", kwlist,
+                            &ofields, &otimes, &oweights, &odirection,
+                            &powder, &nbins))
+  {
+    return NULL;
+  }
+
+  /* turn inputs into numpy array types */
+  fields = (PyArrayObject *) PyArray_FROMANY(ofields, NPY_DOUBLE, 2, 2,
+                                              NPY_ARRAY_IN_ARRAY);
+  times = (PyArrayObject *) PyArray_FROMANY(otimes, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+  if (oweights != NULL && oweights != Py_None)
+    weights = (PyArrayObject *) PyArray_FROMANY(oweights, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+  if (odirection != NULL && odirection != Py_None)
+    direction = (PyArrayObject *) PyArray_FROMANY(odirection, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+
+  /* Validate data */
+  if (!fields || !times ||
+      (oweights != NULL && oweights != Py_None && !weights) ||
+      (odirection != NULL && odirection != Py_None && !direction)) {
+    Py_XDECREF(fields);
+    Py_XDECREF(times);
+    Py_XDECREF(weights);
+    Py_XDECREF(direction);
+    PyErr_Format(PyExc_RuntimeError,
+                    "Error parsing numpy arrays.");
+    return NULL;
+  }
+
+  num_fields = PyArray_SHAPE(fields)[0];
+
+  if (PyArray_SHAPE(fields)[1] != 3 ||
+      (weights && PyArray_SIZE(weights) != num_fields) ||
+      (direction && PyArray_SIZE(direction) != 3)) {
+    Py_DECREF(fields);
+    Py_DECREF(times);
+    Py_XDECREF(weights);
+    Py_XDECREF(direction);
+    PyErr_SetString(PyExc_RuntimeError, "Inconsistent shapes of the input arrays.");
+    return NULL;
+  }
+
+  /* allocate output array */
+  out_dim[0] = PyArray_SIZE(times);
+  opol = (PyArrayObject *) PyArray_ZEROS(1, out_dim, NPY_DOUBLE,0);
+
+  if (!opol) {
+    Py_DECREF(fields);
+    Py_DECREF(times);
+    Py_XDECREF(weights);
+    Py_XDECREF(direction);
+    PyErr_SetString(PyExc_MemoryError, "Cannot create output array.");
+    return NULL;
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+  Polarization( (double *) PyArray_DATA(fields), num_fields,
+      weights ? (double *) PyArray_DATA(weights) : NULL,
+      direction ? (double *) PyArray_DATA(direction) : NULL,
+      powder, nbins,
+      (double *) PyArray_DATA(times), (unsigned int) out_dim[0],
+      (double *) PyArray_DATA(opol));
+  Py_END_ALLOW_THREADS
+
+  Py_DECREF(fields);
+  Py_DECREF(times);
+  Py_XDECREF(weights);
+  Py_XDECREF(direction);
+
+  return (PyObject *) opol;
+}
+
+static PyObject * py_lfclib_hist(PyObject *self, PyObject *args, PyObject *kwargs) {
+
+  char *calc_type = NULL, *precision = NULL;
+  double r=0.0, rcont=0.0, bmax=0.0, acont=0.0;
+  unsigned int nnn=0, nangles=0, nbins=0, flags=0;
+  PyObject *opositions, *oFC, *oK, *oPhi, *omu, *osupercell, *ocell;
+  PyObject *orot_axis = NULL, *oweights = NULL;
+  PyArrayObject *positions, *FC, *K, *Phi, *mu, *supercell, *cell;
+  PyArrayObject *rot_axis = NULL, *weights = NULL;
+  PyArrayObject *ohist = NULL, *ocomp = NULL;
+
+  int num_atoms=0, num_sites=0, rotate=0;
+  npy_intp * pShape;
+  npy_intp out_dim[2];
+
+  static char *kwlist[] = {"calc_type", "positions", "FC", "K", "Phi",
+                           "Muons", "Supercell", "Cell", "r", "nnn", "rcont",
+                           "nangles", "nbins", "bmax", "rot_axis", "ACont",
+                           "weights", "precision", NULL};
+
+  /* put arguments into variables */
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "sOOOOOOOdIdIId|OdOs", kwlist,
+                            &calc_type, &opositions, &oFC, &oK, &oPhi, &omu,
+                            &osupercell, &ocell, &r, &nnn, &rcont, &nangles,
+                            &nbins, &bmax, &orot_axis, &acont, &oweights,
+                            &precision))
+  {
+    return NULL;
+  }
+
+  if (parse_precision(precision, &flags) < 0) {
+    return NULL;
+  }
+  if (strcmp(calc_type, "r")==0 || strcmp(calc_type, "rotate")==0) {
+    rotate = 1;
+  } else if (!(strcmp(calc_type, "i")==0 || strcmp(calc_type, "incommensurate")==0)) {
+    PyErr_Format(PyExc_ValueError,
+                   "Valid calculations are 'r', 'i'.  Unknown value %s", calc_type);
+    return NULL;
+  }
+  if (rotate && (orot_axis == NULL || orot_axis == Py_None)) {
+    PyErr_SetString(PyExc_ValueError, "Axis for rotation required!");
+    return NULL;
+  }
+  if (nangles < 1 || nbins < 1 || !(bmax > 0.0)) {
+    PyErr_SetString(PyExc_ValueError,
+                    "nangles, nbins and bmax must be greater than 0.");
+    return NULL;
+  }
+  if (nnn > 200) {
+    PyErr_Format(PyExc_RuntimeError,
+                    "Error, number of nearest neighbours exceedingly large.");
+    return NULL;
+  }
+
+  /* turn inputs into numpy array types */
+  positions = (PyArrayObject *) PyArray_FROMANY(opositions, NPY_DOUBLE, 2, 2,
+                                              NPY_ARRAY_IN_ARRAY);
+  FC = (PyArrayObject *) PyArray_FROMANY(oFC, NPY_COMPLEX128, 2, 2,
+                                              NPY_ARRAY_IN_ARRAY);
+  K = (PyArrayObject *) PyArray_FROMANY(oK, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+  Phi = (PyArrayObject *) PyArray_FROMANY(oPhi, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+  mu = (PyArrayObject *) PyArray_FROMANY(omu, NPY_DOUBLE, 2, 2,
+                                              NPY_ARRAY_IN_ARRAY);
+  supercell = (PyArrayObject *) PyArray_FROMANY(osupercell, NPY_INT32,
+                                                   1, 1, NPY_ARRAY_IN_ARRAY);
+  cell = (PyArrayObject *) PyArray_FROMANY(ocell, NPY_DOUBLE, 2, 2,
+                                             NPY_ARRAY_IN_ARRAY);
+  if (rotate)
+    rot_axis = (PyArrayObject *) PyArray_FROMANY(orot_axis, NPY_DOUBLE, 1, 1,
+                                             NPY_ARRAY_IN_ARRAY);
+  if (oweights != NULL && oweights != Py_None)
+    weights = (PyArrayObject *) PyArray_FROMANY(oweights, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+
+  /* Validate data */
+  if (!positions || !FC || !K || !Phi || !mu || !supercell || !cell ||
+      (rotate && !rot_axis) ||
+      (oweights != NULL && oweights != Py_None && !weights)) {
+    Py_XDECREF(positions);
+    Py_XDECREF(FC);
+    Py_XDECREF(K);
+    Py_XDECREF(Phi);
+    Py_XDECREF(mu);
+    Py_XDECREF(supercell);
+    Py_XDECREF(cell);
+    Py_XDECREF(rot_axis);
+    Py_XDECREF(weights);
+    PyErr_Format(PyExc_RuntimeError,
+                    "Error parsing numpy arrays.");
+    return NULL;
+  }
+
+  pShape = PyArray_SHAPE(positions);
+  num_atoms = pShape[0];
+  num_sites = PyArray_SHAPE(mu)[0];
+
+  if (pShape[1] != 3 || PyArray_SHAPE(FC)[0] != num_atoms ||
+      PyArray_SHAPE(FC)[1] != 3 || PyArray_SIZE(K) != 3 ||
+      PyArray_SIZE(Phi) != num_atoms || PyArray_SHAPE(mu)[1] != 3 ||
+      PyArray_SIZE(supercell) != 3 || PyArray_SIZE(cell) != 9 ||
+      (rot_axis && PyArray_SIZE(rot_axis) != 3) ||
+      (weights && PyArray_SIZE(weights) != num_sites)) {
+    Py_DECREF(positions);
+    Py_DECREF(FC);
+    Py_DECREF(K);
+    Py_DECREF(Phi);
+    Py_DECREF(mu);
+    Py_DECREF(supercell);
+    Py_DECREF(cell);
+    Py_XDECREF(rot_axis);
+    Py_XDECREF(weights);
+    PyErr_SetString(PyExc_RuntimeError, "Inconsistent shapes of the input arrays.");
+    return NULL;
+  }
+
+  /* allocate output arrays */
+  out_dim[0] = (npy_intp) 3;
+  out_dim[1] = (npy_intp) nbins;
+  ohist = (PyArrayObject *) PyArray_ZEROS(1, out_dim + 1, NPY_DOUBLE,0);
+  ocomp = (PyArrayObject *) PyArray_ZEROS(2, out_dim, NPY_DOUBLE,0);
+
+  if (!ohist || !ocomp) {
+    Py_XDECREF(ohist);
+    Py_XDECREF(ocomp);
+    Py_DECREF(positions);
+    Py_DECREF(FC);
+    Py_DECREF(K);
+    Py_DECREF(Phi);
+    Py_DECREF(mu);
+    Py_DECREF(supercell);
+    Py_DECREF(cell);
+    Py_XDECREF(rot_axis);
+    Py_XDECREF(weights);
+    PyErr_SetString(PyExc_MemoryError, "Cannot create output arrays.");
+    return NULL;
   }
 
+  /* long computation starts here. No python object is touched so free thread execution */
+  Py_BEGIN_ALLOW_THREADS
+  if (rotate) {
+    RotataHistogram( (double *) PyArray_DATA(positions),
+        (double *) PyArray_DATA(FC),
+        (double *) PyArray_DATA(K),
+        (double *) PyArray_DATA(Phi),
+        (double *) PyArray_DATA(mu), num_sites,
+        weights ? (double *) PyArray_DATA(weights) : NULL,
+        (int *) PyArray_DATA(supercell),
+        (double *) PyArray_DATA(cell),
+        r, nnn, rcont, num_atoms,
+        (double *) PyArray_DATA(rot_axis), nangles, flags, acont,
+        nbins, bmax,
+        (double *) PyArray_DATA(ohist),
+        (double *) PyArray_DATA(ocomp));
+  } else {
+    FastIncommHistogram( (double *) PyArray_DATA(positions),
+        (double *) PyArray_DATA(FC),
+        (double *) PyArray_DATA(K),
+        (double *) PyArray_DATA(Phi),
+        (double *) PyArray_DATA(mu), num_sites,
+        weights ? (double *) PyArray_DATA(weights) : NULL,
+        (int *) PyArray_DATA(supercell),
+        (double *) PyArray_DATA(cell),
+        r, nnn, rcont, num_atoms,
+        nangles, flags, acont,
+        nbins, bmax,
+        (double *) PyArray_DATA(ohist),
+        (double *) PyArray_DATA(ocomp));
+  }
+  Py_END_ALLOW_THREADS
 
-  /* to avoid problems with int types */
-  in_supercell = malloc(3*sizeof(int));
-  in_supercell[0] = *(npy_int64 *)PyArray_GETPTR1(supercell, 0);
-  in_supercell[1] = *(npy_int64 *)PyArray_GETPTR1(supercell, 1);
-  in_supercell[2] = *(npy_int64 *)PyArray_GETPTR1(supercell, 2);
-  
- 
-  nd = 2; 
-  out_dim= (npy_intp *)malloc(2 * sizeof(npy_intp));
-  out_dim[0] = (npy_intp) 3;
-  out_dim[1] = (npy_intp) 3;
-  
-  odt = (PyArrayObject *) PyArray_ZEROS(nd, out_dim, NPY_DOUBLE,0);
-  
-  free(out_dim);
+  Py_DECREF(positions);
+  Py_DECREF(FC);
+  Py_DECREF(K);
+  Py_DECREF(Phi);
+  Py_DECREF(mu);
+  Py_DECREF(supercell);
+  Py_DECREF(cell);
+  Py_XDECREF(rot_axis);
+  Py_XDECREF(weights);
 
-  if (!odt) {
+  return Py_BuildValue("NN", ohist, ocomp);
+}
+
+static PyObject * py_lfclib_fpol(PyObject *self, PyObject *args, PyObject *kwargs) {
+
+  char *calc_type = NULL, *precision = NULL;
+  double r=0.0, rcont=0.0, bmax=0.0, acont=0.0;
+  unsigned int nnn=0, nangles=0, nbins=0, flags=0, powder=0;
+  PyObject *opositions, *oFC, *oK, *oPhi, *omu, *osupercell, *ocell, *otimes;
+  PyObject *orot_axis = NULL, *oweights = NULL, *odirection = NULL;
+  PyArrayObject *positions, *FC, *K, *Phi, *mu, *supercell, *cell, *times;
+  PyArrayObject *rot_axis = NULL, *weights = NULL, *direction = NULL;
+  PyArrayObject *opol = NULL;
+
+  int num_atoms=0, num_sites=0, rotate=0;
+  npy_intp * pShape;
+  npy_intp out_dim[1];
+
+  static char *kwlist[] = {"calc_type", "positions", "FC", "K", "Phi",
+                           "Muons", "Supercell", "Cell", "r", "nnn", "rcont",
+                           "nangles", "nbins", "bmax", "times", "rot_axis",
+                           "ACont", "weights", "direction", "powder",
+                           "precision", NULL};
+
+  /* put arguments into variables */
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "sOOOOOOOdIdIIdO|OdOOIs", kwlist,
+                            &calc_type, &opositions, &oFC, &oK, &oPhi, &omu,
+                            &osupercell, &ocell, &r, &nnn, &rcont, &nangles,
+                            &nbins, &bmax, &otimes, &orot_axis, &acont,
+                            &oweights, &odirection, &powder, &precision))
+  {
+    return NULL;
+  }
+
+  if (parse_precision(precision, &flags) < 0) {
+    return NULL;
+  }
+  if (strcmp(calc_type, "r")==0 || strcmp(calc_type, "rotate")==0) {
+    rotate = 1;
+  } else if (!(strcmp(calc_type, "i")==0 || strcmp(calc_type, "incommensurate")==0)) {
+    PyErr_Format(PyExc_ValueError,
+                   "Valid calculations are 'r', 'i'.  Unknown value %s", calc_type);
+    return NULL;
+  }
+  if (rotate && (orot_axis == NULL || orot_axis == Py_None)) {
+    PyErr_SetString(PyExc_ValueError, "Axis for rotation required!");
+    return NULL;
+  }
+  if (nangles < 1 || nbins < 1 || !(bmax > 0.0)) {
+    PyErr_SetString(PyExc_ValueError,
+                    "nangles, nbins and bmax must be greater than 0.");
+    return NULL;
+  }
+  if (nnn > 200) {
+    PyErr_Format(PyExc_RuntimeError,
+                    "Error, number of nearest neighbours exceedingly large.");
+    return NULL;
+  }
+
+  /* turn inputs into numpy array types */
+  positions = (PyArrayObject *) PyArray_FROMANY(opositions, NPY_DOUBLE, 2, 2,
+                                              NPY_ARRAY_IN_ARRAY);
+  FC = (PyArrayObject *) PyArray_FROMANY(oFC, NPY_COMPLEX128, 2, 2,
+                                              NPY_ARRAY_IN_ARRAY);
+  K = (PyArrayObject *) PyArray_FROMANY(oK, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+  Phi = (PyArrayObject *) PyArray_FROMANY(oPhi, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+  mu = (PyArrayObject *) PyArray_FROMANY(omu, NPY_DOUBLE, 2, 2,
+                                              NPY_ARRAY_IN_ARRAY);
+  supercell = (PyArrayObject *) PyArray_FROMANY(osupercell, NPY_INT32,
+                                                   1, 1, NPY_ARRAY_IN_ARRAY);
+  cell = (PyArrayObject *) PyArray_FROMANY(ocell, NPY_DOUBLE, 2, 2,
+                                             NPY_ARRAY_IN_ARRAY);
+  times = (PyArrayObject *) PyArray_FROMANY(otimes, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+  if (rotate)
+    rot_axis = (PyArrayObject *) PyArray_FROMANY(orot_axis, NPY_DOUBLE, 1, 1,
+                                             NPY_ARRAY_IN_ARRAY);
+  if (oweights != NULL && oweights != Py_None)
+    weights = (PyArrayObject *) PyArray_FROMANY(oweights, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+  if (odirection != NULL && odirection != Py_None)
+    direction = (PyArrayObject *) PyArray_FROMANY(odirection, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+
+  /* Validate data */
+  if (!positions || !FC || !K || !Phi || !mu || !supercell || !cell || !times ||
+      (rotate && !rot_axis) ||
+      (oweights != NULL && oweights != Py_None && !weights) ||
+      (odirection != NULL && odirection != Py_None && !direction)) {
     Py_XDECREF(positions);
+    Py_XDECREF(FC);
+    Py_XDECREF(K);
+    Py_XDECREF(Phi);
     Py_XDECREF(mu);
     Py_XDECREF(supercell);
     Py_XDECREF(cell);
-    if (in_supercell != NULL)
-      free(in_supercell);
+    Py_XDECREF(times);
+    Py_XDECREF(rot_axis);
+    Py_XDECREF(weights);
+    Py_XDECREF(direction);
+    PyErr_Format(PyExc_RuntimeError,
+                    "Error parsing numpy arrays.");
+    return NULL;
+  }
+
+  pShape = PyArray_SHAPE(positions);
+  num_atoms = pShape[0];
+  num_sites = PyArray_SHAPE(mu)[0];
+
+  if (pShape[1] != 3 || PyArray_SHAPE(FC)[0] != num_atoms ||
+      PyArray_SHAPE(FC)[1] != 3 || PyArray_SIZE(K) != 3 ||
+      PyArray_SIZE(Phi) != num_atoms || PyArray_SHAPE(mu)[1] != 3 ||
+      PyArray_SIZE(supercell) != 3 || PyArray_SIZE(cell) != 9 ||
+      (rot_axis && PyArray_SIZE(rot_axis) != 3) ||
+      (weights && PyArray_SIZE(weights) != num_sites) ||
+      (direction && PyArray_SIZE(direction) != 3)) {
+    Py_DECREF(positions);
+    Py_DECREF(FC);
+    Py_DECREF(K);
+    Py_DECREF(Phi);
+    Py_DECREF(mu);
+    Py_DECREF(supercell);
+    Py_DECREF(cell);
+    Py_DECREF(times);
+    Py_XDECREF(rot_axis);
+    Py_XDECREF(weights);
+    Py_XDECREF(direction);
+    PyErr_SetString(PyExc_RuntimeError, "Inconsistent shapes of the input arrays.");
+    return NULL;
+  }
+
+  /* allocate output array */
+  out_dim[0] = PyArray_SIZE(times);
+  opol = (PyArrayObject *) PyArray_ZEROS(1, out_dim, NPY_DOUBLE,0);
+
+  if (!opol) {
+    Py_DECREF(positions);
+    Py_DECREF(FC);
+    Py_DECREF(K);
+    Py_DECREF(Phi);
+    Py_DECREF(mu);
+    Py_DECREF(supercell);
+    Py_DECREF(cell);
+    Py_DECREF(times);
+    Py_XDECREF(rot_axis);
+    Py_XDECREF(weights);
+    Py_XDECREF(direction);
     PyErr_SetString(PyExc_MemoryError, "Cannot create output array.");
     return NULL;
   }
-  
+
   /* long computation starts here. No python object is touched so free thread execution */
-  Py_BEGIN_ALLOW_THREADS  
-  DipolarTensor( (double *) PyArray_DATA(positions),
+  Py_BEGIN_ALLOW_THREADS
+  if (rotate) {
+    RotataPolarization( (double *) PyArray_DATA(positions),
+        (double *) PyArray_DATA(FC),
+        (double *) PyArray_DATA(K),
+        (double *) PyArray_DATA(Phi),
+        (double *) PyArray_DATA(mu), num_sites,
+        weights ? (double *) PyArray_DATA(weights) : NULL,
+        (int *) PyArray_DATA(supercell),
+        (double *) PyArray_DATA(cell),
+        r, nnn, rcont, num_atoms,
+        (double *) PyArray_DATA(rot_axis), nangles, flags, acont,
+        direction ? (double *) PyArray_DATA(direction) : NULL, powder,
+        nbins, bmax,
+        (double *) PyArray_DATA(times), (unsigned int) out_dim[0],
+        (double *) PyArray_DATA(opol));
+  } else {
+    FastIncommPolarization( (double *) PyArray_DATA(positions),
+        (double *) PyArray_DATA(FC),
+        (double *) PyArray_DATA(K),
+        (double *) PyArray_DATA(Phi),
+        (double *) PyArray_DATA(mu), num_sites,
+        weights ? (double *) PyArray_DATA(weights) : NULL,
+        (int *) PyArray_DATA(supercell),
+        (double *) PyArray_DATA(cell),
+        r, nnn, rcont, num_atoms,
+        nangles, flags, acont,
+        direction ? (double *) PyArray_DATA(direction) : NULL, powder,
+        nbins, bmax,
+        (double *) PyArray_DATA(times), (unsigned int) out_dim[0],
+        (double *) PyArray_DATA(opol));
+  }
+  Py_END_ALLOW_THREADS
+
+  Py_DECREF(positions);
+  Py_DECREF(FC);
+  Py_DECREF(K);
+  Py_DECREF(Phi);
+  Py_DECREF(mu);
+  Py_DECREF(supercell);
+  Py_DECREF(cell);
+  Py_DECREF(times);
+  Py_XDECREF(rot_axis);
+  Py_XDECREF(weights);
+  Py_XDECREF(direction);
+
+  return (PyObject *) opol;
+}
+
+static PyObject * py_lfclib_ss(PyObject *self, PyObject *args, PyObject *kwargs) {
+
+  double r=0.0;
+  PyObject *opositions, *omu, *osupercell, *ocell;
+  PyArrayObject *positions, *mu, *supercell, *cell;
+  PyArrayObject *okey = NULL, *otensor = NULL, *odist = NULL;
+
+  unsigned int num_atoms=0, num_sites=0;
+  npy_intp out_dim[2];
+
+  static char *kwlist[] = {"positions", "Muon", "Supercell", "Cell", "r", NULL};
+
+  /* put arguments into variables */
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOOd", kwlist,
+                            &opositions, &omu, &osupercell, &ocell, &r))
+  {
+    return NULL;
+  }
+
+  /* turn inputs into numpy array types */
+  positions = (PyArrayObject *) PyArray_FROMANY(opositions, NPY_DOUBLE, 2, 2,
+                                              NPY_ARRAY_IN_ARRAY);
+  mu = (PyArrayObject *) PyArray_FROMANY(omu, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+  supercell = (PyArrayObject *) PyArray_FROMANY(osupercell, NPY_INT32,
+                                                   1, 1, NPY_ARRAY_IN_ARRAY);
+  cell = (PyArrayObject *) PyArray_FROMANY(ocell, NPY_DOUBLE, 2, 2,
+                                             NPY_ARRAY_IN_ARRAY);
+
+  /* Validate data */
+  if (!positions || !mu || !supercell || !cell) {
+    Py_XDECREF(positions);
+    Py_XDECREF(mu);
+    Py_XDECREF(supercell);
+    Py_XDECREF(cell);
+    PyErr_Format(PyExc_RuntimeError,
+                    "Error parsing numpy arrays.");
+    return NULL;
+  }
+
+  num_atoms = PyArray_SHAPE(positions)[0];
+
+  if (PyArray_SHAPE(positions)[1] != 3 || PyArray_SIZE(mu) != 3 ||
+      PyArray_SIZE(supercell) != 3 || PyArray_SIZE(cell) != 9) {
+    Py_DECREF(positions);
+    Py_DECREF(mu);
+    Py_DECREF(supercell);
+    Py_DECREF(cell);
+    PyErr_SetString(PyExc_RuntimeError, "Inconsistent shapes of the input arrays.");
+    return NULL;
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+  num_sites = SphereSites( (double *) PyArray_DATA(positions),
       (double *) PyArray_DATA(mu),
-      in_supercell, 
-      (double *) PyArray_DATA(cell), 
-      r, num_atoms, 
-      (double *) PyArray_DATA(odt));
+      (int *) PyArray_DATA(supercell),
+      (double *) PyArray_DATA(cell),
+      r, num_atoms, NULL, NULL, NULL);
   Py_END_ALLOW_THREADS
-  
-  
+
+  /* allocate output arrays */
+  out_dim[0] = (npy_intp) num_sites;
+  out_dim[1] = (npy_intp) 6;
+  okey = (PyArrayObject *) PyArray_ZEROS(1, out_dim, NPY_ULONG,0);
+  otensor = (PyArrayObject *) PyArray_ZEROS(2, out_dim, NPY_DOUBLE,0);
+  odist = (PyArrayObject *) PyArray_ZEROS(1, out_dim, NPY_DOUBLE,0);
+
+  if (!okey || !otensor || !odist) {
+    Py_XDECREF(okey);
+    Py_XDECREF(otensor);
+    Py_XDECREF(odist);
+    Py_DECREF(positions);
+    Py_DECREF(mu);
+    Py_DECREF(supercell);
+    Py_DECREF(cell);
+    PyErr_SetString(PyExc_MemoryError, "Cannot create output arrays.");
+    return NULL;
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+  SphereSites( (double *) PyArray_DATA(positions),
+      (double *) PyArray_DATA(mu),
+      (int *) PyArray_DATA(supercell),
+      (double *) PyArray_DATA(cell),
+      r, num_atoms,
+      (unsigned long *) PyArray_DATA(okey),
+      (double *) PyArray_DATA(otensor),
+      (double *) PyArray_DATA(odist));
+  Py_END_ALLOW_THREADS
+
   Py_DECREF(positions);
   Py_DECREF(mu);
   Py_DECREF(supercell);
   Py_DECREF(cell);
-  
-  free(in_supercell);
-  return Py_BuildValue("N", odt);
 
+  return Py_BuildValue("NNN", okey, otensor, odist);
+}
+
+/* Parses the tensors and distances returned by SphereSites. */
+static int parse_sites(PyObject *otensor, PyObject *odist,
+                       PyArrayObject **tensor, PyArrayObject **dist) {
+
+  *tensor = (PyArrayObject *) PyArray_FROMANY(otensor, NPY_DOUBLE, 2, 2,
+                                              NPY_ARRAY_IN_ARRAY);
+  *dist = (PyArrayObject *) PyArray_FROMANY(odist, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+  if (!*tensor || !*dist) {
+    Py_XDECREF(*tensor);
+    Py_XDECREF(*dist);
+    PyErr_Format(PyExc_RuntimeError,
+                    "Error parsing numpy arrays.");
+    return -1;
+  }
+  if (PyArray_SHAPE(*tensor)[1] != 6 ||
+      PyArray_SHAPE(*tensor)[0] != PyArray_SIZE(*dist)) {
+    Py_DECREF(*tensor);
+    Py_DECREF(*dist);
+    PyErr_SetString(PyExc_RuntimeError, "Inconsistent shapes of tensors and dist.");
+    return -1;
+  }
+  return 0;
+}
+
+static PyObject * py_lfclib_dis(PyObject *self, PyObject *args, PyObject *kwargs) {
+
+  double r=0.0, rcont=0.0;
+  unsigned int nnn=0;
+  PyObject *otensor, *odist, *omoments;
+  PyArrayObject *tensor, *dist, *moments;
+  PyArrayObject *ocont = NULL, *odip = NULL, *olor = NULL;
+
+  unsigned int num_sites=0, num_conf=0;
+  npy_intp out_dim[2];
+
+  static char *kwlist[] = {"tensors", "dist", "moments", "r", "nnn", "rcont", NULL};
+
+  /* put arguments into variables */
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOdId", kwlist,
+                            &otensor, &odist, &omoments, &r, &nnn, &rcont))
+  {
+    return NULL;
+  }
+
+  if (parse_sites(otensor, odist, &tensor, &dist) < 0) {
+    return NULL;
+  }
+  num_sites = PyArray_SIZE(dist);
+
+  moments = (PyArrayObject *) PyArray_FROMANY(omoments, NPY_DOUBLE, 3, 3,
+                                              NPY_ARRAY_IN_ARRAY);
+  if (!moments || PyArray_SHAPE(moments)[1] != num_sites ||
+      PyArray_SHAPE(moments)[2] != 3) {
+    Py_XDECREF(moments);
+    Py_DECREF(tensor);
+    Py_DECREF(dist);
+    PyErr_SetString(PyExc_RuntimeError, "moments must be a n_conf x n_sites x 3 array.");
+    return NULL;
+  }
+  num_conf = PyArray_SHAPE(moments)[0];
+
+  /* allocate output arrays */
+  out_dim[0] = (npy_intp) num_conf;
+  out_dim[1] = (npy_intp) 3;
+  ocont = (PyArrayObject *) PyArray_ZEROS(2, out_dim, NPY_DOUBLE,0);
+  odip = (PyArrayObject *) PyArray_ZEROS(2, out_dim, NPY_DOUBLE,0);
+  olor = (PyArrayObject *) PyArray_ZEROS(2, out_dim, NPY_DOUBLE,0);
+
+  if (!ocont || !odip || !olor) {
+    Py_XDECREF(ocont);
+    Py_XDECREF(odip);
+    Py_XDECREF(olor);
+    Py_DECREF(moments);
+    Py_DECREF(tensor);
+    Py_DECREF(dist);
+    PyErr_SetString(PyExc_MemoryError, "Cannot create output arrays.");
+    return NULL;
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+  DisorderSum( (double *) PyArray_DATA(tensor),
+      (double *) PyArray_DATA(dist), num_sites,
+      (double *) PyArray_DATA(moments), num_conf,
+      r, nnn, rcont,
+      (double *) PyArray_DATA(ocont),
+      (double *) PyArray_DATA(odip),
+      (double *) PyArray_DATA(olor));
+  Py_END_ALLOW_THREADS
+
+  Py_DECREF(moments);
+  Py_DECREF(tensor);
+  Py_DECREF(dist);
+
+  return Py_BuildValue("NNN", ocont, odip, olor);
+}
+
+static PyObject * py_lfclib_dil(PyObject *self, PyObject *args, PyObject *kwargs) {
+
+  double r=0.0, rcont=0.0;
+  unsigned int nnn=0, nconf=0, random_directions=0;
+  unsigned long seed=0;
+  PyObject *otensor, *odist, *omoments, *ooccupancy = NULL;
+  PyArrayObject *tensor, *dist, *moments, *occupancy = NULL;
+  PyArrayObject *ocont = NULL, *odip = NULL, *olor = NULL;
+
+  unsigned int num_sites=0;
+  npy_intp out_dim[2];
+
+  static char *kwlist[] = {"tensors", "dist", "moments", "nconf", "r", "nnn",
+                           "rcont", "occupancy", "random_directions", "seed", NULL};
+
+  /* put arguments into variables */
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOIdId|OIk", kwlist,
+                            &otensor, &odist, &omoments, &nconf, &r, &nnn,
+                            &rcont, &ooccupancy, &random_directions, &seed))
+  {
+    return NULL;
+  }
+
+  if (parse_sites(otensor, odist, &tensor, &dist) < 0) {
+    return NULL;
+  }
+  num_sites = PyArray_SIZE(dist);
+
+  moments = (PyArrayObject *) PyArray_FROMANY(omoments, NPY_DOUBLE, 2, 2,
+                                              NPY_ARRAY_IN_ARRAY);
+  if (ooccupancy != NULL && ooccupancy != Py_None)
+    occupancy = (PyArrayObject *) PyArray_FROMANY(ooccupancy, NPY_DOUBLE, 1, 1,
+                                              NPY_ARRAY_IN_ARRAY);
+  if (!moments || PyArray_SHAPE(moments)[0] != num_sites ||
+      PyArray_SHAPE(moments)[1] != 3 ||
+      (ooccupancy != NULL && ooccupancy != Py_None &&
+       (!occupancy || PyArray_SIZE(occupancy) != num_sites))) {
+    Py_XDECREF(moments);
+    Py_XDECREF(occupancy);
+    Py_DECREF(tensor);
+    Py_DECREF(dist);
+    PyErr_SetString(PyExc_RuntimeError,
+                    "moments must be n_sites x 3 and occupancy n_sites long.");
+    return NULL;
+  }
+
+  /* allocate output arrays */
+  out_dim[0] = (npy_intp) nconf;
+  out_dim[1] = (npy_intp) 3;
+  ocont = (PyArrayObject *) PyArray_ZEROS(2, out_dim, NPY_DOUBLE,0);
+  odip = (PyArrayObject *) PyArray_ZEROS(2, out_dim, NPY_DOUBLE,0);
+  olor = (PyArrayObject *) PyArray_ZEROS(2, out_dim, NPY_DOUBLE,0);
+
+  if (!ocont || !odip || !olor) {
+    Py_XDECREF(ocont);
+    Py_XDECREF(odip);
+    Py_XDECREF(olor);
+    Py_DECREF(moments);
+    Py_XDECREF(occupancy);
+    Py_DECREF(tensor);
+    Py_DECREF(dist);
+    PyErr_SetString(PyExc_MemoryError, "Cannot create output arrays.");
+    return NULL;
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+  DilutionSample( (double *) PyArray_DATA(tensor),
+      (double *) PyArray_DATA(dist), num_sites,
+      (double *) PyArray_DATA(moments),
+      occupancy ? (double *) PyArray_DATA(occupancy) : NULL,
+      random_directions, nconf, seed,
+      r, nnn, rcont,
+      (double *) PyArray_DATA(ocont),
+      (double *) PyArray_DATA(odip),
+      (double *) PyArray_DATA(olor));
+  Py_END_ALLOW_THREADS
+
+  Py_DECREF(moments);
+  Py_XDECREF(occupancy);
+  Py_DECREF(tensor);
+  Py_DECREF(dist);
+
+  return Py_BuildValue("NNN", ocont, odip, olor);
 }
 
 static PyMethodDef lfclib_methods[] =
 {
-  {"Fields", (PyCFunction)py_lfclib_fields, METH_VARARGS, py_lfclib_fields_docstring},
-  {"DipolarTensor", (PyCFunction)py_lfclib_dt, METH_VARARGS, py_lfclib_dt_docstring},
+  {"Fields", (PyCFunction)py_lfclib_fields, METH_VARARGS | METH_KEYWORDS, py_lfclib_fields_docstring},
+  {"AdaptiveSum", (PyCFunction)py_lfclib_ad, METH_VARARGS | METH_KEYWORDS, py_lfclib_ad_docstring},
+  {"ChargeSum", (PyCFunction)py_lfclib_chs, METH_VARARGS | METH_KEYWORDS, py_lfclib_chs_docstring},
+  {"SessionNew", (PyCFunction)py_lfclib_sn, METH_NOARGS, py_lfclib_sn_docstring},
+  {"SessionUpdate", (PyCFunction)py_lfclib_su, METH_VARARGS | METH_KEYWORDS, py_lfclib_su_docstring},
+  {"SessionEvaluate", (PyCFunction)py_lfclib_se, METH_VARARGS | METH_KEYWORDS, py_lfclib_se_docstring},
+  {"GridMask", (PyCFunction)py_lfclib_gm, METH_VARARGS | METH_KEYWORDS, py_lfclib_gm_docstring},
+  {"GridScan", (PyCFunction)py_lfclib_gs, METH_VARARGS | METH_KEYWORDS, py_lfclib_gs_docstring},
+  {"HybridSum", (PyCFunction)py_lfclib_hy, METH_VARARGS | METH_KEYWORDS, py_lfclib_hy_docstring},
+  {"ExtrapolatedSum", (PyCFunction)py_lfclib_ex, METH_VARARGS | METH_KEYWORDS, py_lfclib_ex_docstring},
+  {"DipolarTensor", (PyCFunction)py_lfclib_dt, METH_VARARGS | METH_KEYWORDS, py_lfclib_dt_docstring},
+  {"FusedSum", (PyCFunction)py_lfclib_fs, METH_VARARGS | METH_KEYWORDS, py_lfclib_fs_docstring},
+  {"DomainSum", (PyCFunction)py_lfclib_ds, METH_VARARGS | METH_KEYWORDS, py_lfclib_ds_docstring},
+  {"ConfigSum", (PyCFunction)py_lfclib_cs, METH_VARARGS | METH_KEYWORDS, py_lfclib_cs_docstring},
+  {"ConfigResponse", (PyCFunction)py_lfclib_cr, METH_VARARGS | METH_KEYWORDS, py_lfclib_cr_docstring},
+  {"FitMoments", (PyCFunction)py_lfclib_fit, METH_VARARGS | METH_KEYWORDS, py_lfclib_fit_docstring},
+  {"StrainSum", (PyCFunction)py_lfclib_st, METH_VARARGS | METH_KEYWORDS, py_lfclib_st_docstring},
+  {"Polarization", (PyCFunction)py_lfclib_pol, METH_VARARGS | METH_KEYWORDS, py_lfclib_pol_docstring},
+  {"Histogram", (PyCFunction)py_lfclib_hist, METH_VARARGS | METH_KEYWORDS, py_lfclib_hist_docstring},
+  {"FieldPolarization", (PyCFunction)py_lfclib_fpol, METH_VARARGS | METH_KEYWORDS, py_lfclib_fpol_docstring},
+  {"SphereSites", (PyCFunction)py_lfclib_ss, METH_VARARGS | METH_KEYWORDS, py_lfclib_ss_docstring},
+  {"DisorderSum", (PyCFunction)py_lfclib_dis, METH_VARARGS | METH_KEYWORDS, py_lfclib_dis_docstring},
+  {"DilutionSample", (PyCFunction)py_lfclib_dil, METH_VARARGS | METH_KEYWORDS, py_lfclib_dil_docstring},
   {NULL}  /* sentinel */
 };
 
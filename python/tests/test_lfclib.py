@@ -1,5 +1,6 @@
 # -*- coding: utf-8 -*-
 import lfclib, unittest
+import os, sys, subprocess
 import numpy as np
 
 # http://stackoverflow.com/a/6802723
@@ -323,6 +324,317 @@ class TestLFCExtension(unittest.TestCase):
         
 
     
+    def test_adaptive_sum(self):
+        latpar = np.array([[4.,0.,0.],[1.,4.,0.],[0.3,0.2,5.]])
+        p  = np.array([[0.,0.,0.],[0.5,0.5,0.5]])
+        fc = np.array([[1.,1.j,0.],[0.,0.5,1.]],dtype=np.complex128)
+        k  = np.array([0.13,0.,0.1])
+        phi= np.array([0.,0.2])
+        mu = np.array([0.23,0.11,0.07])
+        sc = np.array([20,20,16],dtype=np.int32)
+
+        # with zero tolerance the sphere grows up to rmax: same as Fields
+        c,d,l,r,err,conv = lfclib.AdaptiveSum(p,fc,k,phi,mu,latpar,30.,2,6.,0.,0.,origin=sc//2)
+        self.assertEqual(conv, 0)
+        self.assertEqual(r, 30.)
+        c0,d0,l0 = lfclib.Fields('s',p,fc,k,phi,mu,sc,latpar,30.,2,6.)
+        np.testing.assert_allclose(d, d0, rtol=1e-10, atol=1e-12)
+        np.testing.assert_allclose(l, l0, rtol=1e-10, atol=1e-12)
+        np.testing.assert_allclose(c, c0, rtol=1e-10, atol=1e-12)
+
+        # ferromagnet: the radius grows with the required accuracy
+        fc = np.array([[0.,0.,1.],[0.,0.,1.]],dtype=np.complex128)
+        k = np.zeros(3)
+        sc = np.array([121,121,97],dtype=np.int32)
+        c0,d0,l0 = lfclib.Fields('s',p,fc,k,phi,mu,sc,latpar,220.,2,6.)
+        radii = []
+        for atol in (1e-3, 1e-4):
+            c,d,l,r,err,conv = lfclib.AdaptiveSum(p,fc,k,phi,mu,latpar,220.,2,6.,atol)
+            self.assertEqual(conv, 1)
+            self.assertLessEqual(err, atol)
+            self.assertLess(np.linalg.norm(d+l-d0-l0), 2*atol)
+            np.testing.assert_allclose(c, c0, rtol=1e-10, atol=1e-12)
+            c1,d1,l1 = lfclib.Fields('s',p,fc,k,phi,mu,sc,latpar,r,2,6.)
+            np.testing.assert_allclose(d, d1, rtol=1e-10, atol=1e-12)
+            radii.append(r)
+        self.assertLess(radii[0], radii[1])
+
+        self.assertRaises(ValueError, lfclib.AdaptiveSum, p,fc,k,phi,mu,latpar,-1.,2,6.)
+
+    def test_extrapolated_sum(self):
+        latpar = np.array([[4.,0.,0.],[1.,4.,0.],[0.3,0.2,5.]])
+        p  = np.array([[0.,0.,0.],[0.5,0.5,0.5]])
+        fc = np.array([[1.,1.j,0.],[0.,0.5,1.]],dtype=np.complex128)
+        k  = np.array([0.13,0.,0.1])
+        phi= np.array([0.,0.2])
+        mu = np.array([0.23,0.11,0.07])
+        sc = np.array([20,20,16],dtype=np.int32)
+
+        # a single radius is the plain sum
+        c,d,l,t,err,part = lfclib.ExtrapolatedSum(p,fc,k,phi,mu,sc,latpar,30.,2,6.,nradii=1)
+        c0,d0,l0 = lfclib.Fields('s',p,fc,k,phi,mu,sc,latpar,30.,2,6.)
+        np.testing.assert_allclose(d, d0, rtol=1e-10, atol=1e-12)
+        np.testing.assert_allclose(l, l0, rtol=1e-10, atol=1e-12)
+        np.testing.assert_allclose(c, c0, rtol=1e-10, atol=1e-12)
+        np.testing.assert_allclose(t, lfclib.DipolarTensor(p,mu,sc,latpar,30.), rtol=1e-10, atol=1e-12)
+        self.assertEqual(part.shape, (1,15))
+        np.testing.assert_array_almost_equal(err, np.zeros(2))
+
+        # the partial sums are the plain sums at the intermediate radii
+        c,d,l,t,err,part = lfclib.ExtrapolatedSum(p,fc,k,phi,mu,sc,latpar,30.,2,6.,nradii=8)
+        self.assertEqual(part.shape, (8,15))
+        for i in (0, 3, 7):
+            ri = 15.*(1. + (i+1)/8.)
+            c0,d0,l0 = lfclib.Fields('s',p,fc,k,phi,mu,sc,latpar,ri,2,6.)
+            np.testing.assert_allclose(part[i,0:3], d0, rtol=1e-10, atol=1e-12)
+            np.testing.assert_allclose(part[i,3:6], l0, rtol=1e-10, atol=1e-12)
+            np.testing.assert_allclose(part[i,6:].reshape(3,3),
+                                       lfclib.DipolarTensor(p,mu,sc,latpar,ri), rtol=1e-10, atol=1e-12)
+        np.testing.assert_allclose(d + l, np.mean(part[:,0:3] + part[:,3:6], axis=0))
+        self.assertTrue(np.all(err > 0))
+
+        # ferromagnet: closer to the limit than the plain sum on average,
+        # and within the estimated error of the large radius reference
+        fc = np.array([[0.,0.,1.],[0.,0.,1.]],dtype=np.complex128)
+        k = np.zeros(3)
+        sc = np.array([101,101,81],dtype=np.int32)
+        c,d,l,t,err,part = lfclib.ExtrapolatedSum(p,fc,k,phi,mu,sc,latpar,190.,2,6.)
+        ref = d + l
+        reft = t
+        e_ext = []
+        e_sum = []
+        for r in np.arange(15., 40., 1.3):
+            c,d,l,t,err,part = lfclib.ExtrapolatedSum(p,fc,k,phi,mu,sc,latpar,r,2,6.)
+            c0,d0,l0 = lfclib.Fields('s',p,fc,k,phi,mu,sc,latpar,r,2,6.)
+            e_ext.append(np.linalg.norm(d + l - ref))
+            e_sum.append(np.linalg.norm(d0 + l0 - ref))
+            self.assertLessEqual(e_ext[-1], err[0])
+            self.assertLessEqual(np.linalg.norm(t - reft), err[1])
+        self.assertLess(np.mean(e_ext), 0.6*np.mean(e_sum))
+
+        self.assertRaises(ValueError, lfclib.ExtrapolatedSum, p,fc,k,phi,mu,sc,latpar,30.,2,6.,nradii=0)
+
+    def test_hybrid_sum(self):
+        latpar = np.diag([2.,2.2,2.5])
+        p  = np.array([[0.,0.,0.],[0.5,0.5,0.5]])
+        fc = np.array([[0.,0.3,1.],[1.j,0.2,0.5j]],dtype=np.complex128)
+        k  = np.array([0.03,0.01,0.02])
+        phi= np.array([0.,0.1])
+        mu = np.array([0.25,0.1,0.3])
+        sc = np.array([130,120,100],dtype=np.int32)
+
+        # no shell: same as Fields
+        c,d,l,err = lfclib.HybridSum(p,fc,k,phi,mu,latpar,30.,30.,2,6.,origin=sc//2)
+        c0,d0,l0 = lfclib.Fields('s',p,fc,k,phi,mu,sc,latpar,30.,2,6.)
+        np.testing.assert_allclose(d, d0, rtol=1e-10, atol=1e-12)
+        np.testing.assert_allclose(l, l0, rtol=1e-10, atol=1e-12)
+        np.testing.assert_allclose(c, c0, rtol=1e-10, atol=1e-12)
+        self.assertGreater(err, 0.)
+
+        # the continuum shell recovers the field of the large sphere
+        c0,d0,l0 = lfclib.Fields('s',p,fc,k,phi,mu,sc,latpar,110.,2,6.)
+        c1,d1,l1 = lfclib.Fields('s',p,fc,k,phi,mu,sc,latpar,30.,2,6.)
+        c,d,l,err = lfclib.HybridSum(p,fc,k,phi,mu,latpar,110.,30.,2,6.,origin=sc//2)
+        self.assertLess(np.linalg.norm(d+l-d0-l0), err)
+        self.assertLess(10*np.linalg.norm(d+l-d0-l0), np.linalg.norm(d1+l1-d0-l0))
+        np.testing.assert_allclose(c, c0, rtol=1e-10, atol=1e-12)
+
+        # ferromagnet: the shell does not contribute
+        k = np.zeros(3)
+        c,d,l,err = lfclib.HybridSum(p,fc,k,phi,mu,latpar,110.,30.,2,6.)
+        c1,d1,l1 = lfclib.Fields('s',p,fc,k,phi,mu,sc,latpar,30.,2,6.)
+        np.testing.assert_allclose(d, d1, rtol=1e-10, atol=1e-12)
+        np.testing.assert_allclose(l, l1, rtol=1e-10, atol=1e-12)
+
+        self.assertRaises(ValueError, lfclib.HybridSum, p,fc,k,phi,mu,latpar,10.,20.,2,6.)
+
+    def test_grid_scan(self):
+        latpar = np.array([[4.,0.,0.],[0.5,4.2,0.],[0.3,0.2,5.]])
+        p  = np.array([[0.,0.,0.],[0.5,0.5,0.5]])
+        fc = np.array([[0.,0.3,1.],[1.j,0.2,0.5j]],dtype=np.complex128)
+        k  = np.array([0.1,0.,0.25])
+        phi= np.array([0.,0.1])
+        sc = np.array([30,30,24],dtype=np.int32)
+
+        # excluded points, against all the images of the atoms
+        atoms = np.array([[0.,0.,0.],[0.5,0.5,0.5],[0.5,0.,0.]])
+        grid = np.array([6,6,5],dtype=np.int32)
+        mask = lfclib.GridMask(atoms, latpar, grid, 1.2)
+        self.assertEqual(mask.shape, (6,6,5))
+        shifts = np.array(np.meshgrid([-1,0,1],[-1,0,1],[-1,0,1])).reshape(3,-1).T
+        for idx in np.ndindex(6,6,5):
+            x = np.array(idx)/grid
+            d = min(np.linalg.norm(np.dot(a + s - x, latpar)) for a in atoms for s in shifts)
+            self.assertEqual(mask[idx], d >= 1.2)
+
+        # fields and tensors as Fields and DipolarTensor
+        pts = np.argwhere(mask)[::7]/grid
+        c,d,l,t = lfclib.GridScan(p,fc,k,phi,pts,latpar,30.,2,5.,origin=sc//2,tensor=1)
+        self.assertEqual(t.shape, (len(pts),3,3))
+        for i, mu in enumerate(pts):
+            c0,d0,l0 = lfclib.Fields('s',p,fc,k,phi,mu,sc,latpar,30.,2,5.)
+            np.testing.assert_allclose(c[i], c0, rtol=1e-10, atol=1e-12)
+            np.testing.assert_allclose(d[i], d0, rtol=1e-10, atol=1e-12)
+            np.testing.assert_allclose(l[i], l0, rtol=1e-10, atol=1e-12)
+            np.testing.assert_allclose(t[i], lfclib.DipolarTensor(p,mu,sc,latpar,30.),
+                                       rtol=1e-10, atol=1e-12)
+
+        c,d,l,t = lfclib.GridScan(p,fc,k,phi,pts,latpar,30.,2,5.)
+        self.assertIsNone(t)
+        self.assertRaises(ValueError, lfclib.GridMask, atoms, latpar, grid, -1.)
+
+    def test_charge_sum(self):
+        # rock salt, the muon in the tetrahedral site
+        latpar = np.diag([5.64, 5.64, 5.64])
+        na = np.array([[0.,0.,0.],[0.5,0.5,0.],[0.5,0.,0.5],[0.,0.5,0.5]])
+        p = np.vstack([na, na + 0.5])
+        q = np.array([1.]*4 + [-1.]*4)
+        sc = np.array([9,9,9],dtype=np.int32)
+        r = 20.
+
+        mu = np.array([0.25,0.25,0.25])
+        v, efg = lfclib.ChargeSum(p, q, mu, sc, latpar, r)
+        np.testing.assert_array_almost_equal(efg, np.zeros([3,3]))
+
+        mu = np.array([0.21,0.3,0.13])
+        v, efg = lfclib.ChargeSum(p, q, mu, sc, latpar, r)
+        pos = np.array([np.dot(x + n, latpar) for n in np.ndindex(9,9,9) for x in p]) \
+              - np.dot(mu + sc//2, latpar)
+        qq = np.tile(q, 9**3)
+        d = np.linalg.norm(pos, axis=1)
+        sel = d < r
+        vref = 14.399645*np.sum(qq[sel]/d[sel])
+        eref = 14.399645*np.einsum('n,ni,nj->ij', qq[sel]/d[sel]**5, 3*pos[sel], pos[sel]) \
+               - 14.399645*np.sum(qq[sel]/d[sel]**3)*np.eye(3)
+        self.assertAlmostEqual(v, vref)
+        np.testing.assert_allclose(efg, eref, rtol=1e-10, atol=1e-10)
+        self.assertAlmostEqual(np.trace(efg), 0.)
+
+    def test_session(self):
+        latpar = np.diag([2.,3.,4.])
+        p = np.array([[0.,0.,0.],[0.5,0.5,0.5]])
+        fc = np.array([[0,0,1.],[0,1j,1.]],dtype=np.complex128)
+        k = np.array([0.1,0.,0.])
+        phi = np.array([0.,0.2])
+        mus = np.array([[0.1,0.2,0.3],[0.4,0.1,0.2]])
+        sc = np.array([20,20,20],dtype=np.int32)
+        r = 15.
+
+        s = lfclib.SessionNew()
+        self.assertTrue(lfclib.SessionUpdate(s, Cell=latpar, Supercell=sc, positions=p,
+                                             FC=fc, Phi=phi, K=k, Muons=mus, r=r, nnn=2, rcont=10.))
+        c, d, l, t, n = lfclib.SessionEvaluate(s, tensor=1)
+        self.assertEqual(n, 2)
+        for i, mu in enumerate(mus):
+            rc, rd, rl = lfclib.Fields('s', p,fc,k,phi,mu,sc,latpar,r,2,10.)
+            np.testing.assert_array_almost_equal(c[i], rc)
+            np.testing.assert_array_almost_equal(d[i], rd)
+            np.testing.assert_array_almost_equal(l[i], rl)
+            np.testing.assert_array_almost_equal(t[i], lfclib.DipolarTensor(p,mu,sc,latpar,r))
+
+        # nothing changed, moments only, one muon site
+        self.assertFalse(lfclib.SessionUpdate(s, FC=fc, Phi=phi, r=r))
+        self.assertEqual(lfclib.SessionEvaluate(s)[4], 0)
+        lfclib.SessionUpdate(s, FC=2*fc, Phi=phi)
+        c2, d2, l2, t2, n = lfclib.SessionEvaluate(s)
+        self.assertEqual(n, 0)
+        self.assertIsNone(t2)
+        np.testing.assert_array_almost_equal(d2, 2*d)
+        mus[1] += 0.01
+        lfclib.SessionUpdate(s, Muons=mus)
+        c2, d2, l2, t2, n = lfclib.SessionEvaluate(s)
+        self.assertEqual(n, 1)
+        np.testing.assert_array_almost_equal(d2[1], lfclib.Fields('s', p,2*fc,k,phi,mus[1],sc,latpar,r,2,10.)[1])
+
+        self.assertRaises(RuntimeError, lfclib.SessionUpdate, s, FC=fc[:1], Phi=phi)
+        self.assertRaises(ValueError, lfclib.SessionUpdate, s, r=-1.)
+
+        # a failed update leaves the session untouched
+        self.assertRaises(RuntimeError, lfclib.SessionUpdate, s, Cell=2*latpar, Supercell=sc,
+                          K=2*k, Muons=mus[:,:2])
+        self.assertRaises(RuntimeError, lfclib.SessionUpdate, s, positions=p[:1], FC=fc, Phi=phi)
+        self.assertRaises(ValueError, lfclib.SessionUpdate, s, Muons=mus+0.1, r=-1.)
+        self.assertRaises(TypeError, lfclib.SessionUpdate, s, K=2*k, nnn='a')
+        c3, d3, l3, t3, n = lfclib.SessionEvaluate(s)
+        self.assertEqual(n, 0)
+        np.testing.assert_array_equal(d3, d2)
+        self.assertFalse(lfclib.SessionUpdate(s, Cell=latpar, Supercell=sc, positions=p,
+                                              FC=2*fc, Phi=phi, K=k, Muons=mus, r=r, nnn=2, rcont=10.))
+
+    def test_session_radius(self):
+        latpar = np.diag([2.,3.,4.])
+        p = np.array([[0.,0.,0.],[0.5,0.5,0.5]])
+        fc = np.array([[0,0,1.],[0,1j,1.]],dtype=np.complex128)
+        k = np.array([0.1,0.,0.])
+        phi = np.array([0.,0.2])
+        mus = np.array([[0.1,0.2,0.3],[0.4,0.1,0.2]])
+        sc = np.array([40,40,40],dtype=np.int32)
+
+        # the contact atoms are found again when rcont exceeds the old radius
+        for rc in [1.5, 12.]:
+            s = lfclib.SessionNew()
+            lfclib.SessionUpdate(s, Cell=latpar, Supercell=sc, positions=p, FC=fc,
+                                 Phi=phi, K=k, Muons=mus, r=2., nnn=3, rcont=rc)
+            lfclib.SessionEvaluate(s)
+            for r in [5., 10., 30.]:
+                lfclib.SessionUpdate(s, r=r)
+                c, d, l, t, n = lfclib.SessionEvaluate(s, tensor=1)
+                self.assertEqual(n, 2)
+                for i, mu in enumerate(mus):
+                    rc_, rd, rl = lfclib.Fields('s', p,fc,k,phi,mu,sc,latpar,r,3,rc)
+                    np.testing.assert_array_almost_equal(c[i], rc_)
+                    np.testing.assert_array_almost_equal(d[i], rd)
+                    np.testing.assert_array_almost_equal(l[i], rl)
+                    np.testing.assert_array_almost_equal(t[i], lfclib.DipolarTensor(p,mu,sc,latpar,r))
+
+        # a smaller radius starts again
+        lfclib.SessionUpdate(s, r=20.)
+        c, d, l, t, n = lfclib.SessionEvaluate(s)
+        np.testing.assert_array_almost_equal(d[0], lfclib.Fields('s', p,fc,k,phi,mus[0],sc,latpar,20.,3,12.)[1])
+
+    def test_session_threads(self):
+        # SessionEvaluate runs without the GIL: updates from another thread,
+        # here changing the number of muon sites and the radius, must not
+        # be seen half done.
+        import threading
+        latpar = np.diag([2.,3.,4.])
+        p = np.array([[0.,0.,0.],[0.5,0.5,0.5]])
+        fc = np.array([[0,0,1.],[0,1j,1.]],dtype=np.complex128)
+        k = np.array([0.1,0.,0.])
+        phi = np.array([0.,0.2])
+        sc = np.array([30,30,30],dtype=np.int32)
+        inputs = [(np.array([[0.1,0.2,0.3]]), 8.),
+                  (np.array([[0.1,0.2,0.3],[0.4,0.1,0.2],[0.3,0.3,0.1]]), 12.)]
+
+        refs = []
+        for mus, r in inputs:
+            s = lfclib.SessionNew()
+            lfclib.SessionUpdate(s, Cell=latpar, Supercell=sc, positions=p, FC=fc,
+                                 Phi=phi, K=k, Muons=mus, r=r, nnn=2, rcont=5.)
+            refs.append(lfclib.SessionEvaluate(s)[1])
+
+        s = lfclib.SessionNew()
+        lfclib.SessionUpdate(s, Cell=latpar, Supercell=sc, positions=p, FC=fc,
+                             Phi=phi, K=k, Muons=inputs[0][0], r=inputs[0][1], nnn=2, rcont=5.)
+        done = threading.Event()
+
+        def update():
+            i = 0
+            while not done.is_set():
+                i += 1
+                lfclib.SessionUpdate(s, Muons=inputs[i % 2][0], r=inputs[i % 2][1])
+
+        t = threading.Thread(target=update)
+        t.start()
+        try:
+            for i in range(40):
+                d = lfclib.SessionEvaluate(s)[1]
+                self.assertTrue(any(d.shape == ref.shape and np.allclose(d, ref, rtol=1e-10, atol=1e-12)
+                                    for ref in refs))
+        finally:
+            done.set()
+            t.join()
+
     def test_dipolar_tensor(self):
         # initial stupid test...
         ###### TODO : rewrite this test!!!  ######
@@ -362,7 +674,579 @@ class TestLFCExtension(unittest.TestCase):
         res = lfclib.DipolarTensor(p,mu,sc,latpar,r)
         np.testing.assert_array_almost_equal(np.trace(res), np.zeros([3]))
         np.testing.assert_array_almost_equal(res, res.copy().T)
+
+    def test_mixed_precision(self):
+        # MnGe like structure, see test_lfcwrappers.py
+        latpar = np.diag([4.769, 4.769, 4.769])
+        p  = np.array([[0.138, 0.138, 0.138],
+                       [0.362, 0.862, 0.638],
+                       [0.862, 0.638, 0.362],
+                       [0.638, 0.362, 0.862]])
+        fc = 1.85*np.array([[1.,-1.j,0.]]*4,dtype=np.complex)
+        k  = np.array([0.,0.,0.1671])
+        phi= np.zeros(4)
+        mu = np.array([0.543,0.543,0.543])
+        sc = np.array([20,20,20],dtype=np.int32)
+        r = 45.
+        nnn = 3
+        rc = 10.
+        axis = np.array([0,0,1.])
+
+        for args in [('s', p,fc,k,phi,mu,sc,latpar,r,nnn,rc),
+                     ('r', p,fc,k,phi,mu,sc,latpar,r,nnn,rc,12,axis),
+                     ('i', p,fc,k,phi,mu,sc,latpar,r,nnn,rc,12)]:
+            c,d,l = lfclib.Fields(*args)
+            cm,dm,lm = lfclib.Fields(*args, precision='mixed')
+            # error bound discussed in README.md
+            np.testing.assert_allclose(dm, d, rtol=0, atol=1e-5*np.max(np.abs(d)))
+            np.testing.assert_allclose(lm, l, rtol=0, atol=1e-5*np.max(np.abs(l)))
+            np.testing.assert_allclose(cm, c, rtol=0, atol=1e-5*np.max(np.abs(c)))
+
+        t = lfclib.DipolarTensor(p,mu,sc,latpar,r)
+        tm = lfclib.DipolarTensor(p,mu,sc,latpar,r,precision='mixed')
+        np.testing.assert_allclose(tm, t, rtol=0, atol=1e-5*np.max(np.abs(t)))
+
+        self.assertRaises(ValueError, lfclib.DipolarTensor, p,mu,sc,latpar,r,precision='half')
         
+    def test_reproducible(self):
+        # run the same sums with different number of OpenMP threads
+        # in separate processes and compare the bits of the results
+        script = """
+import lfclib
+import numpy as np
+latpar = np.diag([4.769, 4.769, 4.769])
+p  = np.array([[0.138, 0.138, 0.138],
+               [0.362, 0.862, 0.638],
+               [0.862, 0.638, 0.362],
+               [0.638, 0.362, 0.862]])
+fc = 1.85*np.array([[1.,-1.j,0.]]*4,dtype=complex)
+k  = np.array([0.,0.,0.1671])
+phi= np.zeros(4)
+mu = np.array([0.543,0.543,0.543])
+sc = np.array([17,13,11],dtype=np.int32)
+res = list(lfclib.Fields('s', p,fc,k,phi,mu,sc,latpar,30.,3,10.,reproducible=1))
+res.append(lfclib.DipolarTensor(p,mu,sc,latpar,30.,reproducible=1))
+res.append(lfclib.DipolarTensor(p,mu,sc,latpar,30.,precision='mixed',reproducible=1))
+res += list(lfclib.Fields('r', p,fc,k,phi,mu,sc,latpar,30.,3,10.,7,np.array([0.,1.,1.]),reproducible=1))
+res += list(lfclib.Fields('i', p,fc,k,phi,mu,sc,latpar,30.,3,10.,7,reproducible=1))
+res += list(lfclib.ChargeSum(p,np.array([1.,-1.,1.,-1.]),mu,sc,latpar,30.,reproducible=1))
+print(' '.join(float(x).hex() for x in np.concatenate([np.ravel(x) for x in res])))
+"""
+        outputs = []
+        for nthreads in ['1', '3', '4']:
+            env = dict(os.environ)
+            env['OMP_NUM_THREADS'] = nthreads
+            env['PYTHONPATH'] = os.pathsep.join(sys.path)
+            outputs.append(subprocess.check_output([sys.executable, '-c', script], env=env))
+        self.assertEqual(outputs[0], outputs[1])
+        self.assertEqual(outputs[0], outputs[2])
+
+        # and the result is the same (within rounding) of the default sum
+        latpar = np.diag([4.769, 4.769, 4.769])
+        p  = np.array([[0.138, 0.138, 0.138],
+                       [0.362, 0.862, 0.638]])
+        fc = np.array([[1.,-1.j,0.],[0.,1.,1.j]],dtype=np.complex)
+        k  = np.array([0.,0.1,0.1671])
+        phi= np.array([0.,0.25])
+        mu = np.array([0.543,0.543,0.543])
+        sc = np.array([15,15,15],dtype=np.int32)
+        c,d,l = lfclib.Fields('s', p,fc,k,phi,mu,sc,latpar,30.,3,10.)
+        cr,dr,lr = lfclib.Fields('s', p,fc,k,phi,mu,sc,latpar,30.,3,10.,reproducible=1)
+        np.testing.assert_allclose(dr, d, rtol=1e-10, atol=1e-12)
+        np.testing.assert_allclose(lr, l, rtol=1e-10, atol=1e-12)
+        np.testing.assert_array_equal(cr, c)
+        t = lfclib.DipolarTensor(p,mu,sc,latpar,30.)
+        tr = lfclib.DipolarTensor(p,mu,sc,latpar,30.,reproducible=1)
+        np.testing.assert_allclose(tr, t, rtol=1e-10, atol=1e-12)
+        axis = np.array([0.,1.,1.])
+        c,d,l = lfclib.Fields('r', p,fc,k,phi,mu,sc,latpar,30.,3,10.,5,axis)
+        cr,dr,lr = lfclib.Fields('r', p,fc,k,phi,mu,sc,latpar,30.,3,10.,5,axis,reproducible=1)
+        np.testing.assert_allclose(dr, d, rtol=1e-10, atol=1e-12)
+        np.testing.assert_allclose(lr, l, rtol=1e-10, atol=1e-12)
+        np.testing.assert_array_equal(cr, c)
+
+    def test_atom_tiles(self):
+        # A 7x7x7 supercell of a simple cubic ferromagnet has more atoms
+        # than a tile (LFC_ATOM_TILE in config.h). The same atoms surround
+        # the muon when the small cell is repeated 21 times.
+        a = 3.1
+        n = 7
+        p1 = np.array([[0.,0.,0.]])
+        fc1 = np.array([[0.3,0.1j,1.0]],dtype=np.complex)
+        mu1 = np.array([0.3,0.2,0.1])
+        pn = np.array([[x,y,z] for x in range(n) for y in range(n) for z in range(n)],dtype=float)/n
+        fcn = np.repeat(fc1, n**3, axis=0)
+        mun = (mu1 + 3.)/n
+        k = np.zeros(3)
+        r = 6.5*a
+
+        c1,d1,l1 = lfclib.Fields('s', p1,fc1,k,np.zeros(1),mu1,
+                                 np.array([21,21,21],dtype=np.int32),
+                                 np.diag([a,a,a]),r,4,2*a)
+        t1 = lfclib.DipolarTensor(p1,mu1,np.array([21,21,21],dtype=np.int32),
+                                  np.diag([a,a,a]),r)
+        for rep in [0, 1]:
+            cn,dn,ln = lfclib.Fields('s', pn,fcn,k,np.zeros(n**3),mun,
+                                     np.array([3,3,3],dtype=np.int32),
+                                     np.diag([n*a]*3),r,4,2*a,reproducible=rep)
+            tn = lfclib.DipolarTensor(pn,mun,np.array([3,3,3],dtype=np.int32),
+                                      np.diag([n*a]*3),r,reproducible=rep)
+            np.testing.assert_allclose(dn, d1, rtol=1e-9, atol=1e-12)
+            np.testing.assert_allclose(ln, l1, rtol=1e-9, atol=1e-12)
+            np.testing.assert_allclose(cn, c1, rtol=1e-9, atol=1e-12)
+            np.testing.assert_allclose(tn, t1, rtol=1e-9, atol=1e-12)
+
+    def test_atom_order(self):
+        # the results do not depend on the order of the input atoms
+        rng = np.random.RandomState(7)
+        n = 300
+        p = rng.rand(n,3)
+        fc = rng.rand(n,3) + 1.j*rng.rand(n,3)
+        phi = rng.rand(n)
+        k = np.array([0.1,0.,0.25])
+        mu = np.array([0.51,0.47,0.52])
+        sc = np.array([4,4,4],dtype=np.int32)
+        latpar = np.diag([9.,10.,11.])
+        perm = rng.permutation(n)
+
+        c,d,l = lfclib.Fields('s', p,fc,k,phi,mu,sc,latpar,15.,3,5.)
+        cp,dp,lp = lfclib.Fields('s', p[perm],fc[perm],k,phi[perm],mu,sc,latpar,15.,3,5.)
+        np.testing.assert_allclose(dp, d, rtol=1e-10, atol=1e-12)
+        np.testing.assert_allclose(lp, l, rtol=1e-10, atol=1e-12)
+        np.testing.assert_allclose(cp, c, rtol=1e-10, atol=1e-12)
+
+        t = lfclib.DipolarTensor(p,mu,sc,latpar,15.)
+        tp = lfclib.DipolarTensor(p[perm],mu,sc,latpar,15.)
+        np.testing.assert_allclose(tp, t, rtol=1e-10, atol=1e-12)
+
+    def test_unrolled_kernels(self):
+        # 1, 2, 4 and 8 atoms use dedicated kernels. They are compared
+        # with the generic loop, used when an atom without moment is
+        # added far from the muon, and with a direct evaluation of the
+        # dipolar tensor.
+        rng = np.random.RandomState(3)
+        latpar = np.diag([5.,5.2,5.4])
+        mu = np.array([0.5,0.5,0.5])
+        sc = np.array([5,5,5],dtype=np.int32)
+        k = np.array([0.,0.2,0.1])
+        r = 11.
+        for n in [1, 2, 4, 8]:
+            p = 0.2 + 0.6*rng.rand(n,3)
+            fc = rng.rand(n,3) + 1.j*rng.rand(n,3)
+            phi = rng.rand(n)
+            nnn = min(n, 2)
+
+            c,d,l = lfclib.Fields('s', p,fc,k,phi,mu,sc,latpar,r,nnn,4.)
+            cg,dg,lg = lfclib.Fields('s', np.vstack([p,[0.,0.,0.]]),
+                                     np.vstack([fc,[0.,0.,0.]]),k,
+                                     np.append(phi,0.),mu,sc,latpar,r,nnn,4.)
+            np.testing.assert_allclose(d, dg, rtol=1e-10, atol=1e-12)
+            np.testing.assert_allclose(l, lg, rtol=1e-10, atol=1e-12)
+            np.testing.assert_allclose(c, cg, rtol=1e-10, atol=1e-12)
+
+            t = lfclib.DipolarTensor(p,mu,sc,latpar,r)
+            ref = np.zeros([3,3])
+            for i in range(5):
+                for j in range(5):
+                    for kk in range(5):
+                        for a in range(n):
+                            v = np.dot(p[a] + [i,j,kk] - mu - 2, latpar)
+                            d = np.linalg.norm(v)
+                            if d < r:
+                                ref += 3.*np.outer(v,v)/d**5 - np.eye(3)/d**3
+            np.testing.assert_allclose(t, ref, rtol=1e-10, atol=1e-12)
+
+    def test_fused_sum(self):
+        latpar = np.array([[4.8, 0., 0.],[0.3, 5.1, 0.],[0., 0.2, 4.6]])
+        p  = np.array([[0.138, 0.138, 0.138],
+                       [0.362, 0.862, 0.638],
+                       [0.862, 0.638, 0.362]])
+        fc = np.array([[1.,-1.j,0.],[0.2,1.j,0.5],[0.,0.3-0.1j,1.]],dtype=np.complex)
+        k  = np.array([0.1,0.,0.1671])
+        phi= np.array([0.,0.1,0.3])
+        mu = np.array([0.543,0.41,0.27])
+        sc = np.array([12,11,13],dtype=np.int32)
+        r = 25.
+
+        c,d,l = lfclib.Fields('s', p,fc,k,phi,mu,sc,latpar,r,3,6.)
+        t = lfclib.DipolarTensor(p,mu,sc,latpar,r)
+
+        cf,df,lf,tf,sf = lfclib.FusedSum(p,fc,k,phi,mu,sc,latpar,r,3,6.)
+        np.testing.assert_allclose(cf, c, rtol=1e-10, atol=1e-12)
+        np.testing.assert_allclose(df, d, rtol=1e-10, atol=1e-12)
+        np.testing.assert_allclose(lf, l, rtol=1e-10, atol=1e-12)
+        np.testing.assert_allclose(tf, t, rtol=1e-10, atol=1e-12)
+        self.assertIsNone(sf)
+
+        # only the requested components
+        cf,df,lf,tf,sf = lfclib.FusedSum(p,fc,k,phi,mu,sc,latpar,r,3,6.,components='ds')
+        self.assertIsNone(cf)
+        self.assertIsNone(lf)
+        self.assertIsNone(tf)
+        np.testing.assert_allclose(df, d, rtol=1e-10, atol=1e-12)
+        self.assertEqual(sf.shape, (3,3,3))
+        np.testing.assert_allclose(sf.sum(axis=0), t, rtol=1e-10, atol=1e-12)
+        for a in range(3):
+            np.testing.assert_allclose(sf[a], lfclib.DipolarTensor(p[a:a+1],mu,sc,latpar,r),
+                                       rtol=1e-10, atol=1e-12)
+
+        self.assertRaises(ValueError, lfclib.FusedSum, p,fc,k,phi,mu,sc,latpar,r,3,6.,components='x')
+
+    def test_domain_sum(self):
+        latpar = np.array([[4.8, 0., 0.],[0.3, 5.1, 0.],[0., 0.2, 4.6]])
+        p  = np.array([[0.138, 0.138, 0.138],
+                       [0.362, 0.862, 0.638],
+                       [0.862, 0.638, 0.362]])
+        fc1 = np.array([[1.,-1.j,0.],[0.2,1.j,0.5],[0.,0.3-0.1j,1.]],dtype=np.complex)
+        fc2 = np.array([[0.,1.,1.j],[0.,0.,0.],[1.j,0.,-0.5]],dtype=np.complex)
+        k1 = np.array([0.1,0.,0.1671])
+        k2 = np.array([0.,0.1,0.1671])
+        phi1 = np.array([0.,0.1,0.3])
+        phi2 = np.array([0.2,0.,0.])
+        mu = np.array([0.543,0.41,0.27])
+        sc = np.array([12,11,13],dtype=np.int32)
+        r = 25.
+
+        # two domains share the same propagation vector
+        domains = [(fc1,k1,phi1), (fc2,k1,phi2), (fc1,k2,phi1), (fc2,k2,phi1)]
+        fc = np.array([d[0] for d in domains])
+        k = np.array([d[1] for d in domains])
+        phi = np.array([d[2] for d in domains])
+
+        c,d,l = lfclib.DomainSum(p,fc,k,phi,mu,sc,latpar,r,3,6.)
+        self.assertEqual(d.shape, (4,3))
+        for n, (fcn, kn, phin) in enumerate(domains):
+            cn,dn,ln = lfclib.Fields('s', p,fcn,kn,phin,mu,sc,latpar,r,3,6.)
+            np.testing.assert_allclose(c[n], cn, rtol=1e-10, atol=1e-12)
+            np.testing.assert_allclose(d[n], dn, rtol=1e-10, atol=1e-12)
+            np.testing.assert_allclose(l[n], ln, rtol=1e-10, atol=1e-12)
+
+        self.assertRaises(RuntimeError, lfclib.DomainSum, p,fc,k[:3],phi,mu,sc,latpar,r,3,6.)
+
+    def test_config_sum(self):
+        latpar = np.diag([3.,3.,4.])
+        p  = np.array([[0.,0.,0.],[0.5,0.5,0.5],[0.5,0.,0.]])
+        k  = np.array([0.5,0.,0.25])
+        phi= np.array([0.,0.1,0.3])
+        mus = np.array([[0.3,0.2,0.1],[0.5,0.5,0.],[0.1,0.6,0.7]])
+        sc = np.array([12,12,10],dtype=np.int32)
+        r = 15.
+
+        rng = np.random.RandomState(11)
+        fcs = rng.normal(size=(37,3,3)) + 1.j*rng.normal(size=(37,3,3))
+        c,d,l = lfclib.ConfigSum(p,fcs,k,phi,mus,sc,latpar,r,3,6.)
+        self.assertEqual(d.shape, (37,3,3))
+        for n in (0, 5, 36):
+            for m in range(3):
+                cn,dn,ln = lfclib.Fields('s',p,fcs[n],k,phi,mus[m],sc,latpar,r,3,6.)
+                np.testing.assert_allclose(d[n,m], dn, rtol=1e-10, atol=1e-12)
+                np.testing.assert_allclose(l[n,m], ln, rtol=1e-10, atol=1e-12)
+                np.testing.assert_allclose(c[n,m], cn, rtol=1e-10, atol=1e-12)
+
+        self.assertRaises(RuntimeError, lfclib.ConfigSum, p,fcs[:,:2],k,phi,mus,sc,latpar,r,3,6.)
+
+    def test_fit_moments(self):
+        latpar = np.diag([3.,3.,4.])
+        p  = np.array([[0.,0.,0.],[0.5,0.5,0.5]])
+        k  = np.array([0.,0.,0.5])
+        phi= np.array([0.,0.2])
+        mus = np.array([[0.3,0.2,0.1],[0.5,0.5,0.],[0.1,0.6,0.7],[0.25,0.,0.5],
+                        [0.,0.5,0.25],[0.7,0.1,0.4],[0.4,0.4,0.9]])
+        sc = np.array([12,12,10],dtype=np.int32)
+        r = 15.
+
+        R = lfclib.ConfigResponse(p,k,mus,sc,latpar,r,3,6.)
+        self.assertEqual(R.shape, (7,9,12))
+        fc = np.array([[0.3,0.,1.2],[0.5j,0.,0.8]])
+        x = np.hstack([np.cos(2*np.pi*phi)[:,None]*fc.real + np.sin(2*np.pi*phi)[:,None]*fc.imag,
+                       np.cos(2*np.pi*phi)[:,None]*fc.imag - np.sin(2*np.pi*phi)[:,None]*fc.real]).reshape(-1)
+        for m in range(7):
+            c,d,l = lfclib.Fields('s',p,fc,k,phi,mus[m],sc,latpar,r,3,6.)
+            F = np.dot(R[m], x)
+            np.testing.assert_allclose(F[0:3], c, atol=1e-12)
+            np.testing.assert_allclose(F[3:6], d, atol=1e-12)
+            np.testing.assert_allclose(F[6:9], l, atol=1e-12)
+
+        # the moments are x = V p: fit 3 parameters and ACont
+        V = np.zeros([12,3])
+        V[:,0] = x
+        V[2,1] = 1.
+        V[6+2,2] = 1.
+        ptrue = np.array([1.,0.3,-0.2])
+        acont = 0.4
+        B = np.array([np.dot(R[m,3:6] + R[m,6:9] + acont*R[m,0:3], np.dot(V, ptrue))
+                      for m in range(7)])
+        freq = 851.61554/(2*np.pi)*np.linalg.norm(B, axis=1)
+
+        pf, a, chi2, niter = lfclib.FitMoments(R, V, freq, np.array([0.8,0.,0.]),
+                                               ACont=acont)
+        np.testing.assert_allclose(pf, ptrue, atol=1e-6)
+        self.assertLess(chi2, 1e-12)
+        pf, a, chi2, niter = lfclib.FitMoments(R, V, freq, np.array([0.9,0.2,-0.1]),
+                                               ACont=0.2, fit_acont=1)
+        np.testing.assert_allclose(pf, ptrue, atol=1e-6)
+        self.assertAlmostEqual(a, acont, places=5)
+
+        self.assertRaises(RuntimeError, lfclib.FitMoments, R, V, freq[1:], ptrue)
+
+    def test_strain_sum(self):
+        latpar = np.array([[3.,0.,0.],[0.5,3.2,0.],[0.,0.3,4.]])
+        p  = np.array([[0.,0.,0.],[0.5,0.5,0.5]])
+        fc = np.array([[0.,1.,0.5],[0.2,0.,1.j]],dtype=np.complex128)
+        k  = np.array([0.1,0.,0.25])
+        phi= np.array([0.,0.1])
+        mu = np.array([0.3,0.2,0.1])
+        sc = np.array([15,15,13],dtype=np.int32)
+        r = 20.
+
+        d,l,T,dd,dl,dT = lfclib.StrainSum(p,fc,k,phi,mu,sc,latpar,r)
+        c0,d0,l0 = lfclib.Fields('s',p,fc,k,phi,mu,sc,latpar,r,0,1.)
+        np.testing.assert_allclose(d, d0, rtol=1e-10, atol=1e-12)
+        np.testing.assert_allclose(l, l0, rtol=1e-10, atol=1e-12)
+        np.testing.assert_allclose(T, lfclib.DipolarTensor(p,mu,sc,latpar,r), rtol=1e-10, atol=1e-12)
+        self.assertEqual(dT.shape, (6,3,3))
+
+        # an isotropic strain with the radius scaled accordingly keeps the
+        # same atoms inside the sphere: compare with finite differences
+        h = 1e-5
+        cp,dp,lp = lfclib.Fields('s',p,fc,k,phi,mu,sc,latpar*(1+h),r*(1+h),0,1.)
+        cm,dm,lm = lfclib.Fields('s',p,fc,k,phi,mu,sc,latpar*(1-h),r*(1-h),0,1.)
+        np.testing.assert_allclose(dd[:3].sum(axis=0), (dp-dm)/(2*h), rtol=1e-5, atol=1e-8)
+        np.testing.assert_allclose(dl[:3].sum(axis=0), (lp-lm)/(2*h), rtol=1e-5, atol=1e-8)
+        Tp = lfclib.DipolarTensor(p,mu,sc,latpar*(1+h),r*(1+h))
+        Tm = lfclib.DipolarTensor(p,mu,sc,latpar*(1-h),r*(1-h))
+        np.testing.assert_allclose(dT[:3].sum(axis=0), (Tp-Tm)/(2*h), rtol=1e-5, atol=1e-8)
+        np.testing.assert_allclose(dT, dT.transpose(0,2,1), atol=1e-12)
+
+        self.assertRaises(RuntimeError, lfclib.StrainSum, p,fc[:1],k,phi,mu,sc,latpar,r)
+
+    def test_site_symmetry(self):
+        latpar = np.diag([3.,3.,4.])
+        p  = np.array([[0.,0.,0.],[0.5,0.5,0.]])
+        fc = np.array([[0.,0.,1.],[0.,0.,2.]],dtype=np.complex)
+        k  = np.zeros(3)
+        phi= np.zeros(2)
+        mu = np.array([0.5,0.5,0.5])
+        sc = np.array([15,15,11],dtype=np.int32)
+        r = 20.
+
+        # 4/mmm, site symmetry of the muon. The operations that reverse
+        # the moments along z are combined with time reversal.
+        ops = []
+        for perm in ([0,1,2],[1,0,2]):
+            for sx in (1,-1):
+                for sy in (1,-1):
+                    for sz in (1,-1):
+                        ops.append(np.diag([sx,sy,sz])[perm])
+        ops = np.array(ops, dtype=np.float64)
+        tr = np.array([int(round(np.linalg.det(o)*o[2,2])) for o in ops], dtype=np.int32)
+
+        t = lfclib.DipolarTensor(p,mu,sc,latpar,r)
+        ts = lfclib.DipolarTensor(p,mu,sc,latpar,r,siteops=ops)
+        np.testing.assert_allclose(ts, t, rtol=1e-10, atol=1e-12)
+        self.assertGreater(abs(t[2,2]), 1e-3)
+
+        c,d,l = lfclib.Fields('s', p,fc,k,phi,mu,sc,latpar,r,4,6.)
+        cs,ds,ls = lfclib.Fields('s', p,fc,k,phi,mu,sc,latpar,r,4,6.,
+                                 siteops=ops, sitetr=tr)
+        np.testing.assert_allclose(cs, c, rtol=1e-10, atol=1e-12)
+        np.testing.assert_allclose(ds, d, rtol=1e-10, atol=1e-12)
+        np.testing.assert_allclose(ls, l, rtol=1e-10, atol=1e-12)
+        self.assertGreater(abs(d[2]), 1e-3)
+
+        # mixed precision and fixed order summation
+        ts = lfclib.DipolarTensor(p,mu,sc,latpar,r,precision='mixed',
+                                  reproducible=1,siteops=ops)
+        np.testing.assert_allclose(ts, t, rtol=1e-4, atol=1e-6)
+
+        # not a group
+        self.assertRaises(ValueError, lfclib.DipolarTensor, p,mu,sc,latpar,r,
+                          siteops=ops[1:])
+        self.assertRaises(ValueError, lfclib.Fields, 's', p,fc,k,phi,mu,sc,latpar,r,4,6.,
+                          siteops=ops, sitetr=-tr)
+        self.assertRaises(ValueError, lfclib.Fields, 'r', p,fc,k,phi,mu,sc,latpar,r,4,6.,
+                          10, np.array([0.,0.,1.]), siteops=ops)
+
+        # not symmetries of the structure or of the moments
+        self.assertRaises(ValueError, lfclib.Fields, 's', p,fc,k,phi,mu,sc,latpar,r,4,6.,
+                          siteops=ops, sitetr=np.ones(len(ops), dtype=np.int32))
+        tilted = np.array([[0.1,0.,1.],[0.,0.,2.]],dtype=np.complex)
+        self.assertRaises(ValueError, lfclib.Fields, 's', p,tilted,k,phi,mu,sc,latpar,r,4,6.,
+                          siteops=ops, sitetr=tr)
+        self.assertRaises(ValueError, lfclib.DipolarTensor, np.array([[0.,0.,0.],[0.4,0.5,0.]]),
+                          mu,sc,latpar,r,siteops=ops)
+        # the supercell does not contain the sphere
+        self.assertRaises(ValueError, lfclib.DipolarTensor, p,mu,sc,latpar,25.,siteops=ops)
+        self.assertRaises(ValueError, lfclib.Fields, 's', p,fc,k,phi,mu,sc,latpar,25.,4,6.,
+                          siteops=ops, sitetr=tr)
+
+    def test_polarization(self):
+        gamma = 851.61554
+        rng = np.random.RandomState(3)
+        B = rng.normal(size=(200,3)) * 0.1
+        w = rng.uniform(size=200)
+        t = np.linspace(0., 5., 101)
+        n = np.array([1.,1.,0.])/np.sqrt(2.)
+
+        b = np.linalg.norm(B, axis=1)
+        cos2 = np.dot(B, n)**2 / b**2
+        ref = np.dot(w/np.sum(w), cos2[:,None] + (1.-cos2)[:,None]*np.cos(gamma*np.outer(b, t)))
+        np.testing.assert_allclose(lfclib.Polarization(B, t, w, n), ref, atol=1e-12)
+        self.assertAlmostEqual(lfclib.Polarization(B, t, w, n)[0], 1.)
+
+        ref = np.mean(1./3. + 2./3.*np.cos(gamma*np.outer(b, t)), axis=0)
+        np.testing.assert_allclose(lfclib.Polarization(B, t, powder=1), ref, atol=1e-12)
+
+        # the error of the histogram decreases quadratically with the bin width
+        e1 = np.max(np.abs(lfclib.Polarization(B, t, powder=1, nbins=1000) - ref))
+        e2 = np.max(np.abs(lfclib.Polarization(B, t, powder=1, nbins=2000) - ref))
+        self.assertLess(e1, 1e-2)
+        self.assertLess(e2, e1/4.)
+
+        # polarization along z with fields along z does not decay
+        np.testing.assert_allclose(lfclib.Polarization(np.array([[0.,0.,0.3]]), t), 1.)
+        self.assertRaises(RuntimeError, lfclib.Polarization, B, t, w[1:])
+
+    def test_histogram(self):
+        latpar = np.diag([3.,3.,4.])
+        p  = np.array([[0.,0.,0.],[0.5,0.5,0.5]])
+        fc = np.array([[1.,1.j,0.],[0.,0.5,0.5j]],dtype=np.complex)
+        k  = np.array([0.,0.,0.2371])
+        phi= np.array([0.,0.1])
+        mus = np.array([[0.5,0.,0.25],[0.5,0.5,0.],[0.1,0.2,0.3]])
+        w = np.array([1.,2.,3.])
+        sc = np.array([15,15,12],dtype=np.int32)
+        axis = np.array([0.,1.,1.])/np.sqrt(2.)
+        r, nang, nbins, bmax, acont = 18., 50, 40, 4., 0.7
+
+        for ctype in ('r', 'i'):
+            h = np.zeros(nbins)
+            hc = np.zeros([3,nbins])
+            for m, wm in zip(mus, w):
+                if ctype == 'r':
+                    c,d,l = lfclib.Fields(ctype,p,fc,k,phi,m,sc,latpar,r,2,5.,nang,axis)
+                else:
+                    c,d,l = lfclib.Fields(ctype,p,fc,k,phi,m,sc,latpar,r,2,5.,nang)
+                B = d + l + acont*c
+                h += np.histogram(np.linalg.norm(B,axis=1), nbins, (0.,bmax),
+                                  weights=np.full(nang, wm/np.sum(w)/nang))[0]
+                for x in range(3):
+                    hc[x] += np.histogram(B[:,x], nbins, (-bmax,bmax),
+                                          weights=np.full(nang, wm/np.sum(w)/nang))[0]
+            hn, hcn = lfclib.Histogram(ctype,p,fc,k,phi,mus,sc,latpar,r,2,5.,nang,nbins,bmax,
+                                       rot_axis=axis,ACont=acont,weights=w)
+            np.testing.assert_allclose(hn, h, atol=1e-12)
+            np.testing.assert_allclose(hcn, hc, atol=1e-12)
+            self.assertGreater(np.count_nonzero(hn), 3)
+
+        self.assertRaises(ValueError, lfclib.Histogram, 'r',p,fc,k,phi,mus,sc,latpar,r,2,5.,nang,nbins,bmax)
+        self.assertRaises(ValueError, lfclib.Histogram, 's',p,fc,k,phi,mus,sc,latpar,r,2,5.,nang,nbins,bmax)
+        self.assertRaises(RuntimeError, lfclib.Histogram, 'i',p,fc,k,phi,mus,sc,latpar,r,2,5.,nang,nbins,bmax,
+                          weights=w[1:])
+
+    def test_field_polarization(self):
+        gamma = 851.61554
+        latpar = np.diag([3.,3.,4.])
+        p  = np.array([[0.,0.,0.],[0.5,0.5,0.5]])
+        fc = np.array([[1.,1.j,0.],[0.,0.5,0.5j]],dtype=np.complex)
+        k  = np.array([0.,0.,0.2371])
+        phi= np.array([0.,0.1])
+        mus = np.array([[0.5,0.,0.25],[0.5,0.5,0.],[0.1,0.2,0.3]])
+        w = np.array([1.,2.,3.])
+        sc = np.array([15,15,12],dtype=np.int32)
+        axis = np.array([0.,1.,1.])/np.sqrt(2.)
+        n = np.array([1.,0.,1.])/np.sqrt(2.)
+        t = np.linspace(0., 0.5, 26)
+        r, nang, acont = 18., 50, 0.7
+
+        for ctype in ('r', 'i'):
+            B = []
+            for m in mus:
+                if ctype == 'r':
+                    c,d,l = lfclib.Fields(ctype,p,fc,k,phi,m,sc,latpar,r,2,5.,nang,axis)
+                else:
+                    c,d,l = lfclib.Fields(ctype,p,fc,k,phi,m,sc,latpar,r,2,5.,nang)
+                B.append(d + l + acont*c)
+            B = np.concatenate(B)
+            fw = np.repeat(w/np.sum(w)/nang, nang)
+            b = np.linalg.norm(B, axis=1)
+            bmax = np.max(b)*1.001
+
+            for powder in (0, 1):
+                cos2 = np.full(len(b), 1./3.) if powder else np.dot(B, n)**2 / b**2
+                ref = np.dot(fw, cos2[:,None] + (1.-cos2)[:,None]*np.cos(gamma*np.outer(b, t)))
+                pol = lfclib.FieldPolarization(ctype,p,fc,k,phi,mus,sc,latpar,r,2,5.,nang,
+                                               4000,bmax,t,rot_axis=axis,ACont=acont,
+                                               weights=w,direction=n,powder=powder)
+                # same histogram of Polarization, up to the range of the bins
+                np.testing.assert_allclose(pol, ref, atol=1e-3)
+                np.testing.assert_allclose(pol,
+                    lfclib.Polarization(B, t, fw, n, powder, 4000), atol=1e-3)
+                self.assertAlmostEqual(pol[0], 1.)
+
+            # fields beyond bmax end up in the last bin
+            pol = lfclib.FieldPolarization(ctype,p,fc,k,phi,mus,sc,latpar,r,2,5.,nang,
+                                           10,0.5*bmax,t,rot_axis=axis,ACont=acont)
+            self.assertAlmostEqual(pol[0], 1.)
+
+        self.assertRaises(ValueError, lfclib.FieldPolarization, 'r',p,fc,k,phi,mus,sc,latpar,r,2,5.,
+                          nang,10,1.,t)
+        self.assertRaises(ValueError, lfclib.FieldPolarization, 'i',p,fc,k,phi,mus,sc,latpar,r,2,5.,
+                          nang,0,1.,t)
+        self.assertRaises(RuntimeError, lfclib.FieldPolarization, 'i',p,fc,k,phi,mus,sc,latpar,r,2,5.,
+                          nang,10,1.,t,direction=n[1:])
+
+    def test_disorder(self):
+        latpar = np.diag([3.,3.,4.])
+        p  = np.array([[0.,0.,0.],[0.5,0.5,0.5]])
+        fc = np.array([[0.,0.,1.],[1.,0.5j,0.]],dtype=np.complex)
+        k  = np.array([0.5,0.,0.25])
+        phi= np.array([0.,0.1])
+        mu = np.array([0.3,0.2,0.1])
+        sc = np.array([12,12,10],dtype=np.int32)
+        r = 15.
+
+        keys, T, dist = lfclib.SphereSites(p,mu,sc,latpar,r)
+        self.assertTrue(np.all(np.diff(dist) >= 0.))
+        self.assertTrue(np.all(dist < r))
+        np.testing.assert_allclose(T[:,0]+T[:,3]+T[:,5], 0., atol=1e-12)
+
+        # moments of the parent configuration
+        a = keys % 2
+        cell = keys // 2
+        n = np.array([cell // (sc[1]*sc[2]), (cell // sc[2]) % sc[1], cell % sc[2]]).T
+        ph = 2.*np.pi*phi[a]
+        P = np.cos(ph)[:,None]*fc[a].real + np.sin(ph)[:,None]*fc[a].imag
+        Q = np.cos(ph)[:,None]*fc[a].imag - np.sin(ph)[:,None]*fc[a].real
+        kn = 2.*np.pi*np.dot(n, k)
+        m = np.cos(kn)[:,None]*P + np.sin(kn)[:,None]*Q
+
+        c,d,l = lfclib.Fields('s',p,fc,k,phi,mu,sc,latpar,r,3,6.)
+        cd,dd,ld = lfclib.DisorderSum(T,dist,np.array([m,-m,0.*m]),r,3,6.)
+        np.testing.assert_allclose(dd[0], d, rtol=1e-12)
+        np.testing.assert_allclose(ld[0], l, rtol=1e-12)
+        np.testing.assert_allclose(cd[0], c, rtol=1e-12)
+        np.testing.assert_allclose(dd[1], -d, rtol=1e-12)
+        np.testing.assert_allclose(dd[2], 0., atol=1e-14)
+
+        # random configurations
+        cs,ds,ls = lfclib.DilutionSample(T,dist,m,4,r,3,6.)
+        np.testing.assert_allclose(ds, np.tile(dd[0], (4,1)), atol=1e-12)
+        cs,ds,ls = lfclib.DilutionSample(T,dist,m,2000,r,3,6.,
+                                         occupancy=np.full(len(dist), 0.3),seed=7)
+        cs2,ds2,ls2 = lfclib.DilutionSample(T,dist,m,2000,r,3,6.,
+                                            occupancy=np.full(len(dist), 0.3),seed=7)
+        np.testing.assert_array_equal(ds, ds2)
+        # the average is the field of the parent configuration times the occupancy
+        for x, ref in ((ds, d), (ls, l)):
+            np.testing.assert_array_less(np.abs(np.mean(x, axis=0) - 0.3*ref),
+                                         5.*np.std(x, axis=0)/np.sqrt(2000.) + 1e-12)
+        self.assertGreater(np.std(ds[:,0]), 1e-3)
+        cs,ds,ls = lfclib.DilutionSample(T,dist,m,100,r,3,6.,random_directions=1)
+        self.assertGreater(np.std(ds[:,2]), 1e-3)
+
+        self.assertRaises(RuntimeError, lfclib.DisorderSum, T, dist, m, r, 3, 6.)
+        self.assertRaises(RuntimeError, lfclib.DilutionSample, T, dist[1:], m, 4, r, 3, 6.)
     
 if __name__ == '__main__':
     unittest.main()
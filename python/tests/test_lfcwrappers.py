@@ -1,9 +1,18 @@
 # -*- coding: utf-8 -*-
+import os
+import shutil
+import subprocess
+import tempfile
 import unittest
+import warnings
 try:
-    from mulfc import locfield, find_largest_sphere
+    from mulfc import locfield, locfield_adaptive, locfield_extrapolated, locfield_hybrid, dipten, efg, locfield_and_dipten, LFCSession, ResultCache, write_structure, read_structure, find_largest_sphere
+    from mulfc import locfield_domains, locfield_configurations, fit_moments, StrainExpansion, polarization, field_histogram, field_polarization, DisorderSites
+    from mulfc import locfield_symmetric, dipten_symmetric, symmetry_reduce, grid_scan
 except ImportError:
-    from LFC import locfield, find_largest_sphere
+    from LFC import locfield, locfield_adaptive, locfield_extrapolated, locfield_hybrid, dipten, efg, locfield_and_dipten, LFCSession, ResultCache, write_structure, read_structure, find_largest_sphere
+    from LFC import locfield_domains, locfield_configurations, fit_moments, StrainExpansion, polarization, field_histogram, field_polarization, DisorderSites
+    from LFC import locfield_symmetric, dipten_symmetric, symmetry_reduce, grid_scan
 import numpy as np
 
         
@@ -87,6 +96,687 @@ class TestLFCWrappers(unittest.TestCase):
                                           # easily calculate now.
         assert(r > 0.9)                   # Clearly it must also be close to 1.
         
+    def test_locfield_adaptive(self):
+        latpar = np.diag([4., 4., 5.])
+        p = np.array([[0.,0.,0.],[0.5,0.5,0.5],[0.5,0.,0.]])
+        fc = np.array([[0.,0.,1.],[0.,0.,-1.],[0.,0.,0.]], dtype=np.complex128)
+        mus = [[0.23,0.11,0.07], [0.5,0.,0.25]]
+        sc = [101, 101, 81]
+
+        ref = locfield(latpar, p, fc, np.zeros(3), np.zeros(3), mus, 's', sc, 190.)
+        res, radii = locfield_adaptive(latpar, p, fc, np.zeros(3), np.zeros(3), mus,
+                                       atol=1e-4, rmax=190., supercellsize=sc)
+        self.assertEqual(radii.shape, (2,))
+        self.assertTrue(np.all(radii < 190.))
+        for m in range(2):
+            self.assertLess(np.linalg.norm(res[m].D + res[m].L - ref[m].D - ref[m].L), 2e-4)
+            np.testing.assert_array_almost_equal(res[m].C, ref[m].C)
+
+        # not converged within rmax (the field at the second site vanishes
+        # by symmetry and is always converged)
+        with warnings.catch_warnings(record=True) as w:
+            warnings.simplefilter("always")
+            res, radii = locfield_adaptive(latpar, p, fc, np.zeros(3), np.zeros(3), mus,
+                                           atol=1e-9, rmax=20.)
+            self.assertEqual(len([x for x in w if "rmax" in str(x.message)]), 1)
+        self.assertEqual(radii[0], 20.)
+
+    def test_locfield_extrapolated(self):
+        latpar = np.diag([4., 4., 5.])
+        p = np.array([[0.,0.,0.],[0.5,0.5,0.5],[0.5,0.,0.]])
+        fc = np.array([[0.,0.,1.],[0.,0.,-1.],[0.,0.,0.]], dtype=np.complex128)
+        mus = [[0.23,0.11,0.07], [0.5,0.,0.25]]
+        sc = [41, 41, 33]
+
+        ref = locfield_and_dipten(latpar, p, fc, np.zeros(3), np.zeros(3), mus, sc, 30.)
+        res, tensors, errors = locfield_extrapolated(latpar, p, fc, np.zeros(3), np.zeros(3),
+                                                     mus, sc, 30., nradii=1)
+        self.assertEqual(errors.shape, (2,2))
+        for m in range(2):
+            np.testing.assert_array_almost_equal(res[m].T, ref[m][0].T)
+            np.testing.assert_array_almost_equal(tensors[m], ref[m][1])
+
+        res, tensors, errors = locfield_extrapolated(latpar, p, fc, np.zeros(3), np.zeros(3),
+                                                     mus, sc, 30.)
+        for m in range(2):
+            self.assertLess(np.linalg.norm(res[m].D + res[m].L - ref[m][0].D - ref[m][0].L), 5e-3)
+            np.testing.assert_array_almost_equal(res[m].C, ref[m][0].C)
+        self.assertTrue(np.all(errors[0] > 0))
+
+        self.assertRaises(ValueError, locfield_extrapolated, latpar, p, fc, np.zeros(3),
+                          np.zeros(3), mus, sc, 30., nradii=0)
+
+    def test_locfield_hybrid(self):
+        latpar = np.diag([3., 3., 4.])
+        p = np.array([[0.,0.,0.],[0.5,0.5,0.5],[0.5,0.,0.]])
+        fc = np.array([[0.,0.,1.],[0.,1.,0.],[0.,0.,0.]], dtype=np.complex128)
+        k = np.array([0.,0.02,0.03])
+        mus = [[0.23,0.11,0.07], [0.5,0.,0.25]]
+        sc = [61, 61, 47]
+
+        ref = locfield(latpar, p, fc, k, np.zeros(3), mus, 's', sc, 90.)
+        res, errors = locfield_hybrid(latpar, p, fc, k, np.zeros(3), mus, 90., 25.,
+                                      supercellsize=sc)
+        self.assertEqual(errors.shape, (2,))
+        for m in range(2):
+            self.assertLess(np.linalg.norm(res[m].D + res[m].L - ref[m].D - ref[m].L), errors[m])
+            np.testing.assert_array_almost_equal(res[m].C, ref[m].C)
+
+        self.assertRaises(ValueError, locfield_hybrid, latpar, p, fc, k, np.zeros(3),
+                          mus, 20., 25.)
+
+    def test_grid_scan(self):
+        # body centered antiferromagnet, 4/m with the centering combined
+        # with time reversal
+        latpar = np.diag([4., 4., 5.])
+        p = np.array([[0.,0.,0.],[0.5,0.5,0.5],[0.5,0.,0.]])
+        fc = np.array([[0.,0.,1.],[0.,0.,-1.],[0.,0.,0.]], dtype=np.complex128)
+        C4 = np.array([[0.,-1.,0.],[1.,0.,0.],[0.,0.,1.]])
+        M = np.diag([1.,1.,-1.])
+        rots, trs, trev = [], [], []
+        for a in range(4):
+            for b in range(2):
+                for c in range(2):
+                    rots.append(np.dot(np.linalg.matrix_power(C4,a), np.linalg.matrix_power(M,b)))
+                    trs.append(0.5*c*np.ones(3))
+                    trev.append(c == 1)
+
+        x, c, d, l, t = grid_scan(latpar, p, fc, np.zeros(3), np.zeros(3), [8,8,6], 30.,
+                                  min_distance=1.0, tensor=True)
+        self.assertEqual(c.shape, (len(x),3))
+        self.assertEqual(t.shape, (len(x),3,3))
+        for i in range(0, len(x), 25):
+            ref = locfield(latpar, p, fc, np.zeros(3), np.zeros(3), [x[i]], 's', [19,19,15], 30.)[0]
+            np.testing.assert_array_almost_equal(d[i], ref.D)
+            np.testing.assert_array_almost_equal(c[i], ref._BCont)
+            self.assertGreaterEqual(min(np.linalg.norm(np.dot(x[i] - a - np.round(x[i] - a), latpar))
+                                        for a in p), 1.0)
+
+        res = grid_scan(latpar, p, fc, np.zeros(3), np.zeros(3), [8,8,6], 30.,
+                        min_distance=1.0, tensor=True, rotations=rots, translations=trs,
+                        time_reversals=trev)
+        for a, b in zip((x, c, d, l, t), res):
+            np.testing.assert_array_almost_equal(a, b)
+
+    def test_efg(self):
+        latpar = np.diag([5.64, 5.64, 5.64])
+        na = np.array([[0.,0.,0.],[0.5,0.5,0.],[0.5,0.,0.5],[0.,0.5,0.5]])
+        p = np.vstack([na, na + 0.5])
+        q = [1.]*4 + [-1.]*4
+        mus = [[0.25,0.25,0.25],[0.21,0.3,0.13]]
+
+        res = efg(latpar, p, q, mus, [9,9,9], 20.)
+        self.assertEqual(len(res), 2)
+        np.testing.assert_array_almost_equal(res[0][1], np.zeros([3,3]))
+        self.assertGreater(np.max(np.abs(res[1][1])), 0.01)
+        np.testing.assert_array_almost_equal(res[1][1], res[1][1].T)
+
+        self.assertRaises(ValueError, efg, latpar, p, q, mus, [9,9,9], -1.)
+
+    def test_lfc_session(self):
+        latpar = np.diag([2.,3.,4.])
+        p = np.array([[0.,0.,0.],[0.5,0.5,0.5],[0.2,0.1,0.3]])
+        fc = np.array([[0,0,1.],[0,1j,1.],[0,0,0]],dtype=np.complex128)
+        k = np.array([0.1,0.,0.])
+        phi = np.array([0.,0.2,0.])
+        mus = np.array([[0.1,0.2,0.3],[0.4,0.1,0.2]])
+
+        s = LFCSession(latpar, p, fc, k, phi, mus, [20,20,20], 15.)
+        for a, b in zip(s.fields(), locfield(latpar, p, fc, k, phi, mus, 's', [20,20,20], 15.)):
+            np.testing.assert_array_almost_equal(a.T, b.T)
+        self.assertEqual(s.nsums, 2)
+
+        fc[2] = [1j,0,0]
+        s.update(fourier_components=fc, ACont=1.)
+        f = s.fields()
+        self.assertEqual(s.nsums, 2) # a new magnetic atom
+        ref = locfield(latpar, p, fc, k, phi, mus, 's', [20,20,20], 15.)
+        for a, b in zip(f, ref):
+            b.ACont = 1.
+            np.testing.assert_array_almost_equal(a.T, b.T)
+
+        s.update(phases=[0.,0.3,0.1], ACont=0.5)
+        f = s.fields()
+        self.assertEqual(s.nsums, 0)
+        self.assertEqual(f[0].ACont, 0.5)
+        ref = locfield(latpar, p, fc, k, np.array([0.,0.3,0.1]), mus, 's', [20,20,20], 15.)
+        np.testing.assert_array_almost_equal(f[1].D, ref[1].D)
+
+        np.testing.assert_array_almost_equal(s.dipten(), dipten(latpar, p, mus, [20,20,20], 15.))
+        self.assertRaises(ValueError, s.update, supercellsize=[0,1,1])
+
+    def test_lfc_session_radius(self):
+        latpar = np.diag([2.,3.,4.])
+        p = np.array([[0.,0.,0.],[0.5,0.5,0.5]])
+        fc = np.array([[0,0,1.],[0,1j,1.]],dtype=np.complex128)
+        k = np.array([0.1,0.,0.])
+        phi = np.array([0.,0.2])
+        mus = np.array([[0.1,0.2,0.3]])
+
+        s = LFCSession(latpar, p, fc, k, phi, mus, [40,40,40], 5., ACont=1.)
+        s.fields()
+        for r in [10., 20., 35.]:
+            s.update(radius=r)
+            f = s.fields()
+            self.assertEqual(s.nsums, 1)
+            ref = locfield(latpar, p, fc, k, phi, mus, 's', [40,40,40], r)[0]
+            ref.ACont = 1.
+            np.testing.assert_array_almost_equal(f[0].T, ref.T)
+
+    def test_result_cache(self):
+        latpar = np.diag([2.,3.,4.])
+        p = np.array([[0.,0.,0.],[0.5,0.5,0.5]])
+        fc = np.array([[0,0,1.],[0,1j,1.]],dtype=np.complex128)
+        k = np.array([0.1,0.,0.])
+        phi = np.array([0.,0.2])
+        mus = [[0.1,0.2,0.3],[0.4,0.1,0.2]]
+        ref = locfield(latpar, p, fc, k, phi, mus, 's', [20,20,20], 15.)
+
+        d = tempfile.mkdtemp()
+        try:
+            # the store of another build is only removed by clear,
+            # anything else is kept
+            old = os.path.join(d, 'muLFC-cache', '0.0.0')
+            os.makedirs(old)
+            open(os.path.join(old, 'muLFC-cache-version'), 'w').close()
+            for other in [os.path.join(d, '0.0.0'), os.path.join(d, 'muLFC-cache', 'notes')]:
+                os.makedirs(other)
+                with open(os.path.join(other, 'data.npy'), 'w') as f:
+                    f.write('keep')
+            c = ResultCache(directory=d)
+            self.assertTrue(os.path.exists(old))
+            self.assertTrue(c._dir.startswith(os.path.join(d, 'muLFC-cache', '')))
+            c.clear()
+            self.assertFalse(os.path.exists(old))
+            self.assertTrue(os.path.isfile(os.path.join(d, '0.0.0', 'data.npy')))
+            self.assertTrue(os.path.isfile(os.path.join(d, 'muLFC-cache', 'notes', 'data.npy')))
+
+            res = c.locfield(latpar, p, fc, k, phi, mus, 's', [20,20,20], 15.)
+            # same call, different spelling
+            res2 = c.locfield(latpar.tolist(), p, fc, k, phi, np.array(mus), 'sum', [20,20,20], 15, nnn=2)
+            self.assertEqual((c.hits, c.misses), (1, 1))
+            for a, b, r in zip(res, res2, ref):
+                np.testing.assert_array_equal(a.T, r.T)
+                np.testing.assert_array_equal(b.T, r.T)
+            res2[0].ACont = 1.
+            self.assertEqual(res[0].ACont, 0.)
+
+            # another process reads the store
+            c2 = ResultCache(directory=d, maxsize=0)
+            res = c2.locfield(latpar, p, fc, k, phi, mus, 's', [20,20,20], 15.)
+            self.assertEqual(c2.hits, 1)
+            np.testing.assert_array_equal(res[1].D, ref[1].D)
+
+            c2.locfield(latpar, p, fc, k, phi, mus, 's', [20,20,20], 16.)
+            self.assertEqual(c2.misses, 1)
+            t = c2.dipten(latpar, p, mus, [20,20,20], 15.)
+            np.testing.assert_array_equal(t, dipten(latpar, p, mus, [20,20,20], 15.))
+
+            # size limit
+            c3 = ResultCache(directory=d, max_bytes=1)
+            c3.dipten(latpar, p, mus, [20,20,20], 14.)
+            self.assertEqual([f for f in os.listdir(c3._dir) if f.endswith('.npy')], [])
+
+            # entries removed by another process while trimming or clearing
+            os.symlink(os.path.join(d, 'gone'), os.path.join(c3._dir, 'gone.npy'))
+            c3.dipten(latpar, p, mus, [20,20,20], 13.)
+            listdir = os.listdir
+            try:
+                os.listdir = lambda path: listdir(path) + ['gone2.npy']
+                c3.dipten(latpar, p, mus, [20,20,20], 12.)
+                c3.clear()
+            finally:
+                os.listdir = listdir
+            self.assertEqual([f for f in os.listdir(c3._dir) if f.endswith('.npy')], [])
+        finally:
+            shutil.rmtree(d)
+
+    def test_result_cache_builds(self):
+        # two builds of the library sharing a directory
+        latpar = np.diag([2.,3.,4.])
+        p = np.array([[0.,0.,0.],[0.5,0.5,0.5]])
+        fc = np.array([[0,0,1.],[0,1j,1.]],dtype=np.complex128)
+        k = np.array([0.1,0.,0.])
+        phi = np.array([0.,0.2])
+        mus = [[0.1,0.2,0.3]]
+
+        class OtherBuild(ResultCache):
+            _build = '0.0.0-0123456789abcdef'
+
+        d = tempfile.mkdtemp()
+        try:
+            a = ResultCache(directory=d)
+            a.locfield(latpar, p, fc, k, phi, mus, 's', [10,10,10], 5.)
+            b = OtherBuild(directory=d)
+            self.assertNotEqual(a._dir, b._dir)
+            self.assertTrue(os.path.isdir(a._dir))
+            a.locfield(latpar, p, fc, k, phi, mus, 's', [10,10,10], 6.)
+            b.locfield(latpar, p, fc, k, phi, mus, 's', [10,10,10], 6.)
+            self.assertEqual((a.misses, b.misses), (2, 1))
+
+            # clear removes the store of the other build, which is created
+            # again by its next write
+            b.clear()
+            self.assertFalse(os.path.exists(a._dir))
+            ref = locfield(latpar, p, fc, k, phi, mus, 's', [10,10,10], 7.)
+            res = a.locfield(latpar, p, fc, k, phi, mus, 's', [10,10,10], 7.)
+            np.testing.assert_array_equal(res[0].T, ref[0].T)
+            self.assertTrue(os.path.isfile(os.path.join(a._dir, 'muLFC-cache-version')))
+            self.assertEqual(len([f for f in os.listdir(a._dir) if f.endswith('.npy')]), 1)
+            self.assertTrue(os.path.isdir(b._dir))
+        finally:
+            shutil.rmtree(d)
+
+    def test_structure_file(self):
+        latpar = np.diag([2.,3.,4.])
+        p = np.array([[0.,0.,0.],[0.5,0.5,0.5],[0.2,0.1,0.3]])
+        fc = np.array([[0,0,1.],[0,1j,1.],[0,0,0]],dtype=np.complex128)
+        k = np.array([0.1,0.,0.])
+        phi = np.array([0.,0.2,0.])
+        mus = [[0.1,0.2,0.3],[0.4,0.1,0.2]]
+
+        d = tempfile.mkdtemp()
+        try:
+            fname = os.path.join(d, 'test.lfc')
+            write_structure(fname, latpar, p, fc, k, phi, mus)
+            self.assertEqual(os.path.getsize(fname), 120 + 8*(10*3 + 3*2))
+            res = read_structure(fname)
+            for a, b in zip(res, [latpar, p, fc, k, phi, mus]):
+                np.testing.assert_array_equal(a, b)
+            self.assertEqual(res[2].dtype, np.complex128)
+
+            with open(fname, 'r+b') as f:
+                f.write(b'x')
+            self.assertRaises(ValueError, read_structure, fname)
+            self.assertRaises(ValueError, write_structure, fname, latpar, p, fc, k, phi[:2], mus)
+        finally:
+            shutil.rmtree(d)
+
+    @unittest.skipUnless(os.environ.get('LFC_RUN') or shutil.which('lfc-run'),
+                         "lfc-run not found, set LFC_RUN to the program built with the C library")
+    def test_lfc_run(self):
+        run = os.environ.get('LFC_RUN') or shutil.which('lfc-run')
+        latpar = np.array([[3.,0.,0.],[0.2,3.2,0.],[0.,0.1,4.]])
+        # helical order, the third atom is not magnetic
+        p = np.array([[0.,0.,0.],[0.5,0.5,0.5],[0.2,0.1,0.3]])
+        fc = np.array([[1.,1j,0],[0,2.,2j],[0,0,0]],dtype=np.complex128)
+        k = np.array([0.1,0.05,0.])
+        phi = np.array([0.,0.2,0.])
+        mus = np.array([[0.1,0.2,0.3],[0.4,0.1,0.2],[0.5,0.5,0.]])
+        sc = [12,12,12]
+        args = [run, '-r', '12', '-s', '12,12,12', '-n', '2', '-c', '5']
+
+        ref = locfield(latpar, p, fc, k, phi, mus, 's', sc, 12., nnn=2, rcont=5.)
+        refi = locfield(latpar, p, fc, k, phi, mus, 'i', sc, 12., nnn=2, rcont=5., nangles=4)
+        ten = dipten(latpar, p[:2], mus, sc, 12.)
+        for r in ref + refi:
+            r.ACont = 1.
+
+        d = tempfile.mkdtemp()
+        try:
+            fname = os.path.join(d, 'helix.lfc')
+            write_structure(fname, latpar, p, fc, k, phi, mus)
+
+            subprocess.check_call(args + ['-t', '-f', 'npy', fname])
+            B = np.load(os.path.join(d, 'helix.npy'))
+            T = np.load(os.path.join(d, 'helix_tensor.npy'))
+            self.assertEqual(B.shape, (3, 3, 3))
+            self.assertEqual(T.shape, (3, 3, 3))
+            for i, r in enumerate(ref):
+                np.testing.assert_allclose(B[i], [r.C, r.D, r.L], rtol=1e-10, atol=1e-12)
+                np.testing.assert_allclose(T[i], ten[i], rtol=1e-10, atol=1e-12)
+
+            subprocess.check_call(args + ['-a', '4', '-f', 'npy', fname])
+            B = np.load(os.path.join(d, 'helix.npy'), mmap_mode='r')
+            self.assertEqual(B.shape, (3, 3, 4, 3))
+            for i, r in enumerate(refi):
+                np.testing.assert_allclose(B[i], [r.C, r.D, r.L], rtol=1e-10, atol=1e-12)
+
+            subprocess.check_call(args + ['-a', '4', '-t', '-f', 'npz', fname])
+            with np.load(os.path.join(d, 'helix.npz')) as z:
+                self.assertEqual(sorted(z.files), ['contact', 'dipolar', 'lorentz', 'muons', 'tensor'])
+                np.testing.assert_array_equal(z['muons'], mus)
+                self.assertEqual(z['dipolar'].shape, (3, 4, 3))
+                self.assertEqual(z['tensor'].shape, (3, 3, 3))
+                np.testing.assert_allclose(z['contact'], [r.C for r in refi], rtol=1e-10, atol=1e-12)
+                np.testing.assert_allclose(z['dipolar'], [r.D for r in refi], rtol=1e-10, atol=1e-12)
+                np.testing.assert_allclose(z['lorentz'], [r.L for r in refi], rtol=1e-10, atol=1e-12)
+                np.testing.assert_allclose(z['tensor'], ten, rtol=1e-10, atol=1e-12)
+
+            # -a is refused for orders that are not helical, bad values are rejected
+            fname = os.path.join(d, 'collinear.lfc')
+            write_structure(fname, latpar, p, np.array([[0,0,1.],[0,0,1j],[0,0,0]]), k, phi, mus)
+            res = subprocess.run(args + ['-a', '4', '-f', 'npy', fname],
+                                 stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+            self.assertEqual(res.returncode, 1)
+            self.assertIn(b'helical', res.stderr)
+            self.assertNotIn(b'ERROR', res.stdout)
+            for bad in [['-r', '10x'], ['-r', '-1'], ['-n', '2.5'], ['-a', '0'], ['-s', '5,5'],
+                        ['-c', 'nan'], ['-f', 'csv'], ['-']]:
+                res = subprocess.run([run] + bad + [fname], stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+                self.assertEqual(res.returncode, 2)
+                self.assertIn(b'Usage', res.stderr)
+        finally:
+            shutil.rmtree(d)
+
+    def test_locfield_and_dipten(self):
+        latpar = np.diag([4.,4.5,5.])
+        # the second atom is not magnetic and is skipped
+        p = np.array([[0.,0.,0.],[0.5,0.5,0.5],[0.25,0.25,0.]])
+        fc = np.array([[0.,0.,1.],[0.,0.,0.],[1.,0.,0.]],dtype=np.complex)
+        k = np.zeros(3)
+        phi = np.zeros(3)
+        mus = [np.array([0.1,0.2,0.3]), np.array([0.5,0.,0.])]
+        sc = [9,9,9]
+
+        res = locfield(latpar, p, fc, k, phi, mus, 's', sc, 15., nnn=2, rcont=5.)
+        ten = dipten(latpar, p[[0,2]], mus, sc, 15.)
+        fused = locfield_and_dipten(latpar, p, fc, k, phi, mus, sc, 15., nnn=2, rcont=5.,
+                                    components='cdlts')
+        for r, t, (f, ft, fs) in zip(res, ten, fused):
+            f.ACont = 1.
+            r.ACont = 1.
+            np.testing.assert_array_almost_equal(f.T, r.T)
+            np.testing.assert_array_almost_equal(f.C, r.C)
+            np.testing.assert_array_almost_equal(ft, t)
+            self.assertEqual(fs.shape, (2,3,3))
+
+    def test_locfield_configurations(self):
+        # ferromagnet with a variable moment size and direction on two
+        # sublattices, the third atom is never magnetic
+        latpar = np.diag([3., 3., 4.])
+        p = np.array([[0.,0.,0.],[0.5,0.5,0.5],[0.5,0.,0.]])
+        mus = [[0.25,0.1,0.3], [0.5,0.,0.5]]
+        sc = [14, 14, 10]
+        moments = np.zeros([10,3,3])
+        for n, t in enumerate(np.linspace(0., np.pi, 10)):
+            moments[n,0] = [0., np.sin(t), np.cos(t)]
+            moments[n,1] = [0., 0., 0.1*n]
+
+        f = locfield_configurations(latpar, p, moments, mus, sc, 16., nnn=3, rcont=5.)
+        self.assertEqual(f.D.shape, (10,2,3))
+        for n in (0, 4, 9):
+            ref = locfield(latpar, p, moments[n].astype(np.complex), np.zeros(3), np.zeros(3),
+                           mus, 's', sc, 16., nnn=3, rcont=5.)
+            for m in range(2):
+                np.testing.assert_array_almost_equal(f.D[n,m], ref[m].D)
+                np.testing.assert_array_almost_equal(f.L[n,m], ref[m].L)
+
+        self.assertRaises(ValueError, locfield_configurations, latpar, p, moments[0], mus, sc, 16.)
+
+    def test_strain_expansion(self):
+        # ferromagnet on a bcc lattice under a small tetragonal and shear strain
+        latpar = np.diag([4., 4., 4.])
+        p = np.array([[0.,0.,0.],[0.5,0.5,0.5],[0.5,0.,0.]])
+        fc = np.array([[0.,0.,1.],[0.,0.,1.],[0.,0.,0.]], dtype=np.complex128)
+        mus = [[0.25,0.1,0.0], [0.5,0.,0.5]]
+        sc = [25, 25, 25]
+        r = 45.
+
+        s = StrainExpansion(latpar, p, fc, np.zeros(3), np.zeros(3), mus, sc, r)
+        self.assertEqual(s.d_dip.shape, (2,6,3))
+        self.assertEqual(s.d_tensor.shape, (2,6,3,3))
+
+        strained = np.dot(latpar, np.array([[1., 0., 0.003], [0., 1., 0.], [0.003, 0., 1.01]]))
+        np.testing.assert_allclose(s.strain(strained), [0., 0., 0.01, 0., 0.003, 0.], atol=1e-12)
+
+        d, l, T = s.predict(strained)
+        ref = locfield(strained, p, fc, np.zeros(3), np.zeros(3), mus, 's', sc, r)
+        dt = dipten(strained, p[:2], mus, sc, r)
+        for m in range(2):
+            # the fields change by a few mT, the surface of the sphere adds
+            # fluctuations of the order of 1e-4 T
+            np.testing.assert_allclose(d[m], ref[m].D, atol=5e-4)
+            np.testing.assert_allclose(l[m], ref[m].L, atol=5e-4)
+            np.testing.assert_allclose(T[m], dt[m], atol=5e-4)
+            self.assertGreater(np.abs(ref[m].D - s.dip[m]).max(), 2e-3)
+
+        self.assertRaises(ValueError, s.predict, [0.1, 0.2])
+
+    def test_fit_moments(self):
+        # ferromagnet with two sublattices: fit the moment components of
+        # both, the third atom is not magnetic
+        latpar = np.diag([3., 3., 4.])
+        p = np.array([[0.,0.,0.],[0.5,0.5,0.5],[0.5,0.,0.]])
+        mus = [[0.25,0.1,0.3], [0.5,0.,0.5], [0.1,0.7,0.2], [0.6,0.3,0.8],
+               [0.3,0.3,0.3], [0.9,0.2,0.6], [0.45,0.8,0.1]]
+        sc = [14, 14, 10]
+        fc = np.array([[0.,0.6,1.5],[0.,0.,-0.7],[0.,0.,0.]],dtype=np.complex)
+        res = locfield(latpar, p, fc, np.zeros(3), np.zeros(3), mus, 's', sc, 16., nnn=3, rcont=5.)
+        freq = [851.61554/(2.*np.pi)*np.linalg.norm(f.T) for f in res]
+
+        basis = np.zeros([3,3,3])
+        basis[0,0,1] = basis[1,0,2] = basis[2,1,2] = 1.
+        params, acont, chi2 = fit_moments(latpar, p, basis, mus, freq, sc, 16., [0.4,1.2,-0.5],
+                                          nnn=3, rcont=5.)
+        np.testing.assert_allclose(params, [0.6,1.5,-0.7], atol=1e-5)
+        self.assertLess(chi2, 1e-10)
+
+        self.assertRaises(ValueError, fit_moments, latpar, p, basis, mus, freq[1:], sc, 16., [1.,1.,1.])
+        self.assertRaises(ValueError, fit_moments, latpar, p, basis, mus, freq, sc, 16., [1.,1.])
+
+    def test_locfield_domains(self):
+        # two arms of the star of K of a tetragonal antiferromagnet, with a
+        # non magnetic atom
+        latpar = np.diag([3., 3., 4.])
+        p = np.array([[0.,0.,0.],[0.5,0.5,0.5]])
+        fca = np.array([[0.,0.,1.],[0.,0.,0.]],dtype=np.complex)
+        fcb = np.array([[1.,0.,0.],[0.,0.,0.]],dtype=np.complex)
+        phi = np.zeros(2)
+        domains = [(fca, [0.5,0.,0.], phi), (fcb, [0.,0.5,0.], phi)]
+        mus = [[0.25,0.1,0.3], [0.5,0.,0.5]]
+        sc = [20, 20, 15]
+
+        res = locfield_domains(latpar, p, domains, mus, sc, 25., nnn=2, rcont=4.,
+                               weights=[3., 1.])
+        for m, (fields, average) in zip(mus, res):
+            self.assertEqual(len(fields), 2)
+            for f, (fc, k, ph) in zip(fields, domains):
+                d = locfield(latpar, p, fc, k, ph, [m], 's', sc, 25., nnn=2, rcont=4.)[0]
+                np.testing.assert_array_almost_equal(f.D, d.D)
+                np.testing.assert_array_almost_equal(f.L, d.L)
+                d.ACont = f.ACont = 1.
+                np.testing.assert_array_almost_equal(f.C, d.C)
+            np.testing.assert_array_almost_equal(average.D,
+                                                 0.75*fields[0].D + 0.25*fields[1].D)
+
+        self.assertRaises(ValueError, locfield_domains, latpar, p, domains, mus, sc, 25.,
+                          weights=[1.])
+
+    def test_polarization(self):
+        # incommensurate helix: the fields at the muon describe an ellipse
+        # and the distribution of |B| gives a damped oscillation
+        latpar = np.diag([3., 3., 4.])
+        p = np.array([[0.,0.,0.]])
+        fc = np.array([[1.,1.j,0.]],dtype=np.complex)
+        k = np.array([0.,0.,0.2371])
+        phi = np.zeros(1)
+        mus = [[0.5,0.,0.25], [0.5,0.5,0.5]]
+        sc = [20, 20, 20]
+        t = np.linspace(0., 2., 41)
+
+        res = locfield(latpar, p, fc, k, phi, mus, 'i', sc, 25., nangles=360)
+        B = np.concatenate([res[0].T, res[1].T])
+        b = np.linalg.norm(B, axis=1)
+        cos2 = B[:,2]**2/b**2
+        w = np.concatenate([np.full(360, 0.75/360), np.full(360, 0.25/360)])
+        ref = np.dot(w, cos2[:,None] + (1.-cos2)[:,None]*np.cos(851.61554*np.outer(b, t)))
+
+        np.testing.assert_array_almost_equal(polarization(res, t, weights=[3., 1.]), ref)
+        np.testing.assert_array_almost_equal(
+            polarization(res, t, weights=[3., 1.], nbins=4000), ref, decimal=3)
+        np.testing.assert_array_almost_equal(polarization(res[0], t, powder=True),
+            np.mean(1./3. + 2./3.*np.cos(851.61554*np.outer(b[:360], t)), axis=0))
+
+        self.assertRaises(ValueError, polarization, res, t, weights=[1.])
+        self.assertRaises(ValueError, polarization, res, t, direction=[0.,0.,0.])
+
+    def test_field_histogram(self):
+        # non magnetic atoms are removed and the total histogram is normalized
+        latpar = np.diag([3., 3., 4.])
+        p = np.array([[0.,0.,0.],[0.5,0.5,0.5]])
+        fc = np.array([[1.,1.j,0.],[0.,0.,0.]],dtype=np.complex)
+        k = np.array([0.,0.,0.2371])
+        phi = np.zeros(2)
+        mus = [[0.5,0.,0.25], [0.5,0.5,0.5]]
+        sc = [20, 20, 20]
+
+        res = locfield(latpar, p, fc, k, phi, mus, 'i', sc, 25., nangles=100)
+        h, hc = field_histogram(latpar, p, fc, k, phi, mus, 'i', sc, 25., 100, 50, 1.,
+                                weights=[3., 1.])
+        ref = 0.75*np.histogram(np.linalg.norm(res[0].T, axis=1), 50, (0., 1.))[0]/100. + \
+              0.25*np.histogram(np.linalg.norm(res[1].T, axis=1), 50, (0., 1.))[0]/100.
+        np.testing.assert_array_almost_equal(h, ref)
+        self.assertAlmostEqual(np.sum(h), 1.)
+        np.testing.assert_array_almost_equal(np.sum(hc, axis=1), np.ones(3))
+
+        self.assertRaises(ValueError, field_histogram, latpar, p, fc, k, phi, mus, 's', sc, 25.,
+                          100, 50, 1.)
+        self.assertRaises(ValueError, field_histogram, latpar, p, fc, k, phi, mus, 'r', sc, 25.,
+                          100, 50, 1.)
+
+    def test_field_polarization(self):
+        # same helix of test_polarization, fields never returned to Python
+        latpar = np.diag([3., 3., 4.])
+        p = np.array([[0.,0.,0.],[0.5,0.5,0.5]])
+        fc = np.array([[1.,1.j,0.],[0.,0.,0.]],dtype=np.complex)
+        k = np.array([0.,0.,0.2371])
+        phi = np.zeros(2)
+        mus = [[0.5,0.,0.25], [0.5,0.5,0.5]]
+        sc = [20, 20, 20]
+        t = np.linspace(0., 2., 41)
+
+        res = locfield(latpar, p, fc, k, phi, mus, 'i', sc, 25., nangles=360)
+        bmax = 1.001*max(np.max(np.linalg.norm(f.T, axis=1)) for f in res)
+        np.testing.assert_array_almost_equal(
+            field_polarization(latpar, p, fc, k, phi, mus, 'i', sc, 25., 360, 4000, bmax, t,
+                               weights=[3., 1.]),
+            polarization(res, t, weights=[3., 1.]), decimal=3)
+        np.testing.assert_array_almost_equal(
+            field_polarization(latpar, p, fc, k, phi, mus[0], 'i', sc, 25., 360, 4000, bmax, t,
+                               powder=True),
+            polarization(res[0], t, powder=True), decimal=3)
+
+        self.assertRaises(ValueError, field_polarization, latpar, p, fc, k, phi, mus, 'r', sc, 25.,
+                          360, 100, 1., t)
+        self.assertRaises(ValueError, field_polarization, latpar, p, fc, k, phi, mus, 'i', sc, 25.,
+                          360, 100, 1., t, direction=[0.,0.,0.])
+
+    def test_disorder_sites(self):
+        # antiferromagnet with a non magnetic atom
+        latpar = np.diag([3., 3., 4.])
+        p = np.array([[0.,0.,0.],[0.5,0.5,0.5],[0.5,0.,0.]])
+        fc = np.array([[0.,0.,1.],[0.,0.,0.],[0.,1.,0.]],dtype=np.complex)
+        k = np.array([0.5,0.5,0.])
+        phi = np.array([0.,0.,0.25])
+        mu = [0.25,0.1,0.3]
+        sc = [14, 14, 10]
+
+        sites = DisorderSites(latpar, p, fc, k, phi, mu, sc, 16., nnn=3, rcont=5.)
+        self.assertEqual(sites.moments.shape, (sites.nsites, 3))
+        self.assertFalse(np.any(sites.atoms == 1))
+
+        ref = locfield(latpar, p, fc, k, phi, [mu], 's', sc, 16., nnn=3, rcont=5.)[0]
+        f = sites.fields(sites.moments)
+        np.testing.assert_array_almost_equal(f.D, ref.D)
+        np.testing.assert_array_almost_equal(f.L, ref.L)
+        f.ACont = ref.ACont = 1.
+        np.testing.assert_array_almost_equal(f.C, ref.C)
+
+        # atom 2 removed: same as the fields of atom 0 alone
+        ref0 = locfield(latpar, p[:1], fc[:1], k, phi[:1], [mu], 's', sc, 16., nnn=3, rcont=5.)[0]
+        f = sites.sample(3, occupancy=[1., 1., 0.])
+        np.testing.assert_array_almost_equal(f.D, np.tile(ref0.D, (3,1)))
+        self.assertEqual(sites.sample(5, occupancy=0.5, seed=3).D.shape, (5,3))
+
+        self.assertRaises(ValueError, sites.fields, sites.moments[1:])
+        self.assertRaises(ValueError, sites.sample, 3, occupancy=[1., 0.])
+
+    def test_symmetric_sites(self):
+        # hexagonal ferromagnet with moments along c, magnetic point
+        # group 62'2': C6 rotations and C2 around a combined with time reversal
+        latpar = np.array([[3., 0., 0.], [-1.5, 1.5*np.sqrt(3.), 0.], [0., 0., 4.]])
+        p = np.array([[0.,0.,0.]])
+        fc = np.array([[0.,0.,1.]],dtype=np.complex)
+        k = np.zeros(3)
+        phi = np.zeros(1)
+        c6 = np.array([[1,-1,0],[1,0,0],[0,0,1]])
+        c2 = np.array([[1,-1,0],[0,-1,0],[0,0,-1]])
+        rots, trs = [], []
+        for n in range(6):
+            r6 = np.linalg.matrix_power(c6, n)
+            rots += [r6, np.dot(r6, c2)]
+            trs += [False, True]
+        tls = np.zeros([12,3])
+
+        x0 = np.array([0.3,0.1,0.2])
+        mus = [(np.dot(R, x0) % 1.) for R in rots]
+        sc = [19, 19, 11]
+        r = 20.
+
+        irr, mapping = symmetry_reduce(mus, rots, tls)
+        self.assertEqual(irr, [0])
+        self.assertEqual(len(mapping), 12)
+
+        direct = locfield(latpar, p, fc, k, phi, mus, 's', sc, r, nnn=2, rcont=4.)
+        sym = locfield_symmetric(latpar, p, fc, k, phi, mus, rots, tls, trs, sc, r, nnn=2, rcont=4.)
+        for d, f in zip(direct, sym):
+            np.testing.assert_array_almost_equal(f.D, d.D)
+            np.testing.assert_array_almost_equal(f.L, d.L)
+            d.ACont = f.ACont = 1.
+            np.testing.assert_array_almost_equal(f.C, d.C)
+
+        # antiferromagnetic stacking along c: the operations mapping the
+        # site to a different plane are not used.
+        k = np.array([0.,0.,0.5])
+        irr, mapping = symmetry_reduce(mus, rots, tls, k, sc)
+        self.assertEqual(len(irr), 2)
+        direct = locfield(latpar, p, fc, k, phi, mus, 's', sc, r, nnn=2, rcont=4.)
+        sym = locfield_symmetric(latpar, p, fc, k, phi, mus, rots, tls, trs, sc, r, nnn=2, rcont=4.)
+        for d, f in zip(direct, sym):
+            np.testing.assert_array_almost_equal(f.D, d.D)
+
+        direct = dipten(latpar, p, mus, sc, r)
+        sym = dipten_symmetric(latpar, p, mus, rots, tls, sc, r)
+        for d, t in zip(direct, sym):
+            np.testing.assert_array_almost_equal(t, d)
+
+
+    def test_site_symmetry(self):
+        # muon between two atoms along c in a hexagonal ferromagnet with
+        # moments along c. Site symmetry 6/mmm, the operations reversing
+        # the moments are combined with time reversal.
+        latpar = np.array([[3., 0., 0.], [-1.5, 1.5*np.sqrt(3.), 0.], [0., 0., 4.]])
+        p = np.array([[0.,0.,0.]])
+        fc = np.array([[0.,0.,1.]],dtype=np.complex)
+        k = np.zeros(3)
+        phi = np.zeros(1)
+        c6 = np.array([[1,-1,0],[1,0,0],[0,0,1]])
+        c2 = np.array([[1,-1,0],[0,-1,0],[0,0,-1]])
+        rots = []
+        for n in range(6):
+            r6 = np.linalg.matrix_power(c6, n)
+            rots += [r6, np.dot(r6, c2), -r6, -np.dot(r6, c2)]
+        trs = [int(round(np.linalg.det(R)*R[2,2])) for R in rots]
+
+        mus = [np.array([0.,0.,0.5])]
+        sc = [19, 19, 11]
+        r = 20.
+
+        direct = locfield(latpar, p, fc, k, phi, mus, 's', sc, r, nnn=2, rcont=4.)
+        sym = locfield(latpar, p, fc, k, phi, mus, 's', sc, r, nnn=2, rcont=4.,
+                       site_rotations=[rots], site_time_reversals=[trs])
+        np.testing.assert_array_almost_equal(sym[0].D, direct[0].D)
+        np.testing.assert_array_almost_equal(sym[0].L, direct[0].L)
+        direct[0].ACont = sym[0].ACont = 1.
+        np.testing.assert_array_almost_equal(sym[0].C, direct[0].C)
+
+        direct = dipten(latpar, p, mus, sc, r)
+        sym = dipten(latpar, p, mus, sc, r, site_rotations=[rots])
+        np.testing.assert_array_almost_equal(sym[0], direct[0])
+
+        self.assertRaises(ValueError, locfield, latpar, p, fc, k, phi, mus, 'r', sc, r,
+                          nangles=4, axis=[0,0,1], site_rotations=[rots])
     
     def test_mnge(self):
         # from MnGe.cif
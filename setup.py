@@ -18,7 +18,25 @@ sources = ['simplesum.c', \
            'vec3.c', \
            'mat3.c', \
            'pile.c', \
-           'dipolartensor.c']
+           'reduce.c', \
+           'order.c', \
+           'dipolartensor.c', \
+           'fusedsum.c', \
+           'wedge.c', \
+           'polarization.c', \
+           'histogram.c', \
+           'disorder.c', \
+           'configsum.c', \
+           'fit.c', \
+           'strainsum.c', \
+           'adaptivesum.c', \
+           'extrapolate.c', \
+           'hybridsum.c', \
+           'gridscan.c', \
+           'latticesum.c', \
+           'kernels.c', \
+           'chargesum.c', \
+           'session.c']
 
 src_sources = []
 for s in sources:
@@ -0,0 +1,334 @@
+/**
+ * @file adaptivesum.c
+ * @author Pietro Bonfa
+ * @date 2016
+ * @brief Local fields with a Lorentz radius chosen from a tolerance
+ *
+ * The Lorentz sphere is grown by shells [R_{s-1}, R_s) about one cell
+ * thick. After each shell the dipolar field of the atoms inside R_s is
+ * completed with the Lorentz field, which is the continuum estimate of
+ * the contribution of all the atoms outside. The remaining error is
+ * estimated from the change of this sum over the last LFC_ADAPTIVE_SHELLS
+ * shells and the sphere stops growing when it is below the tolerance, so
+ * that every muon site is summed up to the radius it needs.
+ * Each shell is a LatticeWalk in which, for each column of cells along c,
+ * only the range of cells crossing the shell is visited, so the cost
+ * grows with the volume of the sphere actually used.
+ */
+
+#define _USE_MATH_DEFINES
+#include <stdlib.h>
+#include <math.h>
+#include "config.h"
+#include "mat3.h"
+#include "pile.h"
+#include "latticesum.h"
+#include "kernels.h"
+#include "adaptivesum.h"
+
+#ifndef M_PI
+#    define M_PI 3.14159265358979323846
+#endif
+
+/* Data shared by all the cells of a sum. */
+struct adaptive_data {
+    unsigned int natoms;
+    const struct vec3 *atmcart;  /* Cartesian positions in the cell */
+    const struct vec3 *P, *Q;    /* m(R) = cos(2 pi K.R) P + sin(2 pi K.R) Q */
+    const double *K;
+    int origin[3];               /* index of the cell of the muon */
+    int nb[3];                   /* bounds of the cell indices, for the keys */
+    struct mat3 lat;
+    struct vec3 muonpos;
+    double cont_radius;
+    pile *MCont;
+    /* current shell rin <= r < rout and the distances ri, ro of the
+     * centers of the cells crossing it */
+    double rin, rout, ri, ro;
+    struct vec3 center;          /* center of the cell */
+    double cc;                   /* c.c */
+};
+
+/*
+ * Adds the atoms of cell (i, j, k) with rin <= r < rout from the muon.
+ * acc holds the dipolar sum and the sum of the moments.
+ */
+static void adaptive_cell(const struct adaptive_data *d, int i, int j, int k,
+          double rin, double rout, double *acc)
+{
+    struct vec3 base, r, u, m;
+    double n, c, s, t, kr;
+    unsigned long key;
+    unsigned int a;
+
+    base = vec3_sub(vec3_add(vec3_add(vec3_muls((double) i, d->lat.a),
+                                      vec3_muls((double) j, d->lat.b)),
+                             vec3_muls((double) k, d->lat.c)),
+                    d->muonpos);
+
+    kr = 2.0*M_PI * (d->K[0]*(i + d->origin[0]) + d->K[1]*(j + d->origin[1]) +
+                     d->K[2]*(k + d->origin[2]));
+    c = cos(kr);
+    s = sin(kr);
+
+    for (a = 0; a < d->natoms; a++)
+    {
+        r = vec3_add(base, d->atmcart[a]);
+        n = vec3_norm(r);
+        if (n < rin || !(n < rout))
+            continue;
+
+        m = vec3_add(vec3_muls(c, d->P[a]), vec3_muls(s, d->Q[a]));
+
+        if (n < d->cont_radius)
+        {
+            key = ((unsigned long) ((i + d->nb[0]) * (2*d->nb[1] + 1) + (j + d->nb[1])) * (2*d->nb[2] + 1)
+                   + (unsigned long) (k + d->nb[2])) * d->natoms + a;
+#pragma omp critical(adaptive_contact)
+            pile_add_element_keyed(d->MCont, pow(n,CONT_SCALING_POWER), key,
+                                   vec3_muls(1./pow(n,CONT_SCALING_POWER), m));
+        }
+
+        acc[3] += m.x;
+        acc[4] += m.y;
+        acc[5] += m.z;
+
+        u = vec3_muls(1./n, r);
+        t = vec3_dot(m, u);
+        acc[0] += (3.0 * t * u.x - m.x) / (n*n*n);
+        acc[1] += (3.0 * t * u.y - m.y) / (n*n*n);
+        acc[2] += (3.0 * t * u.z - m.z) / (n*n*n);
+    }
+}
+
+/*
+ * Block of LatticeWalk: adds the cells (i, j, klo) ... (i, j, khi-1) that
+ * cross the current shell.
+ */
+static void adaptive_block(const void *ctx, int i, int j, int klo, int khi,
+          unsigned int tile, double *acc)
+{
+    const struct adaptive_data *d = (const struct adaptive_data *) ctx;
+    struct vec3 p0;
+    double lo, hi;
+    int k, k0, k1, k2, k3;
+
+    (void) tile;
+
+    /* |p0 + k c| is the distance of the center of cell k */
+    p0 = vec3_add(vec3_sub(vec3_add(vec3_muls((double) i, d->lat.a),
+                                    vec3_muls((double) j, d->lat.b)),
+                           d->muonpos),
+                  d->center);
+    if (!lattice_column_span(p0, d->lat.c, d->cc, d->ro, &lo, &hi))
+        return;
+    k0 = (int) ceil(lo);
+    k3 = (int) floor(hi);
+    if (d->ri > 0.0 && lattice_column_span(p0, d->lat.c, d->cc, d->ri, &lo, &hi)
+        && hi > lo)
+    {
+        /* cells with lo < k < hi are inside rin */
+        k1 = (int) floor(lo);
+        k2 = (int) ceil(hi);
+        if (k1 > k3)
+            k1 = k3;
+        if (k2 < k0)
+            k2 = k0;
+    }
+    else
+    {
+        k1 = k3;
+        k2 = k3 + 1;
+    }
+
+    for (k = (k0 > klo ? k0 : klo); k <= k1 && k < khi; k++)
+        adaptive_cell(d, i, j, k, d->rin, d->rout, acc);
+    for (k = (k2 > klo ? k2 : klo); k <= k3 && k < khi; k++)
+        adaptive_cell(d, i, j, k, d->rin, d->rout, acc);
+}
+
+/**
+ * This function calculates the local fields at a muon site with the
+ * smallest Lorentz radius (a multiple of the shell thickness) for which the
+ * estimated error of the dipolar plus Lorentz field is below
+ * max(abs_tol, rel_tol |B_dip + B_lor|).
+ * The magnetic order is defined as in SimpleSum and no supercell is needed.
+ *
+ * @param in_positions positions of the magnetic atoms in fractional
+ *         coordinates, 3*in_natoms numbers.
+ * @param in_fc Fourier components (Re x, Im x, Re y, ..., Im z) of each atom.
+ * @param in_K the propagation vector in *reciprocal lattice units*.
+ * @param in_phi the phase for each of the atoms given in in_positions.
+ * @param in_muonpos position of the muon in fractional coordinates
+ * @param in_origin index of the cell of the muon in the phase 2 pi K.R
+ *         (in SimpleSum it is in_supercell/2). NULL for the origin.
+ * @param in_cell lattice cell (a_x, a_y, a_z, b_x, ..., c_z).
+ * @param max_radius largest Lorentz radius.
+ * @param abs_tol absolute tolerance (Tesla).
+ * @param rel_tol tolerance relative to |B_dip + B_lor|.
+ * @param nnn_for_cont number of nearest neighboring atoms to be included
+ *                      for the evaluation of the contact field.
+ * @param cont_radius only atoms within this radius are eligible to contribute to
+ *                      the contact field. The sphere is always grown beyond
+ *                      cont_radius.
+ * @param in_natoms: number of atoms in the unit cell.
+ * @param out_field_cont Contact field in Tesla (see SimpleSum).
+ * @param out_field_dip  Dipolar field in Tesla.
+ * @param out_field_lor  Lorentz field in Tesla.
+ * @param out_radius the Lorentz radius actually used.
+ * @param out_error the estimated error of B_dip + B_lor (Tesla).
+ * @return 1 if the tolerance was reached, 0 if the sphere reached max_radius.
+ */
+int AdaptiveSum(const double *in_positions,
+          const double *in_fc, const double *in_K, const double *in_phi,
+          const double *in_muonpos, const int *in_origin, const double *in_cell,
+          double max_radius, double abs_tol, double rel_tol,
+          const unsigned int nnn_for_cont, const double cont_radius,
+          unsigned int in_natoms,
+          double *out_field_cont, double *out_field_dip, double *out_field_lor,
+          double *out_radius, double *out_error)
+{
+    int ns[2], converged = 0;
+    unsigned int a, s, x;
+    struct mat3 lat, inv;
+    struct vec3 center, BDip, BLor, BCont, tot, prev, col[3];
+    struct vec3 *atmcart = malloc(in_natoms * sizeof(struct vec3));
+    struct vec3 *P = malloc(in_natoms * sizeof(struct vec3));
+    struct vec3 *Q = malloc(in_natoms * sizeof(struct vec3));
+    double change[LFC_ADAPTIVE_SHELLS];
+    double acc[6];
+    double rout = 0.0, dr, t, cellradius = 0.0, offset, err = 0.0;
+    pile MCont;
+    struct adaptive_data d;
+    struct lattice_walk w;
+
+    lat.a.x = in_cell[0]; lat.a.y = in_cell[1]; lat.a.z = in_cell[2];
+    lat.b.x = in_cell[3]; lat.b.y = in_cell[4]; lat.b.z = in_cell[5];
+    lat.c.x = in_cell[6]; lat.c.y = in_cell[7]; lat.c.z = in_cell[8];
+    inv = mat3_inv(lat);
+
+    d.natoms = in_natoms;
+    d.atmcart = atmcart;
+    d.P = P;
+    d.Q = Q;
+    d.K = in_K;
+    d.lat = lat;
+    d.muonpos = mat3_vmul(_vec3(in_muonpos[0], in_muonpos[1], in_muonpos[2]), lat);
+    d.cont_radius = cont_radius;
+    d.MCont = &MCont;
+    for (x = 0; x < 3; x++)
+        d.origin[x] = (in_origin != NULL ? in_origin[x] : 0);
+
+    /* cells farther than the shell by more than cellradius are skipped */
+    center = vec3_muls(0.5, vec3_add(vec3_add(lat.a, lat.b), lat.c));
+    for (a = 0; a < in_natoms; a++)
+    {
+        atmcart[a] = mat3_vmul(_vec3(in_positions[3*a], in_positions[3*a+1],
+                                     in_positions[3*a+2]), lat);
+        t = vec3_norm(vec3_sub(atmcart[a], center));
+        if (t > cellradius)
+            cellradius = t;
+
+        /* m(R) = cos(2 pi K.R) P + sin(2 pi K.R) Q */
+        kernel_fc_moment(in_fc + 6*a, in_phi[a], &P[a], &Q[a]);
+    }
+
+    /* shells about one cell thick */
+    dr = pow(fabs(vec3_dot(lat.a, vec3_cross(lat.b, lat.c))), 1.0/3.0);
+
+    /* A cell n reaching the radius R has |n_x| <= (R + offset) |col[x]|,
+     * with col[x] the columns of lat^-1. The bounds for max_radius are
+     * used to build unique keys for the contact pile. */
+    col[0] = _vec3(inv.a.x, inv.b.x, inv.c.x);
+    col[1] = _vec3(inv.a.y, inv.b.y, inv.c.y);
+    col[2] = _vec3(inv.a.z, inv.b.z, inv.c.z);
+    offset = cellradius + vec3_norm(vec3_sub(d.muonpos, center)) + EPS;
+    for (x = 0; x < 3; x++)
+        d.nb[x] = (int) ceil((max_radius + offset) * vec3_norm(col[x]));
+
+    pile_init(&MCont, nnn_for_cont);
+    for (x = 0; x < 6; x++)
+        acc[x] = 0.0;
+    prev = vec3_zero();
+    BDip = vec3_zero();
+    BLor = vec3_zero();
+    d.center = center;
+    d.cc = vec3_dot(lat.c, lat.c);
+
+    w.block = adaptive_block;
+    w.ctx = &d;
+    w.lo[2] = -d.nb[2];
+    w.hi[2] = d.nb[2] + 1;
+    w.kblock = 0;
+    w.ntiles = 1;
+    w.nacc = 6;
+    w.tile_acc = 0;
+
+    for (s = 0; rout < max_radius; s++)
+    {
+        d.rin = rout;
+        rout = (d.rin + dr < max_radius ? d.rin + dr : max_radius);
+        d.rout = rout;
+        for (x = 0; x < 2; x++)
+            ns[x] = (int) ceil((rout + offset) * vec3_norm(col[x]));
+
+        /* centers of the cells crossing the shell */
+        d.ro = rout + cellradius + EPS;
+        d.ri = d.rin - cellradius - EPS;
+
+        w.lo[0] = -ns[0];
+        w.lo[1] = -ns[1];
+        w.hi[0] = ns[0] + 1;
+        w.hi[1] = ns[1] + 1;
+        LatticeWalk(&w, 0, acc);
+
+        /* dipolar field of the atoms inside rout, completed by the
+         * continuum (Lorentz) contribution of the atoms outside */
+        BDip = vec3_muls(0.92740098, _vec3(acc[0], acc[1], acc[2]));
+        BLor = vec3_muls(0.33333333333*11.654064 * 3./(4.*M_PI*pow(rout,3)),
+                         _vec3(acc[3], acc[4], acc[5]));
+        tot = vec3_add(BDip, BLor);
+
+        change[s % LFC_ADAPTIVE_SHELLS] = vec3_norm(vec3_sub(tot, prev));
+        prev = tot;
+
+        err = 0.0;
+        for (x = 0; x < LFC_ADAPTIVE_SHELLS && x <= s; x++)
+            if (change[x] > err)
+                err = change[x];
+
+        if (s + 1 < LFC_ADAPTIVE_SHELLS || rout < cont_radius)
+            continue;
+
+        t = rel_tol * vec3_norm(tot);
+        if (err <= (abs_tol > t ? abs_tol : t))
+        {
+            converged = 1;
+            break;
+        }
+    }
+
+    /* Contact Field */
+    BCont = kernel_contact_field(&MCont);
+    pile_free(&MCont);
+
+    out_field_cont[0] = BCont.x;
+    out_field_cont[1] = BCont.y;
+    out_field_cont[2] = BCont.z;
+
+    out_field_dip[0] = BDip.x;
+    out_field_dip[1] = BDip.y;
+    out_field_dip[2] = BDip.z;
+
+    out_field_lor[0] = BLor.x;
+    out_field_lor[1] = BLor.y;
+    out_field_lor[2] = BLor.z;
+
+    *out_radius = rout;
+    *out_error = err;
+
+    free(Q);
+    free(P);
+    free(atmcart);
+    return converged;
+}
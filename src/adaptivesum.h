@@ -0,0 +1,12 @@
+#ifndef ADAPTIVE_SUM_H
+#define ADAPTIVE_SUM_H
+
+int AdaptiveSum(const double *in_positions,
+          const double *in_fc, const double *in_K, const double *in_phi,
+          const double *in_muonpos, const int *in_origin, const double *in_cell,
+          double max_radius, double abs_tol, double rel_tol,
+          const unsigned int nnn_for_cont, const double cont_radius,
+          unsigned int in_natoms,
+          double *out_field_cont, double *out_field_dip, double *out_field_lor,
+          double *out_radius, double *out_error);
+#endif
@@ -0,0 +1,69 @@
+/**
+ * @file chargesum.c
+ * @author Pietro Bonfa
+ * @date 2016
+ * @brief Electrostatic potential and electric field gradient of point charges
+ *
+ * A direct sum of the point charges within the sphere, evaluated with the
+ * kernels of LatticeSum. The sum converges (conditionally) only for cells
+ * with zero total charge.
+ */
+
+#include <stdlib.h>
+#include "kernels.h"
+#include "chargesum.h"
+
+/* e / (4 pi epsilon_0 Angstrom), in Volt */
+#define COULOMB_VOLT 14.399645
+
+/**
+ * This function calculates the electrostatic potential and the electric
+ * field gradient generated at the muon site by point charges.
+ *
+ * @param in_positions positions of the charges in fractional coordinates,
+ *         3*in_natoms numbers.
+ * @param in_charges charges in units of e.
+ * @param in_muonpos position of the muon in fractional coordinates
+ * @param in_supercell extension of the supercell along the lattice vectors.
+ * @param in_cell lattice cell (a_x, a_y, a_z, b_x, ..., c_z).
+ * @param radius radius of the sphere.
+ * @param in_natoms: number of charges in the unit cell.
+ * @param in_flags: bitwise or of the LFC_* flags defined in config.h.
+ *                   With LFC_REPRODUCIBLE the result does not depend on
+ *                   the number of threads.
+ * @param out_potential the potential in Volt.
+ * @param out_efg the electric field gradient V_ij (9 numbers, V/Angstrom^2).
+ */
+void ChargeSum(const double *in_positions, const double *in_charges,
+          const double *in_muonpos, const int *in_supercell, const double *in_cell,
+          double radius, unsigned int in_natoms, unsigned int in_flags,
+          double *out_potential, double *out_efg)
+{
+    double acc[7] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+    struct lattice_kernel kernels[2];
+
+    kernels[0].term = kernel_charge_potential;
+    kernels[0].ctx = in_charges;
+    kernels[0].nacc = 1;
+    kernels[0].cutoff = radius;
+
+    kernels[1].term = kernel_efg;
+    kernels[1].ctx = in_charges;
+    kernels[1].nacc = 6;
+    kernels[1].cutoff = radius;
+
+    LatticeSum(in_positions, in_natoms, NULL, in_muonpos, in_supercell, in_cell,
+               radius, kernels, 2, in_flags, acc);
+
+    *out_potential = COULOMB_VOLT * acc[0];
+
+    out_efg[0] = COULOMB_VOLT * acc[1];
+    out_efg[1] = COULOMB_VOLT * acc[2];
+    out_efg[2] = COULOMB_VOLT * acc[3];
+    out_efg[3] = COULOMB_VOLT * acc[2];
+    out_efg[4] = COULOMB_VOLT * acc[4];
+    out_efg[5] = COULOMB_VOLT * acc[5];
+    out_efg[6] = COULOMB_VOLT * acc[3];
+    out_efg[7] = COULOMB_VOLT * acc[5];
+    out_efg[8] = COULOMB_VOLT * acc[6];
+}
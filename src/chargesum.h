@@ -0,0 +1,8 @@
+#ifndef CHARGE_SUM_H
+#define CHARGE_SUM_H
+
+void ChargeSum(const double *in_positions, const double *in_charges,
+          const double *in_muonpos, const int *in_supercell, const double *in_cell,
+          double radius, unsigned int in_natoms, unsigned int in_flags,
+          double *out_potential, double *out_efg);
+#endif
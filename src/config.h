@@ -1,3 +1,58 @@
 /* Power used for contact interaction. Must be positive */
 #define CONT_SCALING_POWER 3 
 #define EPS 1e-5
+
+/* The basis atoms are processed in tiles of LFC_ATOM_TILE atoms and the
+ * cells along the third lattice vector in blocks of LFC_CELL_BLOCK cells.
+ * Each (cell block, atom tile) pair is a unit of parallel work and the
+ * data of the tile (about 72 bytes per atom) is reused, while it is still
+ * in cache, for all the cells of the block. */
+#define LFC_ATOM_TILE 256
+#define LFC_CELL_BLOCK 4
+
+/* ConfigSum multiplies the configurations by the response matrix in blocks
+ * of LFC_GEMM_CONF configurations and LFC_GEMM_K columns (two or three
+ * atoms are 6 columns each), so that a block of the response matrix is
+ * reused from cache for all the configurations of a block. */
+#define LFC_GEMM_CONF 32
+#define LFC_GEMM_K 192
+
+/* Flags accepted by the lattice sums through their in_flags argument.
+ * They can be combined with a bitwise or. */
+
+/* Positions, distances and per-dipole terms are evaluated in single
+ * precision while all the accumulators stay in double precision.
+ * See README.md for the error bound with respect to the default
+ * (full double precision) evaluation. */
+#define LFC_MIXED_PRECISION 1
+
+/* Partial sums are computed per column of cells and reduced in a fixed
+ * order, so that the result is bitwise identical for any number of
+ * threads. */
+#define LFC_REPRODUCIBLE 2
+
+/* Routines that accumulate per-atom quantities (and reproducible sums with
+ * many accumulators) split the columns of cells (along c) in groups. Each
+ * group is summed by a single thread and the groups are then reduced in a
+ * fixed order, so these results never depend on the number of threads.
+ * There are never less than LFC_NGROUPS groups (or columns). */
+#define LFC_NGROUPS 32
+
+/* Reproducible sums with few accumulators store one partial result per
+ * column of cells. When that would take more than LFC_PARTIALS doubles
+ * the columns are split in groups instead (see pairwise_groups). */
+#define LFC_PARTIALS (1UL << 22)
+
+/* Components computed by FusedSum. They can be combined with a bitwise or. */
+#define LFC_CONTACT 1
+#define LFC_DIPOLAR 2
+#define LFC_LORENTZ 4
+#define LFC_TENSOR 8
+#define LFC_SUBLATTICE 16
+#define LFC_ALL 31
+
+/* AdaptiveSum grows the Lorentz sphere by shells about one cell thick and
+ * estimates the error from the change of the dipolar plus Lorentz field
+ * over the last LFC_ADAPTIVE_SHELLS shells. HybridSum estimates it in the
+ * same way by shrinking the radius of the exact sum. */
+#define LFC_ADAPTIVE_SHELLS 3
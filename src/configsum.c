@@ -0,0 +1,262 @@
+/**
+ * @file configsum.c
+ * @author Pietro Bonfa
+ * @date 2016
+ * @brief Local fields of many moment configurations on the same lattice
+ *
+ * With the propagation vector and the phases fixed, the fields at a muon
+ * site are linear in the vectors P_a and Q_a of the atoms (see SimpleSum):
+ * the 9 numbers (contact, dipolar and Lorentz fields) are M x, with x the
+ * 6*natoms components of P and Q and M a 9 x 6*natoms response matrix
+ * obtained from the lattice coefficients of FusedSum.
+ * The response matrices of all the muon sites are stacked and the fields
+ * of all the configurations are obtained with a single matrix product
+ * F = X M^T, evaluated in cache blocks.
+ */
+
+#define _USE_MATH_DEFINES
+#include <stdlib.h>
+#include <math.h>
+#include "config.h"
+#include "fusedsum.h"
+#include "configsum.h"
+
+#ifndef M_PI
+#    define M_PI 3.14159265358979323846
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/* Rows of the response matrix of one muon site. */
+#define CONFIG_NROWS 9
+
+/*
+ * Fills the CONFIG_NROWS rows (contact, dipolar, Lorentz; x, y, z) of the
+ * response matrix of one muon from its lattice coefficients. Column
+ * 6a + j multiplies P_a (j < 3) or Q_a (j >= 3). Units as in SimpleSum.
+ */
+static void config_response(const double *coef, unsigned int in_natoms,
+          double radius, double *M)
+{
+    const double *w;
+    unsigned int a, x, y, ncol = 6 * in_natoms;
+    double lor = 0.33333333333*11.654064 * 3./(4.*M_PI*pow(radius,3));
+    /* position of T_xy in the xx, xy, xz, yy, yz, zz storage */
+    static const unsigned int sym[3][3] = {{0, 1, 2}, {1, 3, 4}, {2, 4, 5}};
+
+    for (a = 0; a < in_natoms; a++)
+    {
+        w = coef + a * LFC_NCOEF;
+        for (x = 0; x < 3; x++)
+        {
+            for (y = 0; y < 3; y++)
+            {
+                M[(0 + x) * ncol + 6*a + y]     = (x == y ? 7.769376 * w[LFC_COEF_CC] : 0.0);
+                M[(0 + x) * ncol + 6*a + 3 + y] = (x == y ? 7.769376 * w[LFC_COEF_CS] : 0.0);
+                M[(3 + x) * ncol + 6*a + y]     = 0.92740098 * w[LFC_COEF_DC + sym[x][y]];
+                M[(3 + x) * ncol + 6*a + 3 + y] = 0.92740098 * w[LFC_COEF_DS + sym[x][y]];
+                M[(6 + x) * ncol + 6*a + y]     = (x == y ? lor * w[LFC_COEF_LC] : 0.0);
+                M[(6 + x) * ncol + 6*a + 3 + y] = (x == y ? lor * w[LFC_COEF_LS] : 0.0);
+            }
+        }
+    }
+}
+
+/*
+ * F[c][r] = sum_k X[c][k] M[r][k] for the configurations c0 <= c < c1.
+ * X is nconf x ncol, M is nrows x ncol and F is nconf x nrows, all row
+ * major. The columns are visited in blocks of LFC_GEMM_K and four
+ * configurations share each row of M loaded from cache.
+ */
+static void config_gemm(const double *X, const double *M, unsigned int c0,
+          unsigned int c1, unsigned int nrows, unsigned int ncol, double *F)
+{
+    unsigned int c, r, k, k0, k1;
+    const double *x0, *x1, *x2, *x3, *m;
+    double s0, s1, s2, s3;
+
+    for (c = c0; c < c1; c++)
+        for (r = 0; r < nrows; r++)
+            F[(size_t) c * nrows + r] = 0.0;
+
+    for (k0 = 0; k0 < ncol; k0 += LFC_GEMM_K)
+    {
+        k1 = (k0 + LFC_GEMM_K < ncol ? k0 + LFC_GEMM_K : ncol);
+        for (c = c0; c + 4 <= c1; c += 4)
+        {
+            x0 = X + (size_t) c * ncol;
+            x1 = x0 + ncol;
+            x2 = x1 + ncol;
+            x3 = x2 + ncol;
+            for (r = 0; r < nrows; r++)
+            {
+                m = M + (size_t) r * ncol;
+                s0 = s1 = s2 = s3 = 0.0;
+                for (k = k0; k < k1; k++)
+                {
+                    s0 += x0[k] * m[k];
+                    s1 += x1[k] * m[k];
+                    s2 += x2[k] * m[k];
+                    s3 += x3[k] * m[k];
+                }
+                F[(size_t) c * nrows + r] += s0;
+                F[(size_t) (c+1) * nrows + r] += s1;
+                F[(size_t) (c+2) * nrows + r] += s2;
+                F[(size_t) (c+3) * nrows + r] += s3;
+            }
+        }
+        for (; c < c1; c++)
+        {
+            x0 = X + (size_t) c * ncol;
+            for (r = 0; r < nrows; r++)
+            {
+                m = M + (size_t) r * ncol;
+                s0 = 0.0;
+                for (k = k0; k < k1; k++)
+                    s0 += x0[k] * m[k];
+                F[(size_t) c * nrows + r] += s0;
+            }
+        }
+    }
+}
+
+/**
+ * This function calculates the response matrices of several muon sites:
+ * the fields at site mu are M_mu x, where x holds P_a and Q_a (see
+ * SimpleSum) of each atom, 6*in_natoms numbers.
+ *
+ * @param in_positions positions of the magnetic atoms in fractional
+ *         coordinates (see SimpleSum).
+ * @param in_K the propagation vector in *reciprocal lattice units*.
+ * @param in_muonpos positions of the muon sites in fractional coordinates,
+ *         3*in_nmu numbers.
+ * @param in_nmu number of muon sites.
+ * @param in_supercell extension of the supercell along the lattice vectors.
+ * @param in_cell lattice cell (see SimpleSum).
+ * @param radius Lorentz sphere radius
+ * @param nnn_for_cont number of nearest neighboring atoms to be included
+ *                      for the evaluation of the contact field.
+ * @param cont_radius only atoms within this radius are eligible to contribute to
+ *                      the contact field.
+ * @param in_natoms: number of atoms in the lattice.
+ * @param out_response in_nmu x 9 x 6*in_natoms numbers. Rows 0-2 give the
+ *         contact field (for unit ACont), rows 3-5 the dipolar field and
+ *         rows 6-8 the Lorentz field, in Tesla. Column 6a + j multiplies
+ *         component j of P_a (j < 3) or of Q_a (j >= 3).
+ */
+void ConfigResponse(const double *in_positions, const double *in_K,
+          const double *in_muonpos, unsigned int in_nmu,
+          const int * in_supercell, const double *in_cell,
+          const double radius, const unsigned int nnn_for_cont, const double cont_radius,
+          unsigned int in_natoms, double *out_response)
+{
+    unsigned int mu, ncol = 6 * in_natoms;
+    double *coef = malloc(in_natoms * LFC_NCOEF * sizeof(double));
+
+    /* the lattice sums are parallel */
+    for (mu = 0; mu < in_nmu; mu++)
+    {
+        LatticeCoefficients(in_positions, in_K, in_muonpos + 3*mu, in_supercell,
+                            in_cell, radius, nnn_for_cont, cont_radius, in_natoms,
+                            LFC_CONTACT | LFC_DIPOLAR | LFC_LORENTZ, coef);
+        config_response(coef, in_natoms, radius,
+                        out_response + (size_t) mu * CONFIG_NROWS * ncol);
+    }
+    free(coef);
+}
+
+/**
+ * This function calculates the local fields at several muon sites for
+ * many configurations of the Fourier components, with the same
+ * propagation vector and phases. The lattice sums are performed once for
+ * each muon site.
+ *
+ * @param in_positions positions of the magnetic atoms in fractional
+ *         coordinates (see SimpleSum).
+ * @param in_nconf number of configurations.
+ * @param in_fc Fourier components of each configuration, in_nconf times
+ *         the 6*in_natoms numbers described in SimpleSum.
+ * @param in_K the propagation vector in *reciprocal lattice units*.
+ * @param in_phi the phase for each of the atoms given in in_positions.
+ * @param in_muonpos positions of the muon sites in fractional coordinates,
+ *         3*in_nmu numbers.
+ * @param in_nmu number of muon sites.
+ * @param in_supercell extension of the supercell along the lattice vectors.
+ * @param in_cell lattice cell (see SimpleSum).
+ * @param radius Lorentz sphere radius
+ * @param nnn_for_cont number of nearest neighboring atoms to be included
+ *                      for the evaluation of the contact field.
+ * @param cont_radius only atoms within this radius are eligible to contribute to
+ *                      the contact field.
+ * @param in_natoms: number of atoms in the lattice.
+ * @param out_field_cont Contact field, in_nconf x in_nmu x 3.
+ * @param out_field_dip  Dipolar field, in_nconf x in_nmu x 3.
+ * @param out_field_lor  Lorentz field, in_nconf x in_nmu x 3.
+ */
+void ConfigSum(const double *in_positions, unsigned int in_nconf,
+          const double *in_fc, const double *in_K, const double *in_phi,
+          const double *in_muonpos, unsigned int in_nmu,
+          const int * in_supercell, const double *in_cell,
+          const double radius, const unsigned int nnn_for_cont, const double cont_radius,
+          unsigned int in_natoms,
+          double *out_field_cont, double *out_field_dip, double *out_field_lor)
+{
+    unsigned int ncol = 6 * in_natoms, nrows = CONFIG_NROWS * in_nmu;
+    unsigned int mu, a, j, x;
+    int c, cb;
+    double phi, cphi, sphi;
+    const double *fc;
+    double *M = malloc((size_t) nrows * ncol * sizeof(double));
+    double *X = malloc((size_t) in_nconf * ncol * sizeof(double));
+    double *F = malloc((size_t) in_nconf * nrows * sizeof(double));
+
+    ConfigResponse(in_positions, in_K, in_muonpos, in_nmu, in_supercell, in_cell,
+                   radius, nnn_for_cont, cont_radius, in_natoms, M);
+
+    /* P and Q of every configuration, see SimpleSum */
+#pragma omp parallel for schedule(static) private(c,a,j,phi,cphi,sphi,fc)
+    for (c = 0; c < (int) in_nconf; c++)
+    {
+        for (a = 0; a < in_natoms; a++)
+        {
+            fc = in_fc + ((size_t) c * in_natoms + a) * 6;
+            phi = 2.0*M_PI*in_phi[a];
+            cphi = cos(phi);
+            sphi = sin(phi);
+            for (j = 0; j < 3; j++)
+            {
+#ifdef _ALTERNATE_FC_INPUT
+                X[(size_t) c * ncol + 6*a + j]     = cphi * fc[j] + sphi * fc[3+j];
+                X[(size_t) c * ncol + 6*a + 3 + j] = cphi * fc[3+j] - sphi * fc[j];
+#else
+                X[(size_t) c * ncol + 6*a + j]     = cphi * fc[2*j] + sphi * fc[2*j+1];
+                X[(size_t) c * ncol + 6*a + 3 + j] = cphi * fc[2*j+1] - sphi * fc[2*j];
+#endif
+            }
+        }
+    }
+
+#pragma omp parallel for schedule(dynamic) private(cb)
+    for (cb = 0; cb < (int) in_nconf; cb += LFC_GEMM_CONF)
+        config_gemm(X, M, cb, (cb + LFC_GEMM_CONF < (int) in_nconf ? cb + LFC_GEMM_CONF : (int) in_nconf),
+                    nrows, ncol, F);
+
+    for (c = 0; c < (int) in_nconf; c++)
+    {
+        for (mu = 0; mu < in_nmu; mu++)
+        {
+            for (x = 0; x < 3; x++)
+            {
+                out_field_cont[((size_t) c * in_nmu + mu) * 3 + x] = F[(size_t) c * nrows + CONFIG_NROWS*mu + x];
+                out_field_dip[((size_t) c * in_nmu + mu) * 3 + x] = F[(size_t) c * nrows + CONFIG_NROWS*mu + 3 + x];
+                out_field_lor[((size_t) c * in_nmu + mu) * 3 + x] = F[(size_t) c * nrows + CONFIG_NROWS*mu + 6 + x];
+            }
+        }
+    }
+
+    free(M);
+    free(X);
+    free(F);
+}
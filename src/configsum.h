@@ -0,0 +1,17 @@
+#ifndef CONFIG_SUM_H
+#define CONFIG_SUM_H
+
+void ConfigResponse(const double *in_positions, const double *in_K,
+          const double *in_muonpos, unsigned int in_nmu,
+          const int * in_supercell, const double *in_cell,
+          const double radius, const unsigned int nnn_for_cont, const double cont_radius,
+          unsigned int in_natoms, double *out_response);
+
+void ConfigSum(const double *in_positions, unsigned int in_nconf,
+          const double *in_fc, const double *in_K, const double *in_phi,
+          const double *in_muonpos, unsigned int in_nmu,
+          const int * in_supercell, const double *in_cell,
+          const double radius, const unsigned int nnn_for_cont, const double cont_radius,
+          unsigned int in_natoms,
+          double *out_field_cont, double *out_field_dip, double *out_field_lor);
+#endif
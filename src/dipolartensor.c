@@ -11,14 +11,257 @@
 
 #define _USE_MATH_DEFINES
 #include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
 #include "mat3.h"
+#include "config.h"
+#include "latticesum.h"
+#include "order.h"
+#include "wedge.h"
 
 #ifdef _OPENMP
 #include <omp.h>
 #endif 
 
 
+/* Data shared by all the cells of the supercell. */
+struct dipolartensor_data {
+    struct mat3 lat;
+    struct vec3 muonpos;
+    unsigned int natoms;
+    unsigned int flags;
+    double radius;
+    const struct vec3 *atmcart;
+    const float *fpos;
+    const struct vec3 *tilec;   /* center and radius of the tiles */
+    const double *tiler;
+    const struct wedge *wedge;  /* site symmetry, NULL if not used */
+};
+
+/**
+ * This function adds the contributions of the atoms of tile `tile`
+ * in cell (i,j,k) to the 6 independent elements of the tensor stored in acc
+ * (xx, xy, xz, yy, yz, zz).
+ * With the site symmetry only the representatives of the orbits are
+ * summed, with weight 1/|stabilizer|.
+ */
+static void dipolartensor_cell(const struct dipolartensor_data *d,
+          unsigned int i, unsigned int j, unsigned int k, unsigned int tile,
+          double *acc)
+{
+    struct vec3 r;
+    struct vec3 base; /* origin of the cell with respect to the muon */
+    double n;
+    double onebrcube; /* 1/r^3 */
+    double onebrfive; /* 1/r^5 */
+    unsigned int atom;
+    unsigned int stab; /* operations leaving the atom in place */
+    double wt = 1.0; /* weight of the atom */
+    unsigned int first = tile * LFC_ATOM_TILE; /* atoms of the tile */
+    unsigned int last = first + LFC_ATOM_TILE < d->natoms ? first + LFC_ATOM_TILE : d->natoms;
+
+    float frx, fry, frz, fn2, fonebrcube, fonebrfive;
+    float fwt = 1.0f;
+    float fradius2 = (float) (d->radius*d->radius);
+
+    /* origin of the cell (in Angstrom!) with respect to the muon */
+    base = vec3_sub(
+                vec3_add(vec3_add(vec3_muls((double) i, d->lat.a),
+                                  vec3_muls((double) j, d->lat.b)),
+                         vec3_muls((double) k, d->lat.c)),
+                d->muonpos);
+
+    /* skip the tile if it is entirely outside the sphere */
+    if (vec3_norm(vec3_add(base, d->tilec[tile])) >
+            (d->radius + d->tiler[tile]) * (1.0 + EPS))
+        return;
+
+    /* skip the tile if it holds no representative of the site symmetry */
+    if (d->wedge != NULL &&
+            wedge_skip(d->wedge, vec3_add(base, d->tilec[tile]), d->tiler[tile]))
+        return;
+
+    if (d->flags & LFC_MIXED_PRECISION)
+    {
+        /* geometry and tensor elements in single precision */
+        for (atom = first; atom < last; ++atom)
+        {
+            frx = (float) base.x + d->fpos[3*atom+0];
+            fry = (float) base.y + d->fpos[3*atom+1];
+            frz = (float) base.z + d->fpos[3*atom+2];
+
+            fn2 = frx*frx + fry*fry + frz*frz;
+            if (fn2 < fradius2)
+            {
+                if (d->wedge != NULL)
+                {
+                    r.x = frx; r.y = fry; r.z = frz;
+                    stab = wedge_stabilizer(d->wedge, r);
+                    if (stab == 0)
+                        continue;
+                    fwt = 1.0f / (float) stab;
+                }
+
+                fonebrcube = fwt/(fn2*sqrtf(fn2));
+                fonebrfive = 3.0f*fonebrcube/fn2;
+
+                acc[0] += -fonebrcube+frx*frx*fonebrfive;
+                acc[1] += frx*fry*fonebrfive;
+                acc[2] += frx*frz*fonebrfive;
+                acc[3] += -fonebrcube+fry*fry*fonebrfive;
+                acc[4] += fry*frz*fonebrfive;
+                acc[5] += -fonebrcube+frz*frz*fonebrfive;
+            }
+        }
+        return;
+    }
+
+    /* loop over atoms */
+    for (atom = first; atom < last; ++atom)
+    {
+        
+        /* difference between atom pos and muon pos (cart coordinates) */
+        r = vec3_add(base, d->atmcart[atom]);
+        
+        n = vec3_norm(r);
+        if (n < d->radius)
+        {
+            if (d->wedge != NULL)
+            {
+                stab = wedge_stabilizer(d->wedge, r);
+                if (stab == 0)
+                    continue;
+                wt = 1.0 / stab;
+            }
+
+            /* vector */
+            onebrcube = wt/pow(n,3);
+            onebrfive = wt/pow(n,5);
+            
+            
+            /* See uSR bible (Yaouanc Dalmas De Reotier, page 81) */
+            /* alpha = x */
+            acc[0] += -onebrcube+3.0*r.x*r.x*onebrfive;
+            acc[1] += 3.0*r.x*r.y*onebrfive;
+            acc[2] += 3.0*r.x*r.z*onebrfive;
+            
+            /* alpha = y */
+            acc[3] += -onebrcube+3.0*r.y*r.y*onebrfive;
+            acc[4] += 3.0*r.y*r.z*onebrfive;
+            
+            /* alpha = z */
+            acc[5] += -onebrcube+3.0*r.z*r.z*onebrfive;
+        }                    
+
+    }
+}
+
+/*
+ * Kernels for tiles of exactly N atoms, used in double precision only
+ * (see the unrolled kernels of simplesum.c).
+ */
+#define DIPOLARTENSOR_UNROLLED(N)                                             \
+static void dipolartensor_block_##N(const struct dipolartensor_data *d,       \
+          unsigned int i, unsigned int j, unsigned int k0, unsigned int k1,    \
+          unsigned int tile, double *acc)                                     \
+{                                                                             \
+    double px[N], py[N], pz[N];                                               \
+    double rx, ry, rz, n2, onebrcube, onebrfive;                              \
+    double Txx = 0.0, Txy = 0.0, Txz = 0.0, Tyy = 0.0, Tyz = 0.0, Tzz = 0.0;  \
+    struct vec3 base;                                                         \
+    unsigned int a, k, first = tile * LFC_ATOM_TILE;                          \
+                                                                              \
+    for (a = 0; a < N; ++a)                                                   \
+    {                                                                         \
+        px[a] = d->atmcart[first+a].x;                                        \
+        py[a] = d->atmcart[first+a].y;                                        \
+        pz[a] = d->atmcart[first+a].z;                                        \
+    }                                                                         \
+                                                                              \
+    for (k = k0; k < k1; ++k)                                                 \
+    {                                                                         \
+        base = vec3_sub(                                                      \
+                    vec3_add(vec3_add(vec3_muls((double) i, d->lat.a),        \
+                                      vec3_muls((double) j, d->lat.b)),       \
+                             vec3_muls((double) k, d->lat.c)),                \
+                    d->muonpos);                                              \
+        if (vec3_norm(vec3_add(base, d->tilec[tile])) >                       \
+                (d->radius + d->tiler[tile]) * (1.0 + EPS))                   \
+            continue;                                                         \
+                                                                              \
+        for (a = 0; a < N; ++a)                                               \
+        {                                                                     \
+            rx = base.x + px[a];                                              \
+            ry = base.y + py[a];                                              \
+            rz = base.z + pz[a];                                              \
+            n2 = rx*rx + ry*ry + rz*rz;                                       \
+            if (sqrt(n2) < d->radius)                                         \
+            {                                                                 \
+                onebrcube = 1.0/(n2*sqrt(n2));                                \
+                onebrfive = 3.0*onebrcube/n2;                                 \
+                Txx += -onebrcube+rx*rx*onebrfive;                            \
+                Txy += rx*ry*onebrfive;                                       \
+                Txz += rx*rz*onebrfive;                                       \
+                Tyy += -onebrcube+ry*ry*onebrfive;                            \
+                Tyz += ry*rz*onebrfive;                                       \
+                Tzz += -onebrcube+rz*rz*onebrfive;                            \
+            }                                                                 \
+        }                                                                     \
+    }                                                                         \
+                                                                              \
+    acc[0] += Txx; acc[1] += Txy; acc[2] += Txz;                              \
+    acc[3] += Tyy; acc[4] += Tyz; acc[5] += Tzz;                              \
+}
+
+DIPOLARTENSOR_UNROLLED(1)
+DIPOLARTENSOR_UNROLLED(2)
+DIPOLARTENSOR_UNROLLED(4)
+DIPOLARTENSOR_UNROLLED(8)
+
+/**
+ * This function adds the contributions of the atoms of tile `tile`
+ * in the cells (i,j,k0) ... (i,j,k1-1) to acc (see dipolartensor_cell).
+ * Unrolled kernels are used for tiles of 1, 2, 4 and 8 atoms, unless the
+ * site symmetry is used. This is the block of LatticeWalk.
+ */
+static void dipolartensor_block(const void *ctx, int i, int j, int k0, int k1,
+          unsigned int tile, double *acc)
+{
+    const struct dipolartensor_data *d = (const struct dipolartensor_data *) ctx;
+    int k;
+    unsigned int first = tile * LFC_ATOM_TILE;
+    unsigned int n = first + LFC_ATOM_TILE < d->natoms ? LFC_ATOM_TILE : d->natoms - first;
+    struct vec3 center; /* center of the block with respect to the muon */
+
+    /* skip the whole block if it holds no representative of the site symmetry */
+    if (d->wedge != NULL)
+    {
+        center = vec3_sub(
+                    vec3_add(vec3_add(vec3_muls((double) i, d->lat.a),
+                                      vec3_muls((double) j, d->lat.b)),
+                             vec3_muls(0.5 * (k0 + k1 - 1), d->lat.c)),
+                    vec3_sub(d->muonpos, d->tilec[tile]));
+        if (wedge_skip(d->wedge, center,
+                       d->tiler[tile] + 0.5 * (k1 - k0 - 1) * vec3_norm(d->lat.c)))
+            return;
+    }
+
+    if (!(d->flags & LFC_MIXED_PRECISION) && d->wedge == NULL)
+    {
+        switch (n)
+        {
+            case 1: dipolartensor_block_1(d, i, j, k0, k1, tile, acc); return;
+            case 2: dipolartensor_block_2(d, i, j, k0, k1, tile, acc); return;
+            case 4: dipolartensor_block_4(d, i, j, k0, k1, tile, acc); return;
+            case 8: dipolartensor_block_8(d, i, j, k0, k1, tile, acc); return;
+            default: break;
+        }
+    }
+
+    for (k = k0; k < k1; ++k)
+        dipolartensor_cell(d, i, j, k, tile, acc);
+}
+
 /**
  * This function calculates dipolar tensors in fractional coordinates.
  * 
@@ -31,6 +274,16 @@
  *         with the following order: a_x, a_y, a_z, b_z, b_y, b_z, c_x, c_y, c_z.
  * @param in_radius Lorentz sphere radius
  * @param in_natoms: number of atoms in the lattice.
+ * @param in_siteops: point group of the muon site, in_nops Cartesian rotation
+ *                   matrices (9 numbers each, row major). When given, only
+ *                   an irreducible wedge of the sphere is summed and the
+ *                   tensor is symmetrized (see SimpleSum). NULL to sum all
+ *                   atoms.
+ * @param in_nops: number of operations in in_siteops.
+ * @param in_flags: bitwise or of the LFC_* flags defined in config.h
+ *                   (0 for the default double precision evaluation).
+ *                   With LFC_REPRODUCIBLE the result does not depend on
+ *                   the number of threads.
  * @param out_field the dipolar tensor as 1D array with 9 entries: 
  *          T_11, T_12, T_13, T_21, T_22, T_23, T_31, T_32, T_33
  *          \f{equation}{ T= 
@@ -41,33 +294,47 @@
  *               \end{matrix}
  *           \f}
  */
-void DipolarTensor(const double *in_positions, 
+void DipolarTensorEx(const double *in_positions, 
           const double *in_muonpos, const int * in_supercell, const double *in_cell, 
           const double in_radius, unsigned int in_natoms,
+          const double *in_siteops, unsigned int in_nops, unsigned int in_flags,
           double *out_field) 
 {
 
     unsigned int scx, scy, scz = 10; /*supercell sizes */
-    unsigned int i,j,k; /* counters for supercells */
+#ifdef _DEBUG
+    unsigned int i;
+#endif
+    
+    unsigned int ntiles; /* tiles of LFC_ATOM_TILE atoms */
     
     struct vec3 atmpos;
     struct vec3 muonpos;
-    struct vec3 r;
 
         
+    struct mat3 lat;
     struct mat3 sc_lat;
     
-    double n;
-    double onebrcube; /* 1/r^3 */
-    double onebrfive; /* 1/r^5 */
+    struct vec3 *atmcart = malloc(in_natoms * sizeof(struct vec3));
     
+    /* single precision copies used with LFC_MIXED_PRECISION */
+    float *fpos = malloc(3 * in_natoms * sizeof(float));
+
+    /* atoms are stored along a Morton curve, see order.c */
+    unsigned int *perm = malloc(in_natoms * sizeof(unsigned int));
+    unsigned int ia; /* input index of the atom */
+    struct vec3 *tilec = malloc(((in_natoms + LFC_ATOM_TILE - 1) / LFC_ATOM_TILE) * sizeof(struct vec3));
+    double *tiler = malloc(((in_natoms + LFC_ATOM_TILE - 1) / LFC_ATOM_TILE) * sizeof(double));
     
-    struct mat3 A, D;
-#ifdef _OPENMP
+    struct dipolartensor_data d;
+    struct lattice_walk walk;
+    struct wedge wedge;
+    double acc[6]; /* xx, xy, xz, yy, yz, zz */
+    
+    struct mat3 A;
     double Bxx=0.0; double Bxy=0.0; double Bxz=0.0;
     double Byx=0.0; double Byy=0.0; double Byz=0.0;
     double Bzx=0.0; double Bzy=0.0; double Bzz=0.0;
-#endif    
     
     unsigned int atom;     /* counter for atoms */
     
@@ -86,32 +353,32 @@ void DipolarTensor(const double *in_positions,
     printf("Size is: %i\n",in_natoms);
 #endif 
     
-    sc_lat.a.x = in_cell[0];
-    sc_lat.a.y = in_cell[1];
-    sc_lat.a.z = in_cell[2];
-    sc_lat.b.x = in_cell[3];
-    sc_lat.b.y = in_cell[4];
-    sc_lat.b.z = in_cell[5];
-    sc_lat.c.x = in_cell[6];
-    sc_lat.c.y = in_cell[7];
-    sc_lat.c.z = in_cell[8];
+    lat.a.x = in_cell[0];
+    lat.a.y = in_cell[1];
+    lat.a.z = in_cell[2];
+    lat.b.x = in_cell[3];
+    lat.b.y = in_cell[4];
+    lat.b.z = in_cell[5];
+    lat.c.x = in_cell[6];
+    lat.c.y = in_cell[7];
+    lat.c.z = in_cell[8];
  
 #ifdef _DEBUG      
     for (i=0;i<3;i++)
         printf("Cell is: %i %e %e %e\n",i,in_cell[i*3],in_cell[i*3+1],in_cell[i*3+2]);
         
-    /*printf("a %e %e %e\n", sc_lat.a.x, sc_lat.a.y, sc_lat.a.z); */
+    /*printf("a %e %e %e\n", lat.a.x, lat.a.y, lat.a.z); */
 #endif     
 
     sc_lat = mat3_mul(
-                        mat3_diag((float) scx, (float) scy, (float) scz),
-                        sc_lat);
+                        mat3_diag((double) scx, (double) scy, (double) scz),
+                        lat);
     
     
     /* muon position in reduced coordinates */
-    muonpos.x =  (in_muonpos[0] + (scx/2) ) / (float) scx;
-    muonpos.y =  (in_muonpos[1] + (scy/2) ) / (float) scy;
-    muonpos.z =  (in_muonpos[2] + (scz/2) ) / (float) scz;
+    muonpos.x =  (in_muonpos[0] + (scx/2) ) / (double) scx;
+    muonpos.y =  (in_muonpos[1] + (scy/2) ) / (double) scy;
+    muonpos.z =  (in_muonpos[2] + (scz/2) ) / (double) scz;
 
 #ifdef _DEBUG
     printf("Muon pos (frac): %e %e %e\n",muonpos.x,muonpos.y,muonpos.z);
@@ -124,105 +391,93 @@ void DipolarTensor(const double *in_positions,
 #endif
 
 
-#ifdef _DEBUG
+    morton_order(in_positions, in_natoms, perm);
+
     for (atom = 0; atom < in_natoms; ++atom)
     {
+        ia = perm[atom];
                     
         /* atom position in reduced coordinates */
-        atmpos.x =  in_positions[3*atom] ;
-        atmpos.y =  in_positions[3*atom+1] ;
-        atmpos.z =  in_positions[3*atom+2] ;
-        
-        printf("Atom pos (crys): %e %e %e\n",atmpos.x,atmpos.y,atmpos.z);
+        atmpos.x =  in_positions[3*ia] ;
+        atmpos.y =  in_positions[3*ia+1] ;
+        atmpos.z =  in_positions[3*ia+2] ;
         
         /* go to cartesian coordinates (in Angstrom!) */
-        atmpos = mat3_vmul(atmpos,sc_lat);  
+        atmcart[atom] = mat3_vmul(atmpos,lat);  
         
-        printf("Atom pos (cart): %e %e %e\n",atmpos.x,atmpos.y,atmpos.z);
+        fpos[3*atom+0] = (float) atmcart[atom].x;
+        fpos[3*atom+1] = (float) atmcart[atom].y;
+        fpos[3*atom+2] = (float) atmcart[atom].z;
+
+#ifdef _DEBUG
+        printf("Atom pos (crys): %e %e %e\n",atmpos.x,atmpos.y,atmpos.z);
+        printf("Atom pos (cart): %e %e %e\n",atmcart[atom].x,atmcart[atom].y,atmcart[atom].z);
+#endif
     }
         
-#endif
 
 
-A = mat3_zero();
-D = mat3_zero();
+    d.lat = lat;
+    d.muonpos = muonpos;
+    d.natoms = in_natoms;
+    d.flags = in_flags;
+    d.radius = in_radius;
+    d.atmcart = atmcart;
+    d.fpos = fpos;
+    d.tilec = tilec;
+    d.tiler = tiler;
+    d.wedge = NULL;
 
-#pragma omp parallel
-{    
-#pragma omp for collapse(3) private(i,j,k,atom,r,n,atmpos,D,onebrcube,onebrfive) reduction(+:Bxx,Bxy,Bxz,Byx,Byy,Byz,Bzx,Bzy,Bzz)
-    for (i = 0; i < scx; ++i)
+    if (in_siteops != NULL && in_nops > 1)
     {
-        for (j = 0; j < scy; ++j)
-        {
-            for (k = 0; k < scz; ++k)
-            {
-                /* loop over atoms */
-                for (atom = 0; atom < in_natoms; ++atom)
-                {
-                    
-                    /* atom position in reduced coordinates */
-                    atmpos.x = ( in_positions[3*atom] + (float) i) / (float) scx;
-                    atmpos.y = ( in_positions[3*atom+1] + (float) j) / (float) scy;
-                    atmpos.z = ( in_positions[3*atom+2] + (float) k) / (float) scz;
-                    
+        wedge_init(&wedge, in_siteops, NULL, in_nops);
+        d.wedge = &wedge;
+    }
 
-                    
-                    /* go to cartesian coordinates (in Angstrom!) */
-                    atmpos = mat3_vmul(atmpos,sc_lat);
-                    
-                    /*printf("atompos: %e %e %e\n", atmpos.x, atmpos.y, atmpos.z); */
-                    /* difference between atom pos and muon pos (cart coordinates) */
-                    
-                    r = vec3_sub(atmpos,muonpos);
-                    
-                    n = vec3_norm(r);
-                    if (n < in_radius)
-                    {
-
-
-                        /* vector */
-                        onebrcube = 1.0/pow(n,3);
-                        onebrfive = 1.0/pow(n,5);
-                        
-                        
-                        /* See uSR bible (Yaouanc Dalmas De Reotier, page 81) */
-                        /* alpha = x */
-                        D.a.x = -onebrcube+3.0*r.x*r.x*onebrfive;
-                        D.a.y = 3.0*r.x*r.y*onebrfive;
-                        D.a.z = 3.0*r.x*r.z*onebrfive;
-                        
-                        /* alpha = y */
-                        D.b.x = D.a.y;
-                        D.b.y = -onebrcube+3.0*r.y*r.y*onebrfive;
-                        D.b.z = 3.0*r.y*r.z*onebrfive;
-                        
-                        /* alpha = z */
-                        D.c.x = D.a.z;
-                        D.c.y = D.b.z;
-                        D.c.z = -onebrcube+3.0*r.z*r.z*onebrfive;
-                        
-#ifdef _OPENMP                        
-                        Bxx += D.a.x; Bxy += D.a.y; Bxz += D.a.z;
-                        Byx += D.b.x; Byy += D.b.y; Byz += D.b.z;
-                        Bzx += D.c.x; Bzy += D.c.y; Bzz += D.c.z;
-                        
-#else
-                        A = mat3_add( A,D );
-#endif                                    
-                        
-                    }                    
+    ntiles = (in_natoms + LFC_ATOM_TILE - 1) / LFC_ATOM_TILE;
+    tile_bounds(atmcart, in_natoms, LFC_ATOM_TILE, tilec, tiler);
 
-                }
-                
-            }
-        }
+    /* fixed summation order with LFC_REPRODUCIBLE, see SimpleSum */
+    walk.block = dipolartensor_block;
+    walk.ctx = &d;
+    walk.lo[0] = walk.lo[1] = walk.lo[2] = 0;
+    walk.hi[0] = scx;
+    walk.hi[1] = scy;
+    walk.hi[2] = scz;
+    walk.kblock = LFC_CELL_BLOCK;
+    walk.ntiles = ntiles;
+    walk.nacc = 6;
+    walk.tile_acc = 0;
+    for (atom = 0; atom < 6; atom++)
+        acc[atom] = 0.0;
+    LatticeWalk(&walk, in_flags, acc);
+
+    Bxx = acc[0]; Bxy = acc[1]; Bxz = acc[2];
+    Byy = acc[3]; Byz = acc[4]; Bzz = acc[5];
+
+    free(atmcart);
+    free(perm);
+    free(tilec);
+    free(tiler);
+    free(fpos);
+
+    /* the rest of each orbit */
+    if (d.wedge != NULL)
+    {
+        acc[0] = Bxx; acc[1] = Bxy; acc[2] = Bxz;
+        acc[3] = Byy; acc[4] = Byz; acc[5] = Bzz;
+        wedge_symmetrize_tensor(&wedge, acc);
+        Bxx = acc[0]; Bxy = acc[1]; Bxz = acc[2];
+        Byy = acc[3]; Byz = acc[4]; Bzz = acc[5];
+        wedge_free(&wedge);
     }
-}
-#ifdef _OPENMP
+
+    /* the tensor is symmetric */
+    Byx = Bxy; Bzx = Bxz; Bzy = Byz;
+
     A.a.x = Bxx; A.a.y = Bxy; A.a.z = Bxz;
     A.b.x = Byx; A.b.y = Byy; A.b.z = Byz;
     A.c.x = Bzx; A.c.y = Bzy; A.c.z = Bzz;
-#endif     
     /* B = vec3_muls(0.9274009, B); // we should multiply for a volume */
     out_field[0] = A.a.x; out_field[1] = A.a.y; out_field[2] = A.a.z;
     out_field[3] = A.b.x; out_field[4] = A.b.y; out_field[5] = A.b.z;
@@ -230,4 +485,15 @@ D = mat3_zero();
 
 }
 
-
+/**
+ * DipolarTensorEx without site symmetry and with the default flags. This
+ * is the interface of the 0.1 releases.
+ */
+void DipolarTensor(const double *in_positions, 
+          const double *in_muonpos, const int * in_supercell, const double *in_cell, 
+          const double in_radius, unsigned int in_natoms,
+          double *out_field)
+{
+    DipolarTensorEx(in_positions, in_muonpos, in_supercell, in_cell, in_radius,
+                    in_natoms, NULL, 0, 0, out_field);
+}
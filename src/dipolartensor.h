@@ -8,4 +8,11 @@
           const double *in_muonpos, const int * in_supercell, const double *in_cell, 
           const double radius, unsigned int size,
           double *out_field);
+
+/** @brief Dipolar Tensor with site symmetry and LFC_* flags */
+void DipolarTensorEx(const double *in_positions, 
+          const double *in_muonpos, const int * in_supercell, const double *in_cell, 
+          const double radius, unsigned int size,
+          const double *siteops, unsigned int nops, unsigned int flags,
+          double *out_field);
 #endif
@@ -0,0 +1,351 @@
+/**
+ * @file disorder.c
+ * @author Pietro Bonfa
+ * @date 2016
+ * @brief Local fields of diluted or disordered magnetic configurations
+ *
+ * The dipolar field at the muon is linear in the moments:
+ * B = sum_s T_s m_s, with T_s the dipolar tensor of site s (an atom of
+ * a given cell of the supercell) inside the Lorentz sphere.
+ * The sites and their tensors are collected once by SphereSites (with a
+ * kernel of LatticeSum) and sorted by distance from the muon, and any
+ * number of configurations (one moment for each site, zero for a vacancy)
+ * can then be evaluated with a sparse dot product each, either given
+ * explicitly (DisorderSum) or drawn at random from a parent configuration
+ * (DilutionSample).
+ * The configurations are evaluated in parallel.
+ */
+
+#define _USE_MATH_DEFINES
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include "config.h"
+#include "latticesum.h"
+#include "disorder.h"
+
+#ifndef M_PI
+#    define M_PI 3.14159265358979323846
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/* A site of the sphere, used while sorting. */
+struct sphere_site {
+    double rank;            /* r^CONT_SCALING_POWER, as in the contact pile */
+    unsigned long key;      /* ((i*scy+j)*scz+k)*natoms + atom */
+    double n;               /* distance from the muon */
+    struct vec3 u;          /* unit vector from the muon */
+};
+
+/* The sites of the sphere, being collected. */
+struct sphere_list {
+    struct sphere_site *sites;
+    unsigned long n, max;
+};
+
+/* Kernel of LatticeSum counting the sites. */
+static void sphere_count(const void *ctx, const struct lattice_site *site,
+          double *acc)
+{
+    (void) ctx;
+    (void) site;
+    acc[0] += 1.0;
+}
+
+/* Kernel of LatticeSum appending the site to the list in ctx. The order
+ * depends on the threads and is fixed by sorting. */
+static void sphere_collect(const void *ctx, const struct lattice_site *site,
+          double *acc)
+{
+    struct sphere_list *list = (struct sphere_list *) ctx;
+    struct sphere_site s;
+
+    (void) acc;
+    s.rank = pow(site->n, CONT_SCALING_POWER);
+    s.key = site->key;
+    s.n = site->n;
+    s.u = vec3_muls(1.0/site->n, site->r);
+
+#pragma omp critical(sphere_sites)
+    {
+        if (list->n == list->max)
+        {
+            list->max = (list->max > 0 ? 2*list->max : 1024);
+            list->sites = realloc(list->sites, list->max * sizeof(struct sphere_site));
+        }
+        list->sites[list->n++] = s;
+    }
+}
+
+/* Same order as the contact pile: by rank, ties broken by the key. */
+static int sphere_site_cmp(const void *a, const void *b)
+{
+    const struct sphere_site *sa = (const struct sphere_site *) a;
+    const struct sphere_site *sb = (const struct sphere_site *) b;
+
+    if (sa->rank != sb->rank)
+        return (sa->rank < sb->rank ? -1 : 1);
+    if (sa->key != sb->key)
+        return (sa->key < sb->key ? -1 : 1);
+    return 0;
+}
+
+/**
+ * This function collects the (cell, atom) sites of the supercell inside
+ * the Lorentz sphere and their dipolar tensors. The cells and the muon
+ * position are defined as in SimpleSum.
+ *
+ * @param in_positions positions of the magnetic atoms in fractional
+ *         coordinates, 3*in_natoms numbers.
+ * @param in_muonpos position of the muon in fractional coordinates
+ * @param in_supercell extension of the supercell along the lattice vectors.
+ * @param in_cell lattice cell (a_x, a_y, a_z, b_x, ..., c_z).
+ * @param radius Lorentz sphere radius
+ * @param in_natoms: number of atoms in the unit cell.
+ * @param out_key for each site ((i*scy+j)*scz+k)*in_natoms + atom, where
+ *         (i, j, k) is the cell in the supercell. If NULL, only the number
+ *         of sites is computed.
+ * @param out_tensor dipolar tensor of each site (xx, xy, xz, yy, yz, zz),
+ *         in Tesla per Bohr magneton, 6 numbers per site.
+ * @param out_dist distance of each site from the muon, Angstrom.
+ * @return the number of sites. The sites are sorted by distance from the
+ *         muon (ties are broken by the key).
+ */
+unsigned int SphereSites(const double *in_positions, const double *in_muonpos,
+          const int *in_supercell, const double *in_cell, double radius,
+          unsigned int in_natoms, unsigned long *out_key, double *out_tensor,
+          double *out_dist)
+{
+    unsigned int nsites = 0, s;
+    struct vec3 u;
+    struct sphere_site *sites;
+    struct sphere_list list = {NULL, 0, 0};
+    struct lattice_kernel kernel;
+    double count = 0.0, t;
+
+    /* the sites are the atoms that LatticeSum hands to the kernels */
+    kernel.nacc = (out_key == NULL ? 1 : 0);
+    kernel.cutoff = radius;
+    if (out_key == NULL)
+    {
+        kernel.term = sphere_count;
+        kernel.ctx = NULL;
+    }
+    else
+    {
+        kernel.term = sphere_collect;
+        kernel.ctx = &list;
+    }
+    LatticeSum(in_positions, in_natoms, NULL, in_muonpos, in_supercell, in_cell,
+               radius, &kernel, 1, 0, &count);
+    sites = list.sites;
+    nsites = (out_key == NULL ? (unsigned int) count : (unsigned int) list.n);
+
+    if (sites != NULL)
+    {
+        qsort(sites, nsites, sizeof(struct sphere_site), sphere_site_cmp);
+        for (s = 0; s < nsites; s++)
+        {
+            /* 0.92740098 (3 u u^T - 1) / r^3, see simplesum.c for the units */
+            u = sites[s].u;
+            t = 0.92740098 / (sites[s].n * sites[s].n * sites[s].n);
+            out_key[s] = sites[s].key;
+            out_dist[s] = sites[s].n;
+            out_tensor[6*s+0] = t * (3.0*u.x*u.x - 1.0);
+            out_tensor[6*s+1] = t * 3.0*u.x*u.y;
+            out_tensor[6*s+2] = t * 3.0*u.x*u.z;
+            out_tensor[6*s+3] = t * (3.0*u.y*u.y - 1.0);
+            out_tensor[6*s+4] = t * 3.0*u.y*u.z;
+            out_tensor[6*s+5] = t * (3.0*u.z*u.z - 1.0);
+        }
+        free(sites);
+    }
+    return nsites;
+}
+
+/* Accumulators of one configuration. */
+struct disorder_acc {
+    struct vec3 dip, lor, cont;
+    double wcont;           /* sum of the contact weights 1/r^3 */
+    unsigned int ncont;     /* number of moments in the contact term */
+};
+
+static void disorder_acc_init(struct disorder_acc *acc)
+{
+    acc->dip = vec3_zero();
+    acc->lor = vec3_zero();
+    acc->cont = vec3_zero();
+    acc->wcont = 0.0;
+    acc->ncont = 0;
+}
+
+/* Adds moment m of site s. The sites are visited by increasing distance. */
+static void disorder_acc_add(struct disorder_acc *acc, const double *T,
+          double n, struct vec3 m, unsigned int nnn_for_cont, double cont_radius)
+{
+    double w;
+
+    acc->dip.x += T[0]*m.x + T[1]*m.y + T[2]*m.z;
+    acc->dip.y += T[1]*m.x + T[3]*m.y + T[4]*m.z;
+    acc->dip.z += T[2]*m.x + T[4]*m.y + T[5]*m.z;
+    acc->lor = vec3_add(acc->lor, m);
+
+    if (acc->ncont < nnn_for_cont && n < cont_radius)
+    {
+        w = 1.0/pow(n, CONT_SCALING_POWER);
+        acc->cont = vec3_add(acc->cont, vec3_muls(w, m));
+        acc->wcont += w;
+        acc->ncont++;
+    }
+}
+
+/* Stores the fields of configuration c, units as in SimpleSum. */
+static void disorder_acc_store(const struct disorder_acc *acc, unsigned int c,
+          double radius, double *out_field_cont, double *out_field_dip,
+          double *out_field_lor)
+{
+    struct vec3 BLor, BCont = vec3_zero();
+
+    BLor = vec3_muls(0.33333333333*11.654064 * 3./(4.*M_PI*pow(radius,3)), acc->lor);
+    if (acc->ncont > 0)
+        BCont = vec3_muls(7.769376 / acc->wcont, acc->cont);
+
+    out_field_dip[3*c+0] = acc->dip.x;
+    out_field_dip[3*c+1] = acc->dip.y;
+    out_field_dip[3*c+2] = acc->dip.z;
+    out_field_lor[3*c+0] = BLor.x;
+    out_field_lor[3*c+1] = BLor.y;
+    out_field_lor[3*c+2] = BLor.z;
+    out_field_cont[3*c+0] = BCont.x;
+    out_field_cont[3*c+1] = BCont.y;
+    out_field_cont[3*c+2] = BCont.z;
+}
+
+/**
+ * This function evaluates the local fields of a batch of configurations
+ * of the sites returned by SphereSites.
+ * Sites with a zero moment are vacancies: they do not contribute to the
+ * contact field, which is the average of the nnn_for_cont nearest
+ * occupied sites closer than cont_radius, weighted by 1/r^3.
+ *
+ * @param in_tensor dipolar tensors of the sites (from SphereSites).
+ * @param in_dist distances of the sites (from SphereSites).
+ * @param in_nsites number of sites.
+ * @param in_moments moments of the sites in each configuration,
+ *         Cartesian, Bohr magnetons, in_nconf x in_nsites x 3 numbers.
+ * @param in_nconf number of configurations.
+ * @param radius Lorentz sphere radius used in SphereSites.
+ * @param nnn_for_cont number of nearest neighbouring moments included in
+ *         the contact field.
+ * @param cont_radius only moments within this radius contribute to the
+ *         contact field.
+ * @param out_field_cont Contact field of each configuration, in_nconf x 3.
+ * @param out_field_dip  Dipolar field of each configuration, in_nconf x 3.
+ * @param out_field_lor  Lorentz field of each configuration, in_nconf x 3.
+ */
+void DisorderSum(const double *in_tensor, const double *in_dist,
+          unsigned int in_nsites, const double *in_moments,
+          unsigned int in_nconf, double radius, unsigned int nnn_for_cont,
+          double cont_radius, double *out_field_cont, double *out_field_dip,
+          double *out_field_lor)
+{
+    int c;
+    unsigned int s;
+    const double *m;
+    struct disorder_acc acc;
+
+#pragma omp parallel for schedule(dynamic) private(c,s,m,acc)
+    for (c = 0; c < (int) in_nconf; c++)
+    {
+        disorder_acc_init(&acc);
+        m = in_moments + 3 * (size_t) in_nsites * c;
+        for (s = 0; s < in_nsites; s++)
+        {
+            if (m[3*s] == 0.0 && m[3*s+1] == 0.0 && m[3*s+2] == 0.0)
+                continue;
+            disorder_acc_add(&acc, in_tensor + 6*s, in_dist[s],
+                             _vec3(m[3*s], m[3*s+1], m[3*s+2]),
+                             nnn_for_cont, cont_radius);
+        }
+        disorder_acc_store(&acc, c, radius, out_field_cont, out_field_dip,
+                           out_field_lor);
+    }
+}
+
+/* splitmix64 generator, one independent stream per configuration */
+static uint64_t disorder_next(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/* uniform in [0, 1) */
+static double disorder_uniform(uint64_t *state)
+{
+    return (disorder_next(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/**
+ * This function evaluates the local fields of in_nconf random
+ * configurations obtained from a parent configuration: site s is occupied
+ * with probability in_occupancy[s] and, if in_random_directions is not
+ * zero, its moment points in a random direction (uniform on the sphere)
+ * keeping the magnitude of the parent moment.
+ * Configuration c only depends on in_seed and c, so the results do not
+ * depend on the number of threads.
+ *
+ * @param in_moments parent moments of the sites, in_nsites x 3.
+ * @param in_occupancy occupation probability of each site, NULL for 1.
+ * @param in_random_directions if non zero the moments are randomly oriented.
+ * @param in_nconf number of configurations.
+ * @param in_seed seed of the random number generator.
+ *
+ * The other parameters are the same of DisorderSum.
+ */
+void DilutionSample(const double *in_tensor, const double *in_dist,
+          unsigned int in_nsites, const double *in_moments,
+          const double *in_occupancy, unsigned int in_random_directions,
+          unsigned int in_nconf, unsigned long in_seed, double radius,
+          unsigned int nnn_for_cont, double cont_radius,
+          double *out_field_cont, double *out_field_dip, double *out_field_lor)
+{
+    int c;
+    unsigned int s;
+    uint64_t state;
+    double z, phi, mn;
+    struct vec3 m;
+    struct disorder_acc acc;
+
+#pragma omp parallel for schedule(dynamic) private(c,s,state,z,phi,mn,m,acc)
+    for (c = 0; c < (int) in_nconf; c++)
+    {
+        disorder_acc_init(&acc);
+        state = (uint64_t) in_seed * 0xD1B54A32D192ED03ULL + (uint64_t) c;
+        disorder_next(&state);
+        for (s = 0; s < in_nsites; s++)
+        {
+            if (in_occupancy != NULL && !(disorder_uniform(&state) < in_occupancy[s]))
+                continue;
+            m = _vec3(in_moments[3*s], in_moments[3*s+1], in_moments[3*s+2]);
+            if (in_random_directions)
+            {
+                mn = vec3_norm(m);
+                z = 2.0 * disorder_uniform(&state) - 1.0;
+                phi = 2.0 * M_PI * disorder_uniform(&state);
+                m = vec3_muls(mn, _vec3(sqrt(1.0 - z*z) * cos(phi),
+                                        sqrt(1.0 - z*z) * sin(phi), z));
+            }
+            if (m.x == 0.0 && m.y == 0.0 && m.z == 0.0)
+                continue;
+            disorder_acc_add(&acc, in_tensor + 6*s, in_dist[s], m,
+                             nnn_for_cont, cont_radius);
+        }
+        disorder_acc_store(&acc, c, radius, out_field_cont, out_field_dip,
+                           out_field_lor);
+    }
+}
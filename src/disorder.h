@@ -0,0 +1,21 @@
+#ifndef DISORDER_H
+#define DISORDER_H
+
+unsigned int SphereSites(const double *in_positions, const double *in_muonpos,
+          const int *in_supercell, const double *in_cell, double radius,
+          unsigned int in_natoms, unsigned long *out_key, double *out_tensor,
+          double *out_dist);
+
+void DisorderSum(const double *in_tensor, const double *in_dist,
+          unsigned int in_nsites, const double *in_moments,
+          unsigned int in_nconf, double radius, unsigned int nnn_for_cont,
+          double cont_radius, double *out_field_cont, double *out_field_dip,
+          double *out_field_lor);
+
+void DilutionSample(const double *in_tensor, const double *in_dist,
+          unsigned int in_nsites, const double *in_moments,
+          const double *in_occupancy, unsigned int in_random_directions,
+          unsigned int in_nconf, unsigned long in_seed, double radius,
+          unsigned int nnn_for_cont, double cont_radius,
+          double *out_field_cont, double *out_field_dip, double *out_field_lor);
+#endif
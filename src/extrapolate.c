@@ -0,0 +1,249 @@
+/**
+ * @file extrapolate.c
+ * @author Pietro Bonfa
+ * @date 2016
+ * @brief Lattice sums extrapolated from partial sums at several radii
+ *
+ * Once the Lorentz field is added, the dipolar sum inside a sphere of
+ * radius R does not approach its limit smoothly: the atoms entering the
+ * sphere make it fluctuate around the limit, with an amplitude decaying
+ * faster than 1/R. A polynomial extrapolation in 1/R (Richardson) amplifies
+ * these fluctuations, while their average over R does not.
+ * The atoms are therefore binned by distance in a single traversal (a
+ * kernel of LatticeSum), the partial sums at in_nradii radii equally
+ * spaced in (radius/2, radius] are obtained from the cumulative sums of
+ * the bins and their mean is the estimate of the infinite radius limit.
+ * The spread of the partial sums gives the error estimate.
+ */
+
+#define _USE_MATH_DEFINES
+#include <stdlib.h>
+#include <math.h>
+#include "config.h"
+#include "pile.h"
+#include "kernels.h"
+#include "extrapolate.h"
+
+#ifndef M_PI
+#    define M_PI 3.14159265358979323846
+#endif
+
+/* Per bin accumulators: dipolar field, sum of the moments, tensor */
+#define EXTRAP_B 0
+#define EXTRAP_M 3
+#define EXTRAP_T 6
+#define EXTRAP_NACC 12
+
+/* Values of a partial sum in out_partial: B_dip, B_lor, T (3x3) */
+#define EXTRAP_NPARTIAL 15
+
+/* Data of the kernel of ExtrapolatedSum. */
+struct extrapolate_data {
+    const struct vec3 *P, *Q;   /* m(R) = cos(2 pi K.R) P + sin(2 pi K.R) Q */
+    unsigned int nradii;
+    double rhalf;               /* radius/2 */
+};
+
+/*
+ * Kernel of LatticeSum: dipolar field, moment and tensor of the atom,
+ * added to its bin. Bin 0 holds the atoms inside radius/2, bin b the atoms
+ * between R_{b-1} and R_b.
+ */
+static void extrapolate_term(const void *ctx, const struct lattice_site *site,
+          double *bins)
+{
+    const struct extrapolate_data *d = (const struct extrapolate_data *) ctx;
+    struct vec3 m, u;
+    double n = site->n, t, *acc;
+    unsigned int b = 0;
+
+    if (n >= d->rhalf)
+    {
+        b = 1 + (unsigned int) ((n - d->rhalf) / d->rhalf * d->nradii);
+        if (b > d->nradii)
+            b = d->nradii;
+    }
+    acc = bins + b*EXTRAP_NACC;
+
+    m = vec3_add(vec3_muls(site->c, d->P[site->atom]), vec3_muls(site->s, d->Q[site->atom]));
+    u = vec3_muls(1./n, site->r);
+    t = vec3_dot(m, u);
+    acc[EXTRAP_B + 0] += (3.0 * t * u.x - m.x) / (n*n*n);
+    acc[EXTRAP_B + 1] += (3.0 * t * u.y - m.y) / (n*n*n);
+    acc[EXTRAP_B + 2] += (3.0 * t * u.z - m.z) / (n*n*n);
+    acc[EXTRAP_M + 0] += m.x;
+    acc[EXTRAP_M + 1] += m.y;
+    acc[EXTRAP_M + 2] += m.z;
+    acc[EXTRAP_T + 0] += (3.0 * u.x * u.x - 1.0) / (n*n*n);
+    acc[EXTRAP_T + 1] += 3.0 * u.x * u.y / (n*n*n);
+    acc[EXTRAP_T + 2] += 3.0 * u.x * u.z / (n*n*n);
+    acc[EXTRAP_T + 3] += (3.0 * u.y * u.y - 1.0) / (n*n*n);
+    acc[EXTRAP_T + 4] += 3.0 * u.y * u.z / (n*n*n);
+    acc[EXTRAP_T + 5] += (3.0 * u.z * u.z - 1.0) / (n*n*n);
+}
+
+/**
+ * This function estimates the dipolar and Lorentz fields and the dipolar
+ * tensor at the muon site for an infinite Lorentz radius, from the partial
+ * sums at in_nradii radii R_i = radius (1 + i/in_nradii)/2, i = 1..in_nradii,
+ * accumulated in a single lattice sum. The magnetic order, the supercell
+ * and the muon position are defined as in SimpleSum.
+ *
+ * @param in_positions positions of the magnetic atoms in fractional
+ *         coordinates, 3*in_natoms numbers.
+ * @param in_fc Fourier components (Re x, Im x, Re y, ..., Im z) of each atom.
+ * @param in_K the propagation vector in *reciprocal lattice units*.
+ * @param in_phi the phase for each of the atoms given in in_positions.
+ * @param in_muonpos position of the muon in fractional coordinates
+ * @param in_supercell extension of the supercell along the lattice vectors.
+ * @param in_cell lattice cell (a_x, a_y, a_z, b_x, ..., c_z).
+ * @param radius largest Lorentz sphere radius
+ * @param in_nradii number of partial sums. With 1 the result is the plain
+ *         sum at radius.
+ * @param nnn_for_cont number of nearest neighboring atoms to be included
+ *                      for the evaluation of the contact field.
+ * @param cont_radius only atoms within this radius are eligible to contribute to
+ *                      the contact field.
+ * @param in_natoms: number of atoms in the unit cell.
+ * @param out_field_cont Contact field in Tesla (see SimpleSum).
+ * @param out_field_dip  extrapolated dipolar field in Tesla.
+ * @param out_field_lor  extrapolated Lorentz field in Tesla.
+ * @param out_tensor extrapolated dipolar tensor (1/Angstrom^3), 9 numbers
+ *          as in DipolarTensor.
+ * @param out_error estimated errors of B_dip + B_lor (Tesla) and of the
+ *          tensor (Frobenius norm), 2 numbers: the largest deviation of
+ *          the partial sums from their mean.
+ * @param out_partial partial sums, in_nradii x 15 numbers (B_dip, B_lor,
+ *          tensor) or NULL.
+ */
+void ExtrapolatedSum(const double *in_positions,
+          const double *in_fc, const double *in_K, const double *in_phi,
+          const double *in_muonpos, const int * in_supercell, const double *in_cell,
+          const double radius, unsigned int in_nradii,
+          const unsigned int nnn_for_cont, const double cont_radius,
+          unsigned int in_natoms,
+          double *out_field_cont, double *out_field_dip, double *out_field_lor,
+          double *out_tensor, double *out_error, double *out_partial)
+{
+    unsigned int a, b, x;
+    unsigned int nbins = in_nradii + 1;
+    struct vec3 BCont;
+    struct vec3 *P = malloc(in_natoms * sizeof(struct vec3));
+    struct vec3 *Q = malloc(in_natoms * sizeof(struct vec3));
+    double *bins = calloc(nbins * EXTRAP_NACC, sizeof(double));
+    double *partial = malloc(in_nradii * EXTRAP_NPARTIAL * sizeof(double));
+    double cum[EXTRAP_NACC], mean[EXTRAP_NPARTIAL];
+    double t, rhalf = 0.5 * radius, ri, lor;
+    double errf, errt, dev;
+    pile MCont;
+    struct extrapolate_data ext;
+    struct kernel_contact cont;
+    struct lattice_kernel kernels[2];
+    /* position of T_xy in the xx, xy, xz, yy, yz, zz storage */
+    static const unsigned int sym[9] = {0, 1, 2, 1, 3, 4, 2, 4, 5};
+
+    for (a = 0; a < in_natoms; a++)
+    {
+        /* m(R) = cos(2 pi K.R) P + sin(2 pi K.R) Q */
+        kernel_fc_moment(in_fc + 6*a, in_phi[a], &P[a], &Q[a]);
+    }
+
+    pile_init(&MCont, nnn_for_cont);
+
+    ext.P = P;
+    ext.Q = Q;
+    ext.nradii = in_nradii;
+    ext.rhalf = rhalf;
+    cont.P = P;
+    cont.Q = Q;
+    cont.MCont = &MCont;
+
+    kernels[0].term = extrapolate_term;
+    kernels[0].ctx = &ext;
+    kernels[0].nacc = nbins * EXTRAP_NACC;
+    kernels[0].cutoff = radius;
+
+    kernels[1].term = kernel_contact;
+    kernels[1].ctx = &cont;
+    kernels[1].nacc = 0;
+    kernels[1].cutoff = cont_radius;
+
+    LatticeSum(in_positions, in_natoms, in_K, in_muonpos, in_supercell, in_cell,
+               radius, kernels, 2, 0, bins);
+
+    /* partial sums from the cumulative sums of the bins */
+    for (x = 0; x < EXTRAP_NACC; x++)
+        cum[x] = bins[x];
+    for (x = 0; x < EXTRAP_NPARTIAL; x++)
+        mean[x] = 0.0;
+    for (b = 1; b <= in_nradii; b++)
+    {
+        for (x = 0; x < EXTRAP_NACC; x++)
+            cum[x] += bins[b*EXTRAP_NACC + x];
+
+        /* see simplesum.c for the units */
+        ri = rhalf * (1.0 + (double) b / in_nradii);
+        lor = 0.33333333333*11.654064 * 3./(4.*M_PI*pow(ri,3));
+        for (x = 0; x < 3; x++)
+        {
+            partial[(b-1)*EXTRAP_NPARTIAL + x] = 0.92740098 * cum[EXTRAP_B + x];
+            partial[(b-1)*EXTRAP_NPARTIAL + 3 + x] = lor * cum[EXTRAP_M + x];
+        }
+        for (x = 0; x < 9; x++)
+            partial[(b-1)*EXTRAP_NPARTIAL + 6 + x] = cum[EXTRAP_T + sym[x]];
+        for (x = 0; x < EXTRAP_NPARTIAL; x++)
+            mean[x] += partial[(b-1)*EXTRAP_NPARTIAL + x] / in_nradii;
+    }
+
+    /* largest deviation of the partial sums from their mean: the partial
+     * sums share most of the atoms, so they are not independent samples
+     * and their spread is not reduced by averaging */
+    errf = 0.0;
+    errt = 0.0;
+    for (b = 0; b < in_nradii; b++)
+    {
+        dev = 0.0;
+        for (x = 0; x < 3; x++)
+        {
+            t = partial[b*EXTRAP_NPARTIAL + x] + partial[b*EXTRAP_NPARTIAL + 3 + x]
+                - mean[x] - mean[3 + x];
+            dev += t * t;
+        }
+        if (dev > errf)
+            errf = dev;
+        dev = 0.0;
+        for (x = 6; x < EXTRAP_NPARTIAL; x++)
+        {
+            t = partial[b*EXTRAP_NPARTIAL + x] - mean[x];
+            dev += t * t;
+        }
+        if (dev > errt)
+            errt = dev;
+    }
+    out_error[0] = sqrt(errf);
+    out_error[1] = sqrt(errt);
+
+    for (x = 0; x < 3; x++)
+    {
+        out_field_dip[x] = mean[x];
+        out_field_lor[x] = mean[3 + x];
+    }
+    for (x = 0; x < 9; x++)
+        out_tensor[x] = mean[6 + x];
+    if (out_partial != NULL)
+        for (x = 0; x < in_nradii * EXTRAP_NPARTIAL; x++)
+            out_partial[x] = partial[x];
+
+    /* Contact Field */
+    BCont = kernel_contact_field(&MCont);
+    pile_free(&MCont);
+
+    out_field_cont[0] = BCont.x;
+    out_field_cont[1] = BCont.y;
+    out_field_cont[2] = BCont.z;
+
+    free(partial);
+    free(bins);
+    free(Q);
+    free(P);
+}
@@ -0,0 +1,12 @@
+#ifndef EXTRAPOLATE_H
+#define EXTRAPOLATE_H
+
+void ExtrapolatedSum(const double *in_positions,
+          const double *in_fc, const double *in_K, const double *in_phi,
+          const double *in_muonpos, const int * in_supercell, const double *in_cell,
+          const double radius, unsigned int in_nradii,
+          const unsigned int nnn_for_cont, const double cont_radius,
+          unsigned int in_natoms,
+          double *out_field_cont, double *out_field_dip, double *out_field_lor,
+          double *out_tensor, double *out_error, double *out_partial);
+#endif
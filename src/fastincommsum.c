@@ -13,6 +13,7 @@
 #include "mat3.h"
 #include "pile.h"
 #include "config.h"
+#include "latticesum.h"
 
 #ifndef M_PI
 #    define M_PI 3.14159265358979323846
@@ -22,6 +23,87 @@
 #include <omp.h>
 #endif 
 
+/* Data of the kernel of FastIncommSum. */
+struct fastincomm_data {
+    const struct vec3 *A, *B;   /* unit vectors of the helix of each atom */
+    const float *fA, *fB;
+    const scalar *stagmom;
+    const scalar *cphase;       /* cosine and sine of the phase of each atom, */
+    const scalar *sphase;       /* 2 pi (phi - K.(r_mu + r_ref)) */
+    unsigned int flags;
+    double cont_radius;
+    pile *CCont, *SCont;
+};
+
+/*
+ * Kernel of LatticeSum: cosine and sine parts of the dipolar field
+ * (CDip, SDip) and of the sum of the moments (CLor, SLor) of each atom,
+ * 12 accumulators per atom.
+ */
+static void fastincomm_term(const void *ctx, const struct lattice_site *site, double *acc)
+{
+    const struct fastincomm_data *d = (const struct fastincomm_data *) ctx;
+    unsigned int a = site->atom;
+    struct vec3 u, da, db, A = d->A[a], B = d->B[a];
+    struct vec3 cdip, sdip, clor, slor;
+    double c, s, onebrcube, n = site->n;
+    float frx, fry, frz, fn, fux, fuy, fuz, fau, fbu, fonebrcube;
+    const float *fA = d->fA + 3*a, *fB = d->fB + 3*a;
+
+    if (d->flags & LFC_MIXED_PRECISION)
+    {
+        /* geometry and dipolar terms in single precision */
+        frx = (float) site->r.x;
+        fry = (float) site->r.y;
+        frz = (float) site->r.z;
+        fn = sqrtf(frx*frx + fry*fry + frz*frz);
+
+        fux = frx/fn; fuy = fry/fn; fuz = frz/fn;
+        fonebrcube = 1.0f/(fn*fn*fn);
+
+        fau = 3.0f * (fA[0]*fux + fA[1]*fuy + fA[2]*fuz);
+        fbu = 3.0f * (fB[0]*fux + fB[1]*fuy + fB[2]*fuz);
+        da.x = fonebrcube * (fau * fux - fA[0]);
+        da.y = fonebrcube * (fau * fuy - fA[1]);
+        da.z = fonebrcube * (fau * fuz - fA[2]);
+        db.x = fonebrcube * (fbu * fux - fB[0]);
+        db.y = fonebrcube * (fbu * fuy - fB[1]);
+        db.z = fonebrcube * (fbu * fuz - fB[2]);
+    } else {
+        /* unit vector */
+        u = vec3_muls(1.0/n, site->r);
+        onebrcube = 1.0/pow(n,3);
+
+        da = vec3_muls(onebrcube ,vec3_sub(vec3_muls(3.0*vec3_dot(A,u),u), A));
+        db = vec3_muls(onebrcube ,vec3_sub(vec3_muls(3.0*vec3_dot(B,u),u), B));
+    }
+
+    /* cos and sin of K.(r - r_mu - r_ref) + phi */
+    c = site->c * d->cphase[a] - site->s * d->sphase[a];
+    s = site->s * d->cphase[a] + site->c * d->sphase[a];
+
+    cdip = vec3_add( vec3_muls( c , da), vec3_muls( s , db));
+    sdip = vec3_sub( vec3_muls( s , da), vec3_muls( c , db));
+    clor = vec3_add( vec3_muls( c , A), vec3_muls( s , B));
+    slor = vec3_sub( vec3_muls( s , A), vec3_muls( c , B));
+
+    acc[12*a+0] += cdip.x; acc[12*a+1] += cdip.y; acc[12*a+2] += cdip.z;
+    acc[12*a+3] += sdip.x; acc[12*a+4] += sdip.y; acc[12*a+5] += sdip.z;
+    acc[12*a+6] += clor.x; acc[12*a+7] += clor.y; acc[12*a+8] += clor.z;
+    acc[12*a+9] += slor.x; acc[12*a+10] += slor.y; acc[12*a+11] += slor.z;
+
+    /* Contact */
+    if (n < d->cont_radius) {
+        #pragma omp critical(contact)
+        {
+            pile_add_element_keyed(d->CCont, pow(n,CONT_SCALING_POWER), site->key,
+                                   vec3_muls(d->stagmom[a], clor));
+            pile_add_element_keyed(d->SCont, pow(n,CONT_SCALING_POWER), site->key,
+                                   vec3_muls(d->stagmom[a], slor));
+        }
+    }
+}
+
 
 /**
  * This function calculates the dipolar field for helical structures
@@ -50,41 +132,29 @@
  * @param in_natoms: number of atoms in the lattice.
  * @param in_nangles: number of angles used to sample the field distribution 
  *                      generated by an incommensurate order
+ * @param in_flags: bitwise or of the LFC_* flags defined in config.h
+ *                   (0 for the default double precision evaluation).
  * @param out_field_cont Contact filed in Cartesian coordinates defined by in_cell.
  * @param out_field_dip  Dipolar field in Cartesian coordinates defined by in_cell.
  * @param out_field_lor  Lorentz field in Cartesian coordinates defined by in_cell.
  */
-void FastIncommSum(const double *in_positions, 
+void FastIncommSumEx(const double *in_positions, 
           const double *in_fc, const double *in_K, const double *in_phi,
           const double *in_muonpos, const int * in_supercell, const double *in_cell, 
           const double radius, const unsigned int nnn_for_cont, const double cont_radius, 
-          unsigned int in_natoms, unsigned int in_nangles,
+          unsigned int in_natoms, unsigned int in_nangles, unsigned int in_flags,
           double *out_field_cont, double *out_field_dip, double *out_field_lor) 
 {
 
     unsigned int scx, scy, scz = 10; /*supercell sizes */
-    unsigned int i,j,k; /* counters for supercells */
-    
-    struct vec3 atmpos;
-    struct vec3 muonpos;
-    
-    struct vec3 r;
-    struct vec3 u;   /* unit vector */
+    unsigned int i; /* counter for the contact piles */
     
-    struct mat3 sc_lat;
-    struct mat3 inv_sc_lat;
-    
-    double n;
-    double c,s; /*cosine and sine of K.R */
-    double onebrcube; /* 1/r^3 */
-    
-    double  phi ;
-    
-    /* tmp value for speed and clearness */
-    struct vec3 crysvec;
+    double t; /* phase of the reference cell */
     
     scalar *stagmom=malloc(in_natoms*sizeof(scalar));                    /* this is m_0 */
-    struct vec3 *refatmpos=malloc(in_natoms*sizeof(struct vec3));             /* reference atom used to produce C and S     */
+    scalar *cphase=malloc(in_natoms*sizeof(scalar));
+    scalar *sphase=malloc(in_natoms*sizeof(scalar));                     /* cosine and sine of the phase of each atom */
+    double *acc=calloc(12*in_natoms, sizeof(double));                     /* CDip, SDip, CLor, SLor of each atom */
     struct vec3 *Ahelix=malloc(in_natoms * sizeof(struct vec3));
     struct vec3 *Bhelix= malloc(in_natoms * sizeof(struct vec3));/* two unit vectors describing the helix in the m_0 (cos(phi).a +/- sin(phi).b) */
     struct vec3 *SDip= malloc(in_natoms * sizeof(struct vec3));
@@ -92,7 +162,13 @@ void FastIncommSum(const double *in_positions,
     struct vec3 *SLor= malloc(in_natoms * sizeof(struct vec3));  
     struct vec3 *CLor= malloc(in_natoms * sizeof(struct vec3));/* sums of contribution providing cosine and sine prefactors */
     
+    /* single precision copies used with LFC_MIXED_PRECISION */
+    float *fA=malloc(3*in_natoms*sizeof(float));
+    float *fB=malloc(3*in_natoms*sizeof(float));
+    
     pile CCont, SCont;
+    struct fastincomm_data d;
+    struct lattice_kernel kernel;
     
     struct vec3 K;
     
@@ -133,52 +209,12 @@ void FastIncommSum(const double *in_positions,
 
 #ifdef _DEBUG    
     printf("I use: %i %i %i\n",scx, scy, scz);    
-    printf("Size is: %i\n",size);
+    printf("Size is: %i\n",in_natoms);
 #endif 
     
-    sc_lat.a.x = in_cell[0];
-    sc_lat.a.y = in_cell[1];
-    sc_lat.a.z = in_cell[2];
-    sc_lat.b.x = in_cell[3];
-    sc_lat.b.y = in_cell[4];
-    sc_lat.b.z = in_cell[5];
-    sc_lat.c.x = in_cell[6];
-    sc_lat.c.y = in_cell[7];
-    sc_lat.c.z = in_cell[8];
-
-    inv_sc_lat = mat3_inv(sc_lat);
-
 #ifdef _DEBUG      
     for (i=0;i<3;i++)
         printf("Cell is: %i %e %e %e\n",i,in_cell[i*3],in_cell[i*3+1],in_cell[i*3+2]);
-      
-    printf("Inverse cell is %e %e %e\n", inv_sc_lat.a.x, inv_sc_lat.a.y, inv_sc_lat.a.z);
-    printf("Inverse cell is %e %e %e\n", inv_sc_lat.b.x, inv_sc_lat.b.y, inv_sc_lat.b.z);
-    printf("Inverse cell is %e %e %e\n", inv_sc_lat.c.x, inv_sc_lat.c.y, inv_sc_lat.c.z);
-
-    for (a = 0; a < in_natoms; ++a)
-    {
-                    
-        /* atom position in reduced coordinates */
-        atmpos.x =  in_positions[3*a] ;
-        atmpos.y =  in_positions[3*a+1] ;
-        atmpos.z =  in_positions[3*a+2] ;
-        
-        printf("Atom pos (crys): %e %e %e\n",atmpos.x,atmpos.y,atmpos.z);
-        
-        /* go to cartesian coordinates (in Angstrom!) */
-        atmpos = mat3_vmul(atmpos,sc_lat);  
-        
-        printf("Atom pos (cart): %e %e %e\n",atmpos.x,atmpos.y,atmpos.z);
-#ifdef _ALTERNATE_FC_INPUT
-        printf("FC (real, imag): %e %e %e %e %e %e\n",in_fc[6*a],in_fc[6*a+1],in_fc[6*a+2],in_fc[6*a+3],in_fc[6*a+4],in_fc[6*a+5]);
-#else
-        printf("FC (real, imag): %e %e %e %e %e %e\n",in_fc[6*a],in_fc[6*a+2],in_fc[6*a+4],in_fc[6*a+1],in_fc[6*a+3],in_fc[6*a+5]);
-#endif
-        printf("phi: %e\n",in_phi[a]);
-    }
-        
-
 #endif     
     
     K.x = in_K[0];
@@ -190,51 +226,8 @@ void FastIncommSum(const double *in_positions,
     printf("Radius is: %e\n",radius);
 #endif
 
-    sc_lat = mat3_mul(
-                        mat3_diag((float) scx, (float) scy, (float) scz),
-                        sc_lat);
-    
-    
-    /* muon position in reduced coordinates */
-    muonpos.x =  (in_muonpos[0] + (scx/2) ) / (float) scx;
-    muonpos.y =  (in_muonpos[1] + (scy/2) ) / (float) scy;
-    muonpos.z =  (in_muonpos[2] + (scz/2) ) / (float) scz;
-    
-    
-
-#ifdef _DEBUG
-    printf("Muon pos (frac): %e %e %e\n",muonpos.x,muonpos.y,muonpos.z);
-#endif
-
-    muonpos = mat3_vmul(muonpos,sc_lat);
-
-#ifdef _DEBUG
-    printf("Muon pos (cart): %e %e %e\n",muonpos.x,muonpos.y,muonpos.z);
-#endif
-
-
-
     for (a = 0; a < in_natoms; ++a)
     {
-        /* reference atom in reduced coordinates */
-        /*   the first atom is chosen as reference */
-        refatmpos[a].x =  (in_positions[3*a+0] + (scx/2) ) / (float) scx;
-        refatmpos[a].y =  (in_positions[3*a+1] + (scy/2) ) / (float) scy;
-        refatmpos[a].z =  (in_positions[3*a+2] + (scz/2) ) / (float) scz;
-
-
-#ifdef _DEBUG
-        printf("Reference atom pos (frac): %e %e %e\n",refatmpos[a].x,refatmpos[a].y,refatmpos[a].z);
-#endif
-
-        refatmpos[a] = mat3_vmul(refatmpos[a],sc_lat);
-
-#ifdef _DEBUG
-        printf("Reference atom pos (cart): %e %e %e\n",refatmpos[a].x,refatmpos[a].y,refatmpos[a].z);
-#endif
-
-        
-        
         /* now take care of magntism */
 
 #ifdef _ALTERNATE_FC_INPUT
@@ -285,153 +278,52 @@ void FastIncommSum(const double *in_positions,
             printf("WARNING!!! Phi not completely tested! Double check your results.\n");
         }
         
+        fA[3*a+0] = (float) Ahelix[a].x; fA[3*a+1] = (float) Ahelix[a].y; fA[3*a+2] = (float) Ahelix[a].z;
+        fB[3*a+0] = (float) Bhelix[a].x; fB[3*a+1] = (float) Bhelix[a].y; fB[3*a+2] = (float) Bhelix[a].z;
+        
     }
 
-/* parallel execution starts here */
-/* the shared variables are listed just to remember about data races! */
-/* other variable shaed by default: refatmpos,atmpos,phi,Ahelix,Bhelix */
-#pragma omp parallel shared(SDip,CDip,SLor,CLor,SCont,CCont,scx,scy,scz,in_positions) 
-{
-#pragma omp for collapse(3) private(i,j,k,a,r,n,c,s,u,crysvec,onebrcube,atmpos)
-    for (i = 0; i < scx; ++i)
+    /* The phase is K.(r - r_mu - r_ref) with the reference atom placed
+     * in the central cell of the supercell, while LatticeSum gives
+     * cos and sin of 2 pi K.R: the rest is folded in the phase of the atom. */
+    t = 2.0*M_PI * (K.x * (in_muonpos[0] + 2.0*(scx/2)) +
+                    K.y * (in_muonpos[1] + 2.0*(scy/2)) +
+                    K.z * (in_muonpos[2] + 2.0*(scz/2)));
+    for (a = 0; a < in_natoms; ++a)
     {
-        for (j = 0; j < scy; ++j)
-        {
-            for (k = 0; k < scz; ++k)
-            {
-                /* loop over atoms */
-                for (a = 0; a < in_natoms; ++a)
-                {
-                    
-                    /* atom position in reduced coordinates */
-                    atmpos.x = ( in_positions[3*a] + (float) i) / (float) scx;
-                    atmpos.y = ( in_positions[3*a+1] + (float) j) / (float) scy;
-                    atmpos.z = ( in_positions[3*a+2] + (float) k) / (float) scz;
-                    
-                    
-                    
-                    /* go to cartesian coordinates (in Angstrom!) */
-                    atmpos = mat3_vmul(atmpos,sc_lat);
-                    
-                    /*printf("atompos: %e %e %e\n", atmpos.x, atmpos.y, atmpos.z); */
-                    /* difference between atom pos and muon pos (cart coordinates) */
-                    
-                    r = vec3_sub(atmpos,muonpos);
-                    
-                    n = vec3_norm(r);
-                    if (n < radius)
-                    {
-
-                        phi = in_phi[a];
-                        
-                        /* unit vector */
-                        u = vec3_muls(1.0/n,r);
-                        onebrcube = 1.0/pow(n,3);
-                        
-                        /* go back to fractional (crystal) definition! */
-                        /* !!!!! CHECK THIS DEFINITION !!!! */
-                        crysvec = mat3_vmul(vec3_sub(vec3_sub(atmpos,muonpos),refatmpos[a]),inv_sc_lat);
-                        /* */
-                        c = cos ( 2.0*M_PI * (vec3_dot(K,crysvec) + phi ) );
-                        s = sin ( 2.0*M_PI * (vec3_dot(K,crysvec) + phi ) );
-#ifdef _DEBUG
-                        printf("crysvec : %e %e %e\n", crysvec.x, crysvec.y,crysvec.z);
-                        struct vec3 tmp = vec3_sub(atmpos,muonpos);
-                        printf("vec3_sub(atmpos,muonpos) : %e %e %e\n", tmp.x, tmp.y,tmp.z);
-                        tmp = vec3_sub(vec3_sub(atmpos,muonpos),refatmpos[a]);
-                        printf("vec3_sub(vec3_sub(atmpos,muonpos),refatmpos[a]) : %e %e %e\n",  tmp.x, tmp.y,tmp.z);
-                        
-                        printf("vec3_dot(K,vec3_sub(vec3_sub(atmpos,muonpos),refatmpos[a])) : %e \n",  vec3_dot(K,vec3_sub(vec3_sub(atmpos,muonpos),refatmpos[a])));
-                        
-                        
-                        printf("cos is this time : %e \n", c);
-                        printf("sin is this time : %e \n", s);
-
-                        
-                        printf("u is : %e %e %e\n", u.x, u.y, u.z);
-                        tmp = vec3_muls(onebrcube ,vec3_sub(vec3_muls(3.0*vec3_dot(Ahelix[a],u),u), Ahelix[a]));
-                        printf("A part %d is : %e %e %e\n", a, tmp.x, tmp.y, tmp.z);
-                        tmp = vec3_muls(onebrcube ,vec3_sub(vec3_muls(3.0*vec3_dot(Bhelix[a],u),u), Bhelix[a]));
-                        printf("B part %d is : %e %e %e\n", a, tmp.x, tmp.y, tmp.z);
-                        
-                        tmp = vec3_add (
-                                            vec3_muls( c * onebrcube ,vec3_sub(vec3_muls(3.0*vec3_dot(Ahelix[a],u),u), Ahelix[a])),
-                                            vec3_muls( s * onebrcube ,vec3_sub(vec3_muls(3.0*vec3_dot(Bhelix[a],u),u), Bhelix[a]))
-                                       );
-                                       
-                        printf("CDip %d to be added : %e %e %e\n", a, tmp.x, tmp.y, tmp.z);
-                        tmp =  vec3_sub(
-                                            vec3_muls( s * onebrcube ,vec3_sub(vec3_muls(3.0*vec3_dot(Ahelix[a],u),u), Ahelix[a])),
-                                            vec3_muls( c * onebrcube ,vec3_sub(vec3_muls(3.0*vec3_dot(Bhelix[a],u),u), Bhelix[a]))
-                                        );
-                        printf("SDip %d to be added : %e %e %e\n", a, tmp.x, tmp.y, tmp.z);
-#endif
-                        /* sum all data */
-                        #pragma omp critical(dipolar)
-                        {
-                            /* Dipolar */
-                            CDip[a] = vec3_add(
-                                            CDip[a],
-                                            vec3_add(
-                                                vec3_muls( c * onebrcube ,vec3_sub(vec3_muls(3.0*vec3_dot(Ahelix[a],u),u), Ahelix[a])),
-                                                vec3_muls( s * onebrcube ,vec3_sub(vec3_muls(3.0*vec3_dot(Bhelix[a],u),u), Bhelix[a]))
-                                            )
-                                        );
-                            
-                            SDip[a] = vec3_add(
-                                            SDip[a],
-                                            vec3_sub(
-                                                vec3_muls( s * onebrcube ,vec3_sub(vec3_muls(3.0*vec3_dot(Ahelix[a],u),u), Ahelix[a])),
-                                                vec3_muls( c * onebrcube ,vec3_sub(vec3_muls(3.0*vec3_dot(Bhelix[a],u),u), Bhelix[a]))
-                                            )
-                                        );
-                        }
-                        #pragma omp critical(lorentz)
-                        {
-                            /* Lorentz */
-                            CLor[a] = vec3_add(
-                                            CLor[a],
-                                            vec3_add(
-                                                vec3_muls( c , Ahelix[a]),
-                                                vec3_muls( s , Bhelix[a])
-                                            )
-                                        );
-                            SLor[a] = vec3_add(
-                                            SLor[a],
-                                            vec3_sub(
-                                                vec3_muls( s ,Ahelix[a]),
-                                                vec3_muls( c ,Bhelix[a])
-                                            )
-                                        );
-                        }
-                        /* Contact */
-                        if (n < cont_radius) {
-                            #pragma omp critical(contact)
-                            {
-                                pile_add_element(&CCont, pow(n,CONT_SCALING_POWER), 
-                                  vec3_add(
-                                    vec3_muls( stagmom[a] * c , Ahelix[a]),
-                                    vec3_muls( stagmom[a] * s , Bhelix[a])
-                                        )
-                                );
-                                pile_add_element(&SCont, pow(n,CONT_SCALING_POWER), 
-                                  vec3_sub(
-                                    vec3_muls( stagmom[a]* s , Ahelix[a]),
-                                    vec3_muls( stagmom[a]* c , Bhelix[a])
-                                  )
-                                );
-                            }
-                        }
-#ifdef _DEBUG                      
-                        printf("CDip %d is now : %e %e %e\n", a, CDip[a].x, CDip[a].y, CDip[a].z);
-                        printf("SDip %d is now : %e %e %e\n", a, SDip[a].x, SDip[a].y, SDip[a].z);
-#endif
-                    }                    
-                }
-            }
-        }
+        cphase[a] = cos(2.0*M_PI*in_phi[a] - t);
+        sphase[a] = sin(2.0*M_PI*in_phi[a] - t);
     }
-}
+
+    d.A = Ahelix;
+    d.B = Bhelix;
+    d.fA = fA;
+    d.fB = fB;
+    d.stagmom = stagmom;
+    d.cphase = cphase;
+    d.sphase = sphase;
+    d.flags = in_flags;
+    d.cont_radius = cont_radius;
+    d.CCont = &CCont;
+    d.SCont = &SCont;
+
+    kernel.term = fastincomm_term;
+    kernel.ctx = &d;
+    kernel.nacc = 12 * in_natoms;
+    kernel.cutoff = radius;
+    LatticeSum(in_positions, in_natoms, in_K, in_muonpos, in_supercell, in_cell,
+               radius, &kernel, 1, in_flags, acc);
+
+    for (a = 0; a < in_natoms; ++a)
+    {
+        CDip[a] = _vec3(acc[12*a+0], acc[12*a+1], acc[12*a+2]);
+        SDip[a] = _vec3(acc[12*a+3], acc[12*a+4], acc[12*a+5]);
+        CLor[a] = _vec3(acc[12*a+6], acc[12*a+7], acc[12*a+8]);
+        SLor[a] = _vec3(acc[12*a+9], acc[12*a+10], acc[12*a+11]);
+    }
+    free(acc);
+    free(cphase);
+    free(sphase);
     
     angle=0;
     /* for contact field evaluation */
@@ -447,7 +339,7 @@ void FastIncommSum(const double *in_positions,
     {
         for (angn = 0; angn < in_nangles; ++angn)
         {
-            angle = 2*M_PI*((float) angn / (float) in_nangles);
+            angle = 2*M_PI*((double) angn / (double) in_nangles);
             
             /*  === Dipolar Field === */
             BDip = vec3_zero();
@@ -523,7 +415,7 @@ void FastIncommSum(const double *in_positions,
         
         for (angn = 0; angn < in_nangles; ++angn) {
             
-            angle = 2*M_PI*((float) angn / (float) in_nangles);
+            angle = 2*M_PI*((double) angn / (double) in_nangles);
             
             if (NofM >0) {
                 BCont = vec3_muls((1./SumOfWeights) * 7.769376 , 
@@ -545,7 +437,8 @@ void FastIncommSum(const double *in_positions,
     pile_free(&CCont);
     pile_free(&SCont);
     free(stagmom);
-    free(refatmpos); 
+    free(fA);
+    free(fB);
     free(Ahelix); 
     free(Bhelix); 
     free(SDip); 
@@ -554,4 +447,18 @@ void FastIncommSum(const double *in_positions,
     free(CLor);
 }
 
-
+/**
+ * FastIncommSumEx with the default flags. This is the interface of the 0.1
+ * releases.
+ */
+void FastIncommSum(const double *in_positions, 
+          const double *in_fc, const double *in_K, const double *in_phi,
+          const double *in_muonpos, const int * in_supercell, const double *in_cell, 
+          const double radius, const unsigned int nnn_for_cont, const double cont_radius, 
+          unsigned int in_natoms, unsigned int in_nangles,
+          double *out_field_cont, double *out_field_dip, double *out_field_lor) 
+{
+    FastIncommSumEx(in_positions, in_fc, in_K, in_phi, in_muonpos, in_supercell,
+                    in_cell, radius, nnn_for_cont, cont_radius, in_natoms,
+                    in_nangles, 0, out_field_cont, out_field_dip, out_field_lor);
+}
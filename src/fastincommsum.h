@@ -5,4 +5,10 @@ void FastIncommSum(const double *, const double *, const double *, const double
           const double *, const int * , const double *, const double , 
           const unsigned int , const double , unsigned int, unsigned int,
           double *, double *, double *);
+
+//FastIncommSum with LFC_* flags
+void FastIncommSumEx(const double *, const double *, const double *, const double *,
+          const double *, const int * , const double *, const double , 
+          const unsigned int , const double , unsigned int, unsigned int, unsigned int,
+          double *, double *, double *);
 #endif
@@ -0,0 +1,299 @@
+/**
+ * @file fit.c
+ * @author Pietro Bonfa
+ * @date 2016
+ * @brief Levenberg-Marquardt fit of the magnetic moments to measured
+ *        muon precession frequencies
+ *
+ * The moments are x = x0 + V p, with V a basis (e.g. the basis vectors of
+ * an irreducible representation, or one direction per sublattice) and p
+ * the fit parameters. The field at muon site mu is
+ *
+ *   B_mu = (D_mu + L_mu + ACont C_mu) x
+ *
+ * with D, L and C the response matrices of ConfigResponse, so that the
+ * projections of the response matrices on the basis are computed once
+ * and both the fields and their analytic derivatives cost O(n_mu n_p)
+ * operations per iteration. The residuals are
+ * (gamma_mu |B_mu| / 2 pi - nu_mu) / sigma_mu.
+ */
+
+#define _USE_MATH_DEFINES
+#include <stdlib.h>
+#include <math.h>
+#include "polarization.h"
+#include "fit.h"
+
+#ifndef M_PI
+#    define M_PI 3.14159265358979323846
+#endif
+
+/* Projected model, for each muon: B = a0 + A p + ACont (c0 + C p). */
+struct fit_model {
+    unsigned int nmu, np;
+    double *a0, *A;     /* 3 and 3 x np numbers per muon */
+    double *c0, *C;
+};
+
+/* Frequencies (MHz) of all the muons and, if J is not NULL, their
+ * derivatives with respect to p and (if fit_acont) ACont. */
+static void fit_eval(const struct fit_model *m, const double *p, double acont,
+          unsigned int fit_acont, double *f, double *J)
+{
+    unsigned int mu, x, q, n = m->np + fit_acont;
+    double B[3], Bc[3], b;
+    const double *A, *C;
+
+    for (mu = 0; mu < m->nmu; mu++)
+    {
+        A = m->A + 3 * m->np * mu;
+        C = m->C + 3 * m->np * mu;
+        for (x = 0; x < 3; x++)
+        {
+            Bc[x] = m->c0[3*mu+x];
+            B[x] = m->a0[3*mu+x];
+            for (q = 0; q < m->np; q++)
+            {
+                Bc[x] += C[x * m->np + q] * p[q];
+                B[x] += A[x * m->np + q] * p[q];
+            }
+            B[x] += acont * Bc[x];
+        }
+        b = sqrt(B[0]*B[0] + B[1]*B[1] + B[2]*B[2]);
+        f[mu] = LFC_GAMMA_MU / (2.0 * M_PI) * b;
+
+        if (J == NULL)
+            continue;
+        /* d|B| = (B/|B|) . dB */
+        for (x = 0; x < 3; x++)
+            B[x] = (b > 0.0 ? LFC_GAMMA_MU / (2.0 * M_PI) * B[x] / b : 0.0);
+        for (q = 0; q < m->np; q++)
+            J[mu * n + q] = B[0] * (A[q] + acont * C[q]) +
+                            B[1] * (A[m->np + q] + acont * C[m->np + q]) +
+                            B[2] * (A[2*m->np + q] + acont * C[2*m->np + q]);
+        if (fit_acont)
+            J[mu * n + m->np] = B[0] * Bc[0] + B[1] * Bc[1] + B[2] * Bc[2];
+    }
+}
+
+/* Weighted residuals and chi^2. */
+static double fit_chi2(const double *f, const double *in_freq,
+          const double *in_sigma, unsigned int nmu, double *r)
+{
+    unsigned int mu;
+    double chi2 = 0.0;
+
+    for (mu = 0; mu < nmu; mu++)
+    {
+        r[mu] = (f[mu] - in_freq[mu]) / (in_sigma != NULL ? in_sigma[mu] : 1.0);
+        chi2 += r[mu] * r[mu];
+    }
+    return chi2;
+}
+
+/* Solves the symmetric positive definite system H d = g (n x n, H is
+ * overwritten by its Cholesky factor). Returns 0 if H is not positive
+ * definite. */
+static int fit_solve(double *H, double *g, unsigned int n)
+{
+    unsigned int i, j, k;
+    double s;
+
+    for (j = 0; j < n; j++)
+    {
+        s = H[j*n+j];
+        for (k = 0; k < j; k++)
+            s -= H[j*n+k] * H[j*n+k];
+        if (!(s > 0.0))
+            return 0;
+        H[j*n+j] = sqrt(s);
+        for (i = j + 1; i < n; i++)
+        {
+            s = H[i*n+j];
+            for (k = 0; k < j; k++)
+                s -= H[i*n+k] * H[j*n+k];
+            H[i*n+j] = s / H[j*n+j];
+        }
+    }
+    for (i = 0; i < n; i++)
+    {
+        for (k = 0; k < i; k++)
+            g[i] -= H[i*n+k] * g[k];
+        g[i] /= H[i*n+i];
+    }
+    for (i = n; i-- > 0; )
+    {
+        for (k = i + 1; k < n; k++)
+            g[i] -= H[k*n+i] * g[k];
+        g[i] /= H[i*n+i];
+    }
+    return 1;
+}
+
+/**
+ * This function fits the moments to the measured precession frequencies
+ * with the Levenberg-Marquardt algorithm.
+ *
+ * @param in_response response matrices of the muon sites (see
+ *         ConfigResponse), in_nmu x 9 x in_ncol numbers.
+ * @param in_nmu number of muon sites.
+ * @param in_ncol number of columns of the response matrices (6 per atom).
+ * @param in_basis basis of the moments, in_ncol x in_nparam numbers
+ *         (row major): x = in_offset + in_basis p.
+ * @param in_offset fixed part of the moments (in_ncol numbers) or NULL.
+ * @param in_nparam number of parameters p.
+ * @param in_freq measured frequencies, MHz, in_nmu numbers.
+ * @param in_sigma uncertainties of the frequencies, NULL for 1 MHz.
+ * @param in_fit_acont if non zero ACont is fitted too.
+ * @param in_maxiter maximum number of iterations.
+ * @param in_tol the fit stops when the relative decrease of chi^2 in an
+ *         iteration is smaller than in_tol.
+ * @param inout_params initial values and, on exit, best fit values of p.
+ * @param inout_acont initial value and, on exit, best fit value of ACont
+ *         (unchanged if in_fit_acont is 0).
+ * @param out_chi2 chi^2 of the best fit.
+ * @return the number of iterations.
+ */
+int FitMoments(const double *in_response, unsigned int in_nmu, unsigned int in_ncol,
+          const double *in_basis, const double *in_offset, unsigned int in_nparam,
+          const double *in_freq, const double *in_sigma, unsigned int in_fit_acont,
+          unsigned int in_maxiter, double in_tol,
+          double *inout_params, double *inout_acont, double *out_chi2)
+{
+    unsigned int n = in_nparam + (in_fit_acont ? 1 : 0);
+    unsigned int mu, x, q, k, i, iter = 0;
+    const double *Rm;
+    double s, sc, chi2, chi2new, lambda = 1e-3, acont = *inout_acont;
+    struct fit_model m;
+    double *f = malloc(in_nmu * sizeof(double));
+    double *r = malloc(in_nmu * sizeof(double));
+    double *J = malloc(in_nmu * n * sizeof(double));
+    double *JJ = malloc(n * n * sizeof(double));
+    double *H = malloc(n * n * sizeof(double));
+    double *g = malloc(n * sizeof(double));
+    double *d = malloc(n * sizeof(double));
+    double *p = calloc(n + 1, sizeof(double));
+
+    in_fit_acont = (in_fit_acont ? 1 : 0);
+    m.nmu = in_nmu;
+    m.np = in_nparam;
+    m.a0 = calloc(3 * in_nmu, sizeof(double));
+    m.c0 = calloc(3 * in_nmu, sizeof(double));
+    m.A = calloc(3 * in_nmu * in_nparam, sizeof(double));
+    m.C = calloc(3 * in_nmu * in_nparam, sizeof(double));
+
+    /* projections of the response matrices on the basis */
+    for (mu = 0; mu < in_nmu; mu++)
+    {
+        Rm = in_response + (size_t) mu * 9 * in_ncol;
+        for (x = 0; x < 3; x++)
+        {
+            for (k = 0; k < in_ncol; k++)
+            {
+                s = Rm[(3 + x) * in_ncol + k] + Rm[(6 + x) * in_ncol + k];
+                sc = Rm[x * in_ncol + k];
+                if (in_offset != NULL)
+                {
+                    m.a0[3*mu+x] += s * in_offset[k];
+                    m.c0[3*mu+x] += sc * in_offset[k];
+                }
+                for (q = 0; q < in_nparam; q++)
+                {
+                    m.A[(3*mu + x) * in_nparam + q] += s * in_basis[k * in_nparam + q];
+                    m.C[(3*mu + x) * in_nparam + q] += sc * in_basis[k * in_nparam + q];
+                }
+            }
+        }
+    }
+
+    for (q = 0; q < in_nparam; q++)
+        p[q] = inout_params[q];
+
+    fit_eval(&m, p, acont, in_fit_acont, f, J);
+    chi2 = fit_chi2(f, in_freq, in_sigma, in_nmu, r);
+
+    while (iter < in_maxiter && n > 0)
+    {
+        iter++;
+        /* J^T J and J^T r, J weighted by 1/sigma */
+        for (i = 0; i < n; i++)
+        {
+            g[i] = 0.0;
+            for (k = 0; k < n; k++)
+                JJ[i*n+k] = 0.0;
+        }
+        for (mu = 0; mu < in_nmu; mu++)
+        {
+            s = (in_sigma != NULL ? 1.0 / in_sigma[mu] : 1.0);
+            for (i = 0; i < n; i++)
+            {
+                g[i] -= s * J[mu*n+i] * r[mu];
+                for (k = 0; k <= i; k++)
+                    JJ[i*n+k] += s * s * J[mu*n+i] * J[mu*n+k];
+            }
+        }
+        for (i = 0; i < n; i++)
+            for (k = 0; k < i; k++)
+                JJ[k*n+i] = JJ[i*n+k];
+
+        /* increase the damping until chi^2 decreases */
+        chi2new = chi2;
+        while (lambda < 1e16)
+        {
+            for (i = 0; i < n * n; i++)
+                H[i] = JJ[i];
+            for (i = 0; i < n; i++)
+            {
+                H[i*n+i] += lambda * (JJ[i*n+i] > 0.0 ? JJ[i*n+i] : 1e-12);
+                d[i] = g[i];
+            }
+            if (fit_solve(H, d, n))
+            {
+                for (q = 0; q < in_nparam; q++)
+                    d[q] += p[q];
+                fit_eval(&m, d, (in_fit_acont ? acont + d[in_nparam] : acont), 0, f, NULL);
+                chi2new = fit_chi2(f, in_freq, in_sigma, in_nmu, r);
+                if (chi2new < chi2)
+                    break;
+            }
+            lambda *= 10.0;
+        }
+        if (!(chi2new < chi2))
+            break;   /* no further improvement: converged */
+
+        for (q = 0; q < in_nparam; q++)
+            p[q] = d[q];
+        if (in_fit_acont)
+            acont += d[in_nparam];
+        lambda = (lambda > 1e-12 ? lambda / 10.0 : lambda);
+
+        s = chi2 - chi2new;
+        chi2 = chi2new;
+        fit_eval(&m, p, acont, in_fit_acont, f, J);
+        fit_chi2(f, in_freq, in_sigma, in_nmu, r);
+        if (s <= in_tol * chi2 || chi2 == 0.0)
+            break;
+    }
+
+    /* restore the residuals of the best parameters */
+    fit_eval(&m, p, acont, 0, f, NULL);
+    *out_chi2 = fit_chi2(f, in_freq, in_sigma, in_nmu, r);
+    for (q = 0; q < in_nparam; q++)
+        inout_params[q] = p[q];
+    if (in_fit_acont)
+        *inout_acont = acont;
+
+    free(m.a0);
+    free(m.c0);
+    free(m.A);
+    free(m.C);
+    free(f);
+    free(r);
+    free(J);
+    free(JJ);
+    free(H);
+    free(g);
+    free(d);
+    free(p);
+    return (int) iter;
+}
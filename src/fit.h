@@ -0,0 +1,9 @@
+#ifndef FIT_H
+#define FIT_H
+
+int FitMoments(const double *in_response, unsigned int in_nmu, unsigned int in_ncol,
+          const double *in_basis, const double *in_offset, unsigned int in_nparam,
+          const double *in_freq, const double *in_sigma, unsigned int in_fit_acont,
+          unsigned int in_maxiter, double in_tol,
+          double *inout_params, double *inout_acont, double *out_chi2);
+#endif
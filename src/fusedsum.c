@@ -0,0 +1,737 @@
+/**
+ * @file fusedsum.c
+ * @author Pietro Bonfa
+ * @date 2016
+ * @brief Single pass evaluation of local fields and dipolar tensors
+ *
+ * Contact, dipolar and Lorentz fields are linear in the magnetic moments.
+ * With m(R) = cos(2 pi K.R) P + sin(2 pi K.R) Q for each atom of the basis
+ * (sublattice), the lattice sum reduces to a few coefficients per
+ * sublattice (see fusedsum.h) that are collected in a single traversal of
+ * the supercell. Fields, dipolar tensor and per-sublattice tensors are
+ * then obtained from the coefficients.
+ * The coefficients of several propagation vectors (e.g. the arms of the
+ * star of K of a multi-domain sample) share the geometric part of the
+ * traversal, so the fields of many magnetic domains cost little more than
+ * the fields of one.
+ */
+
+#define _USE_MATH_DEFINES
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "mat3.h"
+#include "pile.h"
+#include "config.h"
+#include "latticesum.h"
+#include "order.h"
+#include "fusedsum.h"
+
+#ifndef M_PI
+#    define M_PI 3.14159265358979323846
+#endif
+
+#ifdef _OPENMP
+	#include <omp.h>
+#endif
+
+/* Data shared by all the cells of the supercell. */
+struct coef_data {
+    struct mat3 lat;
+    struct vec3 muonpos;
+    const struct vec3 *K;       /* propagation vectors */
+    unsigned int nK;
+    unsigned int natoms;
+    unsigned int scy, scz;
+    unsigned int mask;
+    double radius;
+    double inner_radius;        /* atoms closer than this are already summed */
+    double cont_radius;
+    const struct vec3 *atmcart;
+    const unsigned int *perm;   /* input index of the atoms */
+    const struct vec3 *tilec;   /* center and radius of the tiles */
+    const double *tiler;
+    double *cs;                 /* scratch of coef_cell, 2*nK per thread */
+    pile *MCont;
+};
+
+/**
+ * This function adds the contributions of the atoms of tile `tile`
+ * in cell (i,j,k) to their coefficients (LFC_NCOEF for each atom and
+ * propagation vector, the coefficients of the n-th propagation vector
+ * start at coef + n * natoms * LFC_NCOEF).
+ * Atoms closer than cont_radius are added to the pile used for the
+ * contact field. Atoms closer than inner_radius only enter the pile.
+ * cs is a scratch array of 2*nK numbers.
+ */
+static void coef_cell(const struct coef_data *d,
+          unsigned int i, unsigned int j, unsigned int k, unsigned int tile,
+          double *coef, double *cs)
+{
+    struct vec3 r;
+    struct vec3 base; /* origin of the cell with respect to the muon */
+    double n, dist;
+    double onebrcube, onebrfive;
+    double t[6]; /* dipolar tensor of a single atom */
+    double *w;
+    unsigned long key; /* unique index of the atom in the supercell */
+    unsigned int a, q, kq;
+    unsigned int first = tile * LFC_ATOM_TILE; /* atoms of the tile */
+    unsigned int last = first + LFC_ATOM_TILE < d->natoms ? first + LFC_ATOM_TILE : d->natoms;
+
+    /* origin of the cell (in Angstrom!) with respect to the muon */
+    base = vec3_sub(
+                vec3_add(vec3_add(vec3_muls((double) i, d->lat.a),
+                                  vec3_muls((double) j, d->lat.b)),
+                         vec3_muls((double) k, d->lat.c)),
+                d->muonpos);
+
+    /* skip the tile if it is entirely outside the sphere */
+    dist = vec3_norm(vec3_add(base, d->tilec[tile]));
+    if (dist > (d->radius + d->tiler[tile]) * (1.0 + EPS))
+        return;
+
+    /* or entirely inside the inner sphere and away from the contact atoms */
+    if ((dist + d->tiler[tile]) * (1.0 + EPS) < d->inner_radius &&
+        !((d->mask & LFC_CONTACT) && dist - d->tiler[tile] < d->cont_radius * (1.0 + EPS)))
+        return;
+
+    /* cosine and sine of 2 pi K.R for each propagation vector */
+    if (d->mask & (LFC_DIPOLAR | LFC_LORENTZ))
+    {
+        for (kq = 0; kq < d->nK; kq++)
+        {
+            cs[2*kq] = cos ( 2.0*M_PI * (d->K[kq].x*i + d->K[kq].y*j + d->K[kq].z*k) );
+            cs[2*kq+1] = sin ( 2.0*M_PI * (d->K[kq].x*i + d->K[kq].y*j + d->K[kq].z*k) );
+        }
+    }
+
+    key = (((unsigned long) i * d->scy + j) * d->scz + k) * d->natoms;
+
+    for (a = first; a < last; ++a)
+    {
+        /* difference between atom pos and muon pos (cart coordinates) */
+        r = vec3_add(base, d->atmcart[a]);
+
+        n = vec3_norm(r);
+        if (n >= d->radius)
+            continue;
+
+        /* the phases of the contact atoms are recovered from the key */
+        if ((d->mask & LFC_CONTACT) && n < d->cont_radius)
+        {
+#pragma omp critical
+{
+            pile_add_element_keyed(d->MCont, pow(n,CONT_SCALING_POWER), key + d->perm[a], vec3_zero());
+}
+        }
+
+        if (n < d->inner_radius)
+            continue;
+
+        if (d->mask & LFC_LORENTZ)
+        {
+            for (kq = 0; kq < d->nK; kq++)
+            {
+                w = coef + (kq * d->natoms + a) * LFC_NCOEF;
+                w[LFC_COEF_LC] += cs[2*kq];
+                w[LFC_COEF_LS] += cs[2*kq+1];
+            }
+        }
+
+        if (d->mask & (LFC_DIPOLAR | LFC_TENSOR | LFC_SUBLATTICE))
+        {
+            /* See uSR bible (Yaouanc Dalmas De Reotier, page 81) */
+            onebrcube = 1.0/(n*n*n);
+            onebrfive = 3.0*onebrcube/(n*n);
+            t[0] = -onebrcube+r.x*r.x*onebrfive;
+            t[1] = r.x*r.y*onebrfive;
+            t[2] = r.x*r.z*onebrfive;
+            t[3] = -onebrcube+r.y*r.y*onebrfive;
+            t[4] = r.y*r.z*onebrfive;
+            t[5] = -onebrcube+r.z*r.z*onebrfive;
+
+            if (d->mask & (LFC_TENSOR | LFC_SUBLATTICE))
+            {
+                w = coef + a * LFC_NCOEF;
+                for (q = 0; q < 6; q++)
+                    w[LFC_COEF_T+q] += t[q];
+            }
+            if (d->mask & LFC_DIPOLAR)
+            {
+                for (kq = 0; kq < d->nK; kq++)
+                {
+                    w = coef + (kq * d->natoms + a) * LFC_NCOEF;
+                    for (q = 0; q < 6; q++)
+                    {
+                        w[LFC_COEF_DC+q] += cs[2*kq] * t[q];
+                        w[LFC_COEF_DS+q] += cs[2*kq+1] * t[q];
+                    }
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Cells of column (i,j) that can hold atoms of tile `tile` within the
+ * sphere: kr[0] <= k < kr[1] and kr[2] <= k < kr[3], with 0 <= k < scz.
+ * The cells entirely inside inner_radius are left out, unless the pile of
+ * the contact atoms is needed. coef_cell still checks each cell.
+ */
+static void coef_column(const struct coef_data *d, unsigned int i, unsigned int j,
+          unsigned int tile, unsigned int scz, unsigned int *kr)
+{
+    struct vec3 p0;
+    double cc, kc, so, si, ro, ri;
+    double lo, hi, g0, g1;
+
+    kr[0] = kr[1] = kr[2] = kr[3] = 0;
+
+    /* |p0 + k c| is the distance of the center of the tile in cell k */
+    p0 = vec3_add(vec3_sub(vec3_add(vec3_muls((double) i, d->lat.a),
+                                    vec3_muls((double) j, d->lat.b)),
+                           d->muonpos),
+                  d->tilec[tile]);
+    cc = vec3_dot(d->lat.c, d->lat.c);
+    ro = (d->radius + d->tiler[tile]) * (1.0 + EPS);
+    ri = d->inner_radius * (1.0 - EPS) - d->tiler[tile];
+
+    kc = -vec3_dot(p0, d->lat.c) / cc;
+    so = kc*kc - (vec3_dot(p0, p0) - ro*ro) / cc;
+    if (so < 0.0)
+        return;
+    so = sqrt(so);
+    lo = ceil(kc - so);
+    hi = floor(kc + so);
+    if (lo < 0.0)
+        lo = 0.0;
+    if (hi > (double) scz - 1.0)
+        hi = (double) scz - 1.0;
+    if (lo > hi)
+        return;
+
+    si = (ri > 0.0 && !(d->mask & LFC_CONTACT)) ? kc*kc - (vec3_dot(p0, p0) - ri*ri) / cc : -1.0;
+    if (si > 0.0)
+    {
+        /* cells with kc - si < k < kc + si are inside inner_radius */
+        si = sqrt(si);
+        g0 = floor(kc - si) + 1.0;
+        g1 = ceil(kc + si);
+        kr[0] = (unsigned int) lo;
+        kr[1] = (unsigned int) (g0 < lo ? lo : (g0 > hi + 1.0 ? hi + 1.0 : g0));
+        kr[2] = (unsigned int) (g1 < lo ? lo : (g1 > hi + 1.0 ? hi + 1.0 : g1));
+        kr[3] = (unsigned int) hi + 1;
+    }
+    else
+    {
+        kr[0] = (unsigned int) lo;
+        kr[1] = (unsigned int) hi + 1;
+        kr[2] = kr[3] = kr[1];
+    }
+}
+
+/*
+ * Block of LatticeWalk: adds the coefficients of the atoms of tile `tile`
+ * in the cells (i,j,k0) ... (i,j,k1-1) that can reach the sphere (see
+ * coef_column) to coef.
+ */
+static void coef_block(const void *ctx, int i, int j, int k0, int k1,
+          unsigned int tile, double *coef)
+{
+    const struct coef_data *d = (const struct coef_data *) ctx;
+    unsigned int k, x, kr[4];
+    double *cs = d->cs; /* scratch for coef_cell of this thread */
+
+#ifdef _OPENMP
+    cs += 2 * (unsigned long) d->nK * omp_get_thread_num();
+#endif
+
+    coef_column(d, i, j, tile, d->scz, kr);
+    for (x = 0; x < 4; x++)
+    {
+        if (kr[x] < (unsigned int) k0)
+            kr[x] = k0;
+        if (kr[x] > (unsigned int) k1)
+            kr[x] = k1;
+    }
+
+    for (k = kr[0]; k < kr[1]; ++k)
+        coef_cell(d, i, j, k, tile, coef, cs);
+    for (k = kr[2]; k < kr[3]; ++k)
+        coef_cell(d, i, j, k, tile, coef, cs);
+}
+
+/*
+ * Adds the coefficients of the atoms with inner_radius <= r < radius to
+ * out_coef (see LatticeCoefficientsMulti). The contact weights, if
+ * requested, are those of the whole sphere.
+ */
+static void lattice_coefficients(const double *in_positions,
+          unsigned int in_nK, const double *in_K,
+          const double *in_muonpos, const int * in_supercell, const double *in_cell,
+          const double inner_radius, const double radius,
+          const unsigned int nnn_for_cont, const double cont_radius,
+          unsigned int in_natoms, unsigned int in_mask, double *out_coef)
+{
+    unsigned int scx, scy, scz; /*supercell sizes */
+    unsigned int a, q, i, kq;
+    unsigned long cell; /* cell of a contact atom */
+    double KR;
+    unsigned int ntiles; /* tiles of LFC_ATOM_TILE atoms */
+    unsigned int nthreads = 1;
+
+    struct vec3 atmpos;
+    struct vec3 muonpos;
+    struct mat3 lat;
+    struct mat3 sc_lat;
+
+    struct vec3 *atmcart = malloc(in_natoms * sizeof(struct vec3));
+    unsigned int *perm = malloc(in_natoms * sizeof(unsigned int));
+    struct vec3 *tilec = malloc(((in_natoms + LFC_ATOM_TILE - 1) / LFC_ATOM_TILE) * sizeof(struct vec3));
+    double *tiler = malloc(((in_natoms + LFC_ATOM_TILE - 1) / LFC_ATOM_TILE) * sizeof(double));
+    double *sum = calloc(in_nK * in_natoms * LFC_NCOEF, sizeof(double));
+    struct vec3 *K = malloc(in_nK * sizeof(struct vec3));
+
+    struct coef_data d;
+    struct lattice_walk walk;
+    pile MCont;
+    double SumOfWeights = 0;
+
+    /* define dupercell size */
+    scx = in_supercell[0];
+    scy = in_supercell[1];
+    scz = in_supercell[2];
+
+    lat.a.x = in_cell[0];
+    lat.a.y = in_cell[1];
+    lat.a.z = in_cell[2];
+    lat.b.x = in_cell[3];
+    lat.b.y = in_cell[4];
+    lat.b.z = in_cell[5];
+    lat.c.x = in_cell[6];
+    lat.c.y = in_cell[7];
+    lat.c.z = in_cell[8];
+
+    sc_lat = mat3_mul(
+                        mat3_diag((double) scx, (double) scy, (double) scz),
+                        lat);
+
+    /* muon position in reduced coordinates */
+    muonpos.x =  (in_muonpos[0] + (scx/2) ) / (double) scx;
+    muonpos.y =  (in_muonpos[1] + (scy/2) ) / (double) scy;
+    muonpos.z =  (in_muonpos[2] + (scz/2) ) / (double) scz;
+
+    muonpos = mat3_vmul(muonpos,sc_lat);
+
+    /* atoms are stored along a Morton curve, see order.c */
+    morton_order(in_positions, in_natoms, perm);
+
+    for (a = 0; a < in_natoms; ++a)
+    {
+        atmpos.x =  in_positions[3*perm[a]] ;
+        atmpos.y =  in_positions[3*perm[a]+1] ;
+        atmpos.z =  in_positions[3*perm[a]+2] ;
+
+        /* go to cartesian coordinates (in Angstrom!) */
+        atmcart[a] = mat3_vmul(atmpos,lat);
+    }
+
+    ntiles = (in_natoms + LFC_ATOM_TILE - 1) / LFC_ATOM_TILE;
+    tile_bounds(atmcart, in_natoms, LFC_ATOM_TILE, tilec, tiler);
+
+    pile_init(&MCont, nnn_for_cont);
+
+    d.lat = lat;
+    d.muonpos = muonpos;
+    for (kq = 0; kq < in_nK; kq++)
+    {
+        K[kq].x = in_K[3*kq];
+        K[kq].y = in_K[3*kq+1];
+        K[kq].z = in_K[3*kq+2];
+    }
+    d.K = K;
+    d.nK = in_nK;
+    d.natoms = in_natoms;
+    d.scy = scy;
+    d.scz = scz;
+    d.mask = in_mask;
+    d.radius = radius;
+    d.inner_radius = inner_radius;
+    d.cont_radius = cont_radius;
+    d.atmcart = atmcart;
+    d.perm = perm;
+    d.tilec = tilec;
+    d.tiler = tiler;
+    d.MCont = &MCont;
+
+    /* the scratch of the blocks is allocated once for each thread */
+#ifdef _OPENMP
+    nthreads = omp_get_max_threads();
+#endif
+    d.cs = malloc(2 * (unsigned long) in_nK * nthreads * sizeof(double));
+
+    /* Each tile of atoms in a group of columns is summed by a single
+     * thread. Tasks of the same group write different atoms, so they
+     * share the partial result of the group. */
+    walk.block = coef_block;
+    walk.ctx = &d;
+    walk.lo[0] = walk.lo[1] = walk.lo[2] = 0;
+    walk.hi[0] = scx;
+    walk.hi[1] = scy;
+    walk.hi[2] = scz;
+    walk.kblock = 0;
+    walk.ntiles = ntiles;
+    walk.nacc = (unsigned long) in_nK * in_natoms * LFC_NCOEF;
+    walk.tile_acc = 1;
+    LatticeWalk(&walk, LFC_REPRODUCIBLE, sum);
+
+    /* back to the order of in_positions */
+    for (kq = 0; kq < in_nK; kq++)
+    {
+        for (a = 0; a < in_natoms; ++a)
+        {
+            for (q = 0; q < LFC_NCOEF; q++)
+                out_coef[(kq * in_natoms + perm[a]) * LFC_NCOEF + q] +=
+                    sum[(kq * in_natoms + a) * LFC_NCOEF + q];
+        }
+    }
+
+    /* Contact weights: W(r) = (1/r^3) / (Sum ^N 1/r^3) */
+    for (i=0; i < nnn_for_cont; i++) {
+        if (MCont.ranks[i] > 0.0)
+            SumOfWeights += (1./MCont.ranks[i]);
+    }
+    for (i=0; i < nnn_for_cont; i++) {
+        if (MCont.ranks[i] > 0.0) {
+            a = MCont.keys[i] % in_natoms; /* index in in_positions */
+            cell = MCont.keys[i] / in_natoms; /* ((i * scy + j) * scz + k) */
+            for (kq = 0; kq < in_nK; kq++)
+            {
+                KR = 2.0*M_PI * (K[kq].x * (cell / ((unsigned long) scy * scz)) +
+                                 K[kq].y * ((cell / scz) % scy) +
+                                 K[kq].z * (cell % scz));
+                out_coef[(kq * in_natoms + a) * LFC_NCOEF + LFC_COEF_CC] += cos(KR) / (MCont.ranks[i] * SumOfWeights);
+                out_coef[(kq * in_natoms + a) * LFC_NCOEF + LFC_COEF_CS] += sin(KR) / (MCont.ranks[i] * SumOfWeights);
+            }
+        }
+    }
+
+    pile_free(&MCont);
+    free(d.cs);
+    free(sum);
+    free(K);
+    free(atmcart);
+    free(perm);
+    free(tilec);
+    free(tiler);
+}
+
+/**
+ * This function computes the lattice sum coefficients of each magnetic
+ * atom (see fusedsum.h for their layout) for in_nK propagation vectors
+ * with a single traversal of the supercell. The result does not depend
+ * on the number of threads.
+ *
+ * @param in_positions positions of the magnetic atoms in fractional
+ *         coordinates. Each position is specified by the three
+ *         coordinates and the 1D array must be 3*in_natoms long.
+ * @param in_nK number of propagation vectors.
+ * @param in_K the in_nK propagation vectors in *reciprocal lattice units*.
+ * @param in_muonpos position of the muon in fractional coordinates
+ * @param in_supercell extension of the supercell along the lattice vectors.
+ * @param in_cell lattice cell. The three lattice vectors should be entered
+ *         with the following order: a_x, a_y, a_z, b_z, b_y, b_z, c_x, c_y, c_z.
+ * @param radius Lorentz sphere radius
+ * @param nnn_for_cont number of nearest neighboring atoms to be included
+ *                      for the evaluation of the contact field.
+ * @param cont_radius only atoms within this radius are eligible to contribute to
+ *                      the contact field.
+ * @param in_natoms: number of atoms in the lattice.
+ * @param in_mask: bitwise or of LFC_CONTACT, LFC_DIPOLAR, LFC_LORENTZ,
+ *                  LFC_TENSOR and LFC_SUBLATTICE (see config.h).
+ *                  Coefficients that are not needed are set to zero.
+ * @param out_coef LFC_NCOEF coefficients for each atom and propagation
+ *                  vector (in_nK*in_natoms*LFC_NCOEF numbers, the atoms
+ *                  in the order of in_positions). The K independent
+ *                  tensors LFC_COEF_T are only stored with the first
+ *                  propagation vector. Tensors are in 1/Angstrom^3,
+ *                  contact weights are normalized to 1.
+ */
+void LatticeCoefficientsMulti(const double *in_positions,
+          unsigned int in_nK, const double *in_K,
+          const double *in_muonpos, const int * in_supercell, const double *in_cell,
+          const double radius, const unsigned int nnn_for_cont, const double cont_radius,
+          unsigned int in_natoms, unsigned int in_mask, double *out_coef)
+{
+    memset(out_coef, 0, (size_t) in_nK * in_natoms * LFC_NCOEF * sizeof(double));
+    lattice_coefficients(in_positions, in_nK, in_K, in_muonpos, in_supercell, in_cell,
+                         0.0, radius, nnn_for_cont, cont_radius, in_natoms, in_mask,
+                         out_coef);
+}
+
+/**
+ * This function computes the lattice sum coefficients of each magnetic
+ * atom for a single propagation vector (see LatticeCoefficientsMulti).
+ */
+void LatticeCoefficients(const double *in_positions, const double *in_K,
+          const double *in_muonpos, const int * in_supercell, const double *in_cell,
+          const double radius, const unsigned int nnn_for_cont, const double cont_radius,
+          unsigned int in_natoms, unsigned int in_mask, double *out_coef)
+{
+    LatticeCoefficientsMulti(in_positions, 1, in_K, in_muonpos, in_supercell, in_cell,
+                             radius, nnn_for_cont, cont_radius, in_natoms, in_mask,
+                             out_coef);
+}
+
+/**
+ * This function adds to out_coef the lattice sum coefficients of the
+ * atoms in the spherical shell inner_radius <= r < radius, so that the
+ * coefficients of a sphere of radius inner_radius (see LatticeCoefficients)
+ * become those of a sphere of radius radius. Only the cells that reach the
+ * shell are visited.
+ * If in_mask contains LFC_CONTACT the contact weights of the whole sphere
+ * are added, so the caller must reset LFC_COEF_CC and LFC_COEF_CS first.
+ * They only change when cont_radius is larger than inner_radius.
+ */
+void LatticeShellCoefficients(const double *in_positions, const double *in_K,
+          const double *in_muonpos, const int * in_supercell, const double *in_cell,
+          const double inner_radius, const double radius,
+          const unsigned int nnn_for_cont, const double cont_radius,
+          unsigned int in_natoms, unsigned int in_mask, double *out_coef)
+{
+    lattice_coefficients(in_positions, 1, in_K, in_muonpos, in_supercell, in_cell,
+                         inner_radius, radius, nnn_for_cont, cont_radius, in_natoms,
+                         in_mask, out_coef);
+}
+
+/* Product of the symmetric tensor t (xx, xy, xz, yy, yz, zz) and v */
+static struct vec3 symten_vmul(const double *t, struct vec3 v)
+{
+    return _vec3(t[0]*v.x + t[1]*v.y + t[2]*v.z,
+                 t[1]*v.x + t[3]*v.y + t[4]*v.z,
+                 t[2]*v.x + t[4]*v.y + t[5]*v.z);
+}
+
+/**
+ * This function obtains the local fields from the coefficients of a
+ * single propagation vector (see LatticeCoefficientsMulti) and the
+ * Fourier components and phases of the atoms. Only the fields selected
+ * by in_mask (LFC_CONTACT, LFC_DIPOLAR, LFC_LORENTZ) are stored.
+ */
+void CoefficientFields(const double *coef, const double *in_fc, const double *in_phi,
+          unsigned int in_natoms, double radius, unsigned int in_mask,
+          double *out_field_cont, double *out_field_dip, double *out_field_lor)
+{
+    const double *w;
+    struct vec3 sk, isk, P, Q;
+    struct vec3 BCont, BDip, BLor;
+    double phi;
+    unsigned int a;
+
+    BCont = vec3_zero();
+    BDip = vec3_zero();
+    BLor = vec3_zero();
+
+    for (a = 0; a < in_natoms; ++a)
+    {
+        w = coef + a * LFC_NCOEF;
+
+#ifdef _ALTERNATE_FC_INPUT
+         sk.x = in_fc[6*a];   sk.y = in_fc[6*a+1]; sk.z = in_fc[6*a+2];
+        isk.x = in_fc[6*a+3];isk.y = in_fc[6*a+4];isk.z = in_fc[6*a+5];
+#else
+         sk.x = in_fc[6*a];   sk.y = in_fc[6*a+2]; sk.z = in_fc[6*a+4];
+        isk.x = in_fc[6*a+1];isk.y = in_fc[6*a+3];isk.z = in_fc[6*a+5];
+#endif
+        /* m(R) = cos(2 pi K.R) P + sin(2 pi K.R) Q, see SimpleSum */
+        phi = 2.0*M_PI*in_phi[a];
+        P = vec3_add(vec3_muls(cos(phi), sk), vec3_muls(sin(phi), isk));
+        Q = vec3_sub(vec3_muls(cos(phi), isk), vec3_muls(sin(phi), sk));
+
+        BCont = vec3_add(BCont, vec3_add(vec3_muls(w[LFC_COEF_CC], P),
+                                         vec3_muls(w[LFC_COEF_CS], Q)));
+        BDip = vec3_add(BDip, vec3_add(symten_vmul(w + LFC_COEF_DC, P),
+                                       symten_vmul(w + LFC_COEF_DS, Q)));
+        BLor = vec3_add(BLor, vec3_add(vec3_muls(w[LFC_COEF_LC], P),
+                                       vec3_muls(w[LFC_COEF_LS], Q)));
+    }
+
+    /* same units of SimpleSum */
+    if (in_mask & LFC_CONTACT)
+    {
+        BCont = vec3_muls(7.769376, BCont);
+        out_field_cont[0] = BCont.x;
+        out_field_cont[1] = BCont.y;
+        out_field_cont[2] = BCont.z;
+    }
+    if (in_mask & LFC_DIPOLAR)
+    {
+        BDip = vec3_muls(0.92740098, BDip);
+        out_field_dip[0] = BDip.x;
+        out_field_dip[1] = BDip.y;
+        out_field_dip[2] = BDip.z;
+    }
+    if (in_mask & LFC_LORENTZ)
+    {
+        BLor = vec3_muls(0.33333333333*11.654064, vec3_muls(3./(4.*M_PI*pow(radius,3)),BLor));
+        out_field_lor[0] = BLor.x;
+        out_field_lor[1] = BLor.y;
+        out_field_lor[2] = BLor.z;
+    }
+}
+
+/**
+ * This function calculates, with a single traversal of the supercell,
+ * the local fields and the dipolar tensors at the muon site.
+ *
+ * @param in_positions positions of the magnetic atoms in fractional
+ *         coordinates (see SimpleSum).
+ * @param in_fc Fourier components (see SimpleSum).
+ * @param in_K the propagation vector in *reciprocal lattice units*.
+ * @param in_phi the phase for each of the atoms given in in_positions.
+ * @param in_muonpos position of the muon in fractional coordinates
+ * @param in_supercell extension of the supercell along the lattice vectors.
+ * @param in_cell lattice cell (see SimpleSum).
+ * @param radius Lorentz sphere radius
+ * @param nnn_for_cont number of nearest neighboring atoms to be included
+ *                      for the evaluation of the contact field.
+ * @param cont_radius only atoms within this radius are eligible to contribute to
+ *                      the contact field.
+ * @param in_natoms: number of atoms in the lattice.
+ * @param in_mask: bitwise or of LFC_CONTACT, LFC_DIPOLAR, LFC_LORENTZ,
+ *                  LFC_TENSOR and LFC_SUBLATTICE (see config.h). The
+ *                  corresponding outputs are computed, the others are
+ *                  not touched.
+ * @param out_field_cont Contact field in Tesla (as in SimpleSum).
+ * @param out_field_dip  Dipolar field in Tesla (as in SimpleSum).
+ * @param out_field_lor  Lorentz field in Tesla (as in SimpleSum).
+ * @param out_tensor the dipolar tensor (9 entries, as in DipolarTensor).
+ * @param out_sublattice the dipolar tensor of each sublattice
+ *          (9*in_natoms entries, in the order of in_positions).
+ *          Their sum is out_tensor.
+ */
+void FusedSum(const double *in_positions,
+          const double *in_fc, const double *in_K, const double *in_phi,
+          const double *in_muonpos, const int * in_supercell, const double *in_cell,
+          const double radius, const unsigned int nnn_for_cont, const double cont_radius,
+          unsigned int in_natoms, unsigned int in_mask,
+          double *out_field_cont, double *out_field_dip, double *out_field_lor,
+          double *out_tensor, double *out_sublattice)
+{
+    double *coef = calloc(in_natoms * LFC_NCOEF, sizeof(double));
+    double *w;
+    double T[6] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+    unsigned int a, q;
+
+    LatticeCoefficients(in_positions, in_K, in_muonpos, in_supercell, in_cell,
+                        radius, nnn_for_cont, cont_radius, in_natoms, in_mask, coef);
+
+    CoefficientFields(coef, in_fc, in_phi, in_natoms, radius, in_mask,
+                      out_field_cont, out_field_dip, out_field_lor);
+
+    for (a = 0; a < in_natoms; ++a)
+    {
+        w = coef + a * LFC_NCOEF;
+
+        for (q = 0; q < 6; q++)
+            T[q] += w[LFC_COEF_T+q];
+
+        if (in_mask & LFC_SUBLATTICE)
+        {
+            out_sublattice[9*a+0] = w[LFC_COEF_T+0];
+            out_sublattice[9*a+1] = w[LFC_COEF_T+1];
+            out_sublattice[9*a+2] = w[LFC_COEF_T+2];
+            out_sublattice[9*a+3] = w[LFC_COEF_T+1];
+            out_sublattice[9*a+4] = w[LFC_COEF_T+3];
+            out_sublattice[9*a+5] = w[LFC_COEF_T+4];
+            out_sublattice[9*a+6] = w[LFC_COEF_T+2];
+            out_sublattice[9*a+7] = w[LFC_COEF_T+4];
+            out_sublattice[9*a+8] = w[LFC_COEF_T+5];
+        }
+    }
+    free(coef);
+
+    if (in_mask & LFC_TENSOR)
+    {
+        out_tensor[0] = T[0]; out_tensor[1] = T[1]; out_tensor[2] = T[2];
+        out_tensor[3] = T[1]; out_tensor[4] = T[3]; out_tensor[5] = T[4];
+        out_tensor[6] = T[2]; out_tensor[7] = T[4]; out_tensor[8] = T[5];
+    }
+}
+
+/**
+ * This function calculates the local fields at the muon site for
+ * in_ndomains magnetic domains (e.g. the arms of the star of K and the
+ * symmetry equivalent arrangements of the moments) with a single
+ * traversal of the supercell. The domains sharing the same propagation
+ * vector also share the coefficients of the lattice sum.
+ *
+ * @param in_positions positions of the magnetic atoms in fractional
+ *         coordinates (see SimpleSum).
+ * @param in_ndomains number of domains.
+ * @param in_fc Fourier components of each domain (6*in_natoms numbers for
+ *         each domain, see SimpleSum).
+ * @param in_K the propagation vector of each domain in *reciprocal lattice units*.
+ * @param in_phi the phases of each domain (in_natoms numbers for each domain).
+ * @param in_muonpos position of the muon in fractional coordinates
+ * @param in_supercell extension of the supercell along the lattice vectors.
+ * @param in_cell lattice cell (see SimpleSum).
+ * @param radius Lorentz sphere radius
+ * @param nnn_for_cont number of nearest neighboring atoms to be included
+ *                      for the evaluation of the contact field.
+ * @param cont_radius only atoms within this radius are eligible to contribute to
+ *                      the contact field.
+ * @param in_natoms: number of atoms in the lattice.
+ * @param out_field_cont Contact field of each domain (3*in_ndomains numbers, Tesla).
+ * @param out_field_dip  Dipolar field of each domain (3*in_ndomains numbers, Tesla).
+ * @param out_field_lor  Lorentz field of each domain (3*in_ndomains numbers, Tesla).
+ */
+void DomainSum(const double *in_positions, unsigned int in_ndomains,
+          const double *in_fc, const double *in_K, const double *in_phi,
+          const double *in_muonpos, const int * in_supercell, const double *in_cell,
+          const double radius, const unsigned int nnn_for_cont, const double cont_radius,
+          unsigned int in_natoms,
+          double *out_field_cont, double *out_field_dip, double *out_field_lor)
+{
+    double *K = calloc(3 * in_ndomains, sizeof(double)); /* distinct propagation vectors */
+    unsigned int *kidx = malloc(in_ndomains * sizeof(unsigned int));
+    unsigned int nK = 0;
+    unsigned int dom, kq;
+    double *coef;
+
+    for (dom = 0; dom < in_ndomains; dom++)
+    {
+        for (kq = 0; kq < nK; kq++)
+        {
+            if (fabs(K[3*kq] - in_K[3*dom]) < EPS &&
+                fabs(K[3*kq+1] - in_K[3*dom+1]) < EPS &&
+                fabs(K[3*kq+2] - in_K[3*dom+2]) < EPS)
+                break;
+        }
+        if (kq == nK)
+        {
+            K[3*nK] = in_K[3*dom];
+            K[3*nK+1] = in_K[3*dom+1];
+            K[3*nK+2] = in_K[3*dom+2];
+            nK++;
+        }
+        kidx[dom] = kq;
+    }
+
+    coef = calloc(nK * in_natoms * LFC_NCOEF, sizeof(double));
+    LatticeCoefficientsMulti(in_positions, nK, K, in_muonpos, in_supercell, in_cell,
+                             radius, nnn_for_cont, cont_radius, in_natoms,
+                             LFC_CONTACT | LFC_DIPOLAR | LFC_LORENTZ, coef);
+
+    for (dom = 0; dom < in_ndomains; dom++)
+        CoefficientFields(coef + kidx[dom] * in_natoms * LFC_NCOEF,
+                          in_fc + 6 * in_natoms * dom, in_phi + in_natoms * dom,
+                          in_natoms, radius, LFC_CONTACT | LFC_DIPOLAR | LFC_LORENTZ,
+                          out_field_cont + 3*dom, out_field_dip + 3*dom, out_field_lor + 3*dom);
+
+    free(coef);
+    free(K);
+    free(kidx);
+}
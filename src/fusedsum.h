@@ -0,0 +1,52 @@
+#ifndef FUSED_SUM_H
+#define FUSED_SUM_H
+/** @brief Single pass lattice sums
+ *
+ * Layout of the coefficients computed for each magnetic atom by
+ * LatticeCoefficients. Tensors are stored as xx, xy, xz, yy, yz, zz.
+ */
+#define LFC_COEF_T 0    /**< dipolar tensor of the sublattice */
+#define LFC_COEF_DC 6   /**< dipolar tensor weighted by cos(2 pi K.R) */
+#define LFC_COEF_DS 12  /**< dipolar tensor weighted by sin(2 pi K.R) */
+#define LFC_COEF_LC 18  /**< sum of cos(2 pi K.R) in the Lorentz sphere */
+#define LFC_COEF_LS 19  /**< sum of sin(2 pi K.R) in the Lorentz sphere */
+#define LFC_COEF_CC 20  /**< contact weights times cos(2 pi K.R) */
+#define LFC_COEF_CS 21  /**< contact weights times sin(2 pi K.R) */
+#define LFC_NCOEF 22
+
+void LatticeCoefficients(const double *in_positions, const double *in_K,
+          const double *in_muonpos, const int * in_supercell, const double *in_cell,
+          const double radius, const unsigned int nnn_for_cont, const double cont_radius,
+          unsigned int size, unsigned int mask, double *out_coef);
+
+void LatticeCoefficientsMulti(const double *in_positions,
+          unsigned int nK, const double *in_K,
+          const double *in_muonpos, const int * in_supercell, const double *in_cell,
+          const double radius, const unsigned int nnn_for_cont, const double cont_radius,
+          unsigned int size, unsigned int mask, double *out_coef);
+
+void LatticeShellCoefficients(const double *in_positions, const double *in_K,
+          const double *in_muonpos, const int * in_supercell, const double *in_cell,
+          const double inner_radius, const double radius,
+          const unsigned int nnn_for_cont, const double cont_radius,
+          unsigned int size, unsigned int mask, double *out_coef);
+
+void CoefficientFields(const double *coef, const double *in_fc, const double *in_phi,
+          unsigned int in_natoms, double radius, unsigned int in_mask,
+          double *out_field_cont, double *out_field_dip, double *out_field_lor);
+
+void FusedSum(const double *in_positions,
+          const double *in_fc, const double *in_K, const double *in_phi,
+          const double *in_muonpos, const int * in_supercell, const double *in_cell,
+          const double radius, const unsigned int nnn_for_cont, const double cont_radius,
+          unsigned int size, unsigned int mask,
+          double *out_field_cont, double *out_field_dip, double *out_field_lor,
+          double *out_tensor, double *out_sublattice);
+
+void DomainSum(const double *in_positions, unsigned int ndomains,
+          const double *in_fc, const double *in_K, const double *in_phi,
+          const double *in_muonpos, const int * in_supercell, const double *in_cell,
+          const double radius, const unsigned int nnn_for_cont, const double cont_radius,
+          unsigned int size,
+          double *out_field_cont, double *out_field_dip, double *out_field_lor);
+#endif
@@ -0,0 +1,487 @@
+/**
+ * @file gridscan.c
+ * @author Pietro Bonfa
+ * @date 2016
+ * @brief Local fields on a grid of candidate muon sites
+ *
+ * GridMask excludes the points of a regular grid in the unit cell that are
+ * closer than a minimum distance to any atom. The atoms are binned in a
+ * cell list with bins at least min_dist wide, so that only the neighboring
+ * bins are searched.
+ *
+ * GridScan evaluates the fields (and optionally the dipolar tensor) at
+ * many points of the unit cell. The magnetic atoms within
+ * radius + max |point - center| from the center of the cell, with their
+ * moments, are collected once (by a LatticeWalk) and sorted by their
+ * distance from the center.
+ * Each point then only visits the head of this list that can reach its
+ * sphere, and the points are distributed among the threads.
+ */
+
+#define _USE_MATH_DEFINES
+#include <stdlib.h>
+#include <math.h>
+#include "config.h"
+#include "mat3.h"
+#include "pile.h"
+#include "latticesum.h"
+#include "kernels.h"
+#include "gridscan.h"
+
+#ifndef M_PI
+#    define M_PI 3.14159265358979323846
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/* An atom of the lattice shared by all the points. */
+struct grid_atom {
+    struct vec3 r;       /* Cartesian position, cell 0 at the origin */
+    struct vec3 m;       /* moment */
+    double d;            /* distance from the center of cell 0 */
+    unsigned long key;   /* unique key of the atom for the contact pile */
+};
+
+/* Orders the atoms by distance, then by key, so that the list does not
+ * depend on the order in which the threads built it. */
+static int grid_atom_cmp(const void *a, const void *b)
+{
+    double da = ((const struct grid_atom *) a)->d;
+    double db = ((const struct grid_atom *) b)->d;
+    unsigned long ka = ((const struct grid_atom *) a)->key;
+    unsigned long kb = ((const struct grid_atom *) b)->key;
+    if (da != db)
+        return (da > db) - (da < db);
+    return (ka > kb) - (ka < kb);
+}
+
+/* The list of the atoms of GridScan, being built. */
+struct grid_list {
+    struct grid_atom *atoms;
+    unsigned long n, max;
+};
+
+/* Data of the traversal building the list of GridScan. */
+struct grid_data {
+    unsigned int natoms;
+    const struct vec3 *atmcart;  /* Cartesian positions in the cell */
+    const struct vec3 *P, *Q;    /* m(R) = cos(2 pi K.R) P + sin(2 pi K.R) Q */
+    const double *K;
+    const int *origin;           /* index of the cell of the muon */
+    const int *ns;               /* bounds of the cell indices, for the keys */
+    struct mat3 lat;
+    struct vec3 center;
+    double reach;                /* radius + max |point - center| */
+    double ro, cc;
+    struct grid_list *list;
+};
+
+/* Appends n atoms to the list. */
+static void grid_list_append(struct grid_list *list, const struct grid_atom *atoms,
+          unsigned long n)
+{
+    unsigned long x;
+
+    if (list->n + n > list->max)
+    {
+        list->max = (list->max > 0 ? 2*list->max : 1024);
+        if (list->max < list->n + n)
+            list->max = list->n + n;
+        list->atoms = realloc(list->atoms, list->max * sizeof(struct grid_atom));
+    }
+    for (x = 0; x < n; x++)
+        list->atoms[list->n + x] = atoms[x];
+    list->n += n;
+}
+
+/*
+ * Block of LatticeWalk: appends the atoms of the cells
+ * (i, j, klo) ... (i, j, khi-1) within reach of the center of cell 0.
+ * The atoms of the block are collected first and appended to the shared
+ * list at once.
+ */
+static void grid_block(const void *ctx, int i, int j, int klo, int khi,
+          unsigned int tile, double *acc)
+{
+    const struct grid_data *d = (const struct grid_data *) ctx;
+    struct grid_list block = {NULL, 0, 0};
+    struct grid_atom atom;
+    struct vec3 p0;
+    double t, c, s, lo, hi;
+    int k, k0, k1;
+    unsigned int a;
+
+    (void) tile;
+    (void) acc;
+
+    /* cells k0 <= k <= k1 have centers within ro */
+    p0 = vec3_add(vec3_muls((double) i, d->lat.a), vec3_muls((double) j, d->lat.b));
+    if (!lattice_column_span(p0, d->lat.c, d->cc, d->ro, &lo, &hi))
+        return;
+    k0 = (int) ceil(lo);
+    k1 = (int) floor(hi);
+    if (k0 < klo)
+        k0 = klo;
+    if (k1 > khi - 1)
+        k1 = khi - 1;
+
+    for (k = k0; k <= k1; k++)
+    {
+        t = 2.0*M_PI * (d->K[0]*(i + d->origin[0]) + d->K[1]*(j + d->origin[1]) +
+                        d->K[2]*(k + d->origin[2]));
+        c = cos(t);
+        s = sin(t);
+        p0 = vec3_add(vec3_add(vec3_muls((double) i, d->lat.a),
+                               vec3_muls((double) j, d->lat.b)),
+                      vec3_muls((double) k, d->lat.c));
+
+        for (a = 0; a < d->natoms; a++)
+        {
+            atom.r = vec3_add(p0, d->atmcart[a]);
+            atom.d = vec3_norm(vec3_sub(atom.r, d->center));
+            if (atom.d > d->reach)
+                continue;
+
+            atom.m = vec3_add(vec3_muls(c, d->P[a]), vec3_muls(s, d->Q[a]));
+            atom.key = ((unsigned long) ((i + d->ns[0]) * (2*d->ns[1] + 1) + (j + d->ns[1])) * (2*d->ns[2] + 1)
+                        + (unsigned long) (k + d->ns[2])) * d->natoms + a;
+            grid_list_append(&block, &atom, 1);
+        }
+    }
+
+    if (block.n > 0)
+    {
+#pragma omp critical(grid_list)
+        grid_list_append(d->list, block.atoms, block.n);
+    }
+    free(block.atoms);
+}
+
+/* Wraps i in [0, n) and returns the number of periods removed. */
+static int grid_wrap(int *i, int n)
+{
+    int s = (*i >= 0 ? *i / n : -((-*i + n - 1) / n));
+    *i -= s * n;
+    return s;
+}
+
+/**
+ * This function marks the points x = (i/n_a, j/n_b, k/n_c) of a regular
+ * grid in the unit cell that are at least min_dist away from all the atoms
+ * (and their periodic images).
+ *
+ * @param in_atoms positions of the atoms in fractional coordinates,
+ *         3*in_natoms numbers.
+ * @param in_natoms number of atoms.
+ * @param in_cell lattice cell (a_x, a_y, a_z, b_x, ..., c_z).
+ * @param in_grid number of points along a, b and c.
+ * @param min_dist minimum distance from the atoms (Angstrom).
+ * @param out_mask n_a*n_b*n_c flags, 1 for the points retained. The index
+ *         of point (i, j, k) is (i*n_b + j)*n_c + k.
+ * @return the number of points retained.
+ */
+unsigned int GridMask(const double *in_atoms, unsigned int in_natoms,
+          const double *in_cell, const int *in_grid, double min_dist,
+          char *out_mask)
+{
+    int i, j, k, nb[3], reach[3], o[3], b[3], s[3];
+    unsigned int a, x, nbins, count = 0;
+    unsigned int *head, *next;
+    struct mat3 lat;
+    struct vec3 *frac, p, r;
+    double width, vol, dmin2 = min_dist*min_dist;
+    long g, ngrid;
+
+    lat.a.x = in_cell[0]; lat.a.y = in_cell[1]; lat.a.z = in_cell[2];
+    lat.b.x = in_cell[3]; lat.b.y = in_cell[4]; lat.b.z = in_cell[5];
+    lat.c.x = in_cell[6]; lat.c.y = in_cell[7]; lat.c.z = in_cell[8];
+    vol = fabs(vec3_dot(lat.a, vec3_cross(lat.b, lat.c)));
+
+    /* bins at least min_dist wide across the planes of the lattice; points
+     * within min_dist differ by at most reach bins along each axis */
+    for (x = 0; x < 3; x++)
+    {
+        width = vol / vec3_norm(x == 0 ? vec3_cross(lat.b, lat.c) :
+                                x == 1 ? vec3_cross(lat.c, lat.a) :
+                                         vec3_cross(lat.a, lat.b));
+        nb[x] = (min_dist > 0.0 ? (int) floor(width / min_dist) : 1);
+        if (nb[x] < 1)
+            nb[x] = 1;
+        if (nb[x] > 64)
+            nb[x] = 64;
+        reach[x] = (int) ceil(min_dist * nb[x] / width);
+    }
+    nbins = (unsigned int) (nb[0] * nb[1] * nb[2]);
+
+    /* cell list: linked lists of the atoms, wrapped in the cell */
+    head = malloc(nbins * sizeof(unsigned int));
+    next = malloc(in_natoms * sizeof(unsigned int));
+    frac = malloc(in_natoms * sizeof(struct vec3));
+    for (x = 0; x < nbins; x++)
+        head[x] = in_natoms;
+    for (a = 0; a < in_natoms; a++)
+    {
+        frac[a] = _vec3(in_atoms[3*a+0] - floor(in_atoms[3*a+0]),
+                        in_atoms[3*a+1] - floor(in_atoms[3*a+1]),
+                        in_atoms[3*a+2] - floor(in_atoms[3*a+2]));
+        b[0] = (int) (frac[a].x * nb[0]); if (b[0] >= nb[0]) b[0] = nb[0] - 1;
+        b[1] = (int) (frac[a].y * nb[1]); if (b[1] >= nb[1]) b[1] = nb[1] - 1;
+        b[2] = (int) (frac[a].z * nb[2]); if (b[2] >= nb[2]) b[2] = nb[2] - 1;
+        x = (unsigned int) ((b[0] * nb[1] + b[1]) * nb[2] + b[2]);
+        next[a] = head[x];
+        head[x] = a;
+    }
+
+    ngrid = (long) in_grid[0] * in_grid[1] * in_grid[2];
+
+#pragma omp parallel for schedule(static) private(i,j,k,o,b,s,a,x,p,r) reduction(+:count)
+    for (g = 0; g < ngrid; g++)
+    {
+        int bp[3];
+        int excluded = 0;
+
+        p = _vec3((double) (g / ((long) in_grid[1] * in_grid[2])) / in_grid[0],
+                  (double) ((g / in_grid[2]) % in_grid[1]) / in_grid[1],
+                  (double) (g % in_grid[2]) / in_grid[2]);
+        bp[0] = (int) (p.x * nb[0]); if (bp[0] >= nb[0]) bp[0] = nb[0] - 1;
+        bp[1] = (int) (p.y * nb[1]); if (bp[1] >= nb[1]) bp[1] = nb[1] - 1;
+        bp[2] = (int) (p.z * nb[2]); if (bp[2] >= nb[2]) bp[2] = nb[2] - 1;
+
+        for (i = -reach[0]; i <= reach[0] && !excluded; i++)
+        for (j = -reach[1]; j <= reach[1] && !excluded; j++)
+        for (k = -reach[2]; k <= reach[2] && !excluded; k++)
+        {
+            o[0] = i; o[1] = j; o[2] = k;
+            for (x = 0; x < 3; x++)
+            {
+                b[x] = bp[x] + o[x];
+                s[x] = grid_wrap(&b[x], nb[x]);
+            }
+            x = (unsigned int) ((b[0] * nb[1] + b[1]) * nb[2] + b[2]);
+            for (a = head[x]; a < in_natoms; a = next[a])
+            {
+                r = mat3_vmul(_vec3(frac[a].x + s[0] - p.x, frac[a].y + s[1] - p.y,
+                                    frac[a].z + s[2] - p.z), lat);
+                if (vec3_dot(r, r) < dmin2)
+                {
+                    excluded = 1;
+                    break;
+                }
+            }
+        }
+
+        out_mask[g] = (char) !excluded;
+        count += !excluded;
+    }
+
+    free(frac);
+    free(next);
+    free(head);
+    return count;
+}
+
+/**
+ * This function calculates the local fields, as SimpleSum, at many muon
+ * sites of the same cell.
+ *
+ * @param in_positions positions of the magnetic atoms in fractional
+ *         coordinates, 3*in_natoms numbers.
+ * @param in_fc Fourier components (Re x, Im x, Re y, ..., Im z) of each atom.
+ * @param in_K the propagation vector in *reciprocal lattice units*.
+ * @param in_phi the phase for each of the atoms given in in_positions.
+ * @param in_points positions of the muon in fractional coordinates,
+ *         3*in_npoints numbers (usually in the unit cell).
+ * @param in_npoints number of muon positions.
+ * @param in_origin index of the cell of the muon in the phase 2 pi K.R
+ *         (in SimpleSum it is in_supercell/2). NULL for the origin.
+ * @param in_cell lattice cell (a_x, a_y, a_z, b_x, ..., c_z).
+ * @param radius Lorentz radius. No supercell is needed.
+ * @param nnn_for_cont number of nearest neighboring atoms to be included
+ *                      for the evaluation of the contact field.
+ * @param cont_radius only atoms within this radius are eligible to contribute to
+ *                      the contact field.
+ * @param in_natoms: number of atoms in the unit cell.
+ * @param out_field_cont Contact field in Tesla (see SimpleSum), 3*in_npoints.
+ * @param out_field_dip  Dipolar field in Tesla, 3*in_npoints.
+ * @param out_field_lor  Lorentz field in Tesla, 3*in_npoints.
+ * @param out_tensor dipolar tensor of the magnetic atoms (1/Angstrom^3,
+ *         see DipolarTensor), 9*in_npoints, or NULL.
+ */
+void GridScan(const double *in_positions,
+          const double *in_fc, const double *in_K, const double *in_phi,
+          const double *in_points, unsigned int in_npoints,
+          const int *in_origin, const double *in_cell, double radius,
+          const unsigned int nnn_for_cont, const double cont_radius,
+          unsigned int in_natoms,
+          double *out_field_cont, double *out_field_dip, double *out_field_lor,
+          double *out_tensor)
+{
+    int ns[3], origin[3];
+    unsigned int a, x;
+    unsigned long nlist;
+    long pt;
+    struct mat3 lat, inv;
+    struct vec3 center, col[3], r, m;
+    struct vec3 *atmcart = malloc(in_natoms * sizeof(struct vec3));
+    struct vec3 *P = malloc(in_natoms * sizeof(struct vec3));
+    struct vec3 *Q = malloc(in_natoms * sizeof(struct vec3));
+    struct grid_atom *list;
+    struct grid_list built = {NULL, 0, 0};
+    double t, cellradius = 0.0, ptradius = 0.0, ro;
+    struct grid_data d;
+    struct lattice_walk w;
+
+    lat.a.x = in_cell[0]; lat.a.y = in_cell[1]; lat.a.z = in_cell[2];
+    lat.b.x = in_cell[3]; lat.b.y = in_cell[4]; lat.b.z = in_cell[5];
+    lat.c.x = in_cell[6]; lat.c.y = in_cell[7]; lat.c.z = in_cell[8];
+    inv = mat3_inv(lat);
+
+    for (x = 0; x < 3; x++)
+        origin[x] = (in_origin != NULL ? in_origin[x] : 0);
+
+    center = vec3_muls(0.5, vec3_add(vec3_add(lat.a, lat.b), lat.c));
+    for (a = 0; a < in_natoms; a++)
+    {
+        atmcart[a] = mat3_vmul(_vec3(in_positions[3*a], in_positions[3*a+1],
+                                     in_positions[3*a+2]), lat);
+        t = vec3_norm(vec3_sub(atmcart[a], center));
+        if (t > cellradius)
+            cellradius = t;
+
+        /* m(R) = cos(2 pi K.R) P + sin(2 pi K.R) Q */
+        kernel_fc_moment(in_fc + 6*a, in_phi[a], &P[a], &Q[a]);
+    }
+
+    for (pt = 0; pt < (long) in_npoints; pt++)
+    {
+        t = vec3_norm(vec3_sub(mat3_vmul(_vec3(in_points[3*pt], in_points[3*pt+1],
+                                               in_points[3*pt+2]), lat), center));
+        if (t > ptradius)
+            ptradius = t;
+    }
+
+    /* the atoms that can enter the sphere of any of the points */
+    col[0] = _vec3(inv.a.x, inv.b.x, inv.c.x);
+    col[1] = _vec3(inv.a.y, inv.b.y, inv.c.y);
+    col[2] = _vec3(inv.a.z, inv.b.z, inv.c.z);
+    ro = radius + ptradius + cellradius + EPS;
+    for (x = 0; x < 3; x++)
+        ns[x] = (int) ceil(ro * vec3_norm(col[x]));
+
+    d.natoms = in_natoms;
+    d.atmcart = atmcart;
+    d.P = P;
+    d.Q = Q;
+    d.K = in_K;
+    d.origin = origin;
+    d.ns = ns;
+    d.lat = lat;
+    d.center = center;
+    d.reach = radius + ptradius + EPS;
+    d.ro = ro;
+    d.cc = vec3_dot(lat.c, lat.c);
+    d.list = &built;
+
+    w.block = grid_block;
+    w.ctx = &d;
+    for (x = 0; x < 3; x++)
+    {
+        w.lo[x] = -ns[x];
+        w.hi[x] = ns[x] + 1;
+    }
+    w.kblock = 0;
+    w.ntiles = 1;
+    w.nacc = 0;
+    w.tile_acc = 0;
+    LatticeWalk(&w, 0, NULL);
+    list = built.atoms;
+    nlist = built.n;
+
+    qsort(list, nlist, sizeof(struct grid_atom), grid_atom_cmp);
+
+#pragma omp parallel for schedule(dynamic) private(r,m,t,x)
+    for (pt = 0; pt < (long) in_npoints; pt++)
+    {
+        struct vec3 mu, u, BDip, BLor, BCont;
+        double acc[6] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+        double n, dmax;
+        unsigned long e;
+        pile MCont;
+
+        mu = mat3_vmul(_vec3(in_points[3*pt], in_points[3*pt+1], in_points[3*pt+2]), lat);
+        dmax = radius + vec3_norm(vec3_sub(mu, center)) + EPS;
+        BDip = vec3_zero();
+        BLor = vec3_zero();
+        pile_init(&MCont, nnn_for_cont);
+
+        /* the list is sorted: atoms beyond dmax from the center are outside */
+        for (e = 0; e < nlist && list[e].d <= dmax; e++)
+        {
+            r = vec3_sub(list[e].r, mu);
+            n = vec3_norm(r);
+            if (!(n < radius))
+                continue;
+
+            m = list[e].m;
+            if (n < cont_radius)
+                pile_add_element_keyed(&MCont, pow(n,CONT_SCALING_POWER), list[e].key,
+                                       vec3_muls(1./pow(n,CONT_SCALING_POWER), m));
+
+            BLor = vec3_add(BLor, m);
+
+            u = vec3_muls(1./n, r);
+            t = vec3_dot(m, u);
+            BDip = vec3_add(BDip, vec3_muls(1./(n*n*n), vec3_sub(vec3_muls(3.0*t, u), m)));
+
+            if (out_tensor != NULL)
+            {
+                t = 1./(n*n*n);
+                acc[0] += t*(3.0*u.x*u.x - 1.0);
+                acc[1] += t*3.0*u.x*u.y;
+                acc[2] += t*3.0*u.x*u.z;
+                acc[3] += t*(3.0*u.y*u.y - 1.0);
+                acc[4] += t*3.0*u.y*u.z;
+                acc[5] += t*(3.0*u.z*u.z - 1.0);
+            }
+        }
+
+        /* Contact Field */
+        BCont = kernel_contact_field(&MCont);
+        pile_free(&MCont);
+
+        BDip = vec3_muls(0.92740098, BDip);
+        BLor = vec3_muls(0.33333333333*11.654064 * 3./(4.*M_PI*pow(radius,3)), BLor);
+
+        out_field_cont[3*pt+0] = BCont.x;
+        out_field_cont[3*pt+1] = BCont.y;
+        out_field_cont[3*pt+2] = BCont.z;
+
+        out_field_dip[3*pt+0] = BDip.x;
+        out_field_dip[3*pt+1] = BDip.y;
+        out_field_dip[3*pt+2] = BDip.z;
+
+        out_field_lor[3*pt+0] = BLor.x;
+        out_field_lor[3*pt+1] = BLor.y;
+        out_field_lor[3*pt+2] = BLor.z;
+
+        if (out_tensor != NULL)
+        {
+            out_tensor[9*pt+0] = acc[0];
+            out_tensor[9*pt+1] = acc[1];
+            out_tensor[9*pt+2] = acc[2];
+            out_tensor[9*pt+3] = acc[1];
+            out_tensor[9*pt+4] = acc[3];
+            out_tensor[9*pt+5] = acc[4];
+            out_tensor[9*pt+6] = acc[2];
+            out_tensor[9*pt+7] = acc[4];
+            out_tensor[9*pt+8] = acc[5];
+        }
+    }
+
+    free(list);
+    free(Q);
+    free(P);
+    free(atmcart);
+}
@@ -0,0 +1,16 @@
+#ifndef GRID_SCAN_H
+#define GRID_SCAN_H
+
+unsigned int GridMask(const double *in_atoms, unsigned int in_natoms,
+          const double *in_cell, const int *in_grid, double min_dist,
+          char *out_mask);
+
+void GridScan(const double *in_positions,
+          const double *in_fc, const double *in_K, const double *in_phi,
+          const double *in_points, unsigned int in_npoints,
+          const int *in_origin, const double *in_cell, double radius,
+          const unsigned int nnn_for_cont, const double cont_radius,
+          unsigned int in_natoms,
+          double *out_field_cont, double *out_field_dip, double *out_field_lor,
+          double *out_tensor);
+#endif
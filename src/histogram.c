@@ -0,0 +1,186 @@
+/**
+ * @file histogram.c
+ * @author Pietro Bonfa
+ * @date 2016
+ * @brief Histograms of the local fields generated by rotated or
+ *        incommensurate magnetic orders
+ *
+ * The field distribution sampled by RotataSum and FastIncommSum is
+ * accumulated directly in the bins of two histograms: one for the
+ * intensity of the total field, B_dip + B_lor + ACont B_cont, and one for
+ * each of its Cartesian components. Several muon sites can be accumulated
+ * in the same histograms with their weights.
+ *
+ * The bins are uniform: bin i of the intensity histogram collects the
+ * fields with |B| in [i, i+1) * bmax / nbins, bin i of a component
+ * histogram the fields with B_x (B_y, B_z) in
+ * [-bmax + 2 i bmax / nbins, -bmax + 2 (i+1) bmax / nbins).
+ * Fields outside the range are discarded.
+ */
+
+#include <stdlib.h>
+#include <math.h>
+#include "histogram.h"
+#include "rotatesum.h"
+#include "fastincommsum.h"
+
+/**
+ * This function adds a set of fields to the histograms.
+ *
+ * @param in_cont contact fields, in_nfields x 3 (for unit ACont).
+ * @param in_dip dipolar fields, in_nfields x 3.
+ * @param in_lor Lorentz fields, in_nfields x 3.
+ * @param in_nfields number of fields.
+ * @param in_acont contact hyperfine coupling.
+ * @param in_weight weight of each field.
+ * @param in_nbins number of bins.
+ * @param in_bmax upper limit of the histograms, Tesla.
+ * @param out_hist histogram of |B|, in_nbins numbers. Not initialized.
+ * @param out_comp_hist histograms of B_x, B_y and B_z, 3 x in_nbins numbers.
+ *         Not initialized. Can be NULL.
+ */
+void FieldHistogram(const double *in_cont, const double *in_dip,
+          const double *in_lor, unsigned int in_nfields, double in_acont,
+          double in_weight, unsigned int in_nbins, double in_bmax,
+          double *out_hist, double *out_comp_hist)
+{
+    unsigned int i, c;
+    double B[3], b, x;
+
+    if (in_nbins == 0 || !(in_bmax > 0.0))
+        return;
+
+    for (i = 0; i < in_nfields; i++)
+    {
+        for (c = 0; c < 3; c++)
+            B[c] = in_dip[3*i+c] + in_lor[3*i+c] + in_acont * in_cont[3*i+c];
+
+        b = sqrt(B[0]*B[0] + B[1]*B[1] + B[2]*B[2]);
+        x = b / in_bmax * in_nbins;
+        if (x < in_nbins)
+            out_hist[(unsigned int) x] += in_weight;
+
+        if (out_comp_hist == NULL)
+            continue;
+        for (c = 0; c < 3; c++)
+        {
+            x = (B[c] + in_bmax) / (2.0 * in_bmax) * in_nbins;
+            if (x >= 0.0 && x < in_nbins)
+                out_comp_hist[c*in_nbins + (unsigned int) x] += in_weight;
+        }
+    }
+}
+
+/* Allocates the scratch fields of one muon site, returns 0 on failure.
+ * Also used by the polarization of polarization.c. */
+int histogram_alloc(unsigned int in_nangles, double **cont,
+          double **dip, double **lor)
+{
+    *cont = malloc(3 * in_nangles * sizeof(double));
+    *dip = malloc(3 * in_nangles * sizeof(double));
+    *lor = malloc(3 * in_nangles * sizeof(double));
+    return (*cont != NULL && *dip != NULL && *lor != NULL);
+}
+
+/* Weight of muon site s, the site weights are normalized to 1. */
+double histogram_weight(const double *in_siteweights,
+          unsigned int in_nsites, unsigned int s)
+{
+    unsigned int i;
+    double wsum = 0.0;
+
+    if (in_siteweights == NULL)
+        return 1.0 / in_nsites;
+    for (i = 0; i < in_nsites; i++)
+        wsum += in_siteweights[i];
+    return in_siteweights[s] / wsum;
+}
+
+/**
+ * This function accumulates the histograms of the fields obtained by
+ * RotataSum for each muon site.
+ * Each of the in_nangles fields of site s has weight w_s / in_nangles, with
+ * w_s the normalized weight of the site.
+ *
+ * @param in_muonpos positions of the muon sites in fractional coordinates,
+ *         3*in_nsites numbers.
+ * @param in_nsites number of muon sites.
+ * @param in_siteweights weight of each site, NULL for equal weights.
+ * @param in_acont contact hyperfine coupling.
+ * @param in_nbins number of bins.
+ * @param in_bmax upper limit of the histograms, Tesla.
+ * @param out_hist histogram of |B|, in_nbins numbers. Not initialized.
+ * @param out_comp_hist histograms of the components, 3 x in_nbins numbers.
+ *         Not initialized. Can be NULL.
+ *
+ * The other parameters are the same of RotataSum.
+ */
+void RotataHistogram(const double *in_positions,
+          const double *in_fc, const double *in_K, const double *in_phi,
+          const double *in_muonpos, unsigned int in_nsites,
+          const double *in_siteweights, const int * in_supercell,
+          const double *in_cell, const double radius,
+          const unsigned int nnn_for_cont, const double cont_radius,
+          unsigned int in_natoms, const double *in_axis,
+          unsigned int in_nangles, unsigned int in_flags, double in_acont,
+          unsigned int in_nbins, double in_bmax,
+          double *out_hist, double *out_comp_hist)
+{
+    unsigned int s;
+    double *cont, *dip, *lor;
+
+    if (histogram_alloc(in_nangles, &cont, &dip, &lor))
+    {
+        for (s = 0; s < in_nsites; s++)
+        {
+            RotataSumEx(in_positions, in_fc, in_K, in_phi, in_muonpos + 3*s,
+                        in_supercell, in_cell, radius, nnn_for_cont, cont_radius,
+                        in_natoms, in_axis, in_nangles, in_flags, cont, dip, lor);
+            FieldHistogram(cont, dip, lor, in_nangles, in_acont,
+                           histogram_weight(in_siteweights, in_nsites, s) / in_nangles,
+                           in_nbins, in_bmax, out_hist, out_comp_hist);
+        }
+    }
+    free(cont);
+    free(dip);
+    free(lor);
+}
+
+/**
+ * This function accumulates the histograms of the fields obtained by
+ * FastIncommSum for each muon site.
+ * Each of the in_nangles fields of site s has weight w_s / in_nangles, with
+ * w_s the normalized weight of the site.
+ *
+ * The parameters are the same of RotataHistogram and FastIncommSum.
+ */
+void FastIncommHistogram(const double *in_positions,
+          const double *in_fc, const double *in_K, const double *in_phi,
+          const double *in_muonpos, unsigned int in_nsites,
+          const double *in_siteweights, const int * in_supercell,
+          const double *in_cell, const double radius,
+          const unsigned int nnn_for_cont, const double cont_radius,
+          unsigned int in_natoms, unsigned int in_nangles,
+          unsigned int in_flags, double in_acont,
+          unsigned int in_nbins, double in_bmax,
+          double *out_hist, double *out_comp_hist)
+{
+    unsigned int s;
+    double *cont, *dip, *lor;
+
+    if (histogram_alloc(in_nangles, &cont, &dip, &lor))
+    {
+        for (s = 0; s < in_nsites; s++)
+        {
+            FastIncommSumEx(in_positions, in_fc, in_K, in_phi, in_muonpos + 3*s,
+                            in_supercell, in_cell, radius, nnn_for_cont, cont_radius,
+                            in_natoms, in_nangles, in_flags, cont, dip, lor);
+            FieldHistogram(cont, dip, lor, in_nangles, in_acont,
+                           histogram_weight(in_siteweights, in_nsites, s) / in_nangles,
+                           in_nbins, in_bmax, out_hist, out_comp_hist);
+        }
+    }
+    free(cont);
+    free(dip);
+    free(lor);
+}
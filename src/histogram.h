@@ -0,0 +1,26 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+void FieldHistogram(const double *in_cont, const double *in_dip,
+          const double *in_lor, unsigned int in_nfields, double in_acont,
+          double in_weight, unsigned int in_nbins, double in_bmax,
+          double *out_hist, double *out_comp_hist);
+
+void RotataHistogram(const double *, const double *, const double *, const double *,
+          const double *, unsigned int, const double *, const int *, const double *,
+          const double, const unsigned int, const double, unsigned int,
+          const double *, unsigned int, unsigned int, double, unsigned int, double,
+          double *, double *);
+
+void FastIncommHistogram(const double *, const double *, const double *, const double *,
+          const double *, unsigned int, const double *, const int *, const double *,
+          const double, const unsigned int, const double, unsigned int,
+          unsigned int, unsigned int, double, unsigned int, double,
+          double *, double *);
+
+/* per-site scratch fields and site weights, shared with polarization.c */
+int histogram_alloc(unsigned int in_nangles, double **cont, double **dip,
+          double **lor);
+double histogram_weight(const double *in_siteweights, unsigned int in_nsites,
+          unsigned int s);
+#endif
@@ -0,0 +1,353 @@
+/**
+ * @file hybridsum.c
+ * @author Pietro Bonfa
+ * @date 2016
+ * @brief Local fields with an exact near field and a continuum far field
+ *
+ * The dipoles within near_radius from the muon are summed exactly. Beyond
+ * it the moments are replaced by the smooth magnetization density
+ *
+ *    M(r) = Re[ M_K exp(i q.r) ],   q = 2 pi K (folded in the first zone),
+ *
+ * whose dipolar field at the center of a spherical shell is analytic:
+ *
+ *    B = - mu_0 [f(q r_1) - f(q r_2)] (3 q^ q^ - 1) Re[M_K],
+ *    f(x) = j_1(x)/x = (sin x - x cos x) / x^3.
+ *
+ * The shell between near_radius and radius is therefore added at no cost
+ * and the Lorentz field (the mean of M(r) over the sphere) is moved from
+ * near_radius to radius in the same way. For K = 0 the shell does not
+ * contribute and the result is SimpleSum with radius near_radius.
+ * The error is estimated, as in AdaptiveSum, from the change of the
+ * result when near_radius is reduced by LFC_ADAPTIVE_SHELLS shells about
+ * one cell thick.
+ */
+
+#define _USE_MATH_DEFINES
+#include <stdlib.h>
+#include <math.h>
+#include "config.h"
+#include "mat3.h"
+#include "pile.h"
+#include "latticesum.h"
+#include "kernels.h"
+#include "hybridsum.h"
+
+#ifndef M_PI
+#    define M_PI 3.14159265358979323846
+#endif
+
+#define NBINS (LFC_ADAPTIVE_SHELLS + 1)
+
+/* j_1(x)/x, with its series close to x = 0 */
+static double j1_over_x(double x)
+{
+    if (x < 1e-3)
+        return 1.0/3.0 - x*x/30.0;
+    return (sin(x) - x*cos(x)) / (x*x*x);
+}
+
+/* Data of the exact sum of HybridSum. */
+struct hybrid_data {
+    unsigned int natoms;
+    const struct vec3 *atmcart;  /* Cartesian positions in the cell */
+    const struct vec3 *P, *Q;    /* m(R) = cos(2 pi K.R) P + sin(2 pi K.R) Q */
+    const double *K;
+    const int *origin;           /* index of the cell of the muon */
+    const int *ns;               /* bounds of the cell indices, for the keys */
+    const double *rn;            /* radii of the bins */
+    struct mat3 lat;
+    struct vec3 muonpos, center;
+    double near_radius, cont_radius, dr, cc, ro;
+    pile *MCont;
+};
+
+/*
+ * Block of LatticeWalk: adds the atoms within near_radius of the cells
+ * (i, j, klo) ... (i, j, khi-1) to their bins.
+ */
+static void hybrid_block(const void *ctx, int i, int j, int klo, int khi,
+          unsigned int tile, double *acc)
+{
+    const struct hybrid_data *d = (const struct hybrid_data *) ctx;
+    int k, k0, k1;
+    unsigned int a, b;
+    struct vec3 base, p0, r, u, m;
+    double n, c, s, t, lo, hi;
+    unsigned long key;
+
+    (void) tile;
+
+    /* cells k0 <= k <= k1 have centers within ro */
+    p0 = vec3_add(vec3_sub(vec3_add(vec3_muls((double) i, d->lat.a),
+                                    vec3_muls((double) j, d->lat.b)),
+                           d->muonpos),
+                  d->center);
+    if (!lattice_column_span(p0, d->lat.c, d->cc, d->ro, &lo, &hi))
+        return;
+    k0 = (int) ceil(lo);
+    k1 = (int) floor(hi);
+    if (k0 < klo)
+        k0 = klo;
+    if (k1 > khi - 1)
+        k1 = khi - 1;
+
+    for (k = k0; k <= k1; k++)
+    {
+        base = vec3_sub(vec3_add(vec3_add(vec3_muls((double) i, d->lat.a),
+                                          vec3_muls((double) j, d->lat.b)),
+                                 vec3_muls((double) k, d->lat.c)),
+                        d->muonpos);
+
+        t = 2.0*M_PI * (d->K[0]*(i + d->origin[0]) + d->K[1]*(j + d->origin[1]) +
+                        d->K[2]*(k + d->origin[2]));
+        c = cos(t);
+        s = sin(t);
+
+        for (a = 0; a < d->natoms; a++)
+        {
+            r = vec3_add(base, d->atmcart[a]);
+            n = vec3_norm(r);
+            if (!(n < d->near_radius))
+                continue;
+
+            m = vec3_add(vec3_muls(c, d->P[a]), vec3_muls(s, d->Q[a]));
+
+            if (n < d->cont_radius)
+            {
+                key = ((unsigned long) ((i + d->ns[0]) * (2*d->ns[1] + 1) + (j + d->ns[1])) * (2*d->ns[2] + 1)
+                       + (unsigned long) (k + d->ns[2])) * d->natoms + a;
+#pragma omp critical(hybrid_contact)
+                pile_add_element_keyed(d->MCont, pow(n,CONT_SCALING_POWER), key,
+                                       vec3_muls(1./pow(n,CONT_SCALING_POWER), m));
+            }
+
+            if (n < d->rn[NBINS-1])
+                b = NBINS-1;
+            else
+            {
+                b = (unsigned int) ((d->near_radius - n) / d->dr);
+                if (b > NBINS-2)
+                    b = NBINS-2;
+            }
+
+            u = vec3_muls(1./n, r);
+            t = vec3_dot(m, u);
+            acc[6*b+0] += (3.0 * t * u.x - m.x) / (n*n*n);
+            acc[6*b+1] += (3.0 * t * u.y - m.y) / (n*n*n);
+            acc[6*b+2] += (3.0 * t * u.z - m.z) / (n*n*n);
+            acc[6*b+3] += m.x;
+            acc[6*b+4] += m.y;
+            acc[6*b+5] += m.z;
+        }
+    }
+}
+
+/**
+ * This function calculates the local fields at a muon site summing
+ * exactly the dipoles within near_radius and adding the continuum
+ * contribution of the moments between near_radius and radius.
+ * The magnetic order is defined as in SimpleSum and no supercell is needed.
+ *
+ * @param in_positions positions of the magnetic atoms in fractional
+ *         coordinates, 3*in_natoms numbers.
+ * @param in_fc Fourier components (Re x, Im x, Re y, ..., Im z) of each atom.
+ * @param in_K the propagation vector in *reciprocal lattice units*.
+ * @param in_phi the phase for each of the atoms given in in_positions.
+ * @param in_muonpos position of the muon in fractional coordinates
+ * @param in_origin index of the cell of the muon in the phase 2 pi K.R
+ *         (in SimpleSum it is in_supercell/2). NULL for the origin.
+ * @param in_cell lattice cell (a_x, a_y, a_z, b_x, ..., c_z).
+ * @param radius Lorentz radius.
+ * @param near_radius radius of the exact sum. It is reduced to radius
+ *         when larger.
+ * @param nnn_for_cont number of nearest neighboring atoms to be included
+ *                      for the evaluation of the contact field.
+ * @param cont_radius only atoms within this radius (and near_radius) are
+ *                      eligible to contribute to the contact field.
+ * @param in_natoms: number of atoms in the unit cell.
+ * @param out_field_cont Contact field in Tesla (see SimpleSum).
+ * @param out_field_dip  Dipolar field in Tesla, including the continuum
+ *                       contribution of the shell.
+ * @param out_field_lor  Lorentz field in Tesla.
+ * @param out_error the estimated error of B_dip + B_lor (Tesla).
+ */
+void HybridSum(const double *in_positions,
+          const double *in_fc, const double *in_K, const double *in_phi,
+          const double *in_muonpos, const int *in_origin, const double *in_cell,
+          double radius, double near_radius,
+          const unsigned int nnn_for_cont, const double cont_radius,
+          unsigned int in_natoms,
+          double *out_field_cont, double *out_field_dip, double *out_field_lor,
+          double *out_error)
+{
+    int ns[3];
+    unsigned int a, b, x;
+    struct mat3 lat, inv;
+    struct vec3 center, muonpos, col[3];
+    struct vec3 q, qhat, Mc, shell, BDip, BLor, BCont, tot[NBINS];
+    struct vec3 *atmcart = malloc(in_natoms * sizeof(struct vec3));
+    struct vec3 *P = malloc(in_natoms * sizeof(struct vec3));
+    struct vec3 *Q = malloc(in_natoms * sizeof(struct vec3));
+    double acc[6*NBINS], sum[6];
+    double rn[NBINS];
+    double t, kr, cellradius = 0.0, offset, dr, vol, qn, err;
+    pile MCont;
+    int origin[3];
+    struct hybrid_data d;
+    struct lattice_walk w;
+
+    lat.a.x = in_cell[0]; lat.a.y = in_cell[1]; lat.a.z = in_cell[2];
+    lat.b.x = in_cell[3]; lat.b.y = in_cell[4]; lat.b.z = in_cell[5];
+    lat.c.x = in_cell[6]; lat.c.y = in_cell[7]; lat.c.z = in_cell[8];
+    inv = mat3_inv(lat);
+    vol = vec3_dot(lat.a, vec3_cross(lat.b, lat.c));
+
+    if (near_radius > radius)
+        near_radius = radius;
+
+    for (x = 0; x < 3; x++)
+        origin[x] = (in_origin != NULL ? in_origin[x] : 0);
+    muonpos = mat3_vmul(_vec3(in_muonpos[0], in_muonpos[1], in_muonpos[2]), lat);
+
+    /* smoothest modulation: K folded in the first zone, in Cartesian units */
+    q = vec3_zero();
+    q = vec3_add(q, vec3_muls(in_K[0] - floor(in_K[0] + 0.5), vec3_cross(lat.b, lat.c)));
+    q = vec3_add(q, vec3_muls(in_K[1] - floor(in_K[1] + 0.5), vec3_cross(lat.c, lat.a)));
+    q = vec3_add(q, vec3_muls(in_K[2] - floor(in_K[2] + 0.5), vec3_cross(lat.a, lat.b)));
+    q = vec3_muls(2.0*M_PI/vol, q);
+    qn = vec3_norm(q);
+    qhat = (qn > 0.0 ? vec3_muls(1./qn, q) : vec3_zero());
+
+    /* phase of the modulation at the muon, 2 pi K.R of the muon cell */
+    kr = vec3_dot(q, vec3_add(muonpos,
+                              mat3_vmul(_vec3((double) origin[0], (double) origin[1],
+                                              (double) origin[2]), lat)));
+
+    /* Mc = Re[M_K exp(i q.r_mu)], magnetization of the continuum at the muon */
+    Mc = vec3_zero();
+    center = vec3_muls(0.5, vec3_add(vec3_add(lat.a, lat.b), lat.c));
+    for (a = 0; a < in_natoms; a++)
+    {
+        atmcart[a] = mat3_vmul(_vec3(in_positions[3*a], in_positions[3*a+1],
+                                     in_positions[3*a+2]), lat);
+        t = vec3_norm(vec3_sub(atmcart[a], center));
+        if (t > cellradius)
+            cellradius = t;
+
+        /* m(R) = cos(2 pi K.R) P + sin(2 pi K.R) Q */
+        kernel_fc_moment(in_fc + 6*a, in_phi[a], &P[a], &Q[a]);
+
+        t = kr - vec3_dot(q, atmcart[a]);
+        Mc = vec3_add(Mc, vec3_add(vec3_muls(cos(t), P[a]), vec3_muls(sin(t), Q[a])));
+    }
+    Mc = vec3_muls(1./fabs(vol), Mc);
+
+    /* the exact sums for the radii rn[b] = near_radius - b dr are
+     * accumulated in bins: bin b < NBINS-1 holds rn[b+1] <= r < rn[b] and
+     * the last one r < rn[NBINS-1]. */
+    dr = pow(fabs(vol), 1.0/3.0);
+    for (b = 0; b < NBINS; b++)
+        rn[b] = near_radius - b*dr;
+
+    col[0] = _vec3(inv.a.x, inv.b.x, inv.c.x);
+    col[1] = _vec3(inv.a.y, inv.b.y, inv.c.y);
+    col[2] = _vec3(inv.a.z, inv.b.z, inv.c.z);
+    offset = cellradius + vec3_norm(vec3_sub(muonpos, center)) + EPS;
+    for (x = 0; x < 3; x++)
+        ns[x] = (int) ceil((near_radius + offset) * vec3_norm(col[x]));
+
+    pile_init(&MCont, nnn_for_cont);
+    for (x = 0; x < 6*NBINS; x++)
+        acc[x] = 0.0;
+
+    d.natoms = in_natoms;
+    d.atmcart = atmcart;
+    d.P = P;
+    d.Q = Q;
+    d.K = in_K;
+    d.origin = origin;
+    d.ns = ns;
+    d.rn = rn;
+    d.lat = lat;
+    d.muonpos = muonpos;
+    d.center = center;
+    d.near_radius = near_radius;
+    d.cont_radius = cont_radius;
+    d.dr = dr;
+    d.cc = vec3_dot(lat.c, lat.c);
+    d.ro = near_radius + cellradius + EPS;
+    d.MCont = &MCont;
+
+    w.block = hybrid_block;
+    w.ctx = &d;
+    for (x = 0; x < 3; x++)
+    {
+        w.lo[x] = -ns[x];
+        w.hi[x] = ns[x] + 1;
+    }
+    w.kblock = 0;
+    w.ntiles = 1;
+    w.nacc = 6*NBINS;
+    w.tile_acc = 0;
+    LatticeWalk(&w, 0, acc);
+
+    /* B_dip + B_lor with the exact sum up to rn[b], from the inner bins */
+    for (x = 0; x < 6; x++)
+        sum[x] = 0.0;
+    BDip = vec3_zero();
+    BLor = vec3_zero();
+    for (b = NBINS; b-- > 0; )
+    {
+        for (x = 0; x < 6; x++)
+            sum[x] += acc[6*b+x];
+        if (!(rn[b] > 0.0))
+            continue;
+
+        /* continuum field of the shell rn[b] < r < radius */
+        t = j1_over_x(qn*rn[b]) - j1_over_x(qn*radius);
+        shell = vec3_muls(-11.654064 * t,
+                          vec3_sub(vec3_muls(3.0*vec3_dot(qhat, Mc), qhat), Mc));
+        if (!(qn > 0.0))
+            shell = vec3_zero();
+
+        BDip = vec3_add(vec3_muls(0.92740098, _vec3(sum[0], sum[1], sum[2])), shell);
+        /* Lorentz field of the moments within rn[b], moved to radius */
+        BLor = vec3_add(vec3_muls(0.33333333333*11.654064 * 3./(4.*M_PI*pow(rn[b],3)),
+                                  _vec3(sum[3], sum[4], sum[5])),
+                        vec3_muls(11.654064 * (j1_over_x(qn*radius) - j1_over_x(qn*rn[b])), Mc));
+        tot[b] = vec3_add(BDip, BLor);
+    }
+
+    err = 0.0;
+    for (b = 0; b + 1 < NBINS; b++)
+    {
+        if (!(rn[b+1] > 0.0))
+            break;
+        t = vec3_norm(vec3_sub(tot[b], tot[b+1]));
+        if (t > err)
+            err = t;
+    }
+
+    /* Contact Field */
+    BCont = kernel_contact_field(&MCont);
+    pile_free(&MCont);
+
+    out_field_cont[0] = BCont.x;
+    out_field_cont[1] = BCont.y;
+    out_field_cont[2] = BCont.z;
+
+    out_field_dip[0] = BDip.x;
+    out_field_dip[1] = BDip.y;
+    out_field_dip[2] = BDip.z;
+
+    out_field_lor[0] = BLor.x;
+    out_field_lor[1] = BLor.y;
+    out_field_lor[2] = BLor.z;
+
+    *out_error = err;
+
+    free(Q);
+    free(P);
+    free(atmcart);
+}
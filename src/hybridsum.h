@@ -0,0 +1,12 @@
+#ifndef HYBRID_SUM_H
+#define HYBRID_SUM_H
+
+void HybridSum(const double *in_positions,
+          const double *in_fc, const double *in_K, const double *in_phi,
+          const double *in_muonpos, const int *in_origin, const double *in_cell,
+          double radius, double near_radius,
+          const unsigned int nnn_for_cont, const double cont_radius,
+          unsigned int in_natoms,
+          double *out_field_cont, double *out_field_dip, double *out_field_lor,
+          double *out_error);
+#endif
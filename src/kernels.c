@@ -0,0 +1,124 @@
+/**
+ * @file kernels.c
+ * @author Pietro Bonfa
+ * @date 2016
+ * @brief Per-pair kernels of LatticeSum
+ *
+ * Each kernel adds the contribution of a single atom at position r from
+ * the muon to its accumulators. Unit conversions are left to the callers.
+ */
+
+#include <math.h>
+#include "config.h"
+#include "kernels.h"
+
+#ifndef M_PI
+#    define M_PI 3.14159265358979323846
+#endif
+
+static struct vec3 kernel_moment(const struct vec3 *P, const struct vec3 *Q,
+          const struct lattice_site *site)
+{
+    return vec3_add(vec3_muls(site->c, P[site->atom]), vec3_muls(site->s, Q[site->atom]));
+}
+
+void kernel_fc_moment(const double *fc, double phi, struct vec3 *P, struct vec3 *Q)
+{
+    struct vec3 sk, isk;
+    double c = cos(2.0*M_PI*phi);
+    double s = sin(2.0*M_PI*phi);
+
+#ifdef _ALTERNATE_FC_INPUT
+     sk = _vec3(fc[0], fc[1], fc[2]);
+    isk = _vec3(fc[3], fc[4], fc[5]);
+#else
+     sk = _vec3(fc[0], fc[2], fc[4]);
+    isk = _vec3(fc[1], fc[3], fc[5]);
+#endif
+    *P = vec3_add(vec3_muls(c, sk), vec3_muls(s, isk));
+    *Q = vec3_sub(vec3_muls(c, isk), vec3_muls(s, sk));
+}
+
+void kernel_dipole_field(const void *ctx, const struct lattice_site *site, double *acc)
+{
+    const struct kernel_moments *d = (const struct kernel_moments *) ctx;
+    struct vec3 m = kernel_moment(d->P, d->Q, site);
+    struct vec3 u = vec3_muls(1.0/site->n, site->r);
+    double onebrcube = 1.0/(site->n*site->n*site->n);
+    double t = 3.0*vec3_dot(m, u);
+
+    acc[0] += onebrcube * (t*u.x - m.x);
+    acc[1] += onebrcube * (t*u.y - m.y);
+    acc[2] += onebrcube * (t*u.z - m.z);
+    acc[3] += m.x;
+    acc[4] += m.y;
+    acc[5] += m.z;
+}
+
+void kernel_dipole_tensor(const void *ctx, const struct lattice_site *site, double *acc)
+{
+    struct vec3 r = site->r;
+    double n2 = site->n*site->n;
+    double onebrcube = 1.0/(n2*site->n);
+    double onebrfive = 3.0*onebrcube/n2;
+
+    (void) ctx;
+    acc[0] += -onebrcube + r.x*r.x*onebrfive;
+    acc[1] += r.x*r.y*onebrfive;
+    acc[2] += r.x*r.z*onebrfive;
+    acc[3] += -onebrcube + r.y*r.y*onebrfive;
+    acc[4] += r.y*r.z*onebrfive;
+    acc[5] += -onebrcube + r.z*r.z*onebrfive;
+}
+
+void kernel_contact(const void *ctx, const struct lattice_site *site, double *acc)
+{
+    const struct kernel_contact *d = (const struct kernel_contact *) ctx;
+    struct vec3 m = kernel_moment(d->P, d->Q, site);
+    double w = pow(site->n, CONT_SCALING_POWER);
+
+    (void) acc;
+#pragma omp critical(kernel_contact)
+    pile_add_element_keyed(d->MCont, w, site->key, vec3_muls(1./w, m));
+}
+
+struct vec3 kernel_contact_field(const pile *MCont)
+{
+    struct vec3 BCont = vec3_zero();
+    double SumOfWeights = 0.0;
+    unsigned int a;
+
+    /* weighted average of the moments, see simplesum.c for the units */
+    for (a = 0; a < MCont->nElements; a++) {
+        if (MCont->ranks[a] > 0.0) {
+            BCont = vec3_add(BCont, MCont->elements[a]);
+            SumOfWeights += (1./MCont->ranks[a]);
+        }
+    }
+    if (SumOfWeights > 0.0)
+        BCont = vec3_muls((1./SumOfWeights) * 7.769376 , BCont);
+    return BCont;
+}
+
+void kernel_charge_potential(const void *ctx, const struct lattice_site *site, double *acc)
+{
+    const double *q = (const double *) ctx;
+
+    acc[0] += q[site->atom] / site->n;
+}
+
+void kernel_efg(const void *ctx, const struct lattice_site *site, double *acc)
+{
+    const double *q = (const double *) ctx;
+    struct vec3 r = site->r;
+    double n2 = site->n*site->n;
+    double qbrcube = q[site->atom]/(n2*site->n);
+    double qbrfive = 3.0*qbrcube/n2;
+
+    acc[0] += -qbrcube + r.x*r.x*qbrfive;
+    acc[1] += r.x*r.y*qbrfive;
+    acc[2] += r.x*r.z*qbrfive;
+    acc[3] += -qbrcube + r.y*r.y*qbrfive;
+    acc[4] += r.y*r.z*qbrfive;
+    acc[5] += -qbrcube + r.z*r.z*qbrfive;
+}
@@ -0,0 +1,43 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+#include "vec3.h"
+#include "pile.h"
+#include "latticesum.h"
+
+/* Moments of the atoms, m(R) = cos(2 pi K.R) P + sin(2 pi K.R) Q. */
+struct kernel_moments {
+    const struct vec3 *P;
+    const struct vec3 *Q;
+};
+
+/* P and Q of an atom from its 6 Fourier components fc (Re x, Im x, Re y, ...,
+ * or Re x, Re y, Re z, Im x, ... with _ALTERNATE_FC_INPUT) and its phase phi
+ * (in units of 2 pi), see simplesum.c */
+void kernel_fc_moment(const double *fc, double phi, struct vec3 *P, struct vec3 *Q);
+
+/* Moments and pile of the contact field. */
+struct kernel_contact {
+    const struct vec3 *P;
+    const struct vec3 *Q;
+    pile *MCont;
+};
+
+/* dipolar field (3, mu_B/Angstrom^3) and sum of the moments (3) */
+void kernel_dipole_field(const void *ctx, const struct lattice_site *site, double *acc);
+
+/* dipolar tensor xx, xy, xz, yy, yz, zz (1/Angstrom^3), ctx is unused */
+void kernel_dipole_tensor(const void *ctx, const struct lattice_site *site, double *acc);
+
+/* nearest moments for the contact field, no accumulators */
+void kernel_contact(const void *ctx, const struct lattice_site *site, double *acc);
+
+/* contact field (Tesla) of the moments collected by kernel_contact */
+struct vec3 kernel_contact_field(const pile *MCont);
+
+/* electrostatic potential of point charges (1, e/Angstrom), ctx holds the charges */
+void kernel_charge_potential(const void *ctx, const struct lattice_site *site, double *acc);
+
+/* electric field gradient of point charges, xx, xy, xz, yy, yz, zz
+ * (e/Angstrom^3), ctx holds the charges */
+void kernel_efg(const void *ctx, const struct lattice_site *site, double *acc);
+#endif
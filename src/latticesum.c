@@ -0,0 +1,302 @@
+/**
+ * @file latticesum.c
+ * @author Pietro Bonfa
+ * @date 2016
+ * @brief Supercell traversal shared by the lattice sums
+ *
+ * LatticeWalk schedules the blocks of cells and the tiles of atoms of a
+ * lattice sum among the threads and reduces their accumulators, either
+ * per thread or, with LFC_REPRODUCIBLE, in a fixed order. What is summed
+ * in a block is left to a callback, so that each sum keeps its own inner
+ * loop (unrolled kernels, site symmetry, shells of the sphere...).
+ *
+ * LatticeSum is the simplest client: it takes care of what most lattice
+ * sums repeat, the conversion of the cell and of the positions, centering
+ * of the muon in the cell supercell/2, the cells that can reach the
+ * Lorentz sphere and the phases 2 pi K.R of the cells, and hands each atom
+ * in the sphere to a list of per-pair kernels (see kernels.h).
+ */
+
+#define _USE_MATH_DEFINES
+#include <stdlib.h>
+#include <math.h>
+#include "config.h"
+#include "mat3.h"
+#include "latticesum.h"
+#include "reduce.h"
+
+#ifndef M_PI
+#    define M_PI 3.14159265358979323846
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/**
+ * This function calls in_walk->block for all the blocks of cells and
+ * tiles of atoms of in_walk and adds their accumulators to out_acc.
+ *
+ * By default each thread sums the blocks it gets (blocks of
+ * in_walk->kblock cells along c, dynamically scheduled) in its own
+ * accumulators, which are then added to out_acc.
+ * With LFC_REPRODUCIBLE each tile of a group of columns (see
+ * pairwise_groups) is summed by a single thread, whole columns at a time,
+ * and the partial results are added with pairwise_sum, so that out_acc
+ * does not depend on the number of threads. When in_walk->tile_acc is set
+ * the tiles of a group share its partial result, since they update
+ * different accumulators.
+ *
+ * @param in_walk the cells, the tiles, the callback and its accumulators.
+ * @param in_flags: bitwise or of the LFC_* flags defined in config.h.
+ * @param out_acc in_walk->nacc accumulators. They are not initialized.
+ */
+void LatticeWalk(const struct lattice_walk *in_walk, unsigned int in_flags,
+          double *out_acc)
+{
+    const struct lattice_walk *w = in_walk;
+    unsigned long ni, nj, nk, ncol, nkb, kblock, nslots, ngroups;
+    unsigned long task, col, g, kb, x;
+    unsigned long nacc = w->nacc > 0 ? w->nacc : 1;
+    unsigned int t;
+    double *tacc, *partials;
+
+    if (w->hi[0] <= w->lo[0] || w->hi[1] <= w->lo[1] ||
+        w->hi[2] <= w->lo[2] || w->ntiles == 0)
+        return;
+
+    ni = (unsigned long) (w->hi[0] - w->lo[0]);
+    nj = (unsigned long) (w->hi[1] - w->lo[1]);
+    nk = (unsigned long) (w->hi[2] - w->lo[2]);
+    ncol = ni * nj;
+    kblock = (w->kblock > 0 && w->kblock < nk) ? w->kblock : nk;
+    nkb = (nk + kblock - 1) / kblock;
+
+    if (in_flags & LFC_REPRODUCIBLE)
+    {
+        nslots = w->tile_acc ? 1 : w->ntiles; /* partial results per group */
+        ngroups = pairwise_groups(ncol, nacc * nslots);
+        partials = calloc(ngroups * nslots * nacc, sizeof(double));
+
+#pragma omp parallel for schedule(dynamic) private(task,g,t,col)
+        for (task = 0; task < ngroups * w->ntiles; ++task)
+        {
+            g = task / w->ntiles;
+            t = (unsigned int) (task % w->ntiles);
+            for (col = g * ncol / ngroups; col < (g+1) * ncol / ngroups; ++col)
+                w->block(w->ctx, w->lo[0] + (int) (col / nj), w->lo[1] + (int) (col % nj),
+                         w->lo[2], w->hi[2], t,
+                         partials + (g * nslots + (w->tile_acc ? 0 : t)) * nacc);
+        }
+
+        tacc = malloc(nacc * sizeof(double));
+        pairwise_sum(partials, ngroups * nslots, (unsigned int) nacc, tacc);
+        for (x = 0; x < w->nacc; x++)
+            out_acc[x] += tacc[x];
+        free(tacc);
+        free(partials);
+        return;
+    }
+
+#pragma omp parallel private(task,col,kb,t,x,tacc)
+    {
+        tacc = calloc(nacc, sizeof(double));
+
+        /* the atoms of tile t are reused for all the cells of a block */
+#pragma omp for schedule(dynamic)
+        for (task = 0; task < ncol * nkb * w->ntiles; ++task)
+        {
+            t = (unsigned int) (task % w->ntiles);
+            kb = (task / w->ntiles) % nkb;
+            col = task / (w->ntiles * nkb);
+            w->block(w->ctx, w->lo[0] + (int) (col / nj), w->lo[1] + (int) (col % nj),
+                     w->lo[2] + (int) (kb * kblock),
+                     (kb+1) * kblock < nk ? w->lo[2] + (int) ((kb+1) * kblock) : w->hi[2],
+                     t, tacc);
+        }
+
+#pragma omp critical(lattice_walk)
+        for (x = 0; x < w->nacc; x++)
+            out_acc[x] += tacc[x];
+
+        free(tacc);
+    }
+}
+
+int lattice_column_span(struct vec3 p0, struct vec3 c, double cc, double r,
+          double *lo, double *hi)
+{
+    double kc = -vec3_dot(p0, c) / cc;
+    double so = kc*kc - (vec3_dot(p0, p0) - r*r) / cc;
+
+    if (so < 0.0)
+        return 0;
+    so = sqrt(so);
+    *lo = kc - so;
+    *hi = kc + so;
+    return 1;
+}
+
+/* Data of a LatticeSum traversal. */
+struct lattice_data {
+    struct mat3 lat;
+    struct vec3 muonpos;
+    struct vec3 center;         /* center of the cell */
+    double cellradius;          /* largest distance of an atom from center */
+    double radius;
+    double K[3];
+    int scy, scz;
+    unsigned int natoms;
+    const struct vec3 *atmcart;
+    const struct lattice_kernel *kernels;
+    unsigned int nkernels;
+    const unsigned int *offset; /* of the accumulators of each kernel */
+};
+
+/* Block of LatticeSum: evaluates the kernels for the atoms of the cells
+ * (i,j,k0) ... (i,j,k1-1). The atoms are not tiled. */
+static void lattice_block_kernels(const void *ctx, int i, int j, int k0, int k1,
+          unsigned int tile, double *acc)
+{
+    const struct lattice_data *d = (const struct lattice_data *) ctx;
+    int k;
+    unsigned int a, x;
+    double t;
+    struct vec3 base;
+    struct lattice_site site;
+
+    (void) tile;
+    for (k = k0; k < k1; k++)
+    {
+        /* origin of the cell with respect to the muon */
+        base = vec3_sub(vec3_add(vec3_add(vec3_muls((double) i, d->lat.a),
+                                          vec3_muls((double) j, d->lat.b)),
+                                 vec3_muls((double) k, d->lat.c)),
+                        d->muonpos);
+        if (vec3_norm(vec3_add(base, d->center)) > d->radius + d->cellradius + EPS)
+            continue;
+
+        t = 2.0*M_PI * (d->K[0]*i + d->K[1]*j + d->K[2]*k);
+        site.c = cos(t);
+        site.s = sin(t);
+
+        for (a = 0; a < d->natoms; a++)
+        {
+            site.r = vec3_add(base, d->atmcart[a]);
+            site.n = vec3_norm(site.r);
+            if (!(site.n < d->radius))
+                continue;
+            site.atom = a;
+            site.key = (((unsigned long) i * d->scy + j) * d->scz + k) * d->natoms + a;
+
+            for (x = 0; x < d->nkernels; x++)
+                if (site.n < d->kernels[x].cutoff)
+                    d->kernels[x].term(d->kernels[x].ctx, &site,
+                                       acc + d->offset[x]);
+        }
+    }
+}
+
+/**
+ * This function evaluates the kernels for all the atoms of the supercell
+ * within radius from the muon.
+ *
+ * @param in_positions positions of the atoms in fractional coordinates,
+ *         3*in_natoms numbers.
+ * @param in_natoms number of atoms in the unit cell.
+ * @param in_K the propagation vector in *reciprocal lattice units*, used
+ *         for the phases passed to the kernels. NULL for K = 0.
+ * @param in_muonpos position of the muon in fractional coordinates. The
+ *         muon is placed in the cell in_supercell/2, as in SimpleSum.
+ * @param in_supercell extension of the supercell along the lattice vectors.
+ * @param in_cell lattice cell (a_x, a_y, a_z, b_x, ..., c_z).
+ * @param radius Lorentz sphere radius.
+ * @param in_kernels the kernels.
+ * @param in_nkernels number of kernels.
+ * @param in_flags: bitwise or of the LFC_* flags defined in config.h.
+ *         With LFC_REPRODUCIBLE the accumulators do not depend on the
+ *         number of threads (see LatticeWalk).
+ * @param out_acc the accumulators of the kernels, one after the other.
+ *         They are not initialized by LatticeSum.
+ */
+void LatticeSum(const double *in_positions, unsigned int in_natoms,
+          const double *in_K, const double *in_muonpos,
+          const int *in_supercell, const double *in_cell, double radius,
+          const struct lattice_kernel *in_kernels, unsigned int in_nkernels,
+          unsigned int in_flags, double *out_acc)
+{
+    int scx, scy, scz;
+    unsigned int a, x, nacc = 0;
+    struct mat3 lat;
+    struct vec3 muonpos, center;
+    struct vec3 *atmcart = malloc(in_natoms * sizeof(struct vec3));
+    unsigned int *offset = malloc(in_nkernels * sizeof(unsigned int));
+    double cellradius = 0.0, t;
+    struct lattice_data d;
+    struct lattice_walk w;
+
+    scx = in_supercell[0];
+    scy = in_supercell[1];
+    scz = in_supercell[2];
+
+    lat.a.x = in_cell[0]; lat.a.y = in_cell[1]; lat.a.z = in_cell[2];
+    lat.b.x = in_cell[3]; lat.b.y = in_cell[4]; lat.b.z = in_cell[5];
+    lat.c.x = in_cell[6]; lat.c.y = in_cell[7]; lat.c.z = in_cell[8];
+
+    for (x = 0; x < 3; x++)
+        d.K[x] = in_K != NULL ? in_K[x] : 0.0;
+
+    for (x = 0; x < in_nkernels; x++)
+    {
+        offset[x] = nacc;
+        nacc += in_kernels[x].nacc;
+    }
+
+    /* muon in the cell supercell/2 (in Angstrom!), computed as in
+     * SimpleSum so that the distances, and the ties of the contact pile,
+     * are the same to the last bit */
+    muonpos = _vec3((in_muonpos[0] + (scx/2)) / (double) scx,
+                    (in_muonpos[1] + (scy/2)) / (double) scy,
+                    (in_muonpos[2] + (scz/2)) / (double) scz);
+    muonpos = mat3_vmul(muonpos, mat3_mul(mat3_diag((double) scx, (double) scy,
+                                                    (double) scz), lat));
+
+    /* cells farther than radius + cellradius from the muon are skipped */
+    center = vec3_muls(0.5, vec3_add(vec3_add(lat.a, lat.b), lat.c));
+    for (a = 0; a < in_natoms; a++)
+    {
+        atmcart[a] = mat3_vmul(_vec3(in_positions[3*a], in_positions[3*a+1],
+                                     in_positions[3*a+2]), lat);
+        t = vec3_norm(vec3_sub(atmcart[a], center));
+        if (t > cellradius)
+            cellradius = t;
+    }
+
+    d.lat = lat;
+    d.muonpos = muonpos;
+    d.center = center;
+    d.cellradius = cellradius;
+    d.radius = radius;
+    d.scy = scy;
+    d.scz = scz;
+    d.natoms = in_natoms;
+    d.atmcart = atmcart;
+    d.kernels = in_kernels;
+    d.nkernels = in_nkernels;
+    d.offset = offset;
+
+    w.block = lattice_block_kernels;
+    w.ctx = &d;
+    w.lo[0] = w.lo[1] = w.lo[2] = 0;
+    w.hi[0] = scx;
+    w.hi[1] = scy;
+    w.hi[2] = scz;
+    w.kblock = 0;
+    w.ntiles = 1;
+    w.nacc = nacc;
+    w.tile_acc = 0;
+    LatticeWalk(&w, in_flags, out_acc);
+
+    free(offset);
+    free(atmcart);
+}
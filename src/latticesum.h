@@ -0,0 +1,61 @@
+#ifndef LATTICE_SUM_H
+#define LATTICE_SUM_H
+#include "vec3.h"
+
+/* Adds the contributions of the atoms of tile `tile` in the cells
+ * (i,j,k0) ... (i,j,k1-1) to the accumulators in acc. */
+typedef void (*lattice_block)(const void *ctx, int i, int j, int k0, int k1,
+          unsigned int tile, double *acc);
+
+/* A traversal of the cells lo[x] <= n_x < hi[x], column by column along
+ * the third lattice vector. The blocks skip the cells and the tiles that
+ * cannot reach the sphere (and update shared state, e.g. the contact
+ * pile, in an omp critical section). */
+struct lattice_walk {
+    lattice_block block;
+    const void *ctx;
+    int lo[3], hi[3];
+    unsigned int kblock;   /* cells of a block, 0 for whole columns */
+    unsigned int ntiles;   /* tiles of atoms, 1 if the atoms are not tiled */
+    unsigned long nacc;
+    int tile_acc;          /* non zero if the tiles update disjoint accumulators */
+};
+
+void LatticeWalk(const struct lattice_walk *in_walk, unsigned int in_flags,
+          double *out_acc);
+
+/* The points p0 + k c (cc = c.c) within r of the origin are those with
+ * lo <= k <= hi. Returns 0 if there are none. Used by the blocks to clip
+ * their columns. */
+int lattice_column_span(struct vec3 p0, struct vec3 c, double cc, double r,
+          double *lo, double *hi);
+
+/* An atom of the supercell, as seen by the kernels. */
+struct lattice_site {
+    struct vec3 r;       /* position with respect to the muon (Angstrom) */
+    double n;            /* |r| */
+    unsigned int atom;   /* index of the atom in the unit cell */
+    double c, s;         /* cos(2 pi K.R) and sin(2 pi K.R) of its cell */
+    unsigned long key;   /* unique index of the atom in the supercell */
+};
+
+/* Adds the contribution of one atom to the nacc accumulators in acc. */
+typedef void (*lattice_term)(const void *ctx, const struct lattice_site *site,
+          double *acc);
+
+/* A per-pair interaction. term is only called for the atoms closer than
+ * cutoff (and radius) to the muon. Kernels updating shared state (e.g. the
+ * contact pile) must protect it with an omp critical section. */
+struct lattice_kernel {
+    lattice_term term;
+    const void *ctx;
+    unsigned int nacc;
+    double cutoff;
+};
+
+void LatticeSum(const double *in_positions, unsigned int in_natoms,
+          const double *in_K, const double *in_muonpos,
+          const int *in_supercell, const double *in_cell, double radius,
+          const struct lattice_kernel *in_kernels, unsigned int in_nkernels,
+          unsigned int in_flags, double *out_acc);
+#endif
@@ -0,0 +1,621 @@
+/**
+ * @file lfc-run.c
+ * @author Pietro Bonfa
+ * @date 2016
+ * @brief Batch driver: local fields of structure files
+ *
+ * lfc-run evaluates the contact, dipolar and Lorentz fields (and
+ * optionally the dipolar tensor) at the muon sites of binary structure
+ * files (see lfcfile.h) or of all the .lfc files of directories.
+ * Each file is mapped in memory and its arrays are passed to FusedSum
+ * without copies. Several files are processed in parallel, one per
+ * thread, while a single file uses the threads of the lattice sum.
+ * The results of file.lfc are written to file.txt or, as NumPy arrays, to
+ * file.npy or file.npz (see npyfile.h). The arrays are streamed to disk
+ * in chunks of muon sites, so that their size is not bounded by the
+ * memory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <math.h>
+#include "config.h"
+#include "fusedsum.h"
+#include "fastincommsum.h"
+#include "lfcfile.h"
+#include "npyfile.h"
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+/* Muon sites buffered before the arrays are written. */
+#define LFC_RUN_CHUNK 256
+
+enum run_format { FORMAT_TXT, FORMAT_NPY, FORMAT_NPZ };
+
+/* Parameters of the run, shared by all the files. */
+struct run_options {
+    double radius;
+    int supercell[3];         /* all zero: smallest supercell containing the sphere */
+    unsigned int nnn;
+    double cont_radius;
+    int tensor;
+    unsigned int nangles;     /* 0: commensurate sum, no angle dimension */
+    enum run_format format;
+    const char *outdir;
+};
+
+/* Output files of a structure file. */
+struct run_output {
+    enum run_format format;
+    FILE *txt;
+    npy_writer npy, npy_tensor;
+    npz_writer npz;
+};
+
+static void usage(FILE *f)
+{
+    fprintf(f,
+        "Usage: lfc-run [options] FILE|DIRECTORY...\n"
+        "Local fields at the muon sites of muLFC structure files (.lfc).\n"
+        "\n"
+        "  -r RADIUS    Lorentz sphere radius, Angstrom (default 100)\n"
+        "  -s A,B,C     supercell (default: the smallest containing the sphere)\n"
+        "  -n NNN       atoms contributing to the contact field (default 2)\n"
+        "  -c RCONT     radius for the contact field, Angstrom (default 10)\n"
+        "  -t           also write the dipolar tensors\n"
+        "  -a NANGLES   helical order: fields at NANGLES phases\n"
+        "  -f FORMAT    txt, npy or npz (default txt)\n"
+        "  -o DIR       output directory (default: next to each input)\n"
+        "  -h           show this message\n"
+        "\n"
+        "The results of name.lfc are written to name.txt, one line per muon\n"
+        "site: position, contact (for ACont = 1), dipolar and Lorentz fields\n"
+        "in Tesla and, with -t, the dipolar tensor in 1/Angstrom^3. With -a\n"
+        "there is one line per muon site and phase.\n"
+        "With -f npy, name.npy holds the fields with shape (nmu, 3, [NANGLES,] 3),\n"
+        "contact, dipolar and Lorentz, and name_tensor.npy the tensors with\n"
+        "shape (nmu, 3, 3). With -f npz, name.npz holds the arrays muons,\n"
+        "contact, dipolar, lorentz and tensor.\n");
+}
+
+/*
+ * Smallest supercell that contains the sphere around a muon in the unit
+ * cell placed in cell sc/2: radius/d + 1 cells on each side, with d the
+ * distance between the lattice planes.
+ */
+static void sphere_supercell(const double *cell, double radius, int *sc)
+{
+    const double *a = cell, *b = cell + 3, *c = cell + 6;
+    double n[3][3]; /* normals to the lattice planes: b x c, c x a, a x b */
+    double vol, d;
+    unsigned int i;
+
+    n[0][0] = b[1]*c[2] - b[2]*c[1]; n[0][1] = b[2]*c[0] - b[0]*c[2]; n[0][2] = b[0]*c[1] - b[1]*c[0];
+    n[1][0] = c[1]*a[2] - c[2]*a[1]; n[1][1] = c[2]*a[0] - c[0]*a[2]; n[1][2] = c[0]*a[1] - c[1]*a[0];
+    n[2][0] = a[1]*b[2] - a[2]*b[1]; n[2][1] = a[2]*b[0] - a[0]*b[2]; n[2][2] = a[0]*b[1] - a[1]*b[0];
+    vol = fabs(a[0]*n[0][0] + a[1]*n[0][1] + a[2]*n[0][2]);
+
+    for (i = 0; i < 3; i++)
+    {
+        d = vol / sqrt(n[i][0]*n[i][0] + n[i][1]*n[i][1] + n[i][2]*n[i][2]);
+        sc[i] = 2 * (int) ceil(radius / d) + 3;
+    }
+}
+
+/* Output name: outdir/stem.txt or path with .txt in place of the extension. */
+static char * output_name(const char *path, const char *outdir, const char *ext)
+{
+    const char *base = strrchr(path, '/');
+    const char *dot;
+    char *out;
+    size_t len;
+
+    base = (base ? base + 1 : path);
+    dot = strrchr(base, '.');
+    len = (dot ? (size_t) (dot - base) : strlen(base));
+
+    out = malloc((outdir ? strlen(outdir) : (size_t) (base - path)) + len + strlen(ext) + 2);
+    if (outdir)
+        sprintf(out, "%s/%.*s%s", outdir, (int) len, base, ext);
+    else
+        sprintf(out, "%.*s%s", (int) ((base - path) + len), path, ext);
+    return out;
+}
+
+/* Doubles per muon site of each field: one vector per phase. */
+static size_t field_stride(const struct run_options *o)
+{
+    return 3 * (size_t) (o->nangles > 0 ? o->nangles : 1);
+}
+
+/* Opens the output of the structure file path. Returns 0 on success. */
+static int output_open(struct run_output *out, const char *path, const struct run_options *o,
+          const lfc_structure *s, const int *sc)
+{
+    static const char * const names[5] = {"muons", "contact", "dipolar", "lorentz", "tensor"};
+    unsigned long shapes[5*4], *shape = shapes;
+    unsigned int ndim[5], i;
+    char *name = NULL;
+    int ok = 1;
+
+    memset(out, 0, sizeof(struct run_output));
+    out->format = o->format;
+
+    switch (o->format)
+    {
+        case FORMAT_TXT:
+            name = output_name(path, o->outdir, ".txt");
+            out->txt = fopen(name, "w");
+            ok = (out->txt != NULL);
+            if (!ok)
+                break;
+            fprintf(out->txt, "# lfc-run %s: radius %g A, supercell %d %d %d, nnn %u, rcont %g A",
+                    path, o->radius, sc[0], sc[1], sc[2], o->nnn, o->cont_radius);
+            if (o->nangles > 0)
+                fprintf(out->txt, ", %u phases", o->nangles);
+            fprintf(out->txt, "\n# x y z  Bc_x Bc_y Bc_z  Bd_x Bd_y Bd_z  BL_x BL_y BL_z%s\n",
+                    o->tensor ? "  T_xx T_xy T_xz T_yx T_yy T_yz T_zx T_zy T_zz" : "");
+            break;
+
+        case FORMAT_NPY:
+            /* (nmu, 3, [nangles,] 3), the first dimension grows */
+            shapes[1] = 3;
+            shapes[2] = (o->nangles > 0 ? o->nangles : 3);
+            shapes[3] = 3;
+            name = output_name(path, o->outdir, ".npy");
+            ok = (npy_writer_open(&out->npy, name, (o->nangles > 0 ? 4 : 3), shapes) == 0);
+            if (ok && o->tensor)
+            {
+                free(name);
+                name = output_name(path, o->outdir, "_tensor.npy");
+                shapes[2] = 3;
+                ok = (npy_writer_open(&out->npy_tensor, name, 3, shapes) == 0);
+                if (!ok)
+                    npy_writer_close(&out->npy);
+            }
+            break;
+
+        case FORMAT_NPZ:
+            /* muons (nmu, 3), fields (nmu, [nangles,] 3), tensor (nmu, 3, 3) */
+            for (i = 0; i < 5; i++)
+            {
+                ndim[i] = 0;
+                shape[ndim[i]++] = s->header->nmu;
+                if (i == 4 || (i > 0 && o->nangles > 0))
+                    shape[ndim[i]++] = (i == 4 ? 3 : o->nangles);
+                shape[ndim[i]++] = 3;
+                shape += ndim[i];
+            }
+            name = output_name(path, o->outdir, ".npz");
+            ok = (npz_writer_open(&out->npz, name, (o->tensor ? 5 : 4), names, ndim, shapes) == 0);
+            if (ok && npz_writer_append(&out->npz, 0, s->muonpos, 3 * (size_t) s->header->nmu) != 0)
+            {
+                npz_writer_close(&out->npz);
+                ok = 0;
+            }
+            break;
+    }
+    if (!ok)
+        fprintf(stderr, "lfc-run: cannot write %s\n", name);
+    free(name);
+    return ok ? 0 : -1;
+}
+
+/*
+ * Writes the results of n muon sites, starting from muonpos. The fields
+ * of each site are in buf, contact, dipolar and Lorentz one after the
+ * other, and the tensors in T; for npz the contact fields of the chunk
+ * come first, then the dipolar and the Lorentz fields.
+ */
+static int output_chunk(struct run_output *out, const struct run_options *o,
+          const double *muonpos, unsigned int n, const double *buf, const double *T)
+{
+    size_t stride = field_stride(o);
+    unsigned int mu, ang, c, q;
+    const double *B;
+    int ok = 1;
+
+    switch (out->format)
+    {
+        case FORMAT_TXT:
+            for (mu = 0; mu < n; mu++)
+            {
+                for (ang = 0; ang < stride / 3; ang++)
+                {
+                    fprintf(out->txt, "%.8f %.8f %.8f",
+                            muonpos[3*mu], muonpos[3*mu+1], muonpos[3*mu+2]);
+                    for (c = 0; c < 3; c++)
+                    {
+                        B = buf + (3*mu + c) * stride + 3*ang;
+                        fprintf(out->txt, " %.10e %.10e %.10e", B[0], B[1], B[2]);
+                    }
+                    if (o->tensor)
+                        for (q = 0; q < 9; q++)
+                            fprintf(out->txt, " %.10e", T[9*mu+q]);
+                    fprintf(out->txt, "\n");
+                }
+            }
+            break;
+
+        case FORMAT_NPY:
+            ok = (npy_writer_append(&out->npy, buf, n) == 0 &&
+                  (!o->tensor || npy_writer_append(&out->npy_tensor, T, n) == 0));
+            break;
+
+        case FORMAT_NPZ:
+            for (c = 0; ok && c < 3; c++)
+                ok = (npz_writer_append(&out->npz, 1 + c, buf + c * LFC_RUN_CHUNK * stride,
+                                        n * stride) == 0);
+            if (ok && o->tensor)
+                ok = (npz_writer_append(&out->npz, 4, T, 9 * (size_t) n) == 0);
+            break;
+    }
+    return ok ? 0 : -1;
+}
+
+/* Completes and closes the output. Returns 0 on success. */
+static int output_close(struct run_output *out, const struct run_options *o)
+{
+    int ok = 1;
+
+    switch (out->format)
+    {
+        case FORMAT_TXT:
+            ok = (fclose(out->txt) == 0);
+            break;
+        case FORMAT_NPY:
+            ok = (npy_writer_close(&out->npy) == 0);
+            if (o->tensor && npy_writer_close(&out->npy_tensor) != 0)
+                ok = 0;
+            break;
+        case FORMAT_NPZ:
+            ok = (npz_writer_close(&out->npz) == 0);
+            break;
+    }
+    return ok ? 0 : -1;
+}
+
+/*
+ * Checks that the order can be summed by FastIncommSum: the real and
+ * imaginary parts of the Fourier components of each atom must have the
+ * same length and be orthogonal (a helix). Returns the index of the
+ * first atom that is not, or n.
+ */
+static unsigned int helical_check(const double *fc, unsigned int n)
+{
+    const double *f;
+    double re2, im2, dot;
+    unsigned int a;
+
+    for (a = 0; a < n; a++)
+    {
+        f = fc + 6*a;
+        re2 = f[0]*f[0] + f[2]*f[2] + f[4]*f[4];
+        im2 = f[1]*f[1] + f[3]*f[3] + f[5]*f[5];
+        dot = f[0]*f[1] + f[2]*f[3] + f[4]*f[5];
+        /* same tolerances of FastIncommSum, on |Re|, |Im| and Re^.Im^ */
+        if (re2 == 0.0 || im2 == 0.0 || fabs(sqrt(re2) - sqrt(im2)) > EPS ||
+            fabs(dot) / sqrt(re2 * im2) > EPS)
+            return a;
+    }
+    return n;
+}
+
+/*
+ * Fields of the muon sites of one structure file. Returns 0 on success.
+ * Atoms without moment are left out, as in the Python interface; only
+ * then the arrays are copied.
+ */
+static int run_file(const char *path, const struct run_options *o)
+{
+    lfc_structure s;
+    const struct lfc_file_header *h;
+    const double *pos, *fc, *phi;
+    double *mpos = NULL, *mfc = NULL, *mphi = NULL;
+    double *buf, *T, *Bc, *Bd, *Bl;
+    size_t stride = field_stride(o);
+    struct run_output out;
+    int sc[3], ok = 1;
+    unsigned int a, nmag, mu, c, q;
+
+    if (lfc_structure_map(path, &s) != 0)
+    {
+        fprintf(stderr, "lfc-run: cannot read structure file %s\n", path);
+        return -1;
+    }
+    h = s.header;
+
+    nmag = 0;
+    for (a = 0; a < h->natoms; a++)
+    {
+        for (q = 0; q < 6; q++)
+            if (s.fc[6*a+q] != 0.0)
+                break;
+        if (q < 6)
+            nmag++;
+    }
+    pos = s.positions;
+    fc = s.fc;
+    phi = s.phi;
+    if (nmag < h->natoms)
+    {
+        mpos = malloc(3 * (nmag + 1) * sizeof(double));
+        mfc = malloc(6 * (nmag + 1) * sizeof(double));
+        mphi = malloc((nmag + 1) * sizeof(double));
+        nmag = 0;
+        for (a = 0; a < h->natoms; a++)
+        {
+            for (q = 0; q < 6; q++)
+                if (s.fc[6*a+q] != 0.0)
+                    break;
+            if (q == 6)
+                continue;
+            memcpy(mpos + 3*nmag, s.positions + 3*a, 3 * sizeof(double));
+            memcpy(mfc + 6*nmag, s.fc + 6*a, 6 * sizeof(double));
+            mphi[nmag] = s.phi[a];
+            nmag++;
+        }
+        pos = mpos;
+        fc = mfc;
+        phi = mphi;
+    }
+
+    if (o->nangles > 0 && (a = helical_check(fc, nmag)) < nmag)
+    {
+        fprintf(stderr, "lfc-run: %s: -a needs a helical order, the real and imaginary "
+                "parts of magnetic atom %u are not orthogonal with the same length\n",
+                path, a);
+        free(mpos); free(mfc); free(mphi);
+        lfc_structure_unmap(&s);
+        return -1;
+    }
+
+    if (o->supercell[0] > 0)
+        memcpy(sc, o->supercell, 3 * sizeof(int));
+    else
+        sphere_supercell(h->cell, o->radius, sc);
+
+    if (output_open(&out, path, o, &s, sc) != 0)
+    {
+        free(mpos); free(mfc); free(mphi);
+        lfc_structure_unmap(&s);
+        return -1;
+    }
+
+    /* one chunk of results; for npz one block per field */
+    buf = malloc(3 * LFC_RUN_CHUNK * stride * sizeof(double));
+    T = malloc(9 * LFC_RUN_CHUNK * sizeof(double));
+    for (mu = 0; ok && mu < h->nmu; mu++)
+    {
+        c = mu % LFC_RUN_CHUNK;
+        if (out.format == FORMAT_NPZ)
+        {
+            Bc = buf + c * stride;
+            Bd = Bc + LFC_RUN_CHUNK * stride;
+            Bl = Bd + LFC_RUN_CHUNK * stride;
+        }
+        else
+        {
+            Bc = buf + 3 * c * stride;
+            Bd = Bc + stride;
+            Bl = Bd + stride;
+        }
+
+        if (o->nangles > 0)
+        {
+            FastIncommSum(pos, fc, h->K, phi, s.muonpos + 3*mu, sc, h->cell,
+                          o->radius, o->nnn, o->cont_radius, nmag, o->nangles,
+                          Bc, Bd, Bl);
+            if (o->tensor)
+                FusedSum(pos, fc, h->K, phi, s.muonpos + 3*mu, sc, h->cell,
+                         o->radius, o->nnn, o->cont_radius, nmag, LFC_TENSOR,
+                         NULL, NULL, NULL, T + 9*c, NULL);
+        }
+        else
+            FusedSum(pos, fc, h->K, phi, s.muonpos + 3*mu, sc, h->cell,
+                     o->radius, o->nnn, o->cont_radius, nmag,
+                     LFC_CONTACT | LFC_DIPOLAR | LFC_LORENTZ | (o->tensor ? LFC_TENSOR : 0),
+                     Bc, Bd, Bl, T + 9*c, NULL);
+
+        if (c == LFC_RUN_CHUNK - 1 || mu == h->nmu - 1)
+            ok = (output_chunk(&out, o, s.muonpos + 3*(mu - c), c + 1, buf, T) == 0);
+    }
+    if (!ok)
+        fprintf(stderr, "lfc-run: error writing the results of %s\n", path);
+    if (output_close(&out, o) != 0)
+        ok = 0;
+
+    free(buf);
+    free(T);
+    free(mpos); free(mfc); free(mphi);
+    lfc_structure_unmap(&s);
+    return ok ? 0 : -1;
+}
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/* Appends path, or the .lfc files of the directory path, to the list. */
+static int add_inputs(const char *path, char ***files, unsigned int *nfiles)
+{
+#ifndef _WIN32
+    struct stat st;
+    DIR *dir;
+    struct dirent *e;
+    size_t len;
+    unsigned int first = *nfiles;
+
+    if (stat(path, &st) == 0 && S_ISDIR(st.st_mode))
+    {
+        dir = opendir(path);
+        if (dir == NULL)
+            return -1;
+        while ((e = readdir(dir)) != NULL)
+        {
+            len = strlen(e->d_name);
+            if (len < 5 || strcmp(e->d_name + len - 4, ".lfc") != 0)
+                continue;
+            *files = realloc(*files, (*nfiles + 1) * sizeof(char *));
+            (*files)[*nfiles] = malloc(strlen(path) + len + 2);
+            sprintf((*files)[*nfiles], "%s/%s", path, e->d_name);
+            (*nfiles)++;
+        }
+        closedir(dir);
+        qsort(*files + first, *nfiles - first, sizeof(char *), compare_names);
+        return 0;
+    }
+#endif
+    *files = realloc(*files, (*nfiles + 1) * sizeof(char *));
+    (*files)[*nfiles] = malloc(strlen(path) + 1);
+    strcpy((*files)[*nfiles], path);
+    (*nfiles)++;
+    return 0;
+}
+
+/* Parses a whole string as a finite double. Returns 0 on success. */
+static int parse_double(const char *str, double *out)
+{
+    char *end;
+
+    errno = 0;
+    *out = strtod(str, &end);
+    if (end == str || *end != '\0' || errno == ERANGE || *out != *out ||
+        *out > 1e300 || *out < -1e300)
+        return -1;
+    return 0;
+}
+
+/* Parses a whole string, or up to a comma if next is not NULL, as an int
+ * in [min, INT_MAX]. Returns 0 on success. */
+static int parse_int(const char *str, int min, int *out, const char **next)
+{
+    char *end;
+    long v;
+
+    errno = 0;
+    v = strtol(str, &end, 10);
+    if (end == str || errno == ERANGE || v < min || v > INT_MAX)
+        return -1;
+    if (next != NULL && *end == ',')
+        *next = end + 1;
+    else if (*end != '\0' || next != NULL)
+        return -1;
+    *out = (int) v;
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct run_options o;
+    char **files = NULL;
+    unsigned int nfiles = 0;
+    int i, f, n, bad, failed = 0;
+    const char *next;
+
+    o.radius = 100.0;
+    o.supercell[0] = o.supercell[1] = o.supercell[2] = 0;
+    o.nnn = 2;
+    o.cont_radius = 10.0;
+    o.tensor = 0;
+    o.nangles = 0;
+    o.format = FORMAT_TXT;
+    o.outdir = NULL;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-h") == 0)
+        {
+            usage(stdout);
+            return 0;
+        }
+        else if (strcmp(argv[i], "-t") == 0)
+            o.tensor = 1;
+        else if (argv[i][0] == '-' && argv[i][1] != '\0' && strchr("rsncoaf", argv[i][1])
+                 && argv[i][2] == '\0')
+        {
+            if (i + 1 >= argc)
+            {
+                usage(stderr);
+                return 2;
+            }
+            i++;
+            bad = 0;
+            switch (argv[i-1][1])
+            {
+                case 'r':
+                    bad = (parse_double(argv[i], &o.radius) != 0 || o.radius <= 0.0);
+                    break;
+                case 's':
+                    next = argv[i];
+                    bad = (parse_int(next, 1, &o.supercell[0], &next) != 0 ||
+                           parse_int(next, 1, &o.supercell[1], &next) != 0 ||
+                           parse_int(next, 1, &o.supercell[2], NULL) != 0);
+                    break;
+                case 'n':
+                    bad = (parse_int(argv[i], 0, &n, NULL) != 0);
+                    o.nnn = (unsigned int) n;
+                    break;
+                case 'c':
+                    bad = (parse_double(argv[i], &o.cont_radius) != 0 || o.cont_radius < 0.0);
+                    break;
+                case 'o':
+                    o.outdir = argv[i];
+                    break;
+                case 'a':
+                    bad = (parse_int(argv[i], 1, &n, NULL) != 0);
+                    o.nangles = (unsigned int) n;
+                    break;
+                case 'f':
+                    if (strcmp(argv[i], "txt") == 0)
+                        o.format = FORMAT_TXT;
+                    else if (strcmp(argv[i], "npy") == 0)
+                        o.format = FORMAT_NPY;
+                    else if (strcmp(argv[i], "npz") == 0)
+                        o.format = FORMAT_NPZ;
+                    else
+                        bad = 1;
+                    break;
+            }
+            if (bad)
+            {
+                fprintf(stderr, "lfc-run: invalid value %s for -%c\n\n", argv[i], argv[i-1][1]);
+                usage(stderr);
+                return 2;
+            }
+        }
+        else if (argv[i][0] == '-')
+        {
+            usage(stderr);
+            return 2;
+        }
+        else if (add_inputs(argv[i], &files, &nfiles) != 0)
+        {
+            fprintf(stderr, "lfc-run: cannot read directory %s\n", argv[i]);
+            failed = 1;
+        }
+    }
+
+    if (nfiles == 0)
+    {
+        usage(stderr);
+        return 2;
+    }
+
+    /* one file per thread; a single file uses the threads of FusedSum */
+#pragma omp parallel for schedule(dynamic) reduction(|:failed) if(nfiles > 1)
+    for (f = 0; f < (int) nfiles; f++)
+        failed |= (run_file(files[f], &o) != 0);
+
+    for (f = 0; f < (int) nfiles; f++)
+        free(files[f]);
+    free(files);
+    return failed ? 1 : 0;
+}
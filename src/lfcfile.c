@@ -0,0 +1,169 @@
+/**
+ * @file lfcfile.c
+ * @author Pietro Bonfa
+ * @date 2016
+ * @brief Binary structure files
+ *
+ * A structure file holds the lattice, the magnetic atoms with their
+ * Fourier components and phases, the propagation vector and the muon
+ * sites in the layout used by the lattice sums (see lfcfile.h). The file
+ * is mapped in memory and the arrays are used in place, so that reading
+ * a structure costs no parsing and no copy.
+ * Where mmap is not available the file is read in a single block.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lfcfile.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* Number of doubles following the header. */
+static size_t structure_ndoubles(unsigned int natoms, unsigned int nmu)
+{
+    return 10 * (size_t) natoms + 3 * (size_t) nmu;
+}
+
+/* Checks the header and sets the pointers of s to the arrays of the file. */
+static int structure_attach(lfc_structure * s)
+{
+    const struct lfc_file_header *h = (const struct lfc_file_header *) s->map;
+
+    if (s->size < sizeof(struct lfc_file_header) ||
+        memcmp(h->magic, LFC_FILE_MAGIC, 8) != 0 ||
+        h->version != LFC_FILE_VERSION ||
+        s->size != sizeof(struct lfc_file_header) +
+                   structure_ndoubles(h->natoms, h->nmu) * sizeof(double))
+        return -1;
+
+    s->header = h;
+    s->positions = (const double *) (h + 1);
+    s->fc = s->positions + 3 * (size_t) h->natoms;
+    s->phi = s->fc + 6 * (size_t) h->natoms;
+    s->muonpos = s->phi + h->natoms;
+    return 0;
+}
+
+/**
+ * This function maps a structure file in memory.
+ *
+ * @param path name of the file.
+ * @param s the structure, to be released with lfc_structure_unmap.
+ * @return 0 on success, -1 if the file cannot be read or is not a valid
+ *         structure file (s is then left empty).
+ */
+int lfc_structure_map(const char *path, lfc_structure * s)
+{
+#ifndef _WIN32
+    struct stat st;
+    int fd;
+#else
+    FILE *f;
+    long size;
+#endif
+
+    memset(s, 0, sizeof(lfc_structure));
+
+#ifndef _WIN32
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return -1;
+    }
+    s->size = (size_t) st.st_size;
+    s->map = mmap(NULL, s->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (s->map == MAP_FAILED)
+    {
+        memset(s, 0, sizeof(lfc_structure));
+        return -1;
+    }
+#else
+    f = fopen(path, "rb");
+    if (f == NULL)
+        return -1;
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    s->size = (size_t) (size > 0 ? size : 0);
+    s->map = malloc(s->size > 0 ? s->size : 1);
+    if (fread(s->map, 1, s->size, f) != s->size)
+        s->size = 0;
+    fclose(f);
+#endif
+
+    if (structure_attach(s) != 0)
+    {
+        lfc_structure_unmap(s);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * This function releases a structure mapped by lfc_structure_map.
+ */
+void lfc_structure_unmap(lfc_structure * s)
+{
+    if (s->map != NULL)
+    {
+#ifndef _WIN32
+        munmap(s->map, s->size);
+#else
+        free(s->map);
+#endif
+    }
+    memset(s, 0, sizeof(lfc_structure));
+}
+
+/**
+ * This function writes a structure file.
+ *
+ * @param path name of the file.
+ * @param natoms number of atoms.
+ * @param nmu number of muon sites.
+ * @param cell lattice cell (see SimpleSum).
+ * @param K the propagation vector in *reciprocal lattice units*.
+ * @param positions positions of the atoms, 3*natoms numbers (fractional).
+ * @param fc Fourier components, 6*natoms numbers (see SimpleSum).
+ * @param phi phases, natoms numbers.
+ * @param muonpos muon sites, 3*nmu numbers (fractional).
+ * @return 0 on success, -1 on error.
+ */
+int lfc_structure_write(const char *path, unsigned int natoms, unsigned int nmu,
+          const double *cell, const double *K, const double *positions,
+          const double *fc, const double *phi, const double *muonpos)
+{
+    struct lfc_file_header h;
+    FILE *f;
+    int ok;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, LFC_FILE_MAGIC, 8);
+    h.version = LFC_FILE_VERSION;
+    h.natoms = natoms;
+    h.nmu = nmu;
+    memcpy(h.cell, cell, 9 * sizeof(double));
+    memcpy(h.K, K, 3 * sizeof(double));
+
+    f = fopen(path, "wb");
+    if (f == NULL)
+        return -1;
+    ok = (fwrite(&h, sizeof(h), 1, f) == 1 &&
+          fwrite(positions, sizeof(double), 3 * (size_t) natoms, f) == 3 * (size_t) natoms &&
+          fwrite(fc, sizeof(double), 6 * (size_t) natoms, f) == 6 * (size_t) natoms &&
+          fwrite(phi, sizeof(double), natoms, f) == natoms &&
+          fwrite(muonpos, sizeof(double), 3 * (size_t) nmu, f) == 3 * (size_t) nmu);
+    if (fclose(f) != 0)
+        ok = 0;
+    return ok ? 0 : -1;
+}
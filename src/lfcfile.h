@@ -0,0 +1,50 @@
+#ifndef LFCFILE_H
+#define LFCFILE_H
+
+#include <stddef.h>
+
+/* First bytes of a structure file. */
+#define LFC_FILE_MAGIC "muLFCstr"
+#define LFC_FILE_VERSION 1
+
+/** @brief Header of a structure file
+ *
+ * The header is followed by the arrays, in native byte order:
+ * positions (3*natoms doubles, fractional), Fourier components
+ * (6*natoms doubles, Re x, Im x, Re y, Im y, Re z, Im z, see SimpleSum),
+ * phases (natoms doubles) and muon sites (3*nmu doubles, fractional).
+ * The header is 120 bytes long so that all the arrays are aligned.
+ */
+struct lfc_file_header {
+	char magic[8];            /**< LFC_FILE_MAGIC, not terminated. */
+	unsigned int version;     /**< LFC_FILE_VERSION. */
+	unsigned int natoms;      /**< Number of atoms. */
+	unsigned int nmu;         /**< Number of muon sites. */
+	unsigned int reserved;    /**< Zero. */
+	double cell[9];           /**< Lattice vectors, one per row, Angstrom. */
+	double K[3];              /**< Propagation vector, reciprocal lattice units. */
+};
+
+/** @brief A structure file mapped in memory
+ *
+ * The pointers refer to the mapped file and can be passed directly to
+ * the lattice sums.
+ */
+typedef struct {
+	const struct lfc_file_header *header;
+	const double *positions;
+	const double *fc;
+	const double *phi;
+	const double *muonpos;
+	void *map;                /**< Mapped (or read) file. */
+	size_t size;              /**< Size of the file in bytes. */
+} lfc_structure;
+
+int lfc_structure_map(const char *path, lfc_structure * s);
+
+void lfc_structure_unmap(lfc_structure * s);
+
+int lfc_structure_write(const char *path, unsigned int natoms, unsigned int nmu,
+          const double *cell, const double *K, const double *positions,
+          const double *fc, const double *phi, const double *muonpos);
+#endif
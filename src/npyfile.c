@@ -0,0 +1,427 @@
+/**
+ * @file npyfile.c
+ * @author Pietro Bonfa
+ * @date 2016
+ * @brief Streaming writers of NumPy .npy and .npz files
+ *
+ * The results of large scans are written to disk as they are computed,
+ * so that their size is not bounded by the memory.
+ *
+ * A .npy file (format version 1.0) holds an array of doubles whose first
+ * dimension grows as rows are appended. The header is reserved when the
+ * file is opened, wide enough for any number of rows, and is completed
+ * with the final shape when the file is closed. The data starts at a
+ * multiple of 64 bytes and the file can be loaded with
+ * numpy.load(..., mmap_mode='r').
+ *
+ * A .npz file is an uncompressed zip archive of .npy files. The shapes of
+ * the arrays are fixed when the file is opened and the space of each one
+ * is reserved, so that the arrays can be filled in interleaved chunks. The
+ * CRC-32 of each member is updated as the data is written and the zip
+ * headers are completed when the file is closed. Members are limited to
+ * 4 GB (no zip64 extension); larger results should go to .npy files.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "npyfile.h"
+
+/* Big enough for the header of an array with LFC_NPY_MAXDIM dimensions. */
+#define NPY_HEADER_MAX 512
+
+/* Size of the local file header of a zip member, without the name. */
+#define ZIP_LOCAL_HEADER 30
+
+static int host_little_endian(void)
+{
+    unsigned int one = 1;
+    return *(unsigned char *) &one;
+}
+
+static void put16(unsigned char *p, unsigned long v)
+{
+    p[0] = (unsigned char) (v & 0xff);
+    p[1] = (unsigned char) ((v >> 8) & 0xff);
+}
+
+static void put32(unsigned char *p, unsigned long v)
+{
+    put16(p, v & 0xffff);
+    put16(p + 2, (v >> 16) & 0xffff);
+}
+
+/* Table of the CRC-32 (as in zip) of each byte value. */
+static void crc32_table(unsigned long *table)
+{
+    unsigned long c;
+    unsigned int n, b;
+
+    for (n = 0; n < 256; n++)
+    {
+        c = n;
+        for (b = 0; b < 8; b++)
+            c = (c >> 1) ^ (0xedb88320UL & (0UL - (c & 1)));
+        table[n] = c;
+    }
+}
+
+/* CRC-32 of len bytes, continuing from crc. */
+static unsigned long crc32_update(const unsigned long *table, unsigned long crc,
+          const unsigned char *buf, size_t len)
+{
+    size_t i;
+
+    crc = ~crc & 0xffffffffUL;
+    for (i = 0; i < len; i++)
+        crc = table[(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
+    return ~crc & 0xffffffffUL;
+}
+
+/*
+ * Writes the .npy header of an array of doubles with the given shape in h
+ * and returns its length: total if total > 0 (it must be large enough),
+ * otherwise the smallest multiple of 64.
+ */
+static size_t npy_header(char *h, unsigned int ndim, const unsigned long *shape, size_t total)
+{
+    char dict[NPY_HEADER_MAX];
+    size_t len, i;
+    unsigned int d;
+
+    len = sprintf(dict, "{'descr': '%cf8', 'fortran_order': False, 'shape': (",
+                  host_little_endian() ? '<' : '>');
+    for (d = 0; d < ndim; d++)
+        len += sprintf(dict + len, "%lu,%s", shape[d], (d + 1 < ndim ? " " : ""));
+    len += sprintf(dict + len, "), }");
+
+    if (total == 0)
+        total = (10 + len + 1 + 63) / 64 * 64;
+
+    memcpy(h, "\x93NUMPY\x01\x00", 8);
+    put16((unsigned char *) h + 8, total - 10);
+    memcpy(h + 10, dict, len);
+    for (i = 10 + len; i < total - 1; i++)
+        h[i] = ' ';
+    h[total - 1] = '\n';
+    return total;
+}
+
+/**
+ * This function creates a .npy file for an array of doubles whose first
+ * dimension grows as rows are appended.
+ *
+ * @param path name of the file.
+ * @param ndim number of dimensions, 1 to LFC_NPY_MAXDIM.
+ * @param shape the shape of the array. shape[0] is ignored.
+ * @return 0 on success, -1 on error.
+ */
+int npy_writer_open(npy_writer * w, const char *path, unsigned int ndim,
+          const unsigned long *shape)
+{
+    char h[NPY_HEADER_MAX];
+    unsigned int d;
+
+    memset(w, 0, sizeof(npy_writer));
+    if (ndim < 1 || ndim > LFC_NPY_MAXDIM)
+        return -1;
+
+    w->ndim = ndim;
+    w->rowsize = 1;
+    for (d = 1; d < ndim; d++)
+    {
+        w->shape[d] = shape[d];
+        w->rowsize *= shape[d];
+    }
+
+    /* room for the largest number of rows */
+    w->shape[0] = ULONG_MAX;
+    w->hlen = npy_header(h, ndim, w->shape, 0);
+    w->shape[0] = 0;
+    npy_header(h, ndim, w->shape, w->hlen);
+
+    w->f = fopen(path, "wb");
+    if (w->f == NULL)
+        return -1;
+    if (fwrite(h, 1, w->hlen, w->f) != w->hlen)
+    {
+        fclose(w->f);
+        w->f = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * This function appends nrows rows (nrows times the product of shape[1:]
+ * doubles) to a .npy file.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int npy_writer_append(npy_writer * w, const double *data, unsigned long nrows)
+{
+    if (w->f == NULL)
+        return -1;
+    if (fwrite(data, sizeof(double), nrows * w->rowsize, w->f) != nrows * w->rowsize)
+        return -1;
+    w->shape[0] += nrows;
+    return 0;
+}
+
+/**
+ * This function writes the final shape in the header and closes a .npy
+ * file.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int npy_writer_close(npy_writer * w)
+{
+    char h[NPY_HEADER_MAX];
+    int ok;
+
+    if (w->f == NULL)
+        return -1;
+
+    npy_header(h, w->ndim, w->shape, w->hlen);
+    ok = (fseek(w->f, 0, SEEK_SET) == 0 && fwrite(h, 1, w->hlen, w->f) == w->hlen);
+    if (fclose(w->f) != 0)
+        ok = 0;
+    w->f = NULL;
+    return ok ? 0 : -1;
+}
+
+/* Local file header of member m, with its current CRC. */
+static size_t zip_local_header(const struct npz_member *m, unsigned char *p)
+{
+    size_t nlen = strlen(m->name);
+
+    put32(p, 0x04034b50UL);
+    put16(p + 4, 20);                 /* version needed to extract */
+    put16(p + 6, 0);                  /* flags */
+    put16(p + 8, 0);                  /* stored */
+    put16(p + 10, 0);                 /* time */
+    put16(p + 12, 0x21);              /* date: 1 Jan 1980 */
+    put32(p + 14, m->crc);
+    put32(p + 18, m->hlen + m->size); /* compressed size */
+    put32(p + 22, m->hlen + m->size); /* uncompressed size */
+    put16(p + 26, nlen);
+    put16(p + 28, 0);                 /* extra field */
+    memcpy(p + ZIP_LOCAL_HEADER, m->name, nlen);
+    return ZIP_LOCAL_HEADER + nlen;
+}
+
+/* Central directory header of member m. */
+static size_t zip_central_header(const struct npz_member *m, unsigned char *p)
+{
+    size_t nlen = strlen(m->name);
+
+    put32(p, 0x02014b50UL);
+    put16(p + 4, 20);                 /* version made by */
+    put16(p + 6, 20);                 /* version needed to extract */
+    put16(p + 8, 0);                  /* flags */
+    put16(p + 10, 0);                 /* stored */
+    put16(p + 12, 0);                 /* time */
+    put16(p + 14, 0x21);              /* date */
+    put32(p + 16, m->crc);
+    put32(p + 20, m->hlen + m->size);
+    put32(p + 24, m->hlen + m->size);
+    put16(p + 28, nlen);
+    put16(p + 30, 0);                 /* extra field */
+    put16(p + 32, 0);                 /* comment */
+    put16(p + 34, 0);                 /* disk */
+    put16(p + 36, 0);                 /* internal attributes */
+    put32(p + 38, 0);                 /* external attributes */
+    put32(p + 42, (unsigned long) m->offset);
+    memcpy(p + 46, m->name, nlen);
+    return 46 + nlen;
+}
+
+/* Releases the names and the members. */
+static void npz_writer_free(npz_writer * w)
+{
+    unsigned int i;
+
+    for (i = 0; i < w->narrays; i++)
+        free(w->members[i].name);
+    free(w->members);
+    memset(w, 0, sizeof(npz_writer));
+}
+
+/**
+ * This function creates a .npz file with narrays arrays of doubles and
+ * reserves the space of each one.
+ *
+ * @param path name of the file.
+ * @param narrays number of arrays.
+ * @param names names of the arrays (without the .npy extension).
+ * @param ndim number of dimensions of each array.
+ * @param shapes shapes of the arrays, one after the other.
+ * @return 0 on success, -1 on error (also if an array exceeds 4 GB).
+ */
+int npz_writer_open(npz_writer * w, const char *path, unsigned int narrays,
+          const char * const *names, const unsigned int *ndim,
+          const unsigned long *shapes)
+{
+    char h[NPY_HEADER_MAX];
+    unsigned char lh[ZIP_LOCAL_HEADER + 256];
+    const unsigned long *shape = shapes;
+    struct npz_member *m;
+    unsigned int i, d;
+    double end = 0.0; /* double, to detect overflows */
+    size_t n, nlen;
+    int ok;
+
+    memset(w, 0, sizeof(npz_writer));
+    w->members = calloc(narrays, sizeof(struct npz_member));
+    w->narrays = narrays;
+    crc32_table(w->crc_table);
+
+    for (i = 0; i < narrays; i++)
+    {
+        m = w->members + i;
+        nlen = strlen(names[i]) + 4;
+        if (ndim[i] > LFC_NPY_MAXDIM || nlen > 255)
+            break;
+        m->name = malloc(nlen + 1);
+        sprintf(m->name, "%s.npy", names[i]);
+
+        n = 1;
+        for (d = 0; d < ndim[i]; d++)
+            n *= shape[d];
+        m->size = n * sizeof(double);
+        m->hlen = npy_header(h, ndim[i], shape, 0);
+        m->offset = (long) end;
+        m->data = m->offset + ZIP_LOCAL_HEADER + nlen + m->hlen;
+        end += ZIP_LOCAL_HEADER + nlen + m->hlen + (double) m->size;
+        if (end > 4294967295.0 || end > (double) LONG_MAX)
+            break;
+        shape += ndim[i];
+    }
+    shape = shapes;
+
+    ok = (i == narrays);
+    if (ok)
+    {
+        w->f = fopen(path, "wb");
+        ok = (w->f != NULL);
+    }
+
+    /* local headers, completed by npz_writer_close, and .npy headers */
+    for (i = 0; ok && i < narrays; i++)
+    {
+        m = w->members + i;
+        npy_header(h, ndim[i], shape, m->hlen);
+        m->crc = crc32_update(w->crc_table, 0, (unsigned char *) h, m->hlen);
+        n = zip_local_header(m, lh);
+        ok = (fseek(w->f, m->offset, SEEK_SET) == 0 && fwrite(lh, 1, n, w->f) == n &&
+              fwrite(h, 1, m->hlen, w->f) == m->hlen);
+        shape += ndim[i];
+    }
+    if (!ok)
+    {
+        if (w->f != NULL)
+        {
+            fclose(w->f);
+            remove(path);
+        }
+        npz_writer_free(w);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * This function writes the next count doubles of an array of a .npz file.
+ *
+ * @param array index of the array, in the order given to npz_writer_open.
+ * @return 0 on success, -1 on error or if the array would overflow.
+ */
+int npz_writer_append(npz_writer * w, unsigned int array, const double *data,
+          size_t count)
+{
+    struct npz_member *m;
+    size_t bytes = count * sizeof(double);
+
+    if (w->f == NULL || array >= w->narrays)
+        return -1;
+    m = w->members + array;
+    if (m->written + bytes > m->size)
+        return -1;
+
+    if (fseek(w->f, m->data + (long) m->written, SEEK_SET) != 0 ||
+        fwrite(data, 1, bytes, w->f) != bytes)
+        return -1;
+    m->crc = crc32_update(w->crc_table, m->crc, (const unsigned char *) data, bytes);
+    m->written += bytes;
+    return 0;
+}
+
+/**
+ * This function completes the zip headers and closes a .npz file. The
+ * arrays that were not filled are completed with zeros.
+ *
+ * @return 0 on success, -1 on error or if an array was not filled.
+ */
+int npz_writer_close(npz_writer * w)
+{
+    static const unsigned char zeros[4096];
+    unsigned char p[46 + 256];
+    struct npz_member *m;
+    unsigned int i;
+    size_t n;
+    unsigned long cdir = 0, cdsize = 0;
+    int ok = (w->f != NULL);
+    int unfilled = 0;
+
+    for (i = 0; ok && i < w->narrays; i++)
+    {
+        m = w->members + i;
+        if (m->written < m->size)
+            unfilled = 1; /* still written, as a valid archive */
+        while (ok && m->written < m->size)
+        {
+            n = m->size - m->written;
+            n = (n < sizeof(zeros) ? n : sizeof(zeros));
+            if (fseek(w->f, m->data + (long) m->written, SEEK_SET) != 0 ||
+                fwrite(zeros, 1, n, w->f) != n)
+                ok = 0;
+            m->crc = crc32_update(w->crc_table, m->crc, zeros, n);
+            m->written += n;
+        }
+
+        /* the final CRC */
+        n = zip_local_header(m, p);
+        if (fseek(w->f, m->offset, SEEK_SET) != 0 || fwrite(p, 1, n, w->f) != n)
+            ok = 0;
+        cdir = (unsigned long) m->data + m->size;
+    }
+
+    if (ok && fseek(w->f, (long) cdir, SEEK_SET) != 0)
+        ok = 0;
+    for (i = 0; ok && i < w->narrays; i++)
+    {
+        n = zip_central_header(w->members + i, p);
+        if (fwrite(p, 1, n, w->f) != n)
+            ok = 0;
+        cdsize += n;
+    }
+    if (ok)
+    {
+        /* end of central directory */
+        put32(p, 0x06054b50UL);
+        put16(p + 4, 0);
+        put16(p + 6, 0);
+        put16(p + 8, w->narrays);
+        put16(p + 10, w->narrays);
+        put32(p + 12, cdsize);
+        put32(p + 16, cdir);
+        put16(p + 20, 0);
+        if (fwrite(p, 1, 22, w->f) != 22)
+            ok = 0;
+    }
+
+    if (w->f != NULL && fclose(w->f) != 0)
+        ok = 0;
+    npz_writer_free(w);
+    return (ok && !unfilled) ? 0 : -1;
+}
@@ -0,0 +1,62 @@
+#ifndef NPYFILE_H
+#define NPYFILE_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/* Largest number of dimensions of the arrays written by npy_writer and npz_writer. */
+#define LFC_NPY_MAXDIM 8
+
+/** @brief A .npy file of doubles written row by row
+ *
+ * The first dimension grows as rows are appended; the header is
+ * reserved when the file is opened and completed when it is closed.
+ */
+typedef struct {
+	FILE *f;
+	unsigned int ndim;
+	unsigned long shape[LFC_NPY_MAXDIM]; /**< shape[0] is the number of rows written. */
+	size_t rowsize;                      /**< Doubles per row. */
+	size_t hlen;                         /**< Length of the reserved header. */
+} npy_writer;
+
+int npy_writer_open(npy_writer * w, const char *path, unsigned int ndim,
+          const unsigned long *shape);
+
+int npy_writer_append(npy_writer * w, const double *data, unsigned long nrows);
+
+int npy_writer_close(npy_writer * w);
+
+/** @brief Member of a .npz file */
+struct npz_member {
+	char *name;          /**< Name in the archive, with the .npy extension. */
+	long offset;         /**< Offset of the local header. */
+	long data;           /**< Offset of the data. */
+	size_t hlen;         /**< Length of the .npy header. */
+	size_t size;         /**< Size of the data, bytes. */
+	size_t written;      /**< Bytes written so far. */
+	unsigned long crc;   /**< CRC-32 of the .npy header and of the data written. */
+};
+
+/** @brief A .npz file (uncompressed) of arrays of doubles with known shapes
+ *
+ * The space of each array is reserved when the file is opened, so that
+ * the arrays can be filled in any interleaved order, each one from its
+ * beginning to its end.
+ */
+typedef struct {
+	FILE *f;
+	unsigned int narrays;
+	struct npz_member *members;
+	unsigned long crc_table[256];        /**< CRC-32 of each byte value. */
+} npz_writer;
+
+int npz_writer_open(npz_writer * w, const char *path, unsigned int narrays,
+          const char * const *names, const unsigned int *ndim,
+          const unsigned long *shapes);
+
+int npz_writer_append(npz_writer * w, unsigned int array, const double *data,
+          size_t count);
+
+int npz_writer_close(npz_writer * w);
+#endif
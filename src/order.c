@@ -0,0 +1,119 @@
+/**
+ * @file order.c
+ * @author Pietro Bonfa
+ * @date 2016
+ * @brief Spatial ordering of the basis atoms
+ *
+ * The basis atoms are sorted along a Morton (Z-order) curve of their
+ * fractional coordinates, so that atoms close in space are also close
+ * in memory and fall in the same tile. Each tile is then enclosed in a
+ * sphere that is used to skip whole tiles outside the Lorentz sphere.
+ */
+
+#include <stdlib.h>
+#include <math.h>
+#include "order.h"
+
+/* Bits used for each fractional coordinate in the Morton code. */
+#define MORTON_BITS 10
+
+struct morton_key {
+    unsigned long code;
+    unsigned int index;
+};
+
+/* Spreads the lowest MORTON_BITS bits of x so that two zeros separate them. */
+static unsigned long morton_spread(unsigned long x)
+{
+    unsigned long r = 0;
+    unsigned int b;
+
+    for (b = 0; b < MORTON_BITS; b++)
+        r |= ((x >> b) & 1UL) << (3*b);
+    return r;
+}
+
+/* Maps a fractional coordinate, folded in [0,1), to an integer grid. */
+static unsigned long morton_grid(double x)
+{
+    x = x - floor(x);
+    return (unsigned long) (x * (1UL << MORTON_BITS)) & ((1UL << MORTON_BITS) - 1);
+}
+
+static int morton_compare(const void *p1, const void *p2)
+{
+    const struct morton_key *a = p1;
+    const struct morton_key *b = p2;
+
+    if (a->code != b->code)
+        return a->code < b->code ? -1 : 1;
+    /* equal codes keep the input order */
+    return a->index < b->index ? -1 : (a->index > b->index);
+}
+
+/**
+ * This function sorts the atoms along a Morton curve.
+ *
+ * @param in_positions positions of the atoms in fractional coordinates
+ *         (3*in_natoms values).
+ * @param in_natoms number of atoms.
+ * @param out_perm the new order: out_perm[a] is the index in in_positions
+ *          of the a-th atom along the curve.
+ */
+void morton_order(const double *in_positions, unsigned int in_natoms,
+          unsigned int *out_perm)
+{
+    struct morton_key *keys = malloc(in_natoms * sizeof(struct morton_key));
+    unsigned int a;
+
+    for (a = 0; a < in_natoms; a++)
+    {
+        keys[a].code = (morton_spread(morton_grid(in_positions[3*a+0])) << 2) |
+                       (morton_spread(morton_grid(in_positions[3*a+1])) << 1) |
+                        morton_spread(morton_grid(in_positions[3*a+2]));
+        keys[a].index = a;
+    }
+
+    qsort(keys, in_natoms, sizeof(struct morton_key), morton_compare);
+
+    for (a = 0; a < in_natoms; a++)
+        out_perm[a] = keys[a].index;
+
+    free(keys);
+}
+
+/**
+ * This function computes the smallest sphere centered in the average
+ * position of each tile that contains all the atoms of the tile.
+ *
+ * @param in_pos positions of the atoms (Cartesian coordinates).
+ * @param in_natoms number of atoms.
+ * @param in_tile number of atoms in each tile (the last one may be shorter).
+ * @param out_center center of each tile.
+ * @param out_radius radius of each tile.
+ */
+void tile_bounds(const struct vec3 *in_pos, unsigned int in_natoms,
+          unsigned int in_tile, struct vec3 *out_center, double *out_radius)
+{
+    unsigned int t, a, first, last;
+    double n;
+
+    for (t = 0; t * in_tile < in_natoms; t++)
+    {
+        first = t * in_tile;
+        last = first + in_tile < in_natoms ? first + in_tile : in_natoms;
+
+        out_center[t] = vec3_zero();
+        for (a = first; a < last; a++)
+            out_center[t] = vec3_add(out_center[t], in_pos[a]);
+        out_center[t] = vec3_muls(1.0/(last - first), out_center[t]);
+
+        out_radius[t] = 0.0;
+        for (a = first; a < last; a++)
+        {
+            n = vec3_norm(vec3_sub(in_pos[a], out_center[t]));
+            if (n > out_radius[t])
+                out_radius[t] = n;
+        }
+    }
+}
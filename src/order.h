@@ -0,0 +1,10 @@
+#ifndef ORDER_H
+#define ORDER_H
+#include "vec3.h"
+
+void morton_order(const double *in_positions, unsigned int in_natoms,
+          unsigned int *out_perm);
+
+void tile_bounds(const struct vec3 *in_pos, unsigned int in_natoms,
+          unsigned int in_tile, struct vec3 *out_center, double *out_radius);
+#endif
@@ -31,12 +31,14 @@ void pile_init(pile * p, unsigned int nElements)
 	p->nElements = nElements;
 	p->ranks = malloc(nElements * sizeof(double));
 	p->elements = malloc(nElements * sizeof(struct vec3));
+	p->keys = malloc(nElements * sizeof(unsigned long));
   
   
   for (i = 0; i < nElements; ++i)
   {
     p->ranks[i] = -1.0;
     p->elements[i] = vec3_zero();
+    p->keys[i] = 0;
   }
 }
 
@@ -53,6 +55,7 @@ void pile_reset(pile * p, unsigned int nElements)
   {
     p->ranks[i] = -1.0;
     p->elements[i] = vec3_zero();
+    p->keys[i] = 0;
   }
 }
 
@@ -64,6 +67,18 @@ void pile_reset(pile * p, unsigned int nElements)
  * 
  */
 void pile_add_element(pile * p, double rank, struct vec3 v)
+{
+	pile_add_element_keyed(p, rank, 0, v);
+}
+
+/**
+ * Same as pile_add_element, but elements with the same rank are ordered
+ * according to key (smaller keys first).
+ * When keys are unique the content of the pile does not depend on the
+ * order used to add the elements.
+ * 
+ */
+void pile_add_element_keyed(pile * p, double rank, unsigned long key, struct vec3 v)
 {
 	unsigned int i;
 	for ( i = 0; i < p->nElements; i++)
@@ -71,12 +86,14 @@ void pile_add_element(pile * p, double rank, struct vec3 v)
 		if (p->ranks[i] == -1.0) {
 			p->ranks[i] = rank;
 			p->elements[i] = v;
+			p->keys[i] = key;
 			break;
 		}
-		if (p->ranks[i] > rank) {
+		if (p->ranks[i] > rank || (p->ranks[i] == rank && p->keys[i] > key)) {
 			pile_move_elements_from_position(p, i);
 			p->ranks[i] = rank;
 			p->elements[i] = v;
+			p->keys[i] = key;
 			break;
 		}
 	}
@@ -101,6 +118,7 @@ void pile_move_elements_from_position(pile * p, unsigned int pos)
 	{
 		p->ranks[i+1] = p->ranks[i];
 		p->elements[i+1] = p->elements[i];
+		p->keys[i+1] = p->keys[i];
 	}
 }
 
@@ -114,4 +132,5 @@ void pile_free(pile * p)
 {
 	free(p->ranks);
 	free(p->elements);
+	free(p->keys);
 }
@@ -1,3 +1,5 @@
+#ifndef PILE_H
+#define PILE_H
 #define _USE_MATH_DEFINES
 
 #include <stdlib.h>
@@ -8,12 +10,16 @@ typedef struct {
 	unsigned int nElements; /**< Number of elements in the pile. */
 	double * ranks;  /**< Scalar value to weight the elements.  Must be positive */
 	struct vec3 * elements; /**< Pointer to the elements. */
+	unsigned long * keys; /**< Unique keys used to break ties between equal ranks. */
 } pile;
 
 void pile_init(pile * p, unsigned int nElements);
 
 void pile_add_element(pile * p, double rank, struct vec3 v);
 
+void pile_add_element_keyed(pile * p, double rank, unsigned long key, struct vec3 v);
+
 void pile_move_elements_from_position(pile * p, unsigned int pos);
 
 void pile_free(pile * p);
+#endif
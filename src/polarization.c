@@ -0,0 +1,314 @@
+/**
+ * @file polarization.c
+ * @author Pietro Bonfa
+ * @date 2016
+ * @brief Muon polarization function from a set of local fields
+ *
+ * For a muon experiencing the static field B_i with probability w_i the
+ * polarization along the initial direction n is
+ *
+ *   P(t) = sum_i w_i [cos^2(theta_i) + sin^2(theta_i) cos(gamma |B_i| t)]
+ *
+ * where theta_i is the angle between B_i and n. For a powder
+ * cos^2(theta_i) is replaced by its average, 1/3.
+ * The fields can be used as they are or collected in a histogram of
+ * |B|, in which case the number of cosines evaluated for each time
+ * does not depend on the number of fields.
+ * RotataPolarization and FastIncommPolarization fill the histogram site by
+ * site with the fields of RotataSum and FastIncommSum, so that the fields
+ * of all the sites and angles are never stored together.
+ */
+
+#include <stdlib.h>
+#include <math.h>
+#include "vec3.h"
+#include "polarization.h"
+#include "histogram.h"
+#include "rotatesum.h"
+#include "fastincommsum.h"
+
+#ifdef _OPENMP
+	#include <omp.h>
+#endif
+
+/* cos^2 of the angle between B (of norm b) and the initial polarization n. */
+static double polarization_cos2(struct vec3 B, double b, struct vec3 n,
+          unsigned int powder)
+{
+    if (powder)
+        return 1.0/3.0;
+    if (b > 0.0)
+        return vec3_dot(B, n) * vec3_dot(B, n) / (b * b);
+    return 1.0;
+}
+
+/* Initial polarization of unit length, z if in_direction is NULL. */
+static struct vec3 polarization_direction(const double *in_direction)
+{
+    struct vec3 n = _vec3(0.0, 0.0, 1.0);
+
+    if (in_direction != NULL)
+        n = vec3_muls(1.0/vec3_norm(_vec3(in_direction[0], in_direction[1], in_direction[2])),
+                      _vec3(in_direction[0], in_direction[1], in_direction[2]));
+    return n;
+}
+
+/* Turns the amplitude weighted sums of the frequencies of the bins into
+ * the average frequency of each bin. */
+static void polarization_bin_average(double *bamp, double *bomega,
+          unsigned int in_nbins)
+{
+    unsigned int bin;
+
+    for (bin = 0; bin < in_nbins; bin++)
+    {
+        if (bamp[bin] != 0.0)
+            bomega[bin] /= bamp[bin];
+    }
+}
+
+/* P(t) = c0 + sum_i amp_i cos(omega_i t) for each time. */
+static void polarization_evolve(double c0, const double *amp,
+          const double *omega, unsigned int nterms, const double *in_times,
+          unsigned int in_ntimes, double *out_pol)
+{
+    unsigned int t, i;
+    double p;
+
+#pragma omp parallel for schedule(static) private(t,i,p)
+    for (t = 0; t < in_ntimes; t++)
+    {
+        p = c0;
+        for (i = 0; i < nterms; i++)
+            p += amp[i] * cos(omega[i] * in_times[t]);
+        out_pol[t] = p;
+    }
+}
+
+/**
+ * This function adds the total fields B_dip + B_lor + ACont B_cont of
+ * one muon site to the histogram of |B| used for the polarization.
+ * Bin i collects |B| in [i, i+1) * bmax / nbins, larger fields are
+ * added to the last bin.
+ *
+ * @param c0 sum of w cos^2(theta), updated.
+ * @param bamp sum of w sin^2(theta) of each bin, updated.
+ * @param bomega sum of w sin^2(theta) gamma |B| of each bin, updated.
+ */
+static void polarization_accumulate(const double *cont, const double *dip,
+          const double *lor, unsigned int in_nfields, double in_acont,
+          double in_weight, struct vec3 n, unsigned int in_powder,
+          unsigned int in_nbins, double in_bmax,
+          double *c0, double *bamp, double *bomega)
+{
+    unsigned int i, bin;
+    double b, x, cos2;
+    struct vec3 B;
+
+    for (i = 0; i < in_nfields; i++)
+    {
+        B = _vec3(dip[3*i] + lor[3*i] + in_acont * cont[3*i],
+                  dip[3*i+1] + lor[3*i+1] + in_acont * cont[3*i+1],
+                  dip[3*i+2] + lor[3*i+2] + in_acont * cont[3*i+2]);
+        b = vec3_norm(B);
+        cos2 = polarization_cos2(B, b, n, in_powder);
+
+        x = b / in_bmax * in_nbins;
+        bin = x < in_nbins ? (unsigned int) x : in_nbins - 1;
+
+        *c0 += in_weight * cos2;
+        bamp[bin] += in_weight * (1.0 - cos2);
+        bomega[bin] += in_weight * (1.0 - cos2) * LFC_GAMMA_MU * b;
+    }
+}
+
+/**
+ * This function calculates the muon polarization function.
+ *
+ * @param in_fields local fields in Tesla, 3 numbers for each field
+ *         (e.g. the total field for each muon site and angle).
+ * @param in_nfields number of fields.
+ * @param in_weights probability of each field, NULL for equal probabilities.
+ *         The weights are normalized to 1.
+ * @param in_direction initial muon polarization (Cartesian, does not need
+ *         to be normalized). NULL for the z axis. Not used for powders.
+ * @param in_powder: if non zero the powder average is computed.
+ * @param in_nbins: 0 to sum over the fields, otherwise number of bins of
+ *         the histogram of |B| between 0 and the largest field. Each bin
+ *         is represented by the weighted average of its fields, the
+ *         error is of the order of (gamma t max|B| / in_nbins)^2.
+ * @param in_times times in microseconds.
+ * @param in_ntimes number of times.
+ * @param out_pol polarization at each time (in_ntimes numbers).
+ */
+void Polarization(const double *in_fields, unsigned int in_nfields,
+          const double *in_weights, const double *in_direction,
+          unsigned int in_powder, unsigned int in_nbins,
+          const double *in_times, unsigned int in_ntimes, double *out_pol)
+{
+    double *omega = malloc(in_nfields * sizeof(double)); /* gamma |B| */
+    double *amp = malloc(in_nfields * sizeof(double));   /* w sin^2(theta) */
+    double *bomega = NULL, *bamp = NULL;
+    double c0 = 0.0; /* sum of w cos^2(theta) */
+    double wsum = 0.0, w, b, cos2, maxomega = 0.0;
+    struct vec3 n, B;
+    unsigned int i, bin, nterms;
+
+    n = polarization_direction(in_direction);
+
+    for (i = 0; i < in_nfields; i++)
+        wsum += (in_weights != NULL ? in_weights[i] : 1.0);
+
+    for (i = 0; i < in_nfields; i++)
+    {
+        B = _vec3(in_fields[3*i], in_fields[3*i+1], in_fields[3*i+2]);
+        w = (in_weights != NULL ? in_weights[i] : 1.0) / wsum;
+        b = vec3_norm(B);
+        cos2 = polarization_cos2(B, b, n, in_powder);
+
+        c0 += w * cos2;
+        amp[i] = w * (1.0 - cos2);
+        omega[i] = LFC_GAMMA_MU * b;
+        if (omega[i] > maxomega)
+            maxomega = omega[i];
+    }
+    nterms = in_nfields;
+
+    if (in_nbins > 0 && maxomega > 0.0)
+    {
+        /* histogram of |B|, each bin at the average field of its entries */
+        bomega = calloc(in_nbins, sizeof(double));
+        bamp = calloc(in_nbins, sizeof(double));
+        for (i = 0; i < in_nfields; i++)
+        {
+            bin = (unsigned int) (omega[i] / maxomega * in_nbins);
+            if (bin >= in_nbins)
+                bin = in_nbins - 1;
+            bamp[bin] += amp[i];
+            bomega[bin] += amp[i] * omega[i];
+        }
+        polarization_bin_average(bamp, bomega, in_nbins);
+        free(omega);
+        free(amp);
+        omega = bomega;
+        amp = bamp;
+        nterms = in_nbins;
+    }
+
+    polarization_evolve(c0, amp, omega, nterms, in_times, in_ntimes, out_pol);
+
+    free(omega);
+    free(amp);
+}
+
+/**
+ * This function calculates the muon polarization function of the fields
+ * obtained by RotataSum for each muon site, without storing them: the
+ * in_nangles fields of a site are added to a histogram of |B| as soon as
+ * they are computed (see Polarization for the accuracy of the histogram).
+ * Each field of site s has weight w_s / in_nangles, with w_s the
+ * normalized weight of the site.
+ *
+ * @param in_muonpos positions of the muon sites in fractional coordinates,
+ *         3*in_nsites numbers.
+ * @param in_nsites number of muon sites.
+ * @param in_siteweights weight of each site, NULL for equal weights.
+ * @param in_acont contact hyperfine coupling.
+ * @param in_direction initial muon polarization, NULL for the z axis.
+ * @param in_powder: if non zero the powder average is computed.
+ * @param in_nbins number of bins of |B|, at least 1.
+ * @param in_bmax upper limit of the histogram, Tesla. Fields larger than
+ *         in_bmax are added to the last bin, with their own frequency.
+ * @param in_times times in microseconds.
+ * @param in_ntimes number of times.
+ * @param out_pol polarization at each time (in_ntimes numbers).
+ *
+ * The other parameters are the same of RotataSum.
+ */
+void RotataPolarization(const double *in_positions,
+          const double *in_fc, const double *in_K, const double *in_phi,
+          const double *in_muonpos, unsigned int in_nsites,
+          const double *in_siteweights, const int * in_supercell,
+          const double *in_cell, const double radius,
+          const unsigned int nnn_for_cont, const double cont_radius,
+          unsigned int in_natoms, const double *in_axis,
+          unsigned int in_nangles, unsigned int in_flags, double in_acont,
+          const double *in_direction, unsigned int in_powder,
+          unsigned int in_nbins, double in_bmax,
+          const double *in_times, unsigned int in_ntimes, double *out_pol)
+{
+    unsigned int s;
+    double *cont, *dip, *lor;
+    double *bamp = calloc(in_nbins, sizeof(double));
+    double *bomega = calloc(in_nbins, sizeof(double));
+    double c0 = 0.0;
+    struct vec3 n = polarization_direction(in_direction);
+
+    if (histogram_alloc(in_nangles, &cont, &dip, &lor) &&
+            bamp != NULL && bomega != NULL)
+    {
+        for (s = 0; s < in_nsites; s++)
+        {
+            RotataSumEx(in_positions, in_fc, in_K, in_phi, in_muonpos + 3*s,
+                        in_supercell, in_cell, radius, nnn_for_cont, cont_radius,
+                        in_natoms, in_axis, in_nangles, in_flags, cont, dip, lor);
+            polarization_accumulate(cont, dip, lor, in_nangles, in_acont,
+                      histogram_weight(in_siteweights, in_nsites, s) / in_nangles,
+                      n, in_powder, in_nbins, in_bmax, &c0, bamp, bomega);
+        }
+        polarization_bin_average(bamp, bomega, in_nbins);
+        polarization_evolve(c0, bamp, bomega, in_nbins, in_times, in_ntimes, out_pol);
+    }
+    free(cont);
+    free(dip);
+    free(lor);
+    free(bamp);
+    free(bomega);
+}
+
+/**
+ * This function calculates the muon polarization function of the fields
+ * obtained by FastIncommSum for each muon site, without storing them.
+ *
+ * The parameters are the same of RotataPolarization and FastIncommSum.
+ */
+void FastIncommPolarization(const double *in_positions,
+          const double *in_fc, const double *in_K, const double *in_phi,
+          const double *in_muonpos, unsigned int in_nsites,
+          const double *in_siteweights, const int * in_supercell,
+          const double *in_cell, const double radius,
+          const unsigned int nnn_for_cont, const double cont_radius,
+          unsigned int in_natoms, unsigned int in_nangles,
+          unsigned int in_flags, double in_acont,
+          const double *in_direction, unsigned int in_powder,
+          unsigned int in_nbins, double in_bmax,
+          const double *in_times, unsigned int in_ntimes, double *out_pol)
+{
+    unsigned int s;
+    double *cont, *dip, *lor;
+    double *bamp = calloc(in_nbins, sizeof(double));
+    double *bomega = calloc(in_nbins, sizeof(double));
+    double c0 = 0.0;
+    struct vec3 n = polarization_direction(in_direction);
+
+    if (histogram_alloc(in_nangles, &cont, &dip, &lor) &&
+            bamp != NULL && bomega != NULL)
+    {
+        for (s = 0; s < in_nsites; s++)
+        {
+            FastIncommSumEx(in_positions, in_fc, in_K, in_phi, in_muonpos + 3*s,
+                            in_supercell, in_cell, radius, nnn_for_cont, cont_radius,
+                            in_natoms, in_nangles, in_flags, cont, dip, lor);
+            polarization_accumulate(cont, dip, lor, in_nangles, in_acont,
+                      histogram_weight(in_siteweights, in_nsites, s) / in_nangles,
+                      n, in_powder, in_nbins, in_bmax, &c0, bamp, bomega);
+        }
+        polarization_bin_average(bamp, bomega, in_nbins);
+        polarization_evolve(c0, bamp, bomega, in_nbins, in_times, in_ntimes, out_pol);
+    }
+    free(cont);
+    free(dip);
+    free(lor);
+    free(bamp);
+    free(bomega);
+}
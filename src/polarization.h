@@ -0,0 +1,25 @@
+#ifndef POLARIZATION_H
+#define POLARIZATION_H
+
+/* Muon gyromagnetic ratio, rad / (microsecond Tesla) */
+#define LFC_GAMMA_MU 851.61554
+
+void Polarization(const double *in_fields, unsigned int in_nfields,
+          const double *in_weights, const double *in_direction,
+          unsigned int in_powder, unsigned int in_nbins,
+          const double *in_times, unsigned int in_ntimes, double *out_pol);
+
+void RotataPolarization(const double *, const double *, const double *, const double *,
+          const double *, unsigned int, const double *, const int *, const double *,
+          const double, const unsigned int, const double, unsigned int,
+          const double *, unsigned int, unsigned int, double,
+          const double *, unsigned int, unsigned int, double,
+          const double *, unsigned int, double *);
+
+void FastIncommPolarization(const double *, const double *, const double *, const double *,
+          const double *, unsigned int, const double *, const int *, const double *,
+          const double, const unsigned int, const double, unsigned int,
+          unsigned int, unsigned int, double,
+          const double *, unsigned int, unsigned int, double,
+          const double *, unsigned int, double *);
+#endif
@@ -0,0 +1,99 @@
+/**
+ * @file reduce.c
+ * @author Pietro Bonfa
+ * @date 2016
+ * @brief Reproducible summation of partial results
+ *
+ * The partial results produced by the parallel loops (one for each
+ * column of the supercell) are stored in memory and summed here in
+ * an order that depends only on their number. This makes the final
+ * result independent of the number of threads and of the scheduling.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "reduce.h"
+
+/* Number of partials summed sequentially before the pairwise reduction. */
+#define PAIRWISE_BLOCK 8
+
+/**
+ * This function sums in_n vectors of in_ncomp components stored one after
+ * the other in in_partials. Blocks of PAIRWISE_BLOCK vectors are summed
+ * sequentially, the block sums are then added pairwise (binary tree).
+ * The rounding error grows like log(in_n) instead of in_n.
+ *
+ * @param in_partials the in_n*in_ncomp partial results.
+ * @param in_n number of partial results.
+ * @param in_ncomp number of components of each partial result.
+ * @param out_sum the in_ncomp components of the sum.
+ */
+void pairwise_sum(const double *in_partials, unsigned long in_n,
+          unsigned int in_ncomp, double *out_sum)
+{
+    unsigned long nblocks, b, i;
+    unsigned int c;
+    double *tmp;
+
+    memset(out_sum, 0, in_ncomp * sizeof(double));
+    if (in_n == 0)
+        return;
+
+    nblocks = (in_n + PAIRWISE_BLOCK - 1) / PAIRWISE_BLOCK;
+    tmp = calloc(nblocks * in_ncomp, sizeof(double));
+
+    for (b = 0; b < nblocks; b++)
+    {
+        for (i = b * PAIRWISE_BLOCK; i < in_n && i < (b+1) * PAIRWISE_BLOCK; i++)
+        {
+            for (c = 0; c < in_ncomp; c++)
+                tmp[b*in_ncomp+c] += in_partials[i*in_ncomp+c];
+        }
+    }
+
+    /* binary tree reduction of the blocks */
+    while (nblocks > 1)
+    {
+        for (b = 0; b < nblocks/2; b++)
+        {
+            for (c = 0; c < in_ncomp; c++)
+                tmp[b*in_ncomp+c] = tmp[2*b*in_ncomp+c] + tmp[(2*b+1)*in_ncomp+c];
+        }
+        if (nblocks % 2)
+        {
+            for (c = 0; c < in_ncomp; c++)
+                tmp[(nblocks/2)*in_ncomp+c] = tmp[(nblocks-1)*in_ncomp+c];
+        }
+        nblocks = (nblocks + 1) / 2;
+    }
+
+    for (c = 0; c < in_ncomp; c++)
+        out_sum[c] = tmp[c];
+
+    free(tmp);
+}
+
+/**
+ * This function returns the number of groups of columns of cells summed
+ * separately by a reproducible sum with in_ncomp accumulators: one per
+ * column if the partial results fit in LFC_PARTIALS doubles, otherwise
+ * as many as fit (but at least LFC_NGROUPS and at most in_ncol).
+ * Group g holds the columns g*in_ncol/n ... (g+1)*in_ncol/n - 1. The
+ * number depends only on the sizes, never on the number of threads.
+ *
+ * @param in_ncol number of columns of cells.
+ * @param in_ncomp number of accumulators of each partial result.
+ */
+unsigned long pairwise_groups(unsigned long in_ncol, unsigned long in_ncomp)
+{
+    unsigned long n;
+
+    if (in_ncomp == 0 || in_ncol * in_ncomp <= LFC_PARTIALS)
+        return in_ncol;
+
+    n = LFC_PARTIALS / in_ncomp;
+    if (n < LFC_NGROUPS)
+        n = LFC_NGROUPS;
+    return n < in_ncol ? n : in_ncol;
+}
@@ -0,0 +1,7 @@
+#ifndef REDUCE_H
+#define REDUCE_H
+/* Fixed order summation of partial results */
+void pairwise_sum(const double *in_partials, unsigned long in_n,
+          unsigned int in_ncomp, double *out_sum);
+unsigned long pairwise_groups(unsigned long in_ncol, unsigned long in_ncomp);
+#endif
@@ -3,7 +3,9 @@
  * @author Pietro Bonfa
  * @date 9 Sep 2016
  * @brief Dipolar field calculator
- *     
+ *
+ * The supercell is traversed by LatticeSum (see latticesum.c), this file
+ * only holds the kernel of the rotated moments.
  */
 
 
@@ -14,11 +16,105 @@
 #include "mat3.h"
 #include "pile.h"
 #include "config.h"
+#include "latticesum.h"
 
 #ifndef M_PI
 #    define M_PI 3.14159265358979323846
 #endif
 
+/* Data of the kernel of RotataSum. */
+struct rotatesum_data {
+    const struct vec3 *P;       /* m(R) = cos(2 pi K.R) P + sin(2 pi K.R) Q */
+    const struct vec3 *Q;
+    const struct mat3 *rmat;    /* rotations of the moments */
+    const float *frmat;
+    unsigned int nangles;
+    unsigned int flags;
+    double cont_radius;
+    pile *MCont;                /* one pile per angle */
+};
+
+/*
+ * Kernel of LatticeSum: dipolar field (3) and sum of the moments (3) for
+ * each of the rotated moments.
+ */
+static void rotatesum_term(const void *ctx, const struct lattice_site *site, double *acc)
+{
+    const struct rotatesum_data *d = (const struct rotatesum_data *) ctx;
+    struct vec3 m, rm, u;
+    double onebrcube;
+    unsigned int angn;
+
+    float frx, fry, frz, fn, fux, fuy, fuz, fmx, fmy, fmz, frmx, frmy, frmz, fmu, fonebrcube;
+    const float *fR;
+
+    m = vec3_add(vec3_muls(site->c, d->P[site->atom]), vec3_muls(site->s, d->Q[site->atom]));
+
+    if (d->flags & LFC_MIXED_PRECISION)
+    {
+        /* geometry and dipolar terms in single precision */
+        frx = (float) site->r.x;
+        fry = (float) site->r.y;
+        frz = (float) site->r.z;
+        fn = sqrtf(frx*frx + fry*fry + frz*frz);
+
+        fmx = (float) m.x; fmy = (float) m.y; fmz = (float) m.z;
+        fux = frx/fn; fuy = fry/fn; fuz = frz/fn;
+        fonebrcube = 1.0f/(fn*fn*fn);
+
+        for (angn = 0; angn < d->nangles; ++angn)
+        {
+            fR = d->frmat + 9*angn;
+            frmx = fR[0]*fmx + fR[1]*fmy + fR[2]*fmz;
+            frmy = fR[3]*fmx + fR[4]*fmy + fR[5]*fmz;
+            frmz = fR[6]*fmx + fR[7]*fmy + fR[8]*fmz;
+
+            acc[6*angn+3] += frmx;
+            acc[6*angn+4] += frmy;
+            acc[6*angn+5] += frmz;
+
+            fmu = 3.0f * (frmx*fux + frmy*fuy + frmz*fuz);
+            acc[6*angn+0] += fonebrcube * (fmu * fux - frmx);
+            acc[6*angn+1] += fonebrcube * (fmu * fuy - frmy);
+            acc[6*angn+2] += fonebrcube * (fmu * fuz - frmz);
+
+            if (fn < d->cont_radius) {
+                rm.x = frmx; rm.y = frmy; rm.z = frmz;
+#pragma omp critical(rotatesum_contact)
+                pile_add_element_keyed(&d->MCont[angn], pow((double) fn,CONT_SCALING_POWER), site->key,
+                                       vec3_muls(1./pow((double) fn,CONT_SCALING_POWER),rm));
+            }
+        }
+        return;
+    }
+
+    /* unit vector */
+    u = vec3_muls(1.0/site->n, site->r);
+    onebrcube = 1.0/pow(site->n,3);
+
+    /* do the rotation */
+    for (angn = 0; angn < d->nangles; ++angn)
+    {
+        /* rotate moment */
+        rm = mat3_mulv(d->rmat[angn], m);
+
+        acc[6*angn+3] += rm.x;
+        acc[6*angn+4] += rm.y;
+        acc[6*angn+5] += rm.z;
+
+        acc[6*angn+0] += onebrcube * (3.0*vec3_dot(rm,u)*u.x - rm.x);
+        acc[6*angn+1] += onebrcube * (3.0*vec3_dot(rm,u)*u.y - rm.y);
+        acc[6*angn+2] += onebrcube * (3.0*vec3_dot(rm,u)*u.z - rm.z);
+
+        /* Calculate Contact Field */
+        if (site->n < d->cont_radius) {
+#pragma omp critical(rotatesum_contact)
+            pile_add_element_keyed(&d->MCont[angn], pow(site->n,CONT_SCALING_POWER), site->key,
+                                   vec3_muls(1./pow(site->n,CONT_SCALING_POWER),rm));  /* see ass.c for this line */
+        }
+    }
+}
+
 
 /**
  * This function calculates the dipolar field for a set of rotations of the
@@ -48,255 +144,124 @@
  * @param in_natoms: number of atoms in the lattice.
  * @param in_axis: axis for the rotation
  * @param in_nangles: the code will perform in_nangles rotations of 360 deg/in_nangles
+ * @param in_flags: bitwise or of the LFC_* flags defined in config.h
+ *                   (0 for the default double precision evaluation).
+ *                   With LFC_REPRODUCIBLE the result does not depend on
+ *                   the number of threads.
  * @param out_field_cont Contact filed in Cartesian coordinates defined by in_cell. A coupling of 1 \f$ \mathrm{Ang} ^{-1} \sim 13.912~\mathrm{mol/emu} \f$ is assumed.
  * @param out_field_dip  Dipolar field in Cartesian coordinates defined by in_cell.
  * @param out_field_lor  Lorentz field in Cartesian coordinates defined by in_cell.
  */
-void RotataSum(const double *in_positions, 
+void RotataSumEx(const double *in_positions, 
           const double *in_fc, const double *in_K, const double *in_phi,
           const double *in_muonpos, const int * in_supercell, const double *in_cell, 
           const double radius, const unsigned int nnn_for_cont, const double cont_radius, 
           unsigned int in_natoms, 
-          const double *in_axis, unsigned int in_nangles,
+          const double *in_axis, unsigned int in_nangles, unsigned int in_flags,
           double *out_field_cont, double *out_field_dip, double *out_field_lor)
 {
-
-    unsigned int scx, scy, scz = 10; /*supercell sizes */
-    unsigned int i,j,k; /* counters for supercells */
-    
-    struct vec3 atmpos;
-    struct vec3 muonpos;
-    struct vec3 r;
-    struct vec3 m;   /*magnetic moment of atom */
-    struct vec3 rm;   /*rotated magnetic moment of atom */
-    struct vec3 u;   /* unit vector */
-        
-    struct mat3 sc_lat;
-    
-    double n; /* contains norm of vectors */
-    double c,s; /*cosine and sine of K.R */
-    double onebrcube; /* 1/r^3 */
-    double angle;
-    
     struct vec3 sk  ;
     struct vec3 isk ;
     double  phi ;
-    
-    struct vec3 R, K;
-    
-    unsigned int a, angn;     /* counter for atoms */
-    
+    double angle;
+
+    unsigned int i, a, angn;     /* counter for atoms */
+
+    /* m(R) = cos(2 pi K.R) P + sin(2 pi K.R) Q for every atom */
+    struct vec3 *P = malloc(in_natoms * sizeof(struct vec3));
+    struct vec3 *Q = malloc(in_natoms * sizeof(struct vec3));
+
     /* for rotation */
     struct vec3 axis;
-    struct mat3 rmat;
-    struct vec3 * B = malloc(in_nangles * sizeof(struct vec3));
-    struct vec3 * BLor = malloc(in_nangles * sizeof(struct vec3));
+    struct mat3 * rmat = malloc(in_nangles * sizeof(struct mat3));
+    float *frmat = malloc(9 * in_nangles * sizeof(float));
+    double * acc = calloc(6 * in_nangles, sizeof(double));
     pile * MCont = malloc(in_nangles * sizeof(pile));
-    struct vec3 BCont;
+    struct vec3 B, BLor, BCont;
     int NofM = 0;
     double SumOfWeights = 0;
 
+    struct rotatesum_data d;
+    struct lattice_kernel kernel;
+
     /* defines axis */
     axis.x = in_axis[0];
     axis.y = in_axis[1];
     axis.z = in_axis[2];
-    
-    
-    
-    
-    /* define dupercell size */
-    scx = in_supercell[0];
-    scy = in_supercell[1];
-    scz = in_supercell[2];
-    
-#ifdef _DEBUG    
-    printf("I use: %i %i %i\n",scx, scy, scz);    
-    printf("Total atoms: %i\n",in_natoms);
-    printf("N Angles: %u\n",in_nangles);
-#endif
-    
-    sc_lat.a.x = in_cell[0];
-    sc_lat.a.y = in_cell[1];
-    sc_lat.a.z = in_cell[2];
-    sc_lat.b.x = in_cell[3];
-    sc_lat.b.y = in_cell[4];
-    sc_lat.b.z = in_cell[5];
-    sc_lat.c.x = in_cell[6];
-    sc_lat.c.y = in_cell[7];
-    sc_lat.c.z = in_cell[8];
-
-#ifdef _DEBUG    
-    for (i=0;i<9;i++)
-        printf("Cell is: %i %e\n",i,in_cell[i]);
-#endif
-    
-    K.x = in_K[0];
-    K.y = in_K[1];
-    K.z = in_K[2];
-
-#ifdef _DEBUG
-    printf("K is: %e %e %e \n",K.x,K.y,K.z);
-    printf("Radius is: %e\n",radius);
-#endif
 
-    sc_lat = mat3_mul(
-                        mat3_diag((float) scx, (float) scy, (float) scz),
-                        sc_lat);
-    
-    
-    /* muon position in reduced coordinates */
-    muonpos.x =  (in_muonpos[0] + (scx/2) ) / (float) scx;
-    muonpos.y =  (in_muonpos[1] + (scy/2) ) / (float) scy;
-    muonpos.z =  (in_muonpos[2] + (scz/2) ) / (float) scz;
-    
-    muonpos = mat3_vmul(muonpos,sc_lat);    
-
-#ifdef _DEBUG
-    printf("Muon pos is: %e %e %e\n",muonpos.x,muonpos.y,muonpos.z);
-#endif
-   
     for (angn = 0; angn < in_nangles; ++angn)
     {
-        B[angn] = vec3_zero();
-        BLor[angn] = vec3_zero();
         pile_init(&(MCont[angn]),nnn_for_cont);
+
+        /* rotation matrices do not depend on the atom, build them once */
+        angle = 2*M_PI*((double) angn/ (double) in_nangles);
+        rmat[angn] = mat3_aangle(axis, angle);
+
+        frmat[9*angn+0] = (float) rmat[angn].a.x; frmat[9*angn+1] = (float) rmat[angn].a.y; frmat[9*angn+2] = (float) rmat[angn].a.z;
+        frmat[9*angn+3] = (float) rmat[angn].b.x; frmat[9*angn+4] = (float) rmat[angn].b.y; frmat[9*angn+5] = (float) rmat[angn].b.z;
+        frmat[9*angn+6] = (float) rmat[angn].c.x; frmat[9*angn+7] = (float) rmat[angn].c.y; frmat[9*angn+8] = (float) rmat[angn].c.z;
     }
-    
-    for (i = 0; i < scx; ++i)
+
+    for (a = 0; a < in_natoms; ++a)
     {
-        for (j = 0; j < scy; ++j)
-        {
-            for (k = 0; k < scz; ++k)
-            {
-                /* loop over atoms */
-                for (a = 0; a < in_natoms; ++a)
-                {
-                    
-                    /* atom position in reduced coordinates */
-                    atmpos.x = ( in_positions[3*a] + (float) i) / (float) scx;
-                    atmpos.y = ( in_positions[3*a+1] + (float) j) / (float) scy;
-                    atmpos.z = ( in_positions[3*a+2] + (float) k) / (float) scz;
-                    
-                    /* go to cartesian coordinates (in Angstrom!) */
-                    atmpos = mat3_vmul(atmpos,sc_lat);
-                    
-                    /*printf("atompos: %e %e %e\n", atmpos.x, atmpos.y, atmpos.z); */
-                    /* difference between atom pos and muon pos (cart coordinates) */
-                    
-                    r = vec3_sub(atmpos,muonpos);
-                    
-                    n = vec3_norm(r);
-                    if (n < radius)
-                    {
-                        /* calculate magnetic moment */
+        /* calculate magnetic moment */
 #ifdef _ALTERNATE_FC_INPUT
-                        printf("ERROR!!! If you see this in the Python extension something went wrong!\n");
-                         sk.x = in_fc[6*a];   sk.y = in_fc[6*a+1]; sk.z = in_fc[6*a+2];
-                        isk.x = in_fc[6*a+3];isk.y = in_fc[6*a+4];isk.z = in_fc[6*a+5];
+        printf("ERROR!!! If you see this in the Python extension something went wrong!\n");
+         sk.x = in_fc[6*a];   sk.y = in_fc[6*a+1]; sk.z = in_fc[6*a+2];
+        isk.x = in_fc[6*a+3];isk.y = in_fc[6*a+4];isk.z = in_fc[6*a+5];
 #else
-                         sk.x = in_fc[6*a];   sk.y = in_fc[6*a+2]; sk.z = in_fc[6*a+4];
-                        isk.x = in_fc[6*a+1];isk.y = in_fc[6*a+3];isk.z = in_fc[6*a+5];
-#endif
-                          phi = in_phi[a];
-                        /*printf("sk = %e %e %e\n", sk.x, sk.y, sk.z); */
-                        /*printf("isk = %e %e %e\n", isk.x, isk.y, isk.z); */
-                        
-                        
-                        R.x = (float) i; R.y = (float) j; R.z = (float) k; 
-                        
-                        c = cos ( 2.0*M_PI * (vec3_dot(K,R) + phi));
-                        s = sin ( 2.0*M_PI * (vec3_dot(K,R) + phi));
-                        
-                        m = vec3_zero();
-                        m = vec3_add ( vec3_muls(c, sk), m);
-                        m = vec3_add ( vec3_muls(s, isk), m);
-                        
-                        
-                        
-                        /*printf("I sum: r = %e, p = %e %e %e\n",n, r.x, r.y, r.z); */
-                        /*printf("I sum: m = %e %e %e\n", m.x, m.y, m.z); */
-                        /* sum it */
-                        /* B += (( 3.0 * np.dot(nm,atom[1]) * atom[1] - nm ) / atom[0]**3)*0.9274009 */
-                        
-                        /* unit vector */
-                        u = vec3_muls(1.0/n,r);
-                        onebrcube = 1.0/pow(n,3);
-                        
-                        /* do the rotation */
-                        for (angn = 0; angn < in_nangles; ++angn)
-                        {
-                            angle = 2*M_PI*((float) angn/ (float) in_nangles);
-                            rmat = mat3_aangle(axis, angle);
-
-#ifdef _DEBUG
-                            printf("Rotation matrix is: %e %e %e\n",rmat.a.x,rmat.a.y,rmat.a.z);
-                            printf("Rotation matrix is: %e %e %e\n",rmat.b.x,rmat.b.y,rmat.b.z);
-                            printf("Rotation matrix is: %e %e %e\n",rmat.c.x,rmat.c.y,rmat.c.z);
+         sk.x = in_fc[6*a];   sk.y = in_fc[6*a+2]; sk.z = in_fc[6*a+4];
+        isk.x = in_fc[6*a+1];isk.y = in_fc[6*a+3];isk.z = in_fc[6*a+5];
 #endif
 
-                            /* rotate moment */
-                            rm = mat3_mulv(rmat, m);
-                            
-                            BLor[angn] = vec3_add(BLor[angn],rm);
-                            
-                            B[angn] = vec3_add(
-                                        B[angn],
-                                        vec3_muls( onebrcube ,vec3_sub(vec3_muls(3.0*vec3_dot(rm,u),u), rm))
-                                    );
-
-                            /* Calculate Contact Field */
-                            if (n < cont_radius) {
-#ifdef _DEBUG                      
-                                printf("Adding moment to Cont: n: %e, m: %e %e %e! (Total: %d)\n", n, rm.x,rm.y,rm.z,nnn_for_cont);
-#endif
-                                pile_add_element(&MCont[angn], pow(n,CONT_SCALING_POWER), vec3_muls(1./pow(n,CONT_SCALING_POWER),rm));  /* see ass.c for this line */
-                            }
-                        }
-#ifdef _DEBUG               
-                        for (angn = 0; angn < in_nangles; ++angn)
-                            printf("B %d is now : %e %e %e\n", angn, B[angn].x, B[angn].y, B[angn].z);
-#endif                        
-                    }                    
-
-                }
-                
-            }
-        }
+        /* the phase of the atom is folded into P and Q (see simplesum.c) */
+        phi = 2.0*M_PI*in_phi[a];
+        P[a] = vec3_add(vec3_muls(cos(phi), sk), vec3_muls(sin(phi), isk));
+        Q[a] = vec3_sub(vec3_muls(cos(phi), isk), vec3_muls(sin(phi), sk));
     }
-    
-    /* Lorentz Field (explanation of the numbers in ass.c) */
-    
 
-    for (angn = 0; angn < in_nangles; ++angn)
-    {
-        BLor[angn] = vec3_muls(0.33333333333*11.654064, vec3_muls(3./(4.*M_PI*pow(radius,3)),BLor[angn]));/* to tesla units */
-        /*printf("The Lorents field contribution is: %e %e %e Tesla and it will NOT be added!!\n",BLor[angn].x,BLor[angn].y,BLor[angn].z);     */
+    d.P = P;
+    d.Q = Q;
+    d.rmat = rmat;
+    d.frmat = frmat;
+    d.nangles = in_nangles;
+    d.flags = in_flags;
+    d.cont_radius = cont_radius;
+    d.MCont = MCont;
+
+    kernel.term = rotatesum_term;
+    kernel.ctx = &d;
+    kernel.nacc = 6 * in_nangles;
+    kernel.cutoff = radius;
+
+    LatticeSum(in_positions, in_natoms, in_K, in_muonpos, in_supercell, in_cell,
+               radius, &kernel, 1, in_flags, acc);
+
+    free(P);
+    free(Q);
+    free(frmat);
+    free(rmat);
 
-        out_field_lor[3*angn+0] = BLor[angn].x;
-        out_field_lor[3*angn+1] = BLor[angn].y;
-        out_field_lor[3*angn+2] = BLor[angn].z;
-    }
-    free(BLor);    
-    
-    
-    /* Dipolar Field */
-    
     for (angn = 0; angn < in_nangles; ++angn)
     {
-        B[angn] = vec3_muls(0.9274009, B[angn]); /* to tesla units */
-        /*B[angn] = vec3_add(B[angn], BLor); */
-        out_field_dip[3*angn+0] = B[angn].x;
-        out_field_dip[3*angn+1] = B[angn].y;
-        out_field_dip[3*angn+2] = B[angn].z;
+        /* Lorentz Field (explanation of the numbers in ass.c) */
+        BLor = vec3_muls(0.33333333333*11.654064 * 3./(4.*M_PI*pow(radius,3)),
+                         _vec3(acc[6*angn+3], acc[6*angn+4], acc[6*angn+5])); /* to tesla units */
+
+        out_field_lor[3*angn+0] = BLor.x;
+        out_field_lor[3*angn+1] = BLor.y;
+        out_field_lor[3*angn+2] = BLor.z;
+
+        /* Dipolar Field */
+        B = vec3_muls(0.9274009, _vec3(acc[6*angn+0], acc[6*angn+1], acc[6*angn+2])); /* to tesla units */
+
+        out_field_dip[3*angn+0] = B.x;
+        out_field_dip[3*angn+1] = B.y;
+        out_field_dip[3*angn+2] = B.z;
     }
-    free(B);
-    
-    /* Contact Filed */
-    
+    free(acc);
+
     /* Contact Field */
-    NofM = 0;
-    SumOfWeights = 0;
-    
     for (angn = 0; angn < in_nangles; ++angn)
     {
         /* (re) initialize */
@@ -325,4 +290,19 @@ void RotataSum(const double *in_positions,
     free(MCont);  
 }
 
-
+/**
+ * RotataSumEx with the default flags. This is the interface of the 0.1
+ * releases.
+ */
+void RotataSum(const double *in_positions, 
+          const double *in_fc, const double *in_K, const double *in_phi,
+          const double *in_muonpos, const int * in_supercell, const double *in_cell, 
+          const double radius, const unsigned int nnn_for_cont, const double cont_radius, 
+          unsigned int in_natoms, 
+          const double *in_axis, unsigned int in_nangles,
+          double *out_field_cont, double *out_field_dip, double *out_field_lor)
+{
+    RotataSumEx(in_positions, in_fc, in_K, in_phi, in_muonpos, in_supercell,
+                in_cell, radius, nnn_for_cont, cont_radius, in_natoms, in_axis,
+                in_nangles, 0, out_field_cont, out_field_dip, out_field_lor);
+}
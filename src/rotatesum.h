@@ -5,4 +5,10 @@ void RotataSum(const double *, const double *, const double *, const double *,
           const double *, const int * , const double *, const double , 
           const unsigned int , const double, unsigned int , const double *, 
           unsigned int , double *, double *, double *);
+
+//RotataSum with LFC_* flags
+void RotataSumEx(const double *, const double *, const double *, const double *,
+          const double *, const int * , const double *, const double , 
+          const unsigned int , const double, unsigned int , const double *, 
+          unsigned int , unsigned int , double *, double *, double *);
 #endif
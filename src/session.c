@@ -0,0 +1,307 @@
+/**
+ * @file session.c
+ * @author Pietro Bonfa
+ * @date 2016
+ * @brief Local fields of a structure that is modified step by step
+ *
+ * A session holds the lattice, the magnetic atoms and their moments, the
+ * propagation vector, the muon sites and the parameters of the sphere.
+ * Each setter compares the new input with the stored one and records
+ * what changed. Since the fields are linear in the moments, the lattice
+ * coefficients of each muon site (see LatticeCoefficients) only depend on
+ * the geometry: lfc_session_evaluate repeats the lattice sum of a muon
+ * site only when the geometry seen by that site changed, and otherwise
+ * obtains the fields from the stored coefficients. Moving one muon site
+ * costs one lattice sum, changing the moments costs none.
+ * The coefficients are partial sums over the sphere: when the radius
+ * grows only the shell between the old and the new radius is summed
+ * (see LatticeShellCoefficients).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "fusedsum.h"
+#include "session.h"
+
+/* Marks all muon sites for a new lattice sum. */
+static void session_invalidate(lfc_session * s)
+{
+    unsigned int mu;
+
+    for (mu = 0; mu < s->nmu; mu++)
+        s->covered[mu] = -1.0;
+    s->dirty |= LFC_SESSION_LATTICE;
+}
+
+/* Coefficient and field storage for the current natoms and nmu. */
+static void session_resize(lfc_session * s)
+{
+    free(s->coef);
+    free(s->fields);
+    s->coef = malloc((size_t) s->nmu * s->natoms * LFC_NCOEF * sizeof(double));
+    s->fields = calloc((size_t) s->nmu * 9, sizeof(double));
+    session_invalidate(s);
+}
+
+/**
+ * This function initializes an empty session: no atoms, no muon sites, a
+ * zero cell and propagation vector and a 1x1x1 supercell.
+ */
+void lfc_session_init(lfc_session * s)
+{
+    memset(s, 0, sizeof(lfc_session));
+    s->supercell[0] = s->supercell[1] = s->supercell[2] = 1;
+    s->dirty = LFC_SESSION_MOMENTS | LFC_SESSION_LATTICE;
+}
+
+/**
+ * This function sets the lattice cell and the supercell.
+ *
+ * @param in_cell lattice vectors, one per row (see SimpleSum).
+ * @param in_supercell extension of the supercell along the lattice vectors.
+ * @return 1 if the cell or the supercell changed, 0 otherwise.
+ */
+int lfc_session_set_cell(lfc_session * s, const double *in_cell, const int *in_supercell)
+{
+    if (memcmp(s->cell, in_cell, 9 * sizeof(double)) == 0 &&
+        memcmp(s->supercell, in_supercell, 3 * sizeof(int)) == 0)
+        return 0;
+
+    memcpy(s->cell, in_cell, 9 * sizeof(double));
+    memcpy(s->supercell, in_supercell, 3 * sizeof(int));
+    session_invalidate(s);
+    return 1;
+}
+
+/**
+ * This function sets the positions of the magnetic atoms. When their
+ * number changes the Fourier components and the phases are reset to zero.
+ *
+ * @param in_positions fractional coordinates, 3*in_natoms numbers.
+ * @param in_natoms number of magnetic atoms.
+ * @return 1 if the positions changed, 0 otherwise.
+ */
+int lfc_session_set_positions(lfc_session * s, const double *in_positions, unsigned int in_natoms)
+{
+    if (in_natoms == s->natoms &&
+        memcmp(s->positions, in_positions, 3 * in_natoms * sizeof(double)) == 0)
+        return 0;
+
+    if (in_natoms != s->natoms)
+    {
+        free(s->positions);
+        free(s->fc);
+        free(s->phi);
+        s->natoms = in_natoms;
+        s->positions = malloc(3 * in_natoms * sizeof(double));
+        s->fc = calloc(6 * in_natoms, sizeof(double));
+        s->phi = calloc(in_natoms, sizeof(double));
+        session_resize(s);
+        s->dirty |= LFC_SESSION_MOMENTS;
+    }
+    memcpy(s->positions, in_positions, 3 * in_natoms * sizeof(double));
+    session_invalidate(s);
+    return 1;
+}
+
+/**
+ * This function sets the moments of the magnetic atoms.
+ *
+ * @param in_fc Fourier components, 6*natoms numbers (see SimpleSum).
+ * @param in_phi phases, natoms numbers.
+ * @return 1 if the moments changed, 0 otherwise.
+ */
+int lfc_session_set_moments(lfc_session * s, const double *in_fc, const double *in_phi)
+{
+    if (memcmp(s->fc, in_fc, 6 * s->natoms * sizeof(double)) == 0 &&
+        memcmp(s->phi, in_phi, s->natoms * sizeof(double)) == 0)
+        return 0;
+
+    memcpy(s->fc, in_fc, 6 * s->natoms * sizeof(double));
+    memcpy(s->phi, in_phi, s->natoms * sizeof(double));
+    s->dirty |= LFC_SESSION_MOMENTS;
+    return 1;
+}
+
+/**
+ * This function sets the propagation vector.
+ *
+ * @param in_K the propagation vector in *reciprocal lattice units*.
+ * @return 1 if the propagation vector changed, 0 otherwise.
+ */
+int lfc_session_set_k(lfc_session * s, const double *in_K)
+{
+    if (memcmp(s->K, in_K, 3 * sizeof(double)) == 0)
+        return 0;
+
+    memcpy(s->K, in_K, 3 * sizeof(double));
+    session_invalidate(s);
+    return 1;
+}
+
+/**
+ * This function sets the muon sites. Only the sites that moved are
+ * marked for a new lattice sum, unless their number changed.
+ *
+ * @param in_muonpos fractional coordinates, 3*in_nmu numbers.
+ * @param in_nmu number of muon sites.
+ * @return 1 if any site changed, 0 otherwise.
+ */
+int lfc_session_set_muons(lfc_session * s, const double *in_muonpos, unsigned int in_nmu)
+{
+    unsigned int mu;
+    int changed = 0;
+
+    if (in_nmu != s->nmu)
+    {
+        free(s->muonpos);
+        free(s->covered);
+        s->nmu = in_nmu;
+        s->muonpos = malloc(3 * in_nmu * sizeof(double));
+        s->covered = malloc(in_nmu * sizeof(double));
+        memcpy(s->muonpos, in_muonpos, 3 * in_nmu * sizeof(double));
+        session_resize(s);
+        return 1;
+    }
+
+    for (mu = 0; mu < in_nmu; mu++)
+    {
+        if (memcmp(s->muonpos + 3*mu, in_muonpos + 3*mu, 3 * sizeof(double)) != 0)
+        {
+            memcpy(s->muonpos + 3*mu, in_muonpos + 3*mu, 3 * sizeof(double));
+            s->covered[mu] = -1.0;
+            s->dirty |= LFC_SESSION_LATTICE;
+            changed = 1;
+        }
+    }
+    return changed;
+}
+
+/**
+ * This function sets the parameters of the sphere. A larger radius,
+ * with the same parameters of the contact field, keeps the coefficients
+ * of the muon sites and only adds those of the new shell.
+ *
+ * @param radius Lorentz sphere radius
+ * @param nnn_for_cont number of nearest neighboring atoms to be included
+ *                      for the evaluation of the contact field.
+ * @param cont_radius only atoms within this radius are eligible to contribute to
+ *                      the contact field.
+ * @return 1 if any parameter changed, 0 otherwise.
+ */
+int lfc_session_set_sphere(lfc_session * s, double radius, unsigned int nnn_for_cont,
+          double cont_radius)
+{
+    if (radius == s->radius && nnn_for_cont == s->nnn && cont_radius == s->cont_radius)
+        return 0;
+
+    if (radius < s->radius || nnn_for_cont != s->nnn || cont_radius != s->cont_radius)
+        session_invalidate(s);
+    s->radius = radius;
+    s->nnn = nnn_for_cont;
+    s->cont_radius = cont_radius;
+    s->dirty |= LFC_SESSION_LATTICE;
+    return 1;
+}
+
+/**
+ * This function updates the fields of the session. The lattice sums are
+ * repeated only for the muon sites affected by the changes since the
+ * previous call, or extended to the new shell if only the radius grew,
+ * and the fields only if the moments or the coefficients changed.
+ *
+ * @param out_field_cont Contact field, nmu x 3 (for unit ACont, Tesla).
+ * @param out_field_dip  Dipolar field, nmu x 3 (Tesla).
+ * @param out_field_lor  Lorentz field, nmu x 3 (Tesla).
+ * @param out_tensor dipolar tensor of the magnetic atoms, nmu x 3 x 3
+ *         (1/Angstrom^3), or NULL.
+ * @return number of lattice sums (or shells) performed.
+ */
+unsigned int lfc_session_evaluate(lfc_session * s, double *out_field_cont,
+          double *out_field_dip, double *out_field_lor, double *out_tensor)
+{
+    unsigned int mu, a, q, mask, nsums = 0;
+    size_t stride = (size_t) s->natoms * LFC_NCOEF;
+    const double *w;
+    double *coef;
+    double T[6];
+
+    for (mu = 0; mu < s->nmu; mu++)
+    {
+        coef = s->coef + mu * stride;
+        mask = LFC_DIPOLAR | LFC_LORENTZ | LFC_TENSOR;
+
+        /* the lattice sums are parallel */
+        if (s->covered[mu] < 0.0)
+        {
+            LatticeCoefficients(s->positions, s->K, s->muonpos + 3*mu, s->supercell,
+                                s->cell, s->radius, s->nnn, s->cont_radius, s->natoms,
+                                mask | LFC_CONTACT, coef);
+            nsums++;
+        }
+        else if (s->covered[mu] < s->radius)
+        {
+            /* contact atoms beyond the old sphere may enter the pile */
+            if (s->cont_radius > s->covered[mu])
+            {
+                for (a = 0; a < s->natoms; a++)
+                    coef[a * LFC_NCOEF + LFC_COEF_CC] = coef[a * LFC_NCOEF + LFC_COEF_CS] = 0.0;
+                mask |= LFC_CONTACT;
+            }
+            LatticeShellCoefficients(s->positions, s->K, s->muonpos + 3*mu, s->supercell,
+                                     s->cell, s->covered[mu], s->radius, s->nnn,
+                                     s->cont_radius, s->natoms, mask, coef);
+            nsums++;
+        }
+        else if (!(s->dirty & LFC_SESSION_MOMENTS))
+            continue;
+
+        CoefficientFields(coef, s->fc, s->phi, s->natoms,
+                          s->radius, LFC_CONTACT | LFC_DIPOLAR | LFC_LORENTZ,
+                          s->fields + 9*mu, s->fields + 9*mu + 3, s->fields + 9*mu + 6);
+        s->covered[mu] = s->radius;
+    }
+    s->dirty = 0;
+    s->nsums += nsums;
+
+    for (mu = 0; mu < s->nmu; mu++)
+    {
+        for (q = 0; q < 3; q++)
+        {
+            out_field_cont[3*mu+q] = s->fields[9*mu+q];
+            out_field_dip[3*mu+q] = s->fields[9*mu+3+q];
+            out_field_lor[3*mu+q] = s->fields[9*mu+6+q];
+        }
+        if (out_tensor == NULL)
+            continue;
+
+        for (q = 0; q < 6; q++)
+            T[q] = 0.0;
+        for (a = 0; a < s->natoms; a++)
+        {
+            w = s->coef + mu * stride + a * LFC_NCOEF;
+            for (q = 0; q < 6; q++)
+                T[q] += w[LFC_COEF_T+q];
+        }
+        out_tensor[9*mu+0] = T[0]; out_tensor[9*mu+1] = T[1]; out_tensor[9*mu+2] = T[2];
+        out_tensor[9*mu+3] = T[1]; out_tensor[9*mu+4] = T[3]; out_tensor[9*mu+5] = T[4];
+        out_tensor[9*mu+6] = T[2]; out_tensor[9*mu+7] = T[4]; out_tensor[9*mu+8] = T[5];
+    }
+    return nsums;
+}
+
+/**
+ * This function releases the memory of the session.
+ */
+void lfc_session_free(lfc_session * s)
+{
+    free(s->positions);
+    free(s->fc);
+    free(s->phi);
+    free(s->muonpos);
+    free(s->covered);
+    free(s->coef);
+    free(s->fields);
+    lfc_session_init(s);
+}
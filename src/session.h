@@ -0,0 +1,47 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+/* Inputs that changed since the last evaluation (lfc_session.dirty). */
+#define LFC_SESSION_MOMENTS 1   /**< Fourier components or phases */
+#define LFC_SESSION_LATTICE 2   /**< anything entering the lattice sums */
+
+typedef struct {
+	unsigned int natoms;     /**< Number of magnetic atoms. */
+	unsigned int nmu;        /**< Number of muon sites. */
+	double cell[9];          /**< Lattice vectors, one per row. */
+	int supercell[3];        /**< Extension of the supercell. */
+	double K[3];             /**< Propagation vector. */
+	double radius;           /**< Lorentz sphere radius. */
+	unsigned int nnn;        /**< Atoms contributing to the contact field. */
+	double cont_radius;      /**< Radius for the contact field. */
+	double *positions;       /**< 3*natoms fractional coordinates. */
+	double *fc;              /**< 6*natoms Fourier components. */
+	double *phi;             /**< natoms phases. */
+	double *muonpos;         /**< 3*nmu fractional coordinates. */
+	double *covered;         /**< Radius summed in the coefficients of each muon site, negative if they must be recomputed. */
+	double *coef;            /**< nmu*natoms*LFC_NCOEF lattice coefficients. */
+	double *fields;          /**< nmu*9 contact, dipolar and Lorentz fields. */
+	unsigned int dirty;      /**< LFC_SESSION_* flags. */
+	unsigned long nsums;     /**< Lattice sums performed so far. */
+} lfc_session;
+
+void lfc_session_init(lfc_session * s);
+
+int lfc_session_set_cell(lfc_session * s, const double *in_cell, const int *in_supercell);
+
+int lfc_session_set_positions(lfc_session * s, const double *in_positions, unsigned int in_natoms);
+
+int lfc_session_set_moments(lfc_session * s, const double *in_fc, const double *in_phi);
+
+int lfc_session_set_k(lfc_session * s, const double *in_K);
+
+int lfc_session_set_muons(lfc_session * s, const double *in_muonpos, unsigned int in_nmu);
+
+int lfc_session_set_sphere(lfc_session * s, double radius, unsigned int nnn_for_cont,
+          double cont_radius);
+
+unsigned int lfc_session_evaluate(lfc_session * s, double *out_field_cont,
+          double *out_field_dip, double *out_field_lor, double *out_tensor);
+
+void lfc_session_free(lfc_session * s);
+#endif
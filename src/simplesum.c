@@ -8,10 +8,14 @@
 
 #define _USE_MATH_DEFINES
 #include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
 #include "mat3.h"
 #include "pile.h"
 #include "config.h"
+#include "latticesum.h"
+#include "order.h"
+#include "wedge.h"
 
 #ifndef M_PI
 #    define M_PI 3.14159265358979323846
@@ -21,6 +25,342 @@
 	#include <omp.h>
 #endif 
 
+/* Data shared by all the cells of the supercell. */
+struct simplesum_data {
+    struct mat3 lat;
+    struct vec3 muonpos;
+    struct vec3 K;
+    unsigned int natoms;
+    unsigned int scy, scz;
+    unsigned int flags;
+    double radius;
+    double cont_radius;
+    const struct vec3 *atmcart;
+    const struct vec3 *P;
+    const struct vec3 *Q;
+    const float *fpos;
+    const float *fP;
+    const float *fQ;
+    const unsigned int *perm;   /* input index of the atoms */
+    const struct vec3 *tilec;   /* center and radius of the tiles */
+    const double *tiler;
+    const struct wedge *wedge;  /* site symmetry, NULL if not used */
+    pile *MCont;
+};
+
+/* Adds the moment m of the atom at position r (distance n) from the muon
+ * to the pile used for the contact field. When the site symmetry is used
+ * all the distinct images of the atom are added. */
+static void simplesum_contact(const struct simplesum_data *d, double n,
+          struct vec3 r, unsigned long key, struct vec3 m)
+{
+    unsigned int g;
+
+    if (d->wedge != NULL)
+    {
+        for (g = 0; g < d->wedge->nops; g++)
+            if (!wedge_duplicate(d->wedge, g, r))
+            {
+#pragma omp critical
+{
+                pile_add_element_keyed(d->MCont, pow(n,CONT_SCALING_POWER), key * d->wedge->nops + g,
+                    vec3_muls(d->wedge->sgn[g]/pow(n,CONT_SCALING_POWER), mat3_mulv(d->wedge->R[g], m)));
+}
+            }
+        return;
+    }
+
+    /* We add the moment multiplied by r^3 and then devide by Sum ^N r^3 */
+#pragma omp critical
+{
+    pile_add_element_keyed(d->MCont, pow(n,CONT_SCALING_POWER), key, vec3_muls(1./pow(n,CONT_SCALING_POWER),m));
+}
+}
+
+/**
+ * This function adds the contributions of the atoms of tile `tile`
+ * in cell (i,j,k) to acc. The dipolar field is stored in acc[0..2] and
+ * the sum of the magnetic moments (for the Lorentz field) in acc[3..5].
+ * Atoms closer than cont_radius are added to the pile used for the
+ * contact field.
+ * With the site symmetry only the representatives of the orbits are
+ * summed, with weight 1/|stabilizer|.
+ */
+static void simplesum_cell(const struct simplesum_data *d,
+          unsigned int i, unsigned int j, unsigned int k, unsigned int tile,
+          double *acc)
+{
+    struct vec3 r;
+    struct vec3 m;   /*magnetic moment of atom */
+    struct vec3 u;   /* unit vector */
+    struct vec3 base; /* origin of the cell with respect to the muon */
+    double n;   /* contains norm of vectors */
+    double c,s; /*cosine and sine of K.R */
+    double onebrcube; /* 1/r^3 */
+    unsigned long key; /* unique index of the atom in the supercell */
+    unsigned int a;
+    unsigned int stab; /* operations leaving the atom in place */
+    double wt = 1.0; /* weight of the atom */
+    unsigned int first = tile * LFC_ATOM_TILE; /* atoms of the tile */
+    unsigned int last = first + LFC_ATOM_TILE < d->natoms ? first + LFC_ATOM_TILE : d->natoms;
+
+    float frx, fry, frz, fn, fc, fs, fmx, fmy, fmz, fmu, fonebrcube;
+    float fwt = 1.0f;
+    float fradius = (float) d->radius;
+
+    /* origin of the cell (in Angstrom!) with respect to the muon */
+    base = vec3_sub(
+                vec3_add(vec3_add(vec3_muls((double) i, d->lat.a),
+                                  vec3_muls((double) j, d->lat.b)),
+                         vec3_muls((double) k, d->lat.c)),
+                d->muonpos);
+
+    /* skip the tile if it is entirely outside the sphere */
+    if (vec3_norm(vec3_add(base, d->tilec[tile])) >
+            (d->radius + d->tiler[tile]) * (1.0 + EPS))
+        return;
+
+    /* skip the tile if it holds no representative of the site symmetry */
+    if (d->wedge != NULL &&
+            wedge_skip(d->wedge, vec3_add(base, d->tilec[tile]), d->tiler[tile]))
+        return;
+
+    c = cos ( 2.0*M_PI * (d->K.x*i + d->K.y*j + d->K.z*k) );
+    s = sin ( 2.0*M_PI * (d->K.x*i + d->K.y*j + d->K.z*k) );
+
+    key = (((unsigned long) i * d->scy + j) * d->scz + k) * d->natoms;
+
+    if (d->flags & LFC_MIXED_PRECISION)
+    {
+        /* geometry and dipolar terms in single precision */
+        fc = (float) c;
+        fs = (float) s;
+        for (a = first; a < last; ++a)
+        {
+            frx = (float) base.x + d->fpos[3*a+0];
+            fry = (float) base.y + d->fpos[3*a+1];
+            frz = (float) base.z + d->fpos[3*a+2];
+
+            fn = sqrtf(frx*frx + fry*fry + frz*frz);
+            if (fn < fradius)
+            {
+                if (d->wedge != NULL)
+                {
+                    r.x = frx; r.y = fry; r.z = frz;
+                    stab = wedge_stabilizer(d->wedge, r);
+                    if (stab == 0)
+                        continue;
+                    fwt = 1.0f / (float) stab;
+                }
+
+                fmx = fc * d->fP[3*a+0] + fs * d->fQ[3*a+0];
+                fmy = fc * d->fP[3*a+1] + fs * d->fQ[3*a+1];
+                fmz = fc * d->fP[3*a+2] + fs * d->fQ[3*a+2];
+
+                if (fn < d->cont_radius) {
+                    m.x = fmx; m.y = fmy; m.z = fmz;
+                    r.x = frx; r.y = fry; r.z = frz;
+                    simplesum_contact(d, (double) fn, r, key + d->perm[a], m);
+                }
+
+                fmx *= fwt; fmy *= fwt; fmz *= fwt;
+                acc[3] += fmx;
+                acc[4] += fmy;
+                acc[5] += fmz;
+
+                /* (3 (m.r) r - m r^2) / r^5 */
+                fonebrcube = 1.0f/(fn*fn*fn);
+                fmu = 3.0f * (fmx*frx + fmy*fry + fmz*frz) / (fn*fn);
+                acc[0] += fonebrcube * (fmu * frx - fmx);
+                acc[1] += fonebrcube * (fmu * fry - fmy);
+                acc[2] += fonebrcube * (fmu * frz - fmz);
+            }
+        }
+        return;
+    }
+
+    /* loop over atoms */
+    for (a = first; a < last; ++a)
+    {
+        
+        /* difference between atom pos and muon pos (cart coordinates) */
+        r = vec3_add(base, d->atmcart[a]);
+        
+        n = vec3_norm(r);
+        if (n < d->radius)
+        {
+            if (d->wedge != NULL)
+            {
+                stab = wedge_stabilizer(d->wedge, r);
+                if (stab == 0)
+                    continue;
+                wt = 1.0 / stab;
+            }
+
+            /* calculate magnetic moment */
+            m = vec3_add ( vec3_muls(c, d->P[a]), vec3_muls(s, d->Q[a]));
+			
+            /* Calculate Contact Field */
+            if (n < d->cont_radius) {
+#ifdef _DEBUG                      
+				printf("Adding moment to Cont: n: %e, m: %e %e %e! (Total: %d)\n", n, m.x,m.y,m.z,d->MCont->nElements);
+#endif
+                simplesum_contact(d, n, r, key + d->perm[a], m);
+			}
+
+            m = vec3_muls(wt, m);
+			
+			/* calculate Lorentz Field */
+            acc[3] += m.x; 
+            acc[4] += m.y;
+            acc[5] += m.z;
+            
+            
+            /* printf("I sum: r = %e, p = %e %e %e\n",n, r.x, r.y, r.z); 
+             * printf("I sum: m = %e %e %e\n", m.x, m.y, m.z);
+             * sum it */
+            /* B += (( 3.0 * np.dot(nm,atom[1]) * atom[1] - nm ) / atom[0]**3)*0.9274009 */
+            
+            /* unit vector */
+            u = vec3_muls(1.0/n,r);
+            onebrcube = 1.0/pow(n,3);
+            
+            /* m is used as dummy variable for the sum! */
+            m = vec3_muls( onebrcube ,vec3_sub(vec3_muls(3.0*vec3_dot(m,u),u), m));
+            acc[0] += m.x; 
+            acc[1] += m.y;
+            acc[2] += m.z;
+        }                    
+
+    }
+}
+
+/*
+ * Kernels for tiles of exactly N atoms, used in double precision only.
+ * The positions and the P, Q vectors of the atoms are copied to local
+ * arrays of constant size that the compiler keeps in registers for all
+ * the cells of the block, and the loop over the atoms is fully unrolled.
+ * The contributions are the same of simplesum_cell.
+ */
+#define SIMPLESUM_UNROLLED(N)                                                 \
+static void simplesum_block_##N(const struct simplesum_data *d,               \
+          unsigned int i, unsigned int j, unsigned int k0, unsigned int k1,    \
+          unsigned int tile, double *acc)                                     \
+{                                                                             \
+    double px[N], py[N], pz[N];                                               \
+    double Px[N], Py[N], Pz[N], Qx[N], Qy[N], Qz[N];                          \
+    double rx, ry, rz, n, mx, my, mz, mr, c, s, onebrcube;                    \
+    double Bx = 0.0, By = 0.0, Bz = 0.0, Mx = 0.0, My = 0.0, Mz = 0.0;        \
+    struct vec3 base, m, r;                                                   \
+    unsigned long key;                                                        \
+    unsigned int a, k, first = tile * LFC_ATOM_TILE;                          \
+                                                                              \
+    for (a = 0; a < N; ++a)                                                   \
+    {                                                                         \
+        px[a] = d->atmcart[first+a].x; Px[a] = d->P[first+a].x;               \
+        py[a] = d->atmcart[first+a].y; Py[a] = d->P[first+a].y;               \
+        pz[a] = d->atmcart[first+a].z; Pz[a] = d->P[first+a].z;               \
+        Qx[a] = d->Q[first+a].x; Qy[a] = d->Q[first+a].y;                     \
+        Qz[a] = d->Q[first+a].z;                                              \
+    }                                                                         \
+                                                                              \
+    for (k = k0; k < k1; ++k)                                                 \
+    {                                                                         \
+        base = vec3_sub(                                                      \
+                    vec3_add(vec3_add(vec3_muls((double) i, d->lat.a),        \
+                                      vec3_muls((double) j, d->lat.b)),       \
+                             vec3_muls((double) k, d->lat.c)),                \
+                    d->muonpos);                                              \
+        if (vec3_norm(vec3_add(base, d->tilec[tile])) >                       \
+                (d->radius + d->tiler[tile]) * (1.0 + EPS))                   \
+            continue;                                                         \
+                                                                              \
+        c = cos ( 2.0*M_PI * (d->K.x*i + d->K.y*j + d->K.z*k) );              \
+        s = sin ( 2.0*M_PI * (d->K.x*i + d->K.y*j + d->K.z*k) );              \
+        key = (((unsigned long) i * d->scy + j) * d->scz + k) * d->natoms;    \
+                                                                              \
+        for (a = 0; a < N; ++a)                                               \
+        {                                                                     \
+            rx = base.x + px[a];                                              \
+            ry = base.y + py[a];                                              \
+            rz = base.z + pz[a];                                              \
+            n = sqrt(rx*rx + ry*ry + rz*rz);                                  \
+            if (n < d->radius)                                                \
+            {                                                                 \
+                mx = c * Px[a] + s * Qx[a];                                   \
+                my = c * Py[a] + s * Qy[a];                                   \
+                mz = c * Pz[a] + s * Qz[a];                                   \
+                Mx += mx; My += my; Mz += mz;                                 \
+                                                                              \
+                if (n < d->cont_radius) {                                     \
+                    m.x = mx; m.y = my; m.z = mz;                             \
+                    r.x = rx; r.y = ry; r.z = rz;                             \
+                    simplesum_contact(d, n, r, key + d->perm[first+a], m);    \
+                }                                                             \
+                                                                              \
+                /* (3 (m.r) r - m r^2) / r^5 */                               \
+                onebrcube = 1.0/(n*n*n);                                      \
+                mr = 3.0 * (mx*rx + my*ry + mz*rz) / (n*n);                   \
+                Bx += onebrcube * (mr * rx - mx);                             \
+                By += onebrcube * (mr * ry - my);                             \
+                Bz += onebrcube * (mr * rz - mz);                             \
+            }                                                                 \
+        }                                                                     \
+    }                                                                         \
+                                                                              \
+    acc[0] += Bx; acc[1] += By; acc[2] += Bz;                                 \
+    acc[3] += Mx; acc[4] += My; acc[5] += Mz;                                 \
+}
+
+SIMPLESUM_UNROLLED(1)
+SIMPLESUM_UNROLLED(2)
+SIMPLESUM_UNROLLED(4)
+SIMPLESUM_UNROLLED(8)
+
+/**
+ * This function adds the contributions of the atoms of tile `tile`
+ * in the cells (i,j,k0) ... (i,j,k1-1) to acc (see simplesum_cell).
+ * Unrolled kernels are used for tiles of 1, 2, 4 and 8 atoms, unless the
+ * site symmetry is used. This is the block of LatticeWalk.
+ */
+static void simplesum_block(const void *ctx, int i, int j, int k0, int k1,
+          unsigned int tile, double *acc)
+{
+    const struct simplesum_data *d = (const struct simplesum_data *) ctx;
+    int k;
+    unsigned int first = tile * LFC_ATOM_TILE;
+    unsigned int n = first + LFC_ATOM_TILE < d->natoms ? LFC_ATOM_TILE : d->natoms - first;
+    struct vec3 center; /* center of the block with respect to the muon */
+
+    /* skip the whole block if it holds no representative of the site symmetry */
+    if (d->wedge != NULL)
+    {
+        center = vec3_sub(
+                    vec3_add(vec3_add(vec3_muls((double) i, d->lat.a),
+                                      vec3_muls((double) j, d->lat.b)),
+                             vec3_muls(0.5 * (k0 + k1 - 1), d->lat.c)),
+                    vec3_sub(d->muonpos, d->tilec[tile]));
+        if (wedge_skip(d->wedge, center,
+                       d->tiler[tile] + 0.5 * (k1 - k0 - 1) * vec3_norm(d->lat.c)))
+            return;
+    }
+
+    if (!(d->flags & LFC_MIXED_PRECISION) && d->wedge == NULL)
+    {
+        switch (n)
+        {
+            case 1: simplesum_block_1(d, i, j, k0, k1, tile, acc); return;
+            case 2: simplesum_block_2(d, i, j, k0, k1, tile, acc); return;
+            case 4: simplesum_block_4(d, i, j, k0, k1, tile, acc); return;
+            case 8: simplesum_block_8(d, i, j, k0, k1, tile, acc); return;
+            default: break;
+        }
+    }
+
+    for (k = k0; k < k1; ++k)
+        simplesum_cell(d, i, j, k, tile, acc);
+}
+
 /**
  * This function calculates the dipolar field for a muon site.
  * 
@@ -46,33 +386,46 @@
  *                      the contact field. This option is redundant but speeds
  *                      up the evaluation significantly
  * @param in_natoms: number of atoms in the lattice.
+ * @param in_siteops: point group of the muon site, in_nops Cartesian rotation
+ *                   matrices (9 numbers each, row major) acting on positions
+ *                   relative to the muon. When given, only an irreducible
+ *                   wedge of the sphere is summed and the fields are
+ *                   symmetrized. The operations must form a group, must be
+ *                   symmetries of the magnetic structure and the supercell
+ *                   must contain the whole sphere (see wedge_check,
+ *                   wedge_structure_check and wedge_sphere_check, not
+ *                   repeated here). NULL to sum all atoms.
+ * @param in_sitetr: time reversal (+1 or -1) of each of the in_siteops,
+ *                   NULL if none of them is combined with time reversal.
+ * @param in_nops: number of operations in in_siteops.
+ * @param in_flags: bitwise or of the LFC_* flags defined in config.h
+ *                   (0 for the default double precision evaluation).
+ *                   With LFC_REPRODUCIBLE the result does not depend on
+ *                   the number of threads.
  * @param out_field_cont Contact filed in Tesla in the Cartesian coordinates system defined by in_cell. A coupling of 1 \f$ \mathrm{Ang} ^{-1} \sim 13.912~\mathrm{mol/emu} \f$ is assumed.
  * @param out_field_dip  Dipolar field in Tesla in the Cartesian coordinates system defined by in_cell.
  * @param out_field_lor  Lorentz field in Tesla in the Cartesian coordinates system defined by in_cell.
  */
-void  SimpleSum(const double *in_positions, 
+void  SimpleSumEx(const double *in_positions, 
           const double *in_fc, const double *in_K, const double *in_phi,
           const double *in_muonpos, const int * in_supercell, const double *in_cell, 
           const double radius, const unsigned int nnn_for_cont, const double cont_radius, 
-          unsigned int in_natoms,
+          unsigned int in_natoms, const double *in_siteops, const int *in_sitetr,
+          unsigned int in_nops, unsigned int in_flags,
           double *out_field_cont, double *out_field_dip, double *out_field_lor) 
 {
 
     unsigned int scx, scy, scz; /*supercell sizes */
-    unsigned int i,j,k; /* counters for supercells */
+    unsigned int i; /* counter for the contact atoms */
+    
+    unsigned int ntiles; /* tiles of LFC_ATOM_TILE atoms */
     
     struct vec3 atmpos;
     struct vec3 muonpos;
-    struct vec3 r;
-    struct vec3 m;   /*magnetic moment of atom */
-    struct vec3 u;   /* unit vector */
         
+    struct mat3 lat;
     struct mat3 sc_lat;
     
-    double n;   /* contains norm of vectors */
-    double c,s; /*cosine and sine of K.R */
-    double onebrcube; /* 1/r^3 */
-    
     
     /* description of the magnetic structure. */
     /* data provided in cartesian coordinates */
@@ -80,10 +433,30 @@ void  SimpleSum(const double *in_positions,
     struct vec3 isk ;
     double  phi ;
     
-    struct vec3 R, K, B, BLor;
+    /* m(R) = cos(2 pi K.R) P + sin(2 pi K.R) Q for every atom */
+    struct vec3 *atmcart = malloc(in_natoms * sizeof(struct vec3));
+    struct vec3 *P = malloc(in_natoms * sizeof(struct vec3));
+    struct vec3 *Q = malloc(in_natoms * sizeof(struct vec3));
+
+    /* single precision copies used with LFC_MIXED_PRECISION */
+    float *fpos = malloc(3 * in_natoms * sizeof(float));
+    float *fP = malloc(3 * in_natoms * sizeof(float));
+    float *fQ = malloc(3 * in_natoms * sizeof(float));
+
+    /* atoms are stored along a Morton curve, see order.c */
+    unsigned int *perm = malloc(in_natoms * sizeof(unsigned int));
+    unsigned int ia; /* input index of the atom */
+    struct vec3 *tilec = malloc(((in_natoms + LFC_ATOM_TILE - 1) / LFC_ATOM_TILE) * sizeof(struct vec3));
+    double *tiler = malloc(((in_natoms + LFC_ATOM_TILE - 1) / LFC_ATOM_TILE) * sizeof(double));
+
+    struct simplesum_data d;
+    struct lattice_walk walk;
+    struct wedge wedge;
+    double acc[6]; /* dipolar field and sum of the moments */
+
+    struct vec3 K, B, BLor;
     pile MCont;
     
-#ifdef _OPENMP
     double Bx=0.0;
     double By=0.0;
     double Bz=0.0;
@@ -91,7 +464,6 @@ void  SimpleSum(const double *in_positions,
     double BLorx=0.0;
     double BLory=0.0;
     double BLorz=0.0;
-#endif    
     
     unsigned int a;     /* counter for atoms */
 	struct vec3 BCont;
@@ -112,21 +484,21 @@ void  SimpleSum(const double *in_positions,
     printf("Total atoms: %i\n",in_natoms);
 #endif 
     
-    sc_lat.a.x = in_cell[0];
-    sc_lat.a.y = in_cell[1];
-    sc_lat.a.z = in_cell[2];
-    sc_lat.b.x = in_cell[3];
-    sc_lat.b.y = in_cell[4];
-    sc_lat.b.z = in_cell[5];
-    sc_lat.c.x = in_cell[6];
-    sc_lat.c.y = in_cell[7];
-    sc_lat.c.z = in_cell[8];
+    lat.a.x = in_cell[0];
+    lat.a.y = in_cell[1];
+    lat.a.z = in_cell[2];
+    lat.b.x = in_cell[3];
+    lat.b.y = in_cell[4];
+    lat.b.z = in_cell[5];
+    lat.c.x = in_cell[6];
+    lat.c.y = in_cell[7];
+    lat.c.z = in_cell[8];
  
 #ifdef _DEBUG      
     for (i=0;i<3;i++)
         printf("Cell is: %i %e %e %e\n",i,in_cell[i*3],in_cell[i*3+1],in_cell[i*3+2]);
         
-    /*printf("a %e %e %e\n", sc_lat.a.x, sc_lat.a.y, sc_lat.a.z); */
+    /*printf("a %e %e %e\n", lat.a.x, lat.a.y, lat.a.z); */
 #endif     
     
     K.x = in_K[0];
@@ -140,7 +512,7 @@ void  SimpleSum(const double *in_positions,
 
     sc_lat = mat3_mul(
                         mat3_diag((double) scx, (double) scy, (double) scz),
-                        sc_lat);
+                        lat);
     
     
     /* muon position in reduced coordinates */
@@ -159,155 +531,128 @@ void  SimpleSum(const double *in_positions,
 #endif
 
 
-#ifdef _DEBUG
+    morton_order(in_positions, in_natoms, perm);
+
     for (a = 0; a < in_natoms; ++a)
     {
+        ia = perm[a];
                     
         /* atom position in reduced coordinates */
-        atmpos.x =  in_positions[3*a] ;
-        atmpos.y =  in_positions[3*a+1] ;
-        atmpos.z =  in_positions[3*a+2] ;
-        
-        printf("Atom pos (crys): %e %e %e\n",atmpos.x,atmpos.y,atmpos.z);
+        atmpos.x =  in_positions[3*ia] ;
+        atmpos.y =  in_positions[3*ia+1] ;
+        atmpos.z =  in_positions[3*ia+2] ;
         
         /* go to cartesian coordinates (in Angstrom!) */
-        atmpos = mat3_vmul(atmpos,sc_lat);  
-        
-        printf("Atom pos (cart): %e %e %e\n",atmpos.x,atmpos.y,atmpos.z);
+        atmcart[a] = mat3_vmul(atmpos,lat);
+
+        /* calculate magnetic moment */
 #ifdef _ALTERNATE_FC_INPUT
-        printf("ERROR!!! If you see this the extension compilation went wrong!\n");
-        printf("FC (real, imag): %e %e %e %e %e %e\n",in_fc[6*a],in_fc[6*a+1],in_fc[6*a+2],in_fc[6*a+3],in_fc[6*a+4],in_fc[6*a+5]);
+        printf("ERROR!!! If you see this in the Python extension something went wrong!\n");
+         sk.x = in_fc[6*ia];   sk.y = in_fc[6*ia+1]; sk.z = in_fc[6*ia+2];
+        isk.x = in_fc[6*ia+3];isk.y = in_fc[6*ia+4];isk.z = in_fc[6*ia+5];
 #else
-        printf("FC (real, imag): %e %e %e %e %e %e\n",in_fc[6*a],in_fc[6*a+2],in_fc[6*a+4],in_fc[6*a+1],in_fc[6*a+3],in_fc[6*a+5]);
+         sk.x = in_fc[6*ia];   sk.y = in_fc[6*ia+2]; sk.z = in_fc[6*ia+4];
+        isk.x = in_fc[6*ia+1];isk.y = in_fc[6*ia+3];isk.z = in_fc[6*ia+5];
+#endif
+
+        /* the phase of the atom is folded into the two vectors P and Q,
+         * so that only cos(2 pi K.R) and sin(2 pi K.R) are needed for
+         * each cell. */
+        phi = 2.0*M_PI*in_phi[ia];
+        P[a] = vec3_add(vec3_muls(cos(phi), sk), vec3_muls(sin(phi), isk));
+        Q[a] = vec3_sub(vec3_muls(cos(phi), isk), vec3_muls(sin(phi), sk));
+
+        fpos[3*a+0] = (float) atmcart[a].x;
+        fpos[3*a+1] = (float) atmcart[a].y;
+        fpos[3*a+2] = (float) atmcart[a].z;
+        fP[3*a+0] = (float) P[a].x; fP[3*a+1] = (float) P[a].y; fP[3*a+2] = (float) P[a].z;
+        fQ[3*a+0] = (float) Q[a].x; fQ[3*a+1] = (float) Q[a].y; fQ[3*a+2] = (float) Q[a].z;
+
+#ifdef _DEBUG
+        printf("Atom pos (crys): %e %e %e\n",atmpos.x,atmpos.y,atmpos.z);
+        printf("Atom pos (cart): %e %e %e\n",atmcart[a].x,atmcart[a].y,atmcart[a].z);
+        printf("FC (real, imag): %e %e %e %e %e %e\n",sk.x,sk.y,sk.z,isk.x,isk.y,isk.z);
+        printf("phi: %e\n",in_phi[ia]);
 #endif        
-        printf("phi: %e\n",in_phi[a]);
     }
         
-#endif
-
 
-    B = vec3_zero();
-    BLor = vec3_zero();
     pile_init(&MCont, nnn_for_cont);
     
-#pragma omp parallel shared(MCont) /* remember data race! */
-{    
-#pragma omp for collapse(3) schedule(guided,20)  private(i,j,k,a,r,n,atmpos,sk,isk,phi,R,c,s,m,u,onebrcube) reduction(+:Bx,By,Bz,BLorx,BLory,BLorz)
-    for (i = 0; i < scx; ++i)
+    d.lat = lat;
+    d.muonpos = muonpos;
+    d.K = K;
+    d.natoms = in_natoms;
+    d.scy = scy;
+    d.scz = scz;
+    d.flags = in_flags;
+    d.radius = radius;
+    d.cont_radius = cont_radius;
+    d.atmcart = atmcart;
+    d.P = P;
+    d.Q = Q;
+    d.fpos = fpos;
+    d.fP = fP;
+    d.fQ = fQ;
+    d.perm = perm;
+    d.tilec = tilec;
+    d.tiler = tiler;
+    d.wedge = NULL;
+    d.MCont = &MCont;
+
+    if (in_siteops != NULL && in_nops > 1)
     {
-        for (j = 0; j < scy; ++j)
-        {
-            for (k = 0; k < scz; ++k)
-            {
-                /* loop over atoms */
-                for (a = 0; a < in_natoms; ++a)
-                {
-                    
-                    /* atom position in reduced coordinates */
-                    atmpos.x = ( in_positions[3*a] + (double) i) / (double) scx;
-                    atmpos.y = ( in_positions[3*a+1] + (double) j) / (double) scy;
-                    atmpos.z = ( in_positions[3*a+2] + (double) k) / (double) scz;
-                    
+        wedge_init(&wedge, in_siteops, in_sitetr, in_nops);
+        d.wedge = &wedge;
+    }
+    
+    ntiles = (in_natoms + LFC_ATOM_TILE - 1) / LFC_ATOM_TILE;
+    tile_bounds(atmcart, in_natoms, LFC_ATOM_TILE, tilec, tiler);
 
-                    
-                    /* go to cartesian coordinates (in Angstrom!) */
-                    atmpos = mat3_vmul(atmpos,sc_lat);
-                    
-                    /*printf("atompos: %e %e %e\n", atmpos.x, atmpos.y, atmpos.z); */
-                    /* difference between atom pos and muon pos (cart coordinates) */
-                    
-                    r = vec3_sub(atmpos,muonpos);
-                    
-                    n = vec3_norm(r);
-                    if (n < radius)
-                    {
-                        /* calculate magnetic moment */
-#ifdef _ALTERNATE_FC_INPUT
-                        printf("ERROR!!! If you see this in the Python extension something went wrong!\n");
-                         sk.x = in_fc[6*a];   sk.y = in_fc[6*a+1]; sk.z = in_fc[6*a+2];
-                        isk.x = in_fc[6*a+3];isk.y = in_fc[6*a+4];isk.z = in_fc[6*a+5];
-#else
-                         sk.x = in_fc[6*a];   sk.y = in_fc[6*a+2]; sk.z = in_fc[6*a+4];
-                        isk.x = in_fc[6*a+1];isk.y = in_fc[6*a+3];isk.z = in_fc[6*a+5];
-#endif                        
-
-                          phi = in_phi[a];
-                        /*printf("sk = %e %e %e\n", sk.x, sk.y, sk.z); */
-                        /*printf("isk = %e %e %e\n", isk.x, isk.y, isk.z); */
-                        
-                        
-                        R.x = (double) i; R.y = (double) j; R.z = (double) k; 
-                        
-                        c = cos ( 2.0*M_PI * (vec3_dot(K,R) + phi ));
-                        s = sin ( 2.0*M_PI * (vec3_dot(K,R) + phi ));
-                        
-                        m = vec3_zero();
-                        m = vec3_add ( vec3_muls(c, sk), m);
-                        m = vec3_add ( vec3_muls(s, isk), m);
-						
-						
-						/* calculate Lorentz Field */
-#ifdef _OPENMP                        
-                        BLorx += m.x; 
-                        BLory += m.y;
-                        BLorz += m.z;
-#else
-                        BLor = vec3_add(BLor,m);
-#endif                           
-                        
-                        /* Calculate Contact Field */
-                        if (n < cont_radius) {
-#ifdef _DEBUG                      
-							printf("Adding moment to Cont: n: %e, m: %e %e %e! (Total: %d)\n", n, m.x,m.y,m.z,nnn_for_cont);
-#endif						/* We add the moment multiplied by r^3 and then devide by Sum ^N r^3 */
-#pragma omp critical
-{
-                                pile_add_element(&MCont, pow(n,CONT_SCALING_POWER), vec3_muls(1./pow(n,CONT_SCALING_POWER),m));
-}
-						}
-                        
-                        
-                        /* printf("I sum: r = %e, p = %e %e %e\n",n, r.x, r.y, r.z); 
-                         * printf("I sum: m = %e %e %e\n", m.x, m.y, m.z);
-                         * sum it */
-                        /* B += (( 3.0 * np.dot(nm,atom[1]) * atom[1] - nm ) / atom[0]**3)*0.9274009 */
-                        
-                        /* unit vector */
-                        u = vec3_muls(1.0/n,r);
-                        onebrcube = 1.0/pow(n,3);
-                        
-#ifdef _OPENMP                        
-                        /* m is used as dummy variable for the sum! */
-                        m = vec3_muls( onebrcube ,vec3_sub(vec3_muls(3.0*vec3_dot(m,u),u), m));
-                        Bx += m.x; 
-                        By += m.y;
-                        Bz += m.z;
-#else
-                        B = vec3_add(
-                                        B,
-                                        vec3_muls( onebrcube ,vec3_sub(vec3_muls(3.0*vec3_dot(m,u),u), m))
-                                    );                      
-#endif                                    
-#ifdef _DEBUG                      
-                        printf("B is now : %e %e %e\n", B.x, B.y, B.z);
-#endif
-                    }                    
+    /* With LFC_REPRODUCIBLE each tile of atoms in a column of cells is
+     * summed by a single thread in a fixed order and the partial results
+     * are reduced in a fixed order too, see LatticeWalk. */
+    walk.block = simplesum_block;
+    walk.ctx = &d;
+    walk.lo[0] = walk.lo[1] = walk.lo[2] = 0;
+    walk.hi[0] = scx;
+    walk.hi[1] = scy;
+    walk.hi[2] = scz;
+    walk.kblock = LFC_CELL_BLOCK;
+    walk.ntiles = ntiles;
+    walk.nacc = 6;
+    walk.tile_acc = 0;
+    for (a = 0; a < 6; a++)
+        acc[a] = 0.0;
+    LatticeWalk(&walk, in_flags, acc);
 
-                }
-                
-            }
-        }
-    }
-}
+    Bx = acc[0]; By = acc[1]; Bz = acc[2];
+    BLorx = acc[3]; BLory = acc[4]; BLorz = acc[5];
 
 #ifdef _DEBUG                      
                         printf("Done with iterations!\n");
 #endif
 
-#ifdef _OPENMP
+    free(atmcart);
+    free(perm);
+    free(tilec);
+    free(tiler);
+    free(P);
+    free(Q);
+    free(fpos);
+    free(fP);
+    free(fQ);
+
     B.x = Bx;B.y = By;B.z = Bz;
     BLor.x = BLorx;BLor.y = BLory;BLor.z = BLorz;
-#endif
+
+    /* the rest of each orbit */
+    if (d.wedge != NULL)
+    {
+        B = wedge_symmetrize_vector(&wedge, B);
+        BLor = wedge_symmetrize_vector(&wedge, BLor);
+        wedge_free(&wedge);
+    }
     /*  1 bohr_magneton/(1angstrom^3) = 9274009.5(amperes ∕ meter)
      *   mu_0 = 0.0000012566371((meter tesla) ∕ ampere)
      *   BLor = (mu_0/3)*M_Lor
@@ -365,4 +710,18 @@ void  SimpleSum(const double *in_positions,
 
 }
 
-
+/**
+ * SimpleSumEx without site symmetry and with the default flags. This is
+ * the interface of the 0.1 releases.
+ */
+void  SimpleSum(const double *in_positions, 
+          const double *in_fc, const double *in_K, const double *in_phi,
+          const double *in_muonpos, const int * in_supercell, const double *in_cell, 
+          const double radius, const unsigned int nnn_for_cont, const double cont_radius, 
+          unsigned int in_natoms,
+          double *out_field_cont, double *out_field_dip, double *out_field_lor) 
+{
+    SimpleSumEx(in_positions, in_fc, in_K, in_phi, in_muonpos, in_supercell,
+                in_cell, radius, nnn_for_cont, cont_radius, in_natoms,
+                NULL, NULL, 0, 0, out_field_cont, out_field_dip, out_field_lor);
+}
@@ -7,4 +7,13 @@ void  SimpleSum(const double *in_positions,
           const double radius, const unsigned int nnn_for_cont, const double cont_radius, 
           unsigned int size,
           double *out_field_cont, double *out_field_dip, double *out_field_lor);
+
+//SimpleSum with site symmetry and LFC_* flags
+void  SimpleSumEx(const double *in_positions, 
+          const double *in_fc, const double *in_K, const double *in_phi,
+          const double *in_muonpos, const int * in_supercell, const double *in_cell, 
+          const double radius, const unsigned int nnn_for_cont, const double cont_radius, 
+          unsigned int size, const double *siteops, const int *sitetr,
+          unsigned int nops, unsigned int flags,
+          double *out_field_cont, double *out_field_dip, double *out_field_lor);
 #endif
@@ -0,0 +1,217 @@
+/**
+ * @file strainsum.c
+ * @author Pietro Bonfa
+ * @date 2016
+ * @brief Dipolar field, dipolar tensor and their strain derivatives
+ *
+ * A homogeneous strain e (symmetric, with components e_1..e_6 =
+ * e_xx, e_yy, e_zz, e_yz, e_xz, e_xy) maps the lattice vectors to
+ * (1 + e) a and leaves the fractional coordinates and the moments
+ * unchanged, so that every atom moves to r + e r as seen from the muon.
+ * The derivatives of the terms (3 u u^T - 1) / r^3 are accumulated in the
+ * same traversal (a kernel of LatticeSum) that computes the dipolar field
+ * and tensor.
+ *
+ * The sum at fixed radius also changes because atoms cross the surface of
+ * the sphere. This contribution is replaced by its continuum limit: the
+ * strained sphere becomes an ellipsoid with demagnetizing tensor
+ * 1/3 - 2/5 (e - tr(e)/3), and the average moment density is the one
+ * entering the Lorentz field. The Lorentz field itself scales with the
+ * inverse of the volume.
+ */
+
+#define _USE_MATH_DEFINES
+#include <stdlib.h>
+#include <math.h>
+#include "config.h"
+#include "latticesum.h"
+#include "kernels.h"
+#include "strainsum.h"
+
+#ifndef M_PI
+#    define M_PI 3.14159265358979323846
+#endif
+
+/* Layout of the accumulators */
+#define STRAIN_B   0    /* dipolar field, 3 */
+#define STRAIN_T   3    /* dipolar tensor, xx, xy, xz, yy, yz, zz */
+#define STRAIN_M   9    /* sum of the moments, 3 */
+#define STRAIN_N  12    /* number of atoms */
+#define STRAIN_DB 13    /* derivatives of the field, 6 x 3 */
+#define STRAIN_DT 31    /* derivatives of the tensor, 6 x 6 */
+#define STRAIN_NACC 67
+
+/* Cartesian indices of the six strain components */
+static const unsigned int strain_k[6] = {0, 1, 2, 1, 0, 0};
+static const unsigned int strain_l[6] = {0, 1, 2, 2, 2, 1};
+
+/* position of T_xy in the xx, xy, xz, yy, yz, zz storage */
+static const unsigned int strain_sym[3][3] = {{0, 1, 2}, {1, 3, 4}, {2, 4, 5}};
+
+/*
+ * Adds the atom at r (from the muon, |r| = n) with moment m.
+ * For the strain e the atom moves by n (e u), v = e u, and
+ *   dT = (3 (v u^T + u v^T) - 15 (u.v) u u^T + 3 (u.v)) / r^3
+ */
+static void strain_add(double *acc, const double *r, double n, const double *m)
+{
+    double u[3], v[3], inv3, um, uv, vm;
+    unsigned int s, x, y;
+
+    inv3 = 1.0 / (n * n * n);
+    for (x = 0; x < 3; x++)
+        u[x] = r[x] / n;
+    um = u[0]*m[0] + u[1]*m[1] + u[2]*m[2];
+
+    for (x = 0; x < 3; x++)
+    {
+        acc[STRAIN_B + x] += inv3 * (3.0 * um * u[x] - m[x]);
+        acc[STRAIN_M + x] += m[x];
+        for (y = x; y < 3; y++)
+            acc[STRAIN_T + strain_sym[x][y]] += inv3 * (3.0 * u[x] * u[y] - (x == y ? 1.0 : 0.0));
+    }
+    acc[STRAIN_N] += 1.0;
+
+    for (s = 0; s < 6; s++)
+    {
+        v[0] = v[1] = v[2] = 0.0;
+        v[strain_k[s]] = u[strain_l[s]];
+        v[strain_l[s]] = u[strain_k[s]];
+        uv = u[0]*v[0] + u[1]*v[1] + u[2]*v[2];
+        vm = v[0]*m[0] + v[1]*m[1] + v[2]*m[2];
+        for (x = 0; x < 3; x++)
+        {
+            acc[STRAIN_DB + 3*s + x] += inv3 * (3.0 * (v[x] * um + u[x] * vm)
+                                                - 15.0 * uv * um * u[x]
+                                                + 3.0 * uv * m[x]);
+            for (y = x; y < 3; y++)
+                acc[STRAIN_DT + 6*s + strain_sym[x][y]] +=
+                        inv3 * (3.0 * (v[x] * u[y] + u[x] * v[y])
+                                - 15.0 * uv * u[x] * u[y]
+                                + (x == y ? 3.0 * uv : 0.0));
+        }
+    }
+}
+
+/*
+ * Kernel of LatticeSum: the atom with moment
+ * m(R) = cos(2 pi K.R) P + sin(2 pi K.R) Q, ctx is a struct kernel_moments.
+ */
+static void strain_term(const void *ctx, const struct lattice_site *site, double *acc)
+{
+    const struct kernel_moments *d = (const struct kernel_moments *) ctx;
+    struct vec3 v = vec3_add(vec3_muls(site->c, d->P[site->atom]),
+                             vec3_muls(site->s, d->Q[site->atom]));
+    double r[3], m[3];
+
+    r[0] = site->r.x; r[1] = site->r.y; r[2] = site->r.z;
+    m[0] = v.x; m[1] = v.y; m[2] = v.z;
+    strain_add(acc, r, site->n, m);
+}
+
+/**
+ * This function calculates the dipolar and Lorentz fields, the dipolar
+ * tensor and their first derivatives with respect to the six components
+ * of a homogeneous strain, with a single lattice sum. The magnetic order,
+ * the supercell and the muon position are defined as in SimpleSum.
+ *
+ * The fields of the strained lattice are
+ * B(e) = B + sum_s e_s dB/de_s + O(e^2), with the strain tensor
+ * [[e_1, e_6, e_5], [e_6, e_2, e_4], [e_5, e_4, e_3]] applied to the
+ * lattice vectors (in_cell rows) and the radius kept fixed.
+ *
+ * @param in_positions positions of the magnetic atoms in fractional
+ *         coordinates, 3*in_natoms numbers.
+ * @param in_fc Fourier components (Re x, Im x, Re y, ..., Im z) of each atom.
+ * @param in_K propagation vector in reciprocal lattice units.
+ * @param in_phi the phase for each of the atoms given in in_positions.
+ * @param in_muonpos position of the muon in fractional coordinates
+ * @param in_supercell extension of the supercell along the lattice vectors.
+ * @param in_cell lattice cell (a_x, a_y, a_z, b_x, ..., c_z).
+ * @param radius Lorentz sphere radius
+ * @param in_natoms: number of atoms in the unit cell.
+ * @param out_field_dip dipolar field (Tesla), 3 numbers.
+ * @param out_field_lor Lorentz field (Tesla), 3 numbers.
+ * @param out_tensor dipolar tensor of the atoms (1/Angstrom^3), 9 numbers
+ *          as in DipolarTensor.
+ * @param out_dfield_dip derivatives of the dipolar field, 6 x 3 numbers.
+ * @param out_dfield_lor derivatives of the Lorentz field, 6 x 3 numbers.
+ * @param out_dtensor derivatives of the dipolar tensor, 6 x 9 numbers.
+ */
+void StrainSum(const double *in_positions, const double *in_fc,
+          const double *in_K, const double *in_phi, const double *in_muonpos,
+          const int * in_supercell, const double *in_cell, double radius,
+          unsigned int in_natoms, double *out_field_dip, double *out_field_lor,
+          double *out_tensor, double *out_dfield_dip, double *out_dfield_lor,
+          double *out_dtensor)
+{
+    unsigned int a, s, x, y;
+    struct vec3 *P = malloc(in_natoms * sizeof(struct vec3));
+    struct vec3 *Q = malloc(in_natoms * sizeof(struct vec3));
+    struct kernel_moments moments;
+    double acc[STRAIN_NACC];
+    double lor, dens, dN;
+    struct lattice_kernel kernel;
+
+    /* m(R) = cos(2 pi K.R) P + sin(2 pi K.R) Q */
+    for (a = 0; a < in_natoms; a++)
+        kernel_fc_moment(in_fc + 6*a, in_phi[a], &P[a], &Q[a]);
+    moments.P = P;
+    moments.Q = Q;
+
+    for (s = 0; s < STRAIN_NACC; s++)
+        acc[s] = 0.0;
+
+    kernel.term = strain_term;
+    kernel.ctx = &moments;
+    kernel.nacc = STRAIN_NACC;
+    kernel.cutoff = radius;
+    LatticeSum(in_positions, in_natoms, in_K, in_muonpos, in_supercell, in_cell,
+               radius, &kernel, 1, 0, acc);
+
+    /* see simplesum.c for the units */
+    lor = 0.33333333333*11.654064 * 3./(4.*M_PI*pow(radius,3));
+    /* number of atoms per unit volume, as seen by the Lorentz field */
+    dens = acc[STRAIN_N] * 3./(4.*M_PI*pow(radius,3));
+
+    for (x = 0; x < 3; x++)
+    {
+        out_field_dip[x] = 0.92740098 * acc[STRAIN_B + x];
+        out_field_lor[x] = lor * acc[STRAIN_M + x];
+        for (y = 0; y < 3; y++)
+            out_tensor[3*x + y] = acc[STRAIN_T + strain_sym[x][y]];
+    }
+
+    for (s = 0; s < 6; s++)
+    {
+        for (x = 0; x < 3; x++)
+        {
+            /* Lorentz field: the moment density scales with 1/(1 + tr e) */
+            out_dfield_lor[3*s + x] = (s < 3 ? -out_field_lor[x] : 0.0);
+            out_dfield_dip[3*s + x] = 0.92740098 * acc[STRAIN_DB + 3*s + x];
+            for (y = 0; y < 3; y++)
+                out_dtensor[9*s + 3*x + y] = acc[STRAIN_DT + 6*s + strain_sym[x][y]];
+        }
+
+        /* surface term, dN/de_s = -2/5 (E_s - tr(E_s)/3) for the unit strain E_s */
+        for (x = 0; x < 3; x++)
+        {
+            for (y = 0; y < 3; y++)
+            {
+                dN = 0.0;
+                if ((x == strain_k[s] && y == strain_l[s]) ||
+                    (x == strain_l[s] && y == strain_k[s]))
+                    dN = 1.0;
+                if (x == y && s < 3)
+                    dN -= 1.0/3.0;
+                dN *= -0.4;
+                /* mu_0 dN M = 3 dN B_lor */
+                out_dfield_dip[3*s + x] += 3.0 * dN * out_field_lor[y];
+                out_dtensor[9*s + 3*x + y] += 4.0 * M_PI * dens * dN;
+            }
+        }
+    }
+
+    free(P);
+    free(Q);
+}
@@ -0,0 +1,10 @@
+#ifndef STRAIN_SUM_H
+#define STRAIN_SUM_H
+
+void StrainSum(const double *in_positions, const double *in_fc,
+          const double *in_K, const double *in_phi, const double *in_muonpos,
+          const int * in_supercell, const double *in_cell, double radius,
+          unsigned int in_natoms, double *out_field_dip, double *out_field_lor,
+          double *out_tensor, double *out_dfield_dip, double *out_dfield_lor,
+          double *out_dtensor);
+#endif
@@ -0,0 +1,443 @@
+/**
+ * @file wedge.c
+ * @author Pietro Bonfa
+ * @date 2016
+ * @brief Summation over the irreducible wedge of the muon site symmetry
+ *
+ * When the muon site is left invariant by a point group G (rotations R
+ * about the muon, possibly combined with time reversal), the atoms of the
+ * Lorentz sphere split in orbits {R r} and only one representative of
+ * each orbit has to be visited. An atom r is the representative of its
+ * orbit if v0.r >= v0.(R r) for every R in G, where v0 is a fixed vector
+ * in general position (ties are broken with a second vector v1).
+ * The contribution of the full orbit is recovered from the one of the
+ * representative by symmetrization, with weight 1/|stabilizer of r|.
+ *
+ * The operations are sorted so that those rejecting most of the
+ * directions come first: most of the atoms outside the wedge are then
+ * rejected after one or two scalar products.
+ */
+
+#include <stdlib.h>
+#include <math.h>
+#include "config.h"
+#include "wedge.h"
+
+/* Two vectors in general position used to select the representatives. */
+static const struct vec3 wedge_v0 = {1.0, 0.5772156649, 0.3183098862};
+static const struct vec3 wedge_v1 = {0.2718281828, 1.0, 0.7071067812};
+
+/* Number of directions used to sort the operations. */
+#define WEDGE_SAMPLES 256
+
+/* Tolerance on positions (Angstrom) and moments (relative) of the
+ * structure checks. */
+#define WEDGE_TOLERANCE 1e-4
+
+static struct mat3 wedge_mat(const double *in_op)
+{
+    struct mat3 R;
+
+    R.a.x = in_op[0]; R.a.y = in_op[1]; R.a.z = in_op[2];
+    R.b.x = in_op[3]; R.b.y = in_op[4]; R.b.z = in_op[5];
+    R.c.x = in_op[6]; R.c.y = in_op[7]; R.c.z = in_op[8];
+    return R;
+}
+
+static double wedge_det(struct mat3 R)
+{
+    return vec3_dot(R.a, vec3_cross(R.b, R.c));
+}
+
+/* Returns 1 if the elements of the two matrices differ by less than EPS. */
+static int wedge_same(const struct mat3 *A, const struct mat3 *B)
+{
+    return fabs(A->a.x - B->a.x) < EPS && fabs(A->a.y - B->a.y) < EPS &&
+           fabs(A->a.z - B->a.z) < EPS && fabs(A->b.x - B->b.x) < EPS &&
+           fabs(A->b.y - B->b.y) < EPS && fabs(A->b.z - B->b.z) < EPS &&
+           fabs(A->c.x - B->c.x) < EPS && fabs(A->c.y - B->c.y) < EPS &&
+           fabs(A->c.z - B->c.z) < EPS;
+}
+
+/**
+ * This function checks that the operations form a group of orthogonal
+ * matrices (the identity is included and the product of any two
+ * operations is in the list). Time reversal, if in_tr is not NULL, must
+ * be compatible with the product.
+ *
+ * @param in_ops in_nops Cartesian rotations, 9 numbers (row major) each.
+ * @param in_tr time reversal (+1 or -1) of each operation, or NULL.
+ * @param in_nops number of operations.
+ * @return 1 if the operations form a group, 0 otherwise.
+ */
+int wedge_check(const double *in_ops, const int *in_tr, unsigned int in_nops)
+{
+    unsigned int g, h, p;
+    int identity = 0, found = 1;
+    struct mat3 Rg, Rgh, Rt, RRt, I = mat3_identity();
+    struct mat3 *R = malloc(in_nops * sizeof(struct mat3));
+
+    for (g = 0; g < in_nops; g++)
+        R[g] = wedge_mat(in_ops + 9*g);
+
+    for (g = 0; g < in_nops; g++)
+    {
+        Rg = R[g];
+        Rt.a.x = Rg.a.x; Rt.a.y = Rg.b.x; Rt.a.z = Rg.c.x;
+        Rt.b.x = Rg.a.y; Rt.b.y = Rg.b.y; Rt.b.z = Rg.c.y;
+        Rt.c.x = Rg.a.z; Rt.c.y = Rg.b.z; Rt.c.z = Rg.c.z;
+        RRt = mat3_mul(Rg, Rt);
+        if (!wedge_same(&RRt, &I))
+            found = 0;
+        if (wedge_same(&Rg, &I) && (in_tr == NULL || in_tr[g] == 1))
+            identity = 1;
+        if (in_tr != NULL && in_tr[g] != 1 && in_tr[g] != -1)
+            found = 0;
+    }
+    if (!identity)
+        found = 0;
+
+    for (g = 0; g < in_nops && found; g++)
+    {
+        for (h = 0; h < in_nops && found; h++)
+        {
+            Rgh = mat3_mul(R[g], R[h]);
+            found = 0;
+            for (p = 0; p < in_nops && !found; p++)
+                found = wedge_same(&Rgh, &R[p]) &&
+                        (in_tr == NULL || in_tr[p] == in_tr[g] * in_tr[h]);
+        }
+    }
+    free(R);
+    return found;
+}
+
+/**
+ * This function checks that the supercell contains the whole Lorentz
+ * sphere around the muon, placed in the cell in_supercell/2 as in the
+ * lattice sums (see find_largest_sphere in the Python module).
+ *
+ * @param in_muonpos position of the muon in fractional coordinates.
+ * @param in_supercell extension of the supercell along the lattice vectors.
+ * @param in_cell lattice cell (see SimpleSum).
+ * @param radius Lorentz sphere radius.
+ * @return 1 if the sphere is contained in the supercell, 0 otherwise.
+ */
+int wedge_sphere_check(const double *in_muonpos, const int *in_supercell,
+          const double *in_cell, double radius)
+{
+    struct mat3 L = wedge_mat(in_cell);
+    struct vec3 n[3];
+    double vol, d, f;
+    unsigned int i;
+
+    n[0] = vec3_cross(L.b, L.c);
+    n[1] = vec3_cross(L.c, L.a);
+    n[2] = vec3_cross(L.a, L.b);
+    vol = fabs(vec3_dot(L.a, n[0]));
+
+    for (i = 0; i < 3; i++)
+    {
+        /* distance between the lattice planes times the fractional
+         * distance from the nearest face of the supercell */
+        d = vol / vec3_norm(n[i]);
+        f = in_muonpos[i] + in_supercell[i] / 2;
+        if (radius > d * (f < in_supercell[i] - f ? f : in_supercell[i] - f) + EPS)
+            return 0;
+    }
+    return 1;
+}
+
+/* Moment of atom a in cell c, m(R) = cos(2 pi K.R) P + sin(2 pi K.R) Q. */
+static struct vec3 wedge_moment(const double *in_fc, const double *in_K,
+          const double *in_phi, unsigned int a, struct vec3 c)
+{
+    struct vec3 sk, isk, P, Q;
+    double phi = 2.0*M_PI*in_phi[a];
+    double kr = 2.0*M_PI*(in_K[0]*c.x + in_K[1]*c.y + in_K[2]*c.z);
+
+#ifdef _ALTERNATE_FC_INPUT
+     sk.x = in_fc[6*a];   sk.y = in_fc[6*a+1]; sk.z = in_fc[6*a+2];
+    isk.x = in_fc[6*a+3];isk.y = in_fc[6*a+4];isk.z = in_fc[6*a+5];
+#else
+     sk.x = in_fc[6*a];   sk.y = in_fc[6*a+2]; sk.z = in_fc[6*a+4];
+    isk.x = in_fc[6*a+1];isk.y = in_fc[6*a+3];isk.z = in_fc[6*a+5];
+#endif
+    P = vec3_add(vec3_muls(cos(phi), sk), vec3_muls(sin(phi), isk));
+    Q = vec3_sub(vec3_muls(cos(phi), isk), vec3_muls(sin(phi), sk));
+    return vec3_add(vec3_muls(cos(kr), P), vec3_muls(sin(kr), Q));
+}
+
+/**
+ * This function checks that the operations of the point group of the muon
+ * site are symmetries of the structure: every atom of the cells around
+ * the muon is sent onto an atom and, if in_fc is not NULL, its moment
+ * (an axial vector, reversed by the operations with time reversal) onto
+ * the moment of that atom.
+ *
+ * @param in_ops in_nops Cartesian rotations, 9 numbers (row major) each,
+ *         acting on positions relative to the muon.
+ * @param in_tr time reversal (+1 or -1) of each operation, or NULL.
+ * @param in_nops number of operations.
+ * @param in_positions positions of the atoms (fractional), see SimpleSum.
+ * @param in_fc Fourier components (see SimpleSum), or NULL to check only
+ *         the positions.
+ * @param in_K the propagation vector in *reciprocal lattice units*.
+ * @param in_phi the phase of each atom.
+ * @param in_muonpos position of the muon in fractional coordinates.
+ * @param in_supercell extension of the supercell along the lattice vectors.
+ * @param in_cell lattice cell (see SimpleSum).
+ * @param in_natoms number of atoms.
+ * @return 1 if the operations are symmetries of the structure, 0 otherwise.
+ */
+int wedge_structure_check(const double *in_ops, const int *in_tr, unsigned int in_nops,
+          const double *in_positions, const double *in_fc, const double *in_K,
+          const double *in_phi, const double *in_muonpos, const int *in_supercell,
+          const double *in_cell, unsigned int in_natoms)
+{
+    struct mat3 L = wedge_mat(in_cell), Linv = mat3_inv(L), R;
+    struct vec3 mu, c, x, d, n, m, mr;
+    double sgn, mmax = 0.0;
+    unsigned int g, a, b;
+    int i, j, k, found = 1;
+
+    /* the muon in the cell in_supercell/2, as in the lattice sums */
+    c = _vec3(in_supercell[0] / 2, in_supercell[1] / 2, in_supercell[2] / 2);
+    mu = vec3_add(_vec3(in_muonpos[0], in_muonpos[1], in_muonpos[2]), c);
+
+    if (in_fc != NULL)
+        for (a = 0; a < 6 * in_natoms; a++)
+            mmax = (fabs(in_fc[a]) > mmax ? fabs(in_fc[a]) : mmax);
+
+    for (g = 0; g < in_nops && found; g++)
+    {
+        R = wedge_mat(in_ops + 9*g);
+        sgn = (wedge_det(R) > 0.0 ? 1.0 : -1.0) * (in_tr != NULL ? in_tr[g] : 1);
+
+        for (i = -1; i <= 1 && found; i++)
+        for (j = -1; j <= 1 && found; j++)
+        for (k = -1; k <= 1 && found; k++)
+        for (a = 0; a < in_natoms && found; a++)
+        {
+            /* cell and position of the atom, relative to the muon */
+            c = _vec3(floor(mu.x) + i, floor(mu.y) + j, floor(mu.z) + k);
+            x = vec3_add(c, _vec3(in_positions[3*a], in_positions[3*a+1], in_positions[3*a+2]));
+            x = mat3_mulv(R, mat3_vmul(vec3_sub(x, mu), L));
+            x = vec3_add(mat3_vmul(x, Linv), mu);
+
+            found = 0;
+            for (b = 0; b < in_natoms && !found; b++)
+            {
+                d = vec3_sub(x, _vec3(in_positions[3*b], in_positions[3*b+1], in_positions[3*b+2]));
+                n = _vec3(floor(d.x + 0.5), floor(d.y + 0.5), floor(d.z + 0.5));
+                if (vec3_norm(mat3_vmul(vec3_sub(d, n), L)) > WEDGE_TOLERANCE)
+                    continue;
+                if (in_fc == NULL)
+                {
+                    found = 1;
+                    break;
+                }
+                m = vec3_muls(sgn, mat3_mulv(R, wedge_moment(in_fc, in_K, in_phi, a, c)));
+                mr = wedge_moment(in_fc, in_K, in_phi, b, n);
+                found = (vec3_norm(vec3_sub(m, mr)) <= WEDGE_TOLERANCE * (mmax > 1.0 ? mmax : 1.0));
+                break;
+            }
+        }
+    }
+    return found;
+}
+
+/**
+ * This function prepares the wedge of a point group.
+ *
+ * @param w the wedge to initialize.
+ * @param in_ops in_nops Cartesian rotations, 9 numbers (row major) each,
+ *         acting on positions relative to the muon (r' = R r).
+ * @param in_tr time reversal (+1 or -1) of each operation, or NULL.
+ * @param in_nops number of operations.
+ */
+void wedge_init(struct wedge *w, const double *in_ops, const int *in_tr,
+          unsigned int in_nops)
+{
+    unsigned int g, h, best, nbest, count, i;
+    struct vec3 RTv0;
+    struct mat3 tR;
+    struct vec3 tw;
+    double t, z, phi;
+    struct vec3 *u = malloc(WEDGE_SAMPLES * sizeof(struct vec3));
+    char *rejected = calloc(WEDGE_SAMPLES, 1);
+
+    w->nops = in_nops;
+    w->R = malloc(in_nops * sizeof(struct mat3));
+    w->sgn = malloc(in_nops * sizeof(double));
+    w->w = malloc(in_nops * sizeof(struct vec3));
+    w->wn = malloc(in_nops * sizeof(double));
+
+    for (g = 0; g < in_nops; g++)
+    {
+        w->R[g] = wedge_mat(in_ops + 9*g);
+        w->sgn[g] = (wedge_det(w->R[g]) > 0.0 ? 1.0 : -1.0) *
+                    (in_tr != NULL ? (double) in_tr[g] : 1.0);
+        RTv0 = mat3_vmul(wedge_v0, w->R[g]);
+        w->w[g] = vec3_sub(wedge_v0, RTv0);
+        w->wn[g] = vec3_norm(w->w[g]);
+    }
+
+    /* directions on a Fibonacci sphere */
+    for (i = 0; i < WEDGE_SAMPLES; i++)
+    {
+        z = 1.0 - (2.0 * i + 1.0) / WEDGE_SAMPLES;
+        phi = 2.39996322972865332 * i;
+        u[i].x = sqrt(1.0 - z*z) * cos(phi);
+        u[i].y = sqrt(1.0 - z*z) * sin(phi);
+        u[i].z = z;
+    }
+
+    /* Greedy sort: the operation rejecting most of the directions not yet
+     * rejected by the previous ones comes next. The order of the remaining
+     * operations does not matter once no direction is rejected. */
+    for (g = 0; g < in_nops; g++)
+    {
+        best = g;
+        nbest = 0;
+        for (h = g; h < in_nops; h++)
+        {
+            count = 0;
+            for (i = 0; i < WEDGE_SAMPLES; i++)
+                if (!rejected[i] && vec3_dot(w->w[h], u[i]) < 0.0)
+                    count++;
+            if (count > nbest)
+            {
+                best = h;
+                nbest = count;
+            }
+        }
+        if (nbest == 0)
+            break;
+
+        tR = w->R[g]; w->R[g] = w->R[best]; w->R[best] = tR;
+        t = w->sgn[g]; w->sgn[g] = w->sgn[best]; w->sgn[best] = t;
+        tw = w->w[g]; w->w[g] = w->w[best]; w->w[best] = tw;
+        t = w->wn[g]; w->wn[g] = w->wn[best]; w->wn[best] = t;
+
+        for (i = 0; i < WEDGE_SAMPLES; i++)
+            if (vec3_dot(w->w[g], u[i]) < 0.0)
+                rejected[i] = 1;
+    }
+    free(u);
+    free(rejected);
+}
+
+void wedge_free(struct wedge *w)
+{
+    free(w->R);
+    free(w->sgn);
+    free(w->w);
+    free(w->wn);
+}
+
+/**
+ * This function returns 1 if no atom in the sphere of center c and
+ * radius rho (relative to the muon) is a representative, so that the
+ * whole sphere can be skipped.
+ */
+int wedge_skip(const struct wedge *w, struct vec3 c, double rho)
+{
+    unsigned int g;
+
+    /* v0.(r - R r) = w_g.r is negative everywhere in the sphere */
+    for (g = 0; g < w->nops; g++)
+        if (vec3_dot(w->w[g], c) + w->wn[g] * (rho + EPS) < 0.0)
+            return 1;
+    return 0;
+}
+
+/**
+ * This function returns the number of operations leaving r (relative to
+ * the muon) unchanged if r is the representative of its orbit, 0
+ * otherwise.
+ */
+unsigned int wedge_stabilizer(const struct wedge *w, struct vec3 r)
+{
+    unsigned int g, stab = 0;
+    double p;
+    struct vec3 diff;
+
+    for (g = 0; g < w->nops; g++)
+    {
+        p = vec3_dot(w->w[g], r);
+        if (p < -EPS * w->wn[g])
+            return 0;
+        if (p <= EPS * w->wn[g])
+        {
+            diff = vec3_sub(r, mat3_mulv(w->R[g], r));
+            if (vec3_norm(diff) < EPS)
+                stab++;
+            else if (vec3_dot(wedge_v1, diff) < 0.0)
+                return 0;
+        }
+    }
+    return stab;
+}
+
+/**
+ * This function returns 1 if the image of r through operation g was
+ * already obtained with one of the operations 0 ... g-1.
+ */
+int wedge_duplicate(const struct wedge *w, unsigned int g, struct vec3 r)
+{
+    unsigned int h;
+    struct vec3 Rr = mat3_mulv(w->R[g], r);
+
+    for (h = 0; h < g; h++)
+        if (vec3_norm(vec3_sub(Rr, mat3_mulv(w->R[h], r))) < EPS)
+            return 1;
+    return 0;
+}
+
+/**
+ * This function returns sum_g t_g det(R_g) R_g v, i.e. the sum over the
+ * orbit of an axial vector (magnetic field or moment) v.
+ */
+struct vec3 wedge_symmetrize_vector(const struct wedge *w, struct vec3 v)
+{
+    unsigned int g;
+    struct vec3 s = vec3_zero();
+
+    for (g = 0; g < w->nops; g++)
+        s = vec3_add(s, vec3_muls(w->sgn[g], mat3_mulv(w->R[g], v)));
+    return s;
+}
+
+/**
+ * This function replaces the symmetric tensor t (xx, xy, xz, yy, yz, zz)
+ * with sum_g R_g t R_g^T.
+ */
+void wedge_symmetrize_tensor(const struct wedge *w, double *t)
+{
+    unsigned int g, a, b, p, q;
+    double T[3][3], S[3][3], R[3][3];
+
+    T[0][0] = t[0]; T[0][1] = t[1]; T[0][2] = t[2];
+    T[1][0] = t[1]; T[1][1] = t[3]; T[1][2] = t[4];
+    T[2][0] = t[2]; T[2][1] = t[4]; T[2][2] = t[5];
+
+    for (a = 0; a < 3; a++)
+        for (b = 0; b < 3; b++)
+            S[a][b] = 0.0;
+
+    for (g = 0; g < w->nops; g++)
+    {
+        R[0][0] = w->R[g].a.x; R[0][1] = w->R[g].a.y; R[0][2] = w->R[g].a.z;
+        R[1][0] = w->R[g].b.x; R[1][1] = w->R[g].b.y; R[1][2] = w->R[g].b.z;
+        R[2][0] = w->R[g].c.x; R[2][1] = w->R[g].c.y; R[2][2] = w->R[g].c.z;
+        for (a = 0; a < 3; a++)
+            for (b = a; b < 3; b++)
+                for (p = 0; p < 3; p++)
+                    for (q = 0; q < 3; q++)
+                        S[a][b] += R[a][p] * T[p][q] * R[b][q];
+    }
+
+    t[0] = S[0][0]; t[1] = S[0][1]; t[2] = S[0][2];
+    t[3] = S[1][1]; t[4] = S[1][2]; t[5] = S[2][2];
+}
@@ -0,0 +1,32 @@
+#ifndef WEDGE_H
+#define WEDGE_H
+#include "mat3.h"
+
+/* Irreducible wedge of the point group of the muon site */
+struct wedge {
+    unsigned int nops;
+    struct mat3 *R;     /* Cartesian rotations (rows of the matrices) */
+    double *sgn;        /* time reversal times det(R) */
+    struct vec3 *w;     /* v0 - R^T v0 */
+    double *wn;         /* |v0 - R^T v0| */
+};
+
+int wedge_check(const double *in_ops, const int *in_tr, unsigned int in_nops);
+int wedge_sphere_check(const double *in_muonpos, const int *in_supercell,
+          const double *in_cell, double radius);
+int wedge_structure_check(const double *in_ops, const int *in_tr, unsigned int in_nops,
+          const double *in_positions, const double *in_fc, const double *in_K,
+          const double *in_phi, const double *in_muonpos, const int *in_supercell,
+          const double *in_cell, unsigned int in_natoms);
+
+void wedge_init(struct wedge *w, const double *in_ops, const int *in_tr,
+          unsigned int in_nops);
+void wedge_free(struct wedge *w);
+
+int wedge_skip(const struct wedge *w, struct vec3 c, double rho);
+unsigned int wedge_stabilizer(const struct wedge *w, struct vec3 r);
+int wedge_duplicate(const struct wedge *w, unsigned int g, struct vec3 r);
+
+struct vec3 wedge_symmetrize_vector(const struct wedge *w, struct vec3 v);
+void wedge_symmetrize_tensor(const struct wedge *w, double *t);
+#endif